@@ -11,7 +11,13 @@
 // WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 // See the License for the specific language governing permissions and
 // limitations under the License.
+#include <string.h>
 #include "esp_jpg_decode.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 
 #include "esp_system.h"
 #if ESP_IDF_VERSION_MAJOR >= 4 // IDF 4+
@@ -30,6 +36,21 @@
 #include "rom/tjpgd.h"
 #endif
 
+// target/tjpgd.c is built for every target since IDF 4.4 (next to the ROM decoder where there is one)
+#if CONFIG_IDF_TARGET_ESP32S2 || ESP_IDF_VERSION_MAJOR > 4 || (ESP_IDF_VERSION_MAJOR == 4 && ESP_IDF_VERSION_MINOR >= 4)
+#define JPG_DC_DECODE 1
+JRESULT jd_decomp_dc(JDEC* jd, UINT (*outfunc)(JDEC*, void*, JRECT*));
+JRESULT jd_decomp_rect(JDEC* jd, UINT (*outfunc)(JDEC*, void*, JRECT*), BYTE scale, const JRECT* roi);
+JRESULT jd_decomp_coef(JDEC* jd, UINT (*coeffunc)(JDEC*, const SHORT*, UINT));
+JRESULT jd_get_qt(JDEC* jd, UINT cmp, WORD* qt);
+#else
+#define JPG_DC_DECODE 0
+#endif
+
+// jd_decomp_rect() over the whole image decodes with the faster Huffman decoding of tjpgd.c,
+// jd_decomp() may be the ROM one
+#define JPG_FAST_DECODE (JPG_DC_DECODE && CONFIG_CAMERA_JPEG_FASTDECODE)
+
 #if defined(ARDUINO_ARCH_ESP32) && defined(CONFIG_ARDUHAL_ESP_LOG)
 #include "esp32-hal-log.h"
 #define TAG ""
@@ -45,8 +66,32 @@ typedef struct {
         void * arg;
         size_t len;
         size_t index;
+        JRECT roi;          // bands only: region in scaled pixels
+        uint8_t *tile;
+        bool done;
+        jpg_coef_cb coef_cb;    // coefficients only
+        jpg_coef_info_t *info;
 } esp_jpg_decoder_t;
 
+// the decode callbacks run on the workers of a decode queue
+#define JPG_DECODE_TASK_STACK 4096
+
+typedef struct {
+    jpg_decode_queue_t queue;
+    jpg_decode_ctx_t ctx;
+} jpg_decode_worker_t;
+
+struct jpg_decode_queue_s {
+    QueueHandle_t jobs;
+    SemaphoreHandle_t stopped;
+    size_t workers;             // started
+    jpg_decode_worker_t *worker;
+};
+
+// the context of esp_jpg_decode(), esp_jpg_decode_bands() and esp_jpg_decode_coefficients(), calls that find it taken allocate one
+static jpg_decode_ctx_t s_ctx;
+static bool s_ctx_taken;
+
 static const char * jd_errors[] = {
     "Succeeded",
     "Interrupted by output function",
@@ -75,6 +120,72 @@ static unsigned int _jpg_write(JDEC *decoder, void *bitmap, JRECT *rect)
     return 0;
 }
 
+// copies the region part of an MCU into the band and hands the band over after the last MCU of the row
+static unsigned int _jpg_band_write(JDEC *decoder, void *bitmap, JRECT *rect)
+{
+    esp_jpg_decoder_t * jpeg = (esp_jpg_decoder_t *)decoder->device;
+    const JRECT *roi = &jpeg->roi;
+
+    if (rect->bottom < roi->top || rect->top > roi->bottom || rect->right < roi->left || rect->left > roi->right) {
+        return 1;   // jd_decomp() outputs every MCU
+    }
+    uint16_t l = rect->left > roi->left ? rect->left : roi->left;
+    uint16_t r = rect->right < roi->right ? rect->right : roi->right;
+    uint16_t t = rect->top > roi->top ? rect->top : roi->top;
+    uint16_t b = rect->bottom < roi->bottom ? rect->bottom : roi->bottom;
+    size_t src_stride = (rect->right + 1 - rect->left) * 3;
+    size_t dst_stride = (roi->right + 1 - roi->left) * 3;
+    const uint8_t *src = (const uint8_t *)bitmap + (t - rect->top) * src_stride + (l - rect->left) * 3;
+    uint8_t *dst = jpeg->tile + (l - roi->left) * 3;
+
+    for (uint16_t y = t; y <= b; y++) {
+        memcpy(dst, src, (r + 1 - l) * 3);
+        src += src_stride;
+        dst += dst_stride;
+    }
+    if (rect->right < roi->right) {
+        return 1;
+    }
+    if (!jpeg->writer(jpeg->arg, roi->left, t, roi->right + 1 - roi->left, b + 1 - t, jpeg->tile)) {
+        return 0;
+    }
+    if (b == roi->bottom) {
+        //last band, stop decoding
+        jpeg->done = true;
+        return 0;
+    }
+    return 1;
+}
+
+#if JPG_DC_DECODE
+static unsigned int _jpg_coef_write(JDEC *decoder, const SHORT *coef, UINT cmp)
+{
+    esp_jpg_decoder_t * jpeg = (esp_jpg_decoder_t *)decoder->device;
+    return jpeg->coef_cb(jpeg->arg, jpeg->info, (const int16_t *)coef, (uint8_t)cmp);
+}
+#endif
+
+static jpg_decode_ctx_t *_jpg_ctx_take(void)
+{
+    if (!__atomic_test_and_set(&s_ctx_taken, __ATOMIC_ACQUIRE)) {
+        return &s_ctx;
+    }
+    jpg_decode_ctx_t *ctx = (jpg_decode_ctx_t *)heap_caps_malloc(sizeof(jpg_decode_ctx_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (!ctx) {
+        ESP_LOGE(TAG, "Decoder context malloc failed");
+    }
+    return ctx;
+}
+
+static void _jpg_ctx_give(jpg_decode_ctx_t *ctx)
+{
+    if (ctx == &s_ctx) {
+        __atomic_clear(&s_ctx_taken, __ATOMIC_RELEASE);
+    } else {
+        free(ctx);
+    }
+}
+
 static unsigned int _jpg_read(JDEC *decoder, uint8_t *buf, unsigned int len)
 {
     esp_jpg_decoder_t * jpeg = (esp_jpg_decoder_t *)decoder->device;
@@ -93,7 +204,17 @@ static unsigned int _jpg_read(JDEC *decoder, uint8_t *buf, unsigned int len)
 
 esp_err_t esp_jpg_decode(size_t len, jpg_scale_t scale, jpg_reader_cb reader, jpg_writer_cb writer, void * arg)
 {
-    static uint8_t work[3100];
+    jpg_decode_ctx_t *ctx = _jpg_ctx_take();
+    if (!ctx) {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t err = esp_jpg_decode_ctx(ctx, len, scale, reader, writer, arg);
+    _jpg_ctx_give(ctx);
+    return err;
+}
+
+esp_err_t esp_jpg_decode_ctx(jpg_decode_ctx_t *ctx, size_t len, jpg_scale_t scale, jpg_reader_cb reader, jpg_writer_cb writer, void * arg)
+{
     JDEC decoder;
     esp_jpg_decoder_t jpeg;
 
@@ -104,7 +225,7 @@ esp_err_t esp_jpg_decode(size_t len, jpg_scale_t scale, jpg_reader_cb reader, jp
     jpeg.scale = scale;
     jpeg.index = 0;
 
-    JRESULT jres = jd_prepare(&decoder, _jpg_read, work, 3100, &jpeg);
+    JRESULT jres = jd_prepare(&decoder, _jpg_read, ctx->work, sizeof(ctx->work), &jpeg);
     if(jres != JDR_OK){
         ESP_LOGE(TAG, "JPG Header Parse Failed! %s", jd_errors[jres]);
         return ESP_FAIL;
@@ -116,7 +237,20 @@ esp_err_t esp_jpg_decode(size_t len, jpg_scale_t scale, jpg_reader_cb reader, jp
     //output start
     writer(arg, 0, 0, output_width, output_height, NULL);
     //output write
+#if JPG_DC_DECODE
+    if (jpeg.scale == JPG_SCALE_8X) {
+        //one pixel per block is the block average, AC elements are only parsed and no IDCT is done
+        jres = jd_decomp_dc(&decoder, _jpg_write);
+    } else
+#endif
+#if JPG_FAST_DECODE
+    {
+        JRECT all = { 0, 0xFFFF, 0, 0xFFFF };
+        jres = jd_decomp_rect(&decoder, _jpg_write, (uint8_t)jpeg.scale, &all);
+    }
+#else
     jres = jd_decomp(&decoder, _jpg_write, (uint8_t)jpeg.scale);
+#endif
     //output end
     writer(arg, output_width, output_height, output_width, output_height, NULL);
 
@@ -132,3 +266,241 @@ esp_err_t esp_jpg_decode(size_t len, jpg_scale_t scale, jpg_reader_cb reader, jp
     return ESP_OK;
 }
 
+
+esp_err_t esp_jpg_decode_bands(size_t len, jpg_scale_t scale, const jpg_rect_t *roi, uint8_t *tile, size_t tile_len,
+                               jpg_reader_cb reader, jpg_writer_cb writer, void * arg)
+{
+    jpg_decode_ctx_t *ctx = _jpg_ctx_take();
+    if (!ctx) {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t err = esp_jpg_decode_bands_ctx(ctx, len, scale, roi, tile, tile_len, reader, writer, arg);
+    _jpg_ctx_give(ctx);
+    return err;
+}
+
+esp_err_t esp_jpg_decode_bands_ctx(jpg_decode_ctx_t *ctx, size_t len, jpg_scale_t scale, const jpg_rect_t *roi, uint8_t *tile, size_t tile_len,
+                                   jpg_reader_cb reader, jpg_writer_cb writer, void * arg)
+{
+    JDEC decoder;
+    esp_jpg_decoder_t jpeg;
+
+    jpeg.len = len;
+    jpeg.reader = reader;
+    jpeg.writer = writer;
+    jpeg.arg = arg;
+    jpeg.scale = scale;
+    jpeg.index = 0;
+    jpeg.tile = tile;
+    jpeg.done = false;
+
+    JRESULT jres = jd_prepare(&decoder, _jpg_read, ctx->work, sizeof(ctx->work), &jpeg);
+    if(jres != JDR_OK){
+        ESP_LOGE(TAG, "JPG Header Parse Failed! %s", jd_errors[jres]);
+        return ESP_FAIL;
+    }
+
+    uint16_t output_width = decoder.width / (1 << (uint8_t)(jpeg.scale));
+    uint16_t output_height = decoder.height / (1 << (uint8_t)(jpeg.scale));
+
+    if (!output_width || !output_height) {
+        ESP_LOGE(TAG, "Image is empty at this scale");
+        return ESP_ERR_INVALID_ARG;
+    }
+    jpeg.roi.left = 0;
+    jpeg.roi.top = 0;
+    jpeg.roi.right = output_width - 1;
+    jpeg.roi.bottom = output_height - 1;
+    if (roi) {
+        if (!roi->w || !roi->h || roi->x >= output_width || roi->y >= output_height) {
+            ESP_LOGE(TAG, "Region %ux%u at %u,%u is not in the %ux%u image", roi->w, roi->h, roi->x, roi->y, output_width, output_height);
+            return ESP_ERR_INVALID_ARG;
+        }
+        jpeg.roi.left = roi->x;
+        jpeg.roi.top = roi->y;
+        if (roi->w < output_width - roi->x) {
+            jpeg.roi.right = roi->x + roi->w - 1;
+        }
+        if (roi->h < output_height - roi->y) {
+            jpeg.roi.bottom = roi->y + roi->h - 1;
+        }
+    }
+    size_t band_lines = (decoder.msy * 8) >> jpeg.scale;
+    if (!tile || tile_len < (size_t)(jpeg.roi.right + 1 - jpeg.roi.left) * 3 * band_lines) {
+        ESP_LOGE(TAG, "Tile of %u bytes is too small for %u lines of %u pixels", tile_len, band_lines, jpeg.roi.right + 1 - jpeg.roi.left);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    //output start
+    if (!writer(arg, 0, 0, output_width, output_height, NULL)) {
+        return ESP_FAIL;
+    }
+    //output write
+#if JPG_DC_DECODE
+    jres = jd_decomp_rect(&decoder, _jpg_band_write, (uint8_t)jpeg.scale, &jpeg.roi);
+#else
+    //every MCU is decoded, the bands still only need the tile
+    jres = jd_decomp(&decoder, _jpg_band_write, (uint8_t)jpeg.scale);
+#endif
+    if (jres == JDR_INTR && jpeg.done) {
+        jres = JDR_OK;
+    }
+    //output end
+    writer(arg, output_width, output_height, output_width, output_height, NULL);
+
+    if (jres != JDR_OK) {
+        ESP_LOGE(TAG, "JPG Decompression Failed! %s", jd_errors[jres]);
+        return ESP_FAIL;
+    }
+    //skip the data after the region
+    if (len && jpeg.index < len) {
+        _jpg_read(&decoder, NULL, len - jpeg.index);
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t esp_jpg_decode_coefficients(size_t len, jpg_reader_cb reader, jpg_coef_cb cb, void * arg)
+{
+    jpg_decode_ctx_t *ctx = _jpg_ctx_take();
+    if (!ctx) {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t err = esp_jpg_decode_coefficients_ctx(ctx, len, reader, cb, arg);
+    _jpg_ctx_give(ctx);
+    return err;
+}
+
+esp_err_t esp_jpg_decode_coefficients_ctx(jpg_decode_ctx_t *ctx, size_t len, jpg_reader_cb reader, jpg_coef_cb cb, void * arg)
+{
+#if JPG_DC_DECODE
+    JDEC decoder;
+    esp_jpg_decoder_t jpeg;
+    jpg_coef_info_t info;
+
+    memset(&jpeg, 0, sizeof(jpeg));
+    jpeg.len = len;
+    jpeg.reader = reader;
+    jpeg.arg = arg;
+    jpeg.coef_cb = cb;
+    jpeg.info = &info;
+
+    JRESULT jres = jd_prepare(&decoder, _jpg_read, ctx->work, sizeof(ctx->work), &jpeg);
+    if(jres != JDR_OK){
+        ESP_LOGE(TAG, "JPG Header Parse Failed! %s", jd_errors[jres]);
+        return ESP_FAIL;
+    }
+
+    info.width = decoder.width;
+    info.height = decoder.height;
+    info.mcu_w = decoder.msx;
+    info.mcu_h = decoder.msy;
+    for (int i = 0; i < 3 && jres == JDR_OK; i++) {
+        jres = jd_get_qt(&decoder, i, info.quant[i]);
+    }
+    if (jres != JDR_OK) {
+        ESP_LOGE(TAG, "JPG Quantization Tables Failed! %s", jd_errors[jres]);
+        return ESP_FAIL;
+    }
+
+    if (!cb(arg, &info, NULL, 0)) {
+        return ESP_FAIL;
+    }
+    jres = jd_decomp_coef(&decoder, _jpg_coef_write);
+    if (jres != JDR_OK) {
+        ESP_LOGE(TAG, "JPG Decompression Failed! %s", jd_errors[jres]);
+        return ESP_FAIL;
+    }
+    if (len && jpeg.index < len) {
+        _jpg_read(&decoder, NULL, len - jpeg.index);
+    }
+
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+static void _jpg_decode_task(void *arg)
+{
+    jpg_decode_worker_t *worker = (jpg_decode_worker_t *)arg;
+    jpg_decode_job_t job;
+
+    // a job without reader stops the worker
+    while (xQueueReceive(worker->queue->jobs, &job, portMAX_DELAY) == pdTRUE && job.reader) {
+        esp_err_t err = esp_jpg_decode_ctx(&worker->ctx, job.len, job.scale, job.reader, job.writer, job.arg);
+        if (job.done) {
+            job.done(job.arg, err);
+        }
+    }
+    xSemaphoreGive(worker->queue->stopped);
+    vTaskDelete(NULL);
+}
+
+esp_err_t esp_jpg_decode_queue_create(size_t workers, size_t depth, jpg_decode_queue_t *queue)
+{
+    if (!depth || !queue) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!workers) {
+        workers = portNUM_PROCESSORS;
+    }
+    jpg_decode_queue_t q = (jpg_decode_queue_t)calloc(1, sizeof(struct jpg_decode_queue_s));
+    if (!q) {
+        return ESP_ERR_NO_MEM;
+    }
+    q->jobs = xQueueCreate(depth, sizeof(jpg_decode_job_t));
+    q->stopped = xSemaphoreCreateCounting(workers, 0);
+    q->worker = (jpg_decode_worker_t *)heap_caps_malloc(workers * sizeof(jpg_decode_worker_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (!q->jobs || !q->stopped || !q->worker) {
+        ESP_LOGE(TAG, "Decode queue alloc failed");
+        esp_jpg_decode_queue_delete(q);
+        return ESP_ERR_NO_MEM;
+    }
+    for (; q->workers < workers; q->workers++) {
+        jpg_decode_worker_t *worker = &q->worker[q->workers];
+        worker->queue = q;
+        if (xTaskCreatePinnedToCore(_jpg_decode_task, "jpg_decode", JPG_DECODE_TASK_STACK, worker, uxTaskPriorityGet(NULL),
+                                    NULL, q->workers % portNUM_PROCESSORS) != pdPASS) {
+            ESP_LOGE(TAG, "Decode worker %u task create failed", q->workers);
+            esp_jpg_decode_queue_delete(q);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    *queue = q;
+    return ESP_OK;
+}
+
+esp_err_t esp_jpg_decode_queue_submit(jpg_decode_queue_t queue, const jpg_decode_job_t *job, uint32_t timeout_ms)
+{
+    if (!queue || !job || !job->reader || !job->writer) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (xQueueSend(queue->jobs, job, pdMS_TO_TICKS(timeout_ms)) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
+}
+
+void esp_jpg_decode_queue_delete(jpg_decode_queue_t queue)
+{
+    if (!queue) {
+        return;
+    }
+    // the stop jobs queue up behind the frames, so those are decoded first
+    jpg_decode_job_t stop = { 0 };
+    for (size_t i = 0; i < queue->workers; i++) {
+        xQueueSend(queue->jobs, &stop, portMAX_DELAY);
+    }
+    for (size_t i = 0; i < queue->workers; i++) {
+        xSemaphoreTake(queue->stopped, portMAX_DELAY);
+    }
+    if (queue->jobs) {
+        vQueueDelete(queue->jobs);
+    }
+    if (queue->stopped) {
+        vSemaphoreDelete(queue->stopped);
+    }
+    free(queue->worker);
+    free(queue);
+}
@@ -22,20 +22,185 @@ extern "C" {
 #include <stdint.h>
 #include <stdbool.h>
 #include "esp_err.h"
+#include "sdkconfig.h"
 
 typedef enum {
     JPG_SCALE_NONE,
     JPG_SCALE_2X,
     JPG_SCALE_4X,
-    JPG_SCALE_8X,
+    JPG_SCALE_8X,   /* DC-only decode: AC coefficients are parsed but not stored and no IDCT is done */
     JPG_SCALE_MAX = JPG_SCALE_8X
 } jpg_scale_t;
 
 typedef size_t (* jpg_reader_cb)(void * arg, size_t index, uint8_t *buf, size_t len);
 typedef bool (* jpg_writer_cb)(void * arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data);
 
+typedef struct {
+    uint16_t x;
+    uint16_t y;
+    uint16_t w;
+    uint16_t h;
+} jpg_rect_t;
+
+/* Tile length esp_jpg_decode_bands() needs for bands w pixels wide: one MCU row of up to 16 lines, in RGB888 */
+#define JPG_BAND_LEN(w, scale) ((size_t)(w) * 3 * (16 >> (scale)))
+
+/* Work area of one decode: the tables and buffers of tjpgd, and its Huffman lookup tables at fast decode level 2 */
+#if CONFIG_CAMERA_JPEG_FASTDECODE > 1
+#define JPG_DECODE_WORK_LEN (3100 + 3072)
+#else
+#define JPG_DECODE_WORK_LEN 3100
+#endif
+
+/**
+ * @brief Decoder context, the work area of one decode at a time
+ *
+ * esp_jpg_decode(), esp_jpg_decode_bands() and esp_jpg_decode_coefficients() share a context of this file and allocate one
+ * for the call while it is in use. Tasks that decode at the same time can own a context each,
+ * or take them from a pool, and decode with esp_jpg_decode_ctx() without allocating.
+ */
+typedef struct {
+    uint32_t work[JPG_DECODE_WORK_LEN / 4];
+} jpg_decode_ctx_t;
+
 esp_err_t esp_jpg_decode(size_t len, jpg_scale_t scale, jpg_reader_cb reader, jpg_writer_cb writer, void * arg);
 
+/**
+ * @brief esp_jpg_decode() in the work area of a context
+ *
+ * Decodes with different contexts can run at the same time on any core.
+ *
+ * @param ctx       Context, not used by another decode until this one returns
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_FAIL if the JPEG cannot be decoded
+ */
+esp_err_t esp_jpg_decode_ctx(jpg_decode_ctx_t *ctx, size_t len, jpg_scale_t scale, jpg_reader_cb reader, jpg_writer_cb writer, void * arg);
+
+/**
+ * @brief Decode a JPEG one MCU row at a time into a small reusable tile
+ *
+ * The writer is called as with esp_jpg_decode(): first with NULL data and the scaled image size,
+ * then once per band with the RGB888 pixels (R first) of the region lines that the MCU row holds,
+ * packed w * h, and last with NULL data again. The tile is overwritten by the next band.
+ * MCUs outside of the region are entropy decoded only, without IDCT, and decoding stops after the
+ * last band of the region.
+ *
+ * @param len       Length in bytes of the JPEG, 0 if the reader knows when it ends
+ * @param scale     Output scale
+ * @param roi       Region in scaled pixels, clipped to the image, NULL for the whole image
+ * @param tile      Band buffer, at least JPG_BAND_LEN(region width, scale) bytes
+ * @param tile_len  Length in bytes of the tile
+ * @param reader    Callback that reads the JPEG
+ * @param writer    Callback that gets the bands
+ * @param arg       Pointer to be passed to the callbacks
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the region is not in the image
+ *      - ESP_ERR_INVALID_SIZE if the tile is too small for a band
+ *      - ESP_FAIL if the JPEG cannot be decoded or the writer stopped
+ */
+esp_err_t esp_jpg_decode_bands(size_t len, jpg_scale_t scale, const jpg_rect_t *roi, uint8_t *tile, size_t tile_len,
+                               jpg_reader_cb reader, jpg_writer_cb writer, void * arg);
+
+/**
+ * @brief esp_jpg_decode_bands() in the work area of a context
+ */
+esp_err_t esp_jpg_decode_bands_ctx(jpg_decode_ctx_t *ctx, size_t len, jpg_scale_t scale, const jpg_rect_t *roi, uint8_t *tile, size_t tile_len,
+                                   jpg_reader_cb reader, jpg_writer_cb writer, void * arg);
+
+/**
+ * @brief Size and quantization of a JPEG, for the coefficient callback
+ */
+typedef struct {
+    uint16_t width;             /*!< Image size in pixels */
+    uint16_t height;
+    uint8_t mcu_w;              /*!< Luma blocks across an MCU, 1 or 2 */
+    uint8_t mcu_h;              /*!< Luma blocks down an MCU, 1 or 2 */
+    uint16_t quant[3][64];      /*!< Quantization tables of Y, Cb and Cr in zig-zag order */
+} jpg_coef_info_t;
+
+/* coef holds the 64 quantized coefficients of a block in zig-zag order, the DC one as its value and not as a difference */
+typedef bool (* jpg_coef_cb)(void * arg, const jpg_coef_info_t *info, const int16_t *coef, uint8_t component);
+
+/**
+ * @brief Entropy decode a JPEG into the quantized DCT coefficients of its blocks
+ *
+ * The callback is called first with NULL coef once the header is read, then for every block in
+ * the order of the MCUs: the luma blocks left to right and top to bottom, then Cb, then Cr.
+ * Nothing is dequantized or transformed, so the coefficients can be coded again as they are
+ * or requantized. Returning false from the callback stops the decode.
+ *
+ * @param len       Length in bytes of the JPEG, 0 if the reader knows when it ends
+ * @param reader    Callback that reads the JPEG
+ * @param cb        Callback that gets the coefficients
+ * @param arg       Pointer to be passed to the callbacks
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NOT_SUPPORTED if the decoder of this chip cannot do it
+ *      - ESP_FAIL if the JPEG cannot be decoded or the callback stopped
+ */
+esp_err_t esp_jpg_decode_coefficients(size_t len, jpg_reader_cb reader, jpg_coef_cb cb, void * arg);
+
+/**
+ * @brief esp_jpg_decode_coefficients() in the work area of a context
+ */
+esp_err_t esp_jpg_decode_coefficients_ctx(jpg_decode_ctx_t *ctx, size_t len, jpg_reader_cb reader, jpg_coef_cb cb, void * arg);
+
+typedef void (* jpg_decode_done_cb)(void * arg, esp_err_t err);
+
+/**
+ * @brief A frame for a decode queue, decoded as esp_jpg_decode() does
+ */
+typedef struct {
+    size_t len;                 /*!< Length in bytes of the JPEG, 0 if the reader knows when it ends */
+    jpg_scale_t scale;          /*!< Output scale */
+    jpg_reader_cb reader;       /*!< Callback that reads the JPEG */
+    jpg_writer_cb writer;       /*!< Callback that gets the pixels */
+    jpg_decode_done_cb done;    /*!< Called with the result after the decode, NULL if not needed */
+    void * arg;                 /*!< Pointer to be passed to the callbacks */
+} jpg_decode_job_t;
+
+typedef struct jpg_decode_queue_s *jpg_decode_queue_t;
+
+/**
+ * @brief Start worker tasks that decode the frames of a queue
+ *
+ * The workers are pinned to the cores in turn, run at the priority of the calling task and own
+ * a context each. The callbacks of a job run on the worker that took it, so jobs are decoded
+ * concurrently and finish in any order.
+ *
+ * @param workers   Number of worker tasks, 0 for one per core
+ * @param depth     Jobs that can wait in the queue
+ * @param queue     The queue, for esp_jpg_decode_queue_submit()
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if depth is 0
+ *      - ESP_ERR_NO_MEM if the queue, the contexts or the tasks cannot be created
+ */
+esp_err_t esp_jpg_decode_queue_create(size_t workers, size_t depth, jpg_decode_queue_t *queue);
+
+/**
+ * @brief Queue a frame for the next free worker
+ *
+ * The job is copied, what its callbacks use must stay valid until done is called.
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if the job has no reader or writer
+ *      - ESP_ERR_TIMEOUT if the queue stayed full for timeout_ms
+ */
+esp_err_t esp_jpg_decode_queue_submit(jpg_decode_queue_t queue, const jpg_decode_job_t *job, uint32_t timeout_ms);
+
+/**
+ * @brief Decode the frames still queued, then stop the workers and free the queue
+ */
+void esp_jpg_decode_queue_delete(jpg_decode_queue_t queue);
+
 #ifdef __cplusplus
 }
 #endif
@@ -29,7 +29,7 @@ typedef size_t (* jpg_out_cb)(void * arg, size_t index, const void* data, size_t
 /**
  * @brief Convert image buffer to JPEG
  *
- * @param src       Source buffer in RGB565, RGB888, YUYV or GRAYSCALE format
+ * @param src       Source buffer in RGB565, RGB888, YUYV, YUV420 or GRAYSCALE format
  * @param src_len   Length in bytes of the source buffer
  * @param width     Width in pixels of the source image
  * @param height    Height in pixels of the source image
@@ -57,7 +57,7 @@ bool frame2jpg_cb(camera_fb_t * fb, uint8_t quality, jpg_out_cb cb, void * arg);
 /**
  * @brief Convert image buffer to JPEG buffer
  *
- * @param src       Source buffer in RGB565, RGB888, YUYV or GRAYSCALE format
+ * @param src       Source buffer in RGB565, RGB888, YUYV, YUV420 or GRAYSCALE format
  * @param src_len   Length in bytes of the source buffer
  * @param width     Width in pixels of the source image
  * @param height    Height in pixels of the source image
@@ -83,6 +83,75 @@ bool fmt2jpg(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixf
  */
 bool frame2jpg(camera_fb_t * fb, uint8_t quality, uint8_t ** out, size_t * out_len);
 
+/**
+ * @brief Convert image buffer to JPEG buffer with Huffman tables built for the image
+ *
+ * The encoder first gathers the symbol statistics of the image, then codes it with tables made
+ * from them. Files are smaller than with fmt2jpg() for the time of the extra pass, which suits
+ * stored or uploaded stills rather than live streams. The first pass keeps its symbols in a buffer
+ * of up to CONFIG_CAMERA_JPEG_OPTIMIZE_BUFFER_KB, in SPIRAM when there is some; images that need
+ * more are encoded twice. Always encoded by a single task.
+ *
+ * @param src       Source buffer in RGB565, RGB888, YUYV, YUV420 or GRAYSCALE format
+ * @param src_len   Length in bytes of the source buffer
+ * @param width     Width in pixels of the source image
+ * @param height    Height in pixels of the source image
+ * @param format    Format of the source image
+ * @param quality   JPEG quality of the resulting image
+ * @param out       Pointer to be populated with the address of the resulting buffer.
+ *                  You MUST free the pointer once you are done with it.
+ * @param out_len   Pointer to be populated with the length of the output buffer
+ *
+ * @return true on success
+ */
+bool fmt2jpg_optimized(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, uint8_t ** out, size_t * out_len);
+
+/**
+ * @brief Convert camera frame buffer to JPEG buffer with Huffman tables built for the frame
+ *
+ * @param fb        Source camera frame buffer
+ * @param quality   JPEG quality of the resulting image
+ * @param out       Pointer to be populated with the address of the resulting buffer
+ * @param out_len   Pointer to be populated with the length of the output buffer
+ *
+ * @return true on success, see fmt2jpg_optimized()
+ */
+bool frame2jpg_optimized(camera_fb_t * fb, uint8_t quality, uint8_t ** out, size_t * out_len);
+
+/**
+ * @brief Convert a JPEG to a lower quality JPEG without decoding it to pixels
+ *
+ * The quantized DCT coefficients of each block are entropy decoded, divided down to the quantization
+ * tables of quality and entropy coded again with the standard Huffman tables. There is no IDCT, DCT or
+ * color conversion and only one block is held at a time, so it needs the decoder context of
+ * esp_jpg_decode() and the encoder object, whatever the image size. Quantizers finer than the ones of
+ * the source are raised to them: a quality above the one of the source codes the same image again.
+ * Restart markers of the source are dropped. Needs the tjpgd.c decoder of the ESP32-S2 and newer IDFs.
+ *
+ * @param src       Source JPEG, baseline YCbCr with H1V1, H2V1 or H2V2 chroma subsampling
+ * @param src_len   Length in bytes of the source JPEG
+ * @param quality   JPEG quality of the resulting image, as for fmt2jpg()
+ * @param cb        Callback to be called to write the bytes of the output JPEG
+ * @param arg       Pointer to be passed to the callback
+ *
+ * @return true on success
+ */
+bool jpg2jpg_cb(const uint8_t *src, size_t src_len, uint8_t quality, jpg_out_cb cb, void * arg);
+
+/**
+ * @brief Convert a JPEG to a lower quality JPEG buffer without decoding it to pixels
+ *
+ * @param src       Source JPEG
+ * @param src_len   Length in bytes of the source JPEG
+ * @param quality   JPEG quality of the resulting image
+ * @param out       Pointer to be populated with the address of the resulting buffer.
+ *                  You MUST free the pointer once you are done with it.
+ * @param out_len   Pointer to be populated with the length of the output buffer
+ *
+ * @return true on success, see jpg2jpg_cb(). Fails if the output is more than 1 KB over src_len.
+ */
+bool jpg2jpg(const uint8_t *src, size_t src_len, uint8_t quality, uint8_t ** out, size_t * out_len);
+
 /**
  * @brief Convert image buffer to BMP buffer
  *
@@ -123,6 +192,18 @@ bool fmt2rgb888(const uint8_t *src_buf, size_t src_len, pixformat_t format, uint
 
 bool jpg2rgb565(const uint8_t *src, size_t src_len, uint8_t * out, jpg_scale_t scale);
 
+/**
+ * @brief Convert image buffer to RGB565 buffer, little endian as jpg2rgb565() writes it (used for displays)
+ *
+ * @param src       Source buffer in JPEG, RGB565 or YUYV format
+ * @param src_len   Length in bytes of the source buffer
+ * @param format    Format of the source image
+ * @param rgb_buf   Pointer to the output buffer (width * height * 2), may be src_buf for RGB565
+ *
+ * @return true on success, false on decode failure or for other formats
+ */
+bool fmt2rgb565(const uint8_t *src_buf, size_t src_len, pixformat_t format, uint8_t * rgb_buf);
+
 #ifdef __cplusplus
 }
 #endif
@@ -18,6 +18,12 @@
 #include <string.h>
 #include <malloc.h>
 #include "esp_heap_caps.h"
+#if JPGE_PROFILE
+#include "esp_cpu.h"
+
+// CPU cycles all encoders spent in the entropy coder, for benchmarks
+extern "C" { uint64_t jpge_entropy_cycles; }
+#endif
 
 #define JPGE_MAX(a,b) (((a)>(b))?(a):(b))
 #define JPGE_MIN(a,b) (((a)<(b))?(a):(b))
@@ -36,10 +42,20 @@ namespace jpge {
         return NULL;
 #endif
     }
+    // Large buffers go to SPIRAM first and leave the internal RAM to the rest of the firmware
+    static inline void *jpge_malloc_large(size_t nSize) {
+#if (CONFIG_SPIRAM_SUPPORT && (CONFIG_SPIRAM_USE_CAPS_ALLOC || CONFIG_SPIRAM_USE_MALLOC))
+        void * b = heap_caps_malloc(nSize, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if(b){
+            return b;
+        }
+#endif
+        return malloc(nSize);
+    }
     static inline void jpge_free(void *p) { free(p); }
 
     // Various JPEG enums and tables.
-    enum { M_SOF0 = 0xC0, M_DHT = 0xC4, M_SOI = 0xD8, M_EOI = 0xD9, M_SOS = 0xDA, M_DQT = 0xDB, M_APP0 = 0xE0 };
+    enum { M_SOF0 = 0xC0, M_DHT = 0xC4, M_RST0 = 0xD0, M_SOI = 0xD8, M_EOI = 0xD9, M_SOS = 0xDA, M_DQT = 0xDB, M_DRI = 0xDD, M_APP0 = 0xE0 };
     enum { DC_LUM_CODES = 12, AC_LUM_CODES = 256, DC_CHROMA_CODES = 12, AC_CHROMA_CODES = 256, MAX_HUFF_SYMBOLS = 257, MAX_HUFF_CODESIZE = 32 };
 
     static const uint8 s_zag[64] = { 0,1,8,16,9,2,3,10,17,24,32,25,18,11,4,5,12,19,26,33,40,48,41,34,27,20,13,6,7,14,21,28,35,42,49,56,57,50,43,36,29,22,15,23,30,37,44,51,58,59,52,45,38,31,39,46,53,60,61,54,47,55,62,63 };
@@ -70,14 +86,28 @@ namespace jpge {
 
     const int YR = 19595, YG = 38470, YB = 7471, CB_R = -11059, CB_G = -21709, CB_B = 32768, CR_R = 32768, CR_G = -27439, CR_B = -5329;
 
-    static int32 m_last_quality = 0;
-    static int32 m_quantization_tables[2][64];
-
     static bool m_huff_initialized = false;
-    static uint m_huff_codes[4][256];
-    static uint8 m_huff_code_sizes[4][256];
-    static uint8 m_huff_bits[4][17];
-    static uint8 m_huff_val[4][256];
+    static huff_tables m_std_huff;
+
+    // Components of the blocks of an MCU, in the order process_mcu_row() codes them, by subsampling.
+    static const uint8 s_mcu_components[4][6] = { { 0 }, { 0, 1, 2 }, { 0, 0, 1, 2 }, { 0, 0, 0, 0, 1, 2 } };
+
+    struct sym_freq { uint m_key, m_sym_index; };
+
+    // The quantization tables of an encoder in zig-zag order, as its DQT segments hold them.
+    struct jpeg_encoder::quant_tables {
+        int32 q[2][64];
+#if CONFIG_CAMERA_JPGE_VECTOR_DCT
+        // Natural-order copies as rounding offsets and 1.31 fixed-point reciprocals.
+        int32 round[2][64];
+        uint32 recip[2][64];
+#endif
+    };
+
+    struct jpeg_encoder::huff_stats {
+        uint32 count[4][256];
+        sym_freq syms[MAX_HUFF_SYMBOLS];
+    };
 
     static inline uint8 clamp(int i) {
         if (i < 0) {
@@ -115,22 +145,58 @@ namespace jpge {
     enum { CONST_BITS = 13, ROW_BITS = 2 };
 #define DCT_DESCALE(x, n) (((x) + (((int32)1) << ((n) - 1))) >> (n))
 #define DCT_MUL(var, c) (static_cast<int16>(var) * static_cast<int32>(c))
-#define DCT1D(s0, s1, s2, s3, s4, s5, s6, s7) \
-    int32 t0 = s0 + s7, t7 = s0 - s7, t1 = s1 + s6, t6 = s1 - s6, t2 = s2 + s5, t5 = s2 - s5, t3 = s3 + s4, t4 = s3 - s4; \
-    int32 t10 = t0 + t3, t13 = t0 - t3, t11 = t1 + t2, t12 = t1 - t2; \
-    int32 u1 = DCT_MUL(t12 + t13, 4433); \
-    s2 = u1 + DCT_MUL(t13, 6270); \
-    s6 = u1 + DCT_MUL(t12, -15137); \
+#define DCT1D_T(T, MUL, s0, s1, s2, s3, s4, s5, s6, s7) \
+    T t0 = s0 + s7, t7 = s0 - s7, t1 = s1 + s6, t6 = s1 - s6, t2 = s2 + s5, t5 = s2 - s5, t3 = s3 + s4, t4 = s3 - s4; \
+    T t10 = t0 + t3, t13 = t0 - t3, t11 = t1 + t2, t12 = t1 - t2; \
+    T u1 = MUL(t12 + t13, 4433); \
+    s2 = u1 + MUL(t13, 6270); \
+    s6 = u1 + MUL(t12, -15137); \
     u1 = t4 + t7; \
-    int32 u2 = t5 + t6, u3 = t4 + t6, u4 = t5 + t7; \
-    int32 z5 = DCT_MUL(u3 + u4, 9633); \
-    t4 = DCT_MUL(t4, 2446); t5 = DCT_MUL(t5, 16819); \
-    t6 = DCT_MUL(t6, 25172); t7 = DCT_MUL(t7, 12299); \
-    u1 = DCT_MUL(u1, -7373); u2 = DCT_MUL(u2, -20995); \
-    u3 = DCT_MUL(u3, -16069); u4 = DCT_MUL(u4, -3196); \
+    T u2 = t5 + t6, u3 = t4 + t6, u4 = t5 + t7; \
+    T z5 = MUL(u3 + u4, 9633); \
+    t4 = MUL(t4, 2446); t5 = MUL(t5, 16819); \
+    t6 = MUL(t6, 25172); t7 = MUL(t7, 12299); \
+    u1 = MUL(u1, -7373); u2 = MUL(u2, -20995); \
+    u3 = MUL(u3, -16069); u4 = MUL(u4, -3196); \
     u3 += z5; u4 += z5; \
     s0 = t10 + t11; s1 = t7 + u1 + u4; s3 = t6 + u2 + u3; s4 = t10 - t11; s5 = t5 + u2 + u4; s7 = t4 + u1 + u3;
+#define DCT1D(s0, s1, s2, s3, s4, s5, s6, s7) DCT1D_T(int32, DCT_MUL, s0, s1, s2, s3, s4, s5, s6, s7)
+
+#if CONFIG_CAMERA_JPGE_VECTOR_DCT
+    // Vectorized forward DCT - eight rows (or columns) of the block are transformed per DCT1D pass.
+    // GCC vector extensions map this to SSE/NEON on the host and to plain register code on Xtensa.
+    // DCT_VMUL truncates each lane to 16 bits exactly like DCT_MUL, so the output is bit-exact with the scalar path.
+    typedef int32 dct_vec_t __attribute__((vector_size(8 * sizeof(int32))));
+#define DCT_VMUL(var, c) ((((var) << 16) >> 16) * static_cast<int32>(c))
+
+    static inline void dct_transpose(dct_vec_t *v) {
+        int32 t[64];
+        memcpy(t, v, sizeof(t));
+        for (int r = 0; r < 8; r++) {
+            for (int c = 0; c < 8; c++) {
+                v[r][c] = t[c * 8 + r];
+            }
+        }
+    }
 
+    static void DCT2D(int32 *p) {
+        dct_vec_t v[8];
+        memcpy(v, p, sizeof(v));
+        dct_transpose(v);
+        {
+            DCT1D_T(dct_vec_t, DCT_VMUL, v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7]);
+            v[0] = v[0] << static_cast<int32>(ROW_BITS); v[1] = DCT_DESCALE(v[1], CONST_BITS-ROW_BITS); v[2] = DCT_DESCALE(v[2], CONST_BITS-ROW_BITS); v[3] = DCT_DESCALE(v[3], CONST_BITS-ROW_BITS);
+            v[4] = v[4] << static_cast<int32>(ROW_BITS); v[5] = DCT_DESCALE(v[5], CONST_BITS-ROW_BITS); v[6] = DCT_DESCALE(v[6], CONST_BITS-ROW_BITS); v[7] = DCT_DESCALE(v[7], CONST_BITS-ROW_BITS);
+        }
+        dct_transpose(v);
+        {
+            DCT1D_T(dct_vec_t, DCT_VMUL, v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7]);
+            v[0] = DCT_DESCALE(v[0], ROW_BITS+3); v[1] = DCT_DESCALE(v[1], CONST_BITS+ROW_BITS+3); v[2] = DCT_DESCALE(v[2], CONST_BITS+ROW_BITS+3); v[3] = DCT_DESCALE(v[3], CONST_BITS+ROW_BITS+3);
+            v[4] = DCT_DESCALE(v[4], ROW_BITS+3); v[5] = DCT_DESCALE(v[5], CONST_BITS+ROW_BITS+3); v[6] = DCT_DESCALE(v[6], CONST_BITS+ROW_BITS+3); v[7] = DCT_DESCALE(v[7], CONST_BITS+ROW_BITS+3);
+        }
+        memcpy(p, v, sizeof(v));
+    }
+#else
     static void DCT2D(int32 *p) {
         int32 c, *q = p;
         for (c = 7; c >= 0; c--, q += 8) {
@@ -146,6 +212,7 @@ namespace jpge {
             q[4*8] = DCT_DESCALE(s4, ROW_BITS+3); q[5*8] = DCT_DESCALE(s5, CONST_BITS+ROW_BITS+3); q[6*8] = DCT_DESCALE(s6, CONST_BITS+ROW_BITS+3); q[7*8] = DCT_DESCALE(s7, CONST_BITS+ROW_BITS+3);
         }
     }
+#endif
 
     // Compute the actual canonical Huffman codes/code sizes given the JPEG huff bits and val arrays.
     static void compute_huffman_table(uint *codes, uint8 *code_sizes, uint8 *bits, uint8 *val)
@@ -183,13 +250,130 @@ namespace jpge {
         }
     }
 
+    // Stable sort by frequency, least frequent first. There are at most MAX_HUFF_SYMBOLS symbols, once per image.
+    static void sort_syms(sym_freq *syms, int num_syms)
+    {
+        for (int i = 1; i < num_syms; i++)
+        {
+            sym_freq s = syms[i];
+            int j = i;
+            for ( ; j > 0 && syms[j - 1].m_key > s.m_key; j--)
+                syms[j] = syms[j - 1];
+            syms[j] = s;
+        }
+    }
+
+    // calculate_minimum_redundancy() originally written by: Alistair Moffat, alistair@cs.mu.oz.au, Jyrki Katajainen, jyrki@diku.dk, November 1996.
+    // Replaces the frequencies of the sorted symbols with their code sizes.
+    static void calculate_minimum_redundancy(sym_freq *A, int n)
+    {
+        int root, leaf, next, avbl, used, dpth;
+        if (n == 0) {
+            return;
+        } else if (n == 1) {
+            A[0].m_key = 1;
+            return;
+        }
+        A[0].m_key += A[1].m_key; root = 0; leaf = 2;
+        for (next = 1; next < n - 1; next++)
+        {
+            if (leaf >= n || A[root].m_key < A[leaf].m_key) { A[next].m_key = A[root].m_key; A[root++].m_key = next; } else A[next].m_key = A[leaf++].m_key;
+            if (leaf >= n || (root < next && A[root].m_key < A[leaf].m_key)) { A[next].m_key += A[root].m_key; A[root++].m_key = next; } else A[next].m_key += A[leaf++].m_key;
+        }
+        A[n - 2].m_key = 0;
+        for (next = n - 3; next >= 0; next--)
+            A[next].m_key = A[A[next].m_key].m_key + 1;
+        avbl = 1; used = dpth = 0; root = n - 2; next = n - 1;
+        while (avbl > 0)
+        {
+            while (root >= 0 && (int)A[root].m_key == dpth) { used++; root--; }
+            while (avbl > used) { A[next--].m_key = dpth; avbl--; }
+            avbl = 2 * used; dpth++; used = 0;
+        }
+    }
+
+    // Limits canonical Huffman code table's max code size to max_code_size.
+    static void huffman_enforce_max_code_size(int *pNum_codes, int code_list_len, int max_code_size)
+    {
+        if (code_list_len <= 1) {
+            return;
+        }
+        for (int i = max_code_size + 1; i <= MAX_HUFF_CODESIZE; i++)
+            pNum_codes[max_code_size] += pNum_codes[i];
+
+        uint32 total = 0;
+        for (int i = max_code_size; i > 0; i--)
+            total += (((uint32)pNum_codes[i]) << (max_code_size - i));
+
+        while (total != (1UL << max_code_size))
+        {
+            pNum_codes[max_code_size]--;
+            for (int i = max_code_size - 1; i > 0; i--)
+            {
+                if (pNum_codes[i]) { pNum_codes[i]--; pNum_codes[i + 1] += 2; break; }
+            }
+            total--;
+        }
+    }
+
+    // Generates an optimized Huffman table from the first pass symbol counts of the table.
+    void jpeg_encoder::optimize_huffman_table(int table_num, int table_len)
+    {
+        sym_freq *syms = m_huff_stats->syms;
+        const uint32 *pSym_count = m_huff_stats->count[table_num];
+        syms[0].m_key = 1; syms[0].m_sym_index = 0;  // dummy symbol, assures that no valid code contains all 1's
+        int num_used_syms = 1;
+        for (int i = 0; i < table_len; i++)
+        {
+            if (pSym_count[i]) { syms[num_used_syms].m_key = pSym_count[i]; syms[num_used_syms++].m_sym_index = i + 1; }
+        }
+        sort_syms(syms, num_used_syms);
+        calculate_minimum_redundancy(syms, num_used_syms);
+
+        // Count the # of symbols of each code size.
+        int num_codes[1 + MAX_HUFF_CODESIZE];
+        memset(num_codes, 0, sizeof(num_codes));
+        for (int i = 0; i < num_used_syms; i++)
+            num_codes[syms[i].m_key]++;
+
+        const uint JPGE_CODE_SIZE_LIMIT = 16;
+        huffman_enforce_max_code_size(num_codes, num_used_syms, JPGE_CODE_SIZE_LIMIT);
+
+        // Compute the bits array, which contains the # of symbols per code size.
+        uint8 *bits = m_opt_huff->bits[table_num];
+        memset(bits, 0, 17);
+        for (int i = 1; i <= (int)JPGE_CODE_SIZE_LIMIT; i++)
+            bits[i] = static_cast<uint8>(num_codes[i]);
+
+        // Remove the dummy symbol added above, which must be in largest bucket.
+        for (int i = JPGE_CODE_SIZE_LIMIT; i >= 1; i--)
+        {
+            if (bits[i]) { bits[i]--; break; }
+        }
+
+        // Compute the val array, which contains the symbol indices sorted by code size (smallest to largest).
+        for (int i = num_used_syms - 1; i >= 1; i--)
+            m_opt_huff->val[table_num][num_used_syms - 1 - i] = static_cast<uint8>(syms[i].m_sym_index - 1);
+    }
+
     void jpeg_encoder::flush_output_buffer()
     {
-        if (m_out_buf_left != JPGE_OUT_BUF_SIZE) {
-            m_all_stream_writes_succeeded = m_all_stream_writes_succeeded && m_pStream->put_buf(m_out_buf, JPGE_OUT_BUF_SIZE - m_out_buf_left);
+        uint len = m_out_buf_size - m_out_buf_left;
+        if (len) {
+            if (m_out_window) {
+                m_all_stream_writes_succeeded = m_all_stream_writes_succeeded && m_pStream->commit_window(len);
+            } else {
+                m_all_stream_writes_succeeded = m_all_stream_writes_succeeded && m_pStream->put_buf(m_out_buf, len);
+            }
+        }
+        // write straight into the stream's memory while it has room, else into m_out_buf
+        m_pOut_buf = m_pStream->get_window(m_out_buf_size);
+        m_out_window = m_pOut_buf && m_out_buf_size >= JPGE_MIN_WINDOW;
+        if (!m_out_window) {
+            m_pOut_buf = m_out_buf;
+            m_out_buf_size = JPGE_OUT_BUF_SIZE;
         }
-        m_pOut_buf = m_out_buf;
-        m_out_buf_left = JPGE_OUT_BUF_SIZE;
+        m_out_buf_left = m_out_buf_size;
     }
 
     void jpeg_encoder::emit_byte(uint8 i)
@@ -200,12 +384,47 @@ namespace jpge {
         }
     }
 
-    void jpeg_encoder::put_bits(uint bits, uint len)
+    // The pending bits sit at the top of the 64-bit buffer and leave it a 32-bit word at a time.
+    // A Huffman code comes in one call with its magnitude bits, at most 27 bits, so fewer than 59 bits are ever pending.
+    inline void jpeg_encoder::put_bits(uint bits, uint len)
+    {
+        m_bits_in += len;
+        m_bit_buffer |= (uint64)bits << (64 - m_bits_in);
+        if (m_bits_in >= 32) {
+            emit_bits_word();
+        }
+    }
+
+    void jpeg_encoder::emit_bits_word()
     {
-        uint8 c = 0;
-        m_bit_buffer |= ((uint32)bits << (24 - (m_bits_in += len)));
+        uint32 w = (uint32)(m_bit_buffer >> 32);
+        m_bit_buffer <<= 32;
+        m_bits_in -= 32;
+        // without an 0xFF byte nothing is stuffed and the word goes out in one go
+        if (!(((~w) - 0x01010101U) & w & 0x80808080U) && m_out_buf_left > 4) {
+            m_pOut_buf[0] = uint8(w >> 24);
+            m_pOut_buf[1] = uint8(w >> 16);
+            m_pOut_buf[2] = uint8(w >> 8);
+            m_pOut_buf[3] = uint8(w);
+            m_pOut_buf += 4;
+            m_out_buf_left -= 4;
+            return;
+        }
+        for (int i = 24; i >= 0; i -= 8) {
+            uint8 c = uint8(w >> i);
+            emit_byte(c);
+            if (c == 0xFF) {
+                emit_byte(0);
+            }
+        }
+    }
+
+    // Pad the entropy coded data with 1 bits to a byte boundary and write out what is pending.
+    void jpeg_encoder::flush_bits()
+    {
+        put_bits(0x7F, 7);
         while (m_bits_in >= 8) {
-            c = (uint8)((m_bit_buffer >> 16) & 0xFF);
+            uint8 c = uint8(m_bit_buffer >> 56);
             emit_byte(c);
             if (c == 0xFF) {
                 emit_byte(0);
@@ -213,6 +432,8 @@ namespace jpge {
             m_bit_buffer <<= 8;
             m_bits_in -= 8;
         }
+        m_bit_buffer = 0;
+        m_bits_in = 0;
     }
 
     void jpeg_encoder::emit_word(uint i)
@@ -251,7 +472,7 @@ namespace jpge {
             emit_word(64 + 1 + 2);
             emit_byte(static_cast<uint8>(i));
             for (int j = 0; j < 64; j++)
-                emit_byte(static_cast<uint8>(m_quantization_tables[i][j]));
+                emit_byte(static_cast<uint8>(m_quant->q[i][j]));
         }
     }
 
@@ -294,11 +515,11 @@ namespace jpge {
     // Emit all Huffman tables.
     void jpeg_encoder::emit_dhts()
     {
-        emit_dht(m_huff_bits[0+0], m_huff_val[0+0], 0, false);
-        emit_dht(m_huff_bits[2+0], m_huff_val[2+0], 0, true);
+        emit_dht(m_huff->bits[0+0], m_huff->val[0+0], 0, false);
+        emit_dht(m_huff->bits[2+0], m_huff->val[2+0], 0, true);
         if (m_num_components == 3) {
-            emit_dht(m_huff_bits[0+1], m_huff_val[0+1], 1, false);
-            emit_dht(m_huff_bits[2+1], m_huff_val[2+1], 1, true);
+            emit_dht(m_huff->bits[0+1], m_huff->val[0+1], 1, false);
+            emit_dht(m_huff->bits[2+1], m_huff->val[2+1], 1, true);
         }
     }
 
@@ -321,6 +542,36 @@ namespace jpge {
         emit_byte(0);
     }
 
+    // emit define restart interval
+    void jpeg_encoder::emit_dri()
+    {
+        emit_marker(M_DRI);
+        emit_word(4);
+        emit_word(m_params.m_restart_rows * m_mcus_per_row);
+    }
+
+    // Pad the current entropy coded segment to a byte boundary, start the next one with RSTn and reset the DC predictions.
+    void jpeg_encoder::emit_restart()
+    {
+        flush_bits();
+        emit_marker(M_RST0 + ((m_mcu_row / m_params.m_restart_rows - 1) & 7));
+        memset(m_last_dc_val, 0, 3 * sizeof(m_last_dc_val[0]));
+    }
+
+    // Emit all markers at beginning of image file.
+    void jpeg_encoder::emit_markers()
+    {
+        emit_marker(M_SOI);
+        emit_jfif_app0();
+        emit_dqt();
+        emit_sof();
+        emit_dhts();
+        if (m_params.m_restart_rows) {
+            emit_dri();
+        }
+        emit_sos();
+    }
+
     void jpeg_encoder::load_block_8_8_grey(int x)
     {
         uint8 *pSrc;
@@ -381,9 +632,72 @@ namespace jpge {
         }
     }
 
+    // 4:2:0 and 4:2:2 source data keep their planes in the MCU lines: luma line i at the start of line i,
+    // Cb and Cr line i of the MCU row at m_image_x_mcu and 1.5 * m_image_x_mcu of line i.
+    void jpeg_encoder::load_block_8_8_plane(int y, int x)
+    {
+        uint8 *pSrc;
+        sample_array_t *pDst = m_sample_array;
+        for (int i = 0; i < 8; i++, pDst += 8)
+        {
+            pSrc = m_mcu_lines[y + i] + x;
+            pDst[0] = pSrc[0] - 128; pDst[1] = pSrc[1] - 128; pDst[2] = pSrc[2] - 128; pDst[3] = pSrc[3] - 128;
+            pDst[4] = pSrc[4] - 128; pDst[5] = pSrc[5] - 128; pDst[6] = pSrc[6] - 128; pDst[7] = pSrc[7] - 128;
+        }
+    }
+
+    // Vertical 2:1 chroma downsampling of a 4:2:2 plane, for H2V2
+    void jpeg_encoder::load_block_8_16_plane(int x)
+    {
+        uint8 *pSrc1, *pSrc2;
+        sample_array_t *pDst = m_sample_array;
+        for (int i = 0; i < 16; i += 2, pDst += 8)
+        {
+            pSrc1 = m_mcu_lines[i + 0] + x;
+            pSrc2 = m_mcu_lines[i + 1] + x;
+            pDst[0] = ((pSrc1[0] + pSrc2[0]) >> 1) - 128; pDst[1] = ((pSrc1[1] + pSrc2[1] + 1) >> 1) - 128;
+            pDst[2] = ((pSrc1[2] + pSrc2[2]) >> 1) - 128; pDst[3] = ((pSrc1[3] + pSrc2[3] + 1) >> 1) - 128;
+            pDst[4] = ((pSrc1[4] + pSrc2[4]) >> 1) - 128; pDst[5] = ((pSrc1[5] + pSrc2[5] + 1) >> 1) - 128;
+            pDst[6] = ((pSrc1[6] + pSrc2[6]) >> 1) - 128; pDst[7] = ((pSrc1[7] + pSrc2[7] + 1) >> 1) - 128;
+        }
+    }
+
+#if CONFIG_CAMERA_JPGE_VECTOR_DCT
+    // (n * recip) >> 31 == n / q for every n < 2^15 and q <= 255, which covers all baseline DCT outputs.
+    void jpeg_encoder::compute_quant_recip(int table)
+    {
+        for (int i = 0; i < 64; i++)
+        {
+            uint32 q = m_quant->q[table][i];
+            m_quant->round[table][s_zag[i]] = q >> 1;
+            m_quant->recip[table][s_zag[i]] = (1U << 31) / q + 1;
+        }
+    }
+
+    // Branch-free quantization in natural order; the division is replaced by a reciprocal multiply
+    // and the loop auto-vectorizes. Only the final zig-zag reorder is done per coefficient.
     void jpeg_encoder::load_quantized_coefficients(int component_num)
     {
-        int32 *q = m_quantization_tables[component_num > 0];
+        const int32 *r = m_quant->round[component_num > 0];
+        const uint32 *m = m_quant->recip[component_num > 0];
+        int16 quantized[64];
+        for (int i = 0; i < 64; i++)
+        {
+            int32 j = m_sample_array[i];
+            int32 sign = j >> 31;
+            uint32 n = static_cast<uint32>((j ^ sign) - sign + r[i]);
+            int32 v = static_cast<int32>((static_cast<uint64_t>(n) * m[i]) >> 31);
+            quantized[i] = static_cast<int16>((v ^ sign) - sign);
+        }
+        for (int i = 0; i < 64; i++)
+        {
+            m_coefficient_array[i] = quantized[s_zag[i]];
+        }
+    }
+#else
+    void jpeg_encoder::load_quantized_coefficients(int component_num)
+    {
+        int32 *q = m_quant->q[component_num > 0];
         int16 *pDst = m_coefficient_array;
         for (int i = 0; i < 64; i++)
         {
@@ -405,6 +719,71 @@ namespace jpge {
             q++;
         }
     }
+#endif
+
+    // The first pass keeps each symbol as a byte followed by its magnitude bits, packed into 32-bit words.
+    // Words that do not fit into the buffer are only counted.
+    inline void jpeg_encoder::store_symbol(uint sym, uint bits, uint nbits)
+    {
+        m_symbol_bits += 8 + nbits;
+        m_symbol_buffer |= (uint64)((sym << nbits) | bits) << (64 - m_symbol_bits);
+        if (m_symbol_bits >= 32) {
+            if (m_symbols_len < m_symbols_size) {
+                m_symbols[m_symbols_len] = uint32(m_symbol_buffer >> 32);
+            }
+            m_symbols_len++;
+            m_symbol_buffer <<= 32;
+            m_symbol_bits -= 32;
+        }
+    }
+
+    // First pass: count the symbols pass two would code, and keep them while the symbol buffer has room.
+    void jpeg_encoder::code_coefficients_pass_one(int component_num)
+    {
+        int i, run_len, nbits, temp1, temp2;
+        uint32 *dc_count = m_huff_stats->count[0 + (component_num > 0)], *ac_count = m_huff_stats->count[2 + (component_num > 0)];
+
+        temp1 = temp2 = m_coefficient_array[0] - m_last_dc_val[component_num];
+        m_last_dc_val[component_num] = m_coefficient_array[0];
+
+        if (temp1 < 0)
+        {
+            temp1 = -temp1; temp2--;
+        }
+
+        nbits = temp1 ? 32 - __builtin_clz(temp1) : 0;
+        dc_count[nbits]++;
+        store_symbol(nbits, temp2 & ((1 << nbits) - 1), nbits);
+
+        for (run_len = 0, i = 1; i < 64; i++)
+        {
+            if ((temp1 = m_coefficient_array[i]) == 0)
+                run_len++;
+            else
+            {
+                while (run_len >= 16)
+                {
+                    ac_count[0xF0]++;
+                    store_symbol(0xF0, 0, 0);
+                    run_len -= 16;
+                }
+                if ((temp2 = temp1) < 0)
+                {
+                    temp1 = -temp1;
+                    temp2--;
+                }
+                nbits = 32 - __builtin_clz(temp1);
+                ac_count[(run_len << 4) + nbits]++;
+                store_symbol((run_len << 4) + nbits, temp2 & ((1 << nbits) - 1), nbits);
+                run_len = 0;
+            }
+        }
+        if (run_len)
+        {
+            ac_count[0]++;
+            store_symbol(0, 0, 0);
+        }
+    }
 
     void jpeg_encoder::code_coefficients_pass_two(int component_num)
     {
@@ -415,13 +794,13 @@ namespace jpge {
 
         if (component_num == 0)
         {
-            codes[0] = m_huff_codes[0 + 0]; codes[1] = m_huff_codes[2 + 0];
-            code_sizes[0] = m_huff_code_sizes[0 + 0]; code_sizes[1] = m_huff_code_sizes[2 + 0];
+            codes[0] = m_huff->codes[0 + 0]; codes[1] = m_huff->codes[2 + 0];
+            code_sizes[0] = m_huff->code_sizes[0 + 0]; code_sizes[1] = m_huff->code_sizes[2 + 0];
         }
         else
         {
-            codes[0] = m_huff_codes[0 + 1]; codes[1] = m_huff_codes[2 + 1];
-            code_sizes[0] = m_huff_code_sizes[0 + 1]; code_sizes[1] = m_huff_code_sizes[2 + 1];
+            codes[0] = m_huff->codes[0 + 1]; codes[1] = m_huff->codes[2 + 1];
+            code_sizes[0] = m_huff->code_sizes[0 + 1]; code_sizes[1] = m_huff->code_sizes[2 + 1];
         }
 
         temp1 = temp2 = pSrc[0] - m_last_dc_val[component_num];
@@ -432,14 +811,8 @@ namespace jpge {
             temp1 = -temp1; temp2--;
         }
 
-        nbits = 0;
-        while (temp1)
-        {
-            nbits++; temp1 >>= 1;
-        }
-
-        put_bits(codes[0][nbits], code_sizes[0][nbits]);
-        if (nbits) put_bits(temp2 & ((1 << nbits) - 1), nbits);
+        nbits = temp1 ? 32 - __builtin_clz(temp1) : 0;
+        put_bits((codes[0][nbits] << nbits) | (temp2 & ((1 << nbits) - 1)), code_sizes[0][nbits] + nbits);
 
         for (run_len = 0, i = 1; i < 64; i++)
         {
@@ -457,12 +830,9 @@ namespace jpge {
                     temp1 = -temp1;
                     temp2--;
                 }
-                nbits = 1;
-                while (temp1 >>= 1)
-                    nbits++;
+                nbits = 32 - __builtin_clz(temp1);
                 j = (run_len << 4) + nbits;
-                put_bits(codes[1][j], code_sizes[1][j]);
-                put_bits(temp2 & ((1 << nbits) - 1), nbits);
+                put_bits((codes[1][j] << nbits) | (temp2 & ((1 << nbits) - 1)), code_sizes[1][j] + nbits);
                 run_len = 0;
             }
         }
@@ -470,15 +840,104 @@ namespace jpge {
             put_bits(codes[1][0], code_sizes[1][0]);
     }
 
+    // Codes the next symbol of the kept ones with table, returns it.
+    inline uint jpeg_encoder::code_stored_symbol(int table)
+    {
+        if (m_symbol_bits < 32) {
+            if (m_symbols_pos < m_symbols_len) {
+                m_symbol_buffer |= (uint64)m_symbols[m_symbols_pos++] << (32 - m_symbol_bits);
+            }
+            m_symbol_bits += 32;
+        }
+        const uint32 top = uint32(m_symbol_buffer >> 32);
+        const uint sym = top >> 24, nbits = sym & 15;
+        put_bits((m_huff->codes[table][sym] << nbits) | ((top >> (24 - nbits)) & ((1 << nbits) - 1)), m_huff->code_sizes[table][sym] + nbits);
+        m_symbol_buffer <<= 8 + nbits;
+        m_symbol_bits -= 8 + nbits;
+        return sym;
+    }
+
+    // Second pass of an image whose first pass symbols all fit into the symbol buffer: code them with the new tables.
+    // The DC differences are kept, the block structure follows from the MCU layout as in process_mcu_row().
+    void jpeg_encoder::code_symbols()
+    {
+        const int mcu_rows = m_image_y_mcu / m_mcu_y;
+        const int mcu_blocks = (m_num_components == 1) ? 1 : (m_mcu_x * m_mcu_y / 64) + 2;
+        const uint8 *components = s_mcu_components[m_params.m_subsampling];
+
+        m_symbol_buffer = 0;
+        m_symbol_bits = 0;
+        m_symbols_pos = 0;
+        for (m_mcu_row = 0; m_mcu_row < mcu_rows; )
+        {
+            if (m_params.m_restart_rows && m_mcu_row && (m_mcu_row % m_params.m_restart_rows) == 0) {
+                emit_restart();
+            }
+            m_mcu_row++;
+            for (int i = 0; i < m_mcus_per_row * mcu_blocks; i++)
+            {
+                const int table = components[i % mcu_blocks] > 0;
+                code_stored_symbol(0 + table);
+                for (int k = 1; k < 64; )
+                {
+                    uint sym = code_stored_symbol(2 + table);
+                    if (sym == 0)
+                        break;
+                    k += (sym >> 4) + 1;
+                }
+            }
+        }
+    }
+
+    void jpeg_encoder::code_coefficients(int component_num)
+    {
+#if JPGE_PROFILE
+        esp_cpu_cycle_count_t start = esp_cpu_get_cycle_count();
+#endif
+        if (m_pass_num == 1)
+            code_coefficients_pass_one(component_num);
+        else
+            code_coefficients_pass_two(component_num);
+#if JPGE_PROFILE
+        jpge_entropy_cycles += (esp_cpu_cycle_count_t)(esp_cpu_get_cycle_count() - start);
+#endif
+    }
+
     void jpeg_encoder::code_block(int component_num)
     {
         DCT2D(m_sample_array);
         load_quantized_coefficients(component_num);
-        code_coefficients_pass_two(component_num);
+        code_coefficients(component_num);
+    }
+
+    // The next block of an encoder fed with coefficients, coded where process_mcu_row() would code it.
+    void jpeg_encoder::code_coefficient_block(const int16 *pSrc)
+    {
+        const int mcu_blocks = (m_num_components == 1) ? 1 : (m_mcu_x * m_mcu_y / 64) + 2;
+        if (m_mcu_block == 0) {
+            if (m_params.m_restart_rows && m_mcu_row && (m_mcu_row % m_params.m_restart_rows) == 0) {
+                emit_restart();
+            }
+            m_mcu_row++;
+        }
+        memcpy(m_coefficient_array, pSrc, sizeof(m_coefficient_array));
+        code_coefficients(s_mcu_components[m_params.m_subsampling][m_mcu_block % mcu_blocks]);
+        if (++m_mcu_block == m_mcus_per_row * mcu_blocks) {
+            m_mcu_block = 0;
+        }
     }
 
     void jpeg_encoder::process_mcu_row()
     {
+        if (m_params.m_restart_rows && m_mcu_row && (m_mcu_row % m_params.m_restart_rows) == 0) {
+            if (m_pass_num == 1) {
+                memset(m_last_dc_val, 0, 3 * sizeof(m_last_dc_val[0]));
+            } else {
+                emit_restart();
+            }
+        }
+        m_mcu_row++;
+
         if (m_num_components == 1)
         {
             for (int i = 0; i < m_mcus_per_row; i++)
@@ -486,6 +945,27 @@ namespace jpge {
                 load_block_8_8_grey(i); code_block(0);
             }
         }
+        else if (m_src_layout != SRC_YCC)
+        {
+            const int cb = m_image_x_mcu, cr = m_image_x_mcu + (m_image_x_mcu >> 1);
+            const bool chroma_v_samp = (m_src_layout == SRC_YUV422) && (m_mcu_y == 16);
+            for (int i = 0; i < m_mcus_per_row; i++)
+            {
+                load_block_8_8_plane(0, i * 16); code_block(0); load_block_8_8_plane(0, i * 16 + 8); code_block(0);
+                if (m_mcu_y == 16)
+                {
+                    load_block_8_8_plane(8, i * 16); code_block(0); load_block_8_8_plane(8, i * 16 + 8); code_block(0);
+                }
+                if (chroma_v_samp)
+                {
+                    load_block_8_16_plane(cb + i * 8); code_block(1); load_block_8_16_plane(cr + i * 8); code_block(2);
+                }
+                else
+                {
+                    load_block_8_8_plane(0, cb + i * 8); code_block(1); load_block_8_8_plane(0, cr + i * 8); code_block(2);
+                }
+            }
+        }
         else if ((m_comp_h_samp[0] == 1) && (m_comp_v_samp[0] == 1))
         {
             for (int i = 0; i < m_mcus_per_row; i++)
@@ -550,14 +1030,69 @@ namespace jpge {
         }
     }
 
+    void jpeg_encoder::load_mcu_yuv420(const uint8 *pY0, const uint8 *pY1, const uint8 *pCb, const uint8 *pCr, int chroma_step)
+    {
+        const int chroma_x = (m_image_x + 1) >> 1, chroma_x_mcu = m_image_x_mcu >> 1;
+
+        // Possibly duplicate samples at end of scanline if not a multiple of 16
+        uint8 *pDst = m_mcu_lines[m_mcu_y_ofs];
+        memcpy(pDst, pY0, m_image_x);
+        memset(pDst + m_image_x, pDst[m_image_x - 1], m_image_x_mcu - m_image_x);
+        pDst = m_mcu_lines[m_mcu_y_ofs + 1];
+        memcpy(pDst, pY1, m_image_x);
+        memset(pDst + m_image_x, pDst[m_image_x - 1], m_image_x_mcu - m_image_x);
+
+        uint8 *pDst_cb = m_mcu_lines[m_mcu_y_ofs >> 1] + m_image_x_mcu, *pDst_cr = pDst_cb + chroma_x_mcu;
+        if (chroma_step == 1) {
+            memcpy(pDst_cb, pCb, chroma_x);
+            memcpy(pDst_cr, pCr, chroma_x);
+        } else {
+            for (int i = 0; i < chroma_x; i++, pCb += chroma_step, pCr += chroma_step) {
+                pDst_cb[i] = *pCb;
+                pDst_cr[i] = *pCr;
+            }
+        }
+        memset(pDst_cb + chroma_x, pDst_cb[chroma_x - 1], chroma_x_mcu - chroma_x);
+        memset(pDst_cr + chroma_x, pDst_cr[chroma_x - 1], chroma_x_mcu - chroma_x);
+
+        m_mcu_y_ofs += 2;
+        if (m_mcu_y_ofs == m_mcu_y)
+        {
+            process_mcu_row();
+            m_mcu_y_ofs = 0;
+        }
+    }
+
+    void jpeg_encoder::load_mcu_yuyv(const uint8 *pSrc)
+    {
+        const int chroma_x = m_image_x >> 1, chroma_x_mcu = m_image_x_mcu >> 1;
+        uint8 *pDst = m_mcu_lines[m_mcu_y_ofs], *pDst_cb = pDst + m_image_x_mcu, *pDst_cr = pDst_cb + chroma_x_mcu;
+
+        for (int i = 0; i < chroma_x; i++, pSrc += 4)
+        {
+            pDst[2 * i] = pSrc[0]; pDst_cb[i] = pSrc[1]; pDst[2 * i + 1] = pSrc[2]; pDst_cr[i] = pSrc[3];
+        }
+
+        // Possibly duplicate samples at end of scanline if not a multiple of 16
+        memset(pDst + m_image_x, pDst[m_image_x - 1], m_image_x_mcu - m_image_x);
+        memset(pDst_cb + chroma_x, pDst_cb[chroma_x - 1], chroma_x_mcu - chroma_x);
+        memset(pDst_cr + chroma_x, pDst_cr[chroma_x - 1], chroma_x_mcu - chroma_x);
+
+        if (++m_mcu_y_ofs == m_mcu_y)
+        {
+            process_mcu_row();
+            m_mcu_y_ofs = 0;
+        }
+    }
+
     // Quantization table generation.
-    void jpeg_encoder::compute_quant_table(int32 *pDst, const int16 *pSrc)
+    static void compute_quant_table(int32 *pDst, const int16 *pSrc, int quality)
     {
         int32 q;
-        if (m_params.m_quality < 50)
-            q = 5000 / m_params.m_quality;
+        if (quality < 50)
+            q = 5000 / quality;
         else
-            q = 200 - m_params.m_quality * 2;
+            q = 200 - quality * 2;
         for (int i = 0; i < 64; i++)
         {
             int32 j = *pSrc++; j = (j * q + 50L) / 100L;
@@ -565,6 +1100,15 @@ namespace jpge {
         }
     }
 
+    void get_quant_tables(int quality, uint8 *pTables)
+    {
+        int32 q[2][64];
+        compute_quant_table(q[0], s_std_lum_quant, JPGE_MIN(JPGE_MAX(quality, 1), 100));
+        compute_quant_table(q[1], s_std_croma_quant, JPGE_MIN(JPGE_MAX(quality, 1), 100));
+        for (int i = 0; i < 128; i++)
+            pTables[i] = static_cast<uint8>(q[i >> 6][i & 63]);
+    }
+
     // Higher-level methods.
     bool jpeg_encoder::jpg_open(int p_x_res, int p_y_res, int src_channels)
     {
@@ -612,47 +1156,84 @@ namespace jpge {
         m_image_bpl_mcu  = m_image_x_mcu * m_num_components;
         m_mcus_per_row   = m_image_x_mcu / m_mcu_x;
 
-        if ((m_mcu_lines[0] = static_cast<uint8*>(jpge_malloc(m_image_bpl_mcu * m_mcu_y))) == NULL) {
+        if (m_params.m_restart_rows * m_mcus_per_row > 0xFFFF) {
             return false;
         }
-        for (int i = 1; i < m_mcu_y; i++)
-            m_mcu_lines[i] = m_mcu_lines[i-1] + m_image_bpl_mcu;
 
-        if(m_last_quality != m_params.m_quality){
-            m_last_quality = m_params.m_quality;
-            compute_quant_table(m_quantization_tables[0], s_std_lum_quant);
-            compute_quant_table(m_quantization_tables[1], s_std_croma_quant);
+        if (m_src_layout != SRC_COEF) {
+            if ((m_mcu_lines[0] = static_cast<uint8*>(jpge_malloc(m_image_bpl_mcu * m_mcu_y))) == NULL) {
+                return false;
+            }
+            for (int i = 1; i < m_mcu_y; i++)
+                m_mcu_lines[i] = m_mcu_lines[i-1] + m_image_bpl_mcu;
         }
 
+        // Every encoder has tables of its own, encoders of other qualities or tables may run at the same time
+        if ((m_quant = static_cast<quant_tables*>(jpge_malloc(sizeof(quant_tables)))) == NULL) {
+            return false;
+        }
+        if (m_params.m_quant_tables) {
+            for (int i = 0; i < 128; i++)
+                m_quant->q[i >> 6][i & 63] = m_params.m_quant_tables[i];
+        } else {
+            compute_quant_table(m_quant->q[0], s_std_lum_quant, m_params.m_quality);
+            compute_quant_table(m_quant->q[1], s_std_croma_quant, m_params.m_quality);
+        }
+#if CONFIG_CAMERA_JPGE_VECTOR_DCT
+        compute_quant_recip(0);
+        compute_quant_recip(1);
+#endif
+
         if(!m_huff_initialized){
             m_huff_initialized = true;
 
-            memcpy(m_huff_bits[0+0], s_dc_lum_bits, 17);    memcpy(m_huff_val[0+0], s_dc_lum_val, DC_LUM_CODES);
-            memcpy(m_huff_bits[2+0], s_ac_lum_bits, 17);    memcpy(m_huff_val[2+0], s_ac_lum_val, AC_LUM_CODES);
-            memcpy(m_huff_bits[0+1], s_dc_chroma_bits, 17); memcpy(m_huff_val[0+1], s_dc_chroma_val, DC_CHROMA_CODES);
-            memcpy(m_huff_bits[2+1], s_ac_chroma_bits, 17); memcpy(m_huff_val[2+1], s_ac_chroma_val, AC_CHROMA_CODES);
+            huff_tables *h = &m_std_huff;
+            memcpy(h->bits[0+0], s_dc_lum_bits, 17);    memcpy(h->val[0+0], s_dc_lum_val, DC_LUM_CODES);
+            memcpy(h->bits[2+0], s_ac_lum_bits, 17);    memcpy(h->val[2+0], s_ac_lum_val, AC_LUM_CODES);
+            memcpy(h->bits[0+1], s_dc_chroma_bits, 17); memcpy(h->val[0+1], s_dc_chroma_val, DC_CHROMA_CODES);
+            memcpy(h->bits[2+1], s_ac_chroma_bits, 17); memcpy(h->val[2+1], s_ac_chroma_val, AC_CHROMA_CODES);
+
+            for (int i = 0; i < 4; i++)
+                compute_huffman_table(h->codes[i], h->code_sizes[i], h->bits[i], h->val[i]);
+        }
+        m_huff = &m_std_huff;
+        m_pass_num = 2;
 
-            compute_huffman_table(&m_huff_codes[0+0][0], &m_huff_code_sizes[0+0][0], m_huff_bits[0+0], m_huff_val[0+0]);
-            compute_huffman_table(&m_huff_codes[2+0][0], &m_huff_code_sizes[2+0][0], m_huff_bits[2+0], m_huff_val[2+0]);
-            compute_huffman_table(&m_huff_codes[0+1][0], &m_huff_code_sizes[0+1][0], m_huff_bits[0+1], m_huff_val[0+1]);
-            compute_huffman_table(&m_huff_codes[2+1][0], &m_huff_code_sizes[2+1][0], m_huff_bits[2+1], m_huff_val[2+1]);
+        if (m_params.m_two_pass_flush) {
+            const int blocks = m_mcus_per_row * (m_image_y_mcu / m_mcu_y) * ((m_num_components == 1) ? 1 : (m_mcu_x * m_mcu_y / 64) + 2);
+            m_opt_huff = static_cast<huff_tables*>(jpge_malloc(sizeof(huff_tables)));
+            m_huff_stats = static_cast<huff_stats*>(jpge_malloc(sizeof(huff_stats)));
+            if (!m_opt_huff || !m_huff_stats) {
+                return false;
+            }
+            memset(m_huff_stats->count, 0, sizeof(m_huff_stats->count));
+            // At most 64 symbols of up to 19 bits per block, but never more than the buffer allows.
+            // Without the buffer the scanlines are fed again.
+            m_symbols_size = JPGE_MIN(m_params.m_two_pass_buffer / 4, (uint)blocks * 64 * 19 / 32 + 1);
+            m_symbols = static_cast<uint32*>(jpge_malloc_large(m_symbols_size * sizeof(uint32)));
+            if (!m_symbols) {
+                m_symbols_size = 0;
+            }
+            m_symbols_len = 0;
+            m_symbol_buffer = 0;
+            m_symbol_bits = 0;
+            m_pass_num = 1;
         }
 
-        m_out_buf_left = JPGE_OUT_BUF_SIZE;
-        m_pOut_buf = m_out_buf;
+        m_out_buf_size = m_out_buf_left = 0;
+        m_out_window = false;
+        flush_output_buffer();
         m_bit_buffer = 0;
         m_bits_in = 0;
         m_mcu_y_ofs = 0;
-        m_pass_num = 2;
+        m_mcu_block = 0;
         memset(m_last_dc_val, 0, 3 * sizeof(m_last_dc_val[0]));
 
-        // Emit all markers at beginning of image file.
-        emit_marker(M_SOI);
-        emit_jfif_app0();
-        emit_dqt();
-        emit_sof();
-        emit_dhts();
-        emit_sos();
+        // Stripes further down the image only carry entropy coded data, two pass encoders emit the markers
+        // once they have their tables.
+        if (m_mcu_row == 0 && m_pass_num == 2) {
+            emit_markers();
+        }
 
         return m_all_stream_writes_succeeded;
     }
@@ -660,7 +1241,16 @@ namespace jpge {
     bool jpeg_encoder::process_end_of_image()
     {
         if (m_mcu_y_ofs) {
-            if (m_mcu_y_ofs < 16) { // check here just to shut up static analysis
+            if (m_src_layout != SRC_YCC) {
+                const int chroma_shift = (m_src_layout == SRC_YUV420) ? 1 : 0;
+                const int chroma_y_ofs = m_mcu_y_ofs >> chroma_shift;
+                for (int i = m_mcu_y_ofs; i < m_mcu_y; i++) {
+                    memcpy(m_mcu_lines[i], m_mcu_lines[m_mcu_y_ofs - 1], m_image_x_mcu);
+                }
+                for (int i = chroma_y_ofs; i < (m_mcu_y >> chroma_shift); i++) {
+                    memcpy(m_mcu_lines[i] + m_image_x_mcu, m_mcu_lines[chroma_y_ofs - 1] + m_image_x_mcu, m_image_x_mcu);
+                }
+            } else if (m_mcu_y_ofs < 16) { // check here just to shut up static analysis
                 for (int i = m_mcu_y_ofs; i < m_mcu_y; i++) {
                     memcpy(m_mcu_lines[i], m_mcu_lines[m_mcu_y_ofs - 1], m_image_bpl_mcu);
                 }
@@ -668,19 +1258,85 @@ namespace jpge {
             process_mcu_row();
         }
 
-        put_bits(0x7F, 7);
-        emit_marker(M_EOI);
+        if (m_pass_num == 1) {
+            return terminate_pass_one();
+        }
+
+        flush_bits();
+        if (m_last_stripe) {
+            emit_marker(M_EOI);
+        }
         flush_output_buffer();
-        m_all_stream_writes_succeeded = m_all_stream_writes_succeeded && m_pStream->put_buf(NULL, 0);
+        if (m_last_stripe) {
+            m_all_stream_writes_succeeded = m_all_stream_writes_succeeded && m_pStream->put_buf(NULL, 0);
+        }
         m_pass_num++; // purposely bump up m_pass_num, for debugging
         return true;
     }
 
+    // Build the Huffman tables of the image and start the second pass: code the kept symbols with them
+    // and finish, or wait for the scanlines again if the symbols did not fit.
+    bool jpeg_encoder::terminate_pass_one()
+    {
+        optimize_huffman_table(0+0, DC_LUM_CODES);
+        optimize_huffman_table(2+0, AC_LUM_CODES);
+        if (m_num_components > 1)
+        {
+            optimize_huffman_table(0+1, DC_CHROMA_CODES);
+            optimize_huffman_table(2+1, AC_CHROMA_CODES);
+        }
+        for (int i = 0; i < 4; i += (m_num_components > 1) ? 1 : 2)
+            compute_huffman_table(m_opt_huff->codes[i], m_opt_huff->code_sizes[i], m_opt_huff->bits[i], m_opt_huff->val[i]);
+        jpge_free(m_huff_stats);
+        m_huff_stats = NULL;
+
+        if (m_symbol_bits) {
+            // the last, partly filled word
+            if (m_symbols_len < m_symbols_size) {
+                m_symbols[m_symbols_len] = uint32(m_symbol_buffer >> 32);
+            }
+            m_symbols_len++;
+        }
+        m_huff = m_opt_huff;
+        m_pass_num = 2;
+        m_mcu_row = 0;
+        m_mcu_y_ofs = 0;
+        memset(m_last_dc_val, 0, 3 * sizeof(m_last_dc_val[0]));
+        emit_markers();
+
+        if (m_symbols_len > m_symbols_size) {
+            jpge_free(m_symbols);
+            m_symbols = NULL;
+            return m_all_stream_writes_succeeded;
+        }
+#if JPGE_PROFILE
+        esp_cpu_cycle_count_t start = esp_cpu_get_cycle_count();
+        code_symbols();
+        jpge_entropy_cycles += (esp_cpu_cycle_count_t)(esp_cpu_get_cycle_count() - start);
+#else
+        code_symbols();
+#endif
+        jpge_free(m_symbols);
+        m_symbols = NULL;
+        return process_end_of_image();
+    }
+
+    uint jpeg_encoder::get_total_passes() const
+    {
+        return (m_params.m_two_pass_flush && (m_pass_num == 1 || m_symbols_len > m_symbols_size)) ? 2 : 1;
+    }
+
     void jpeg_encoder::clear()
     {
         m_mcu_lines[0] = NULL;
+        m_src_layout = SRC_YCC;
         m_pass_num = 0;
         m_all_stream_writes_succeeded = true;
+        m_quant = NULL;
+        m_opt_huff = NULL;
+        m_huff_stats = NULL;
+        m_symbols = NULL;
+        m_symbols_len = m_symbols_size = m_symbols_pos = 0;
     }
 
     jpeg_encoder::jpeg_encoder()
@@ -694,17 +1350,42 @@ namespace jpge {
     }
 
     bool jpeg_encoder::init(output_stream *pStream, int width, int height, int src_channels, const params &comp_params)
+    {
+        return init_stripe(pStream, width, height, src_channels, comp_params, 0, true);
+    }
+
+    bool jpeg_encoder::init_stripe(output_stream *pStream, int width, int height, int src_channels, const params &comp_params, int first_mcu_row, bool last_stripe)
     {
         deinit();
         if (((!pStream) || (width < 1) || (height < 1)) || ((src_channels != 1) && (src_channels != 3) && (src_channels != 4)) || (!comp_params.check())) return false;
+        if ((first_mcu_row < 0) || (first_mcu_row && (!comp_params.m_restart_rows || (first_mcu_row % comp_params.m_restart_rows)))) return false;
+        if (comp_params.m_two_pass_flush && (first_mcu_row || !last_stripe)) return false;
         m_pStream = pStream;
         m_params = comp_params;
+        m_mcu_row = first_mcu_row;
+        m_last_stripe = last_stripe;
         return jpg_open(width, height, src_channels);
     }
 
+    bool jpeg_encoder::init_coefficients(output_stream *pStream, int width, int height, const params &comp_params)
+    {
+        deinit();
+        if ((!pStream) || (width < 1) || (height < 1) || (!comp_params.check()) || (!comp_params.m_quant_tables) || comp_params.m_two_pass_flush) return false;
+        m_pStream = pStream;
+        m_params = comp_params;
+        m_mcu_row = 0;
+        m_last_stripe = true;
+        m_src_layout = SRC_COEF;
+        return jpg_open(width, height, (comp_params.m_subsampling == Y_ONLY) ? 1 : 3);
+    }
+
     void jpeg_encoder::deinit()
     {
         jpge_free(m_mcu_lines[0]);
+        jpge_free(m_quant);
+        jpge_free(m_opt_huff);
+        jpge_free(m_huff_stats);
+        jpge_free(m_symbols);
         clear();
     }
 
@@ -719,10 +1400,71 @@ namespace jpge {
                     return false;
                 }
             } else {
+                if (!begin_src_layout(SRC_YCC)) {
+                    return false;
+                }
                 load_mcu(pScanline);
             }
         }
         return m_all_stream_writes_succeeded;
     }
 
+    bool jpeg_encoder::process_scanlines_yuv420(const void* pY0, const void* pY1, const void* pCb, const void* pCr, int chroma_step)
+    {
+        if ((m_pass_num < 1) || (m_pass_num > 2)) {
+            return false;
+        }
+        if ((m_params.m_subsampling != H2V2) || (m_image_bpp != 3) || (chroma_step < 1)) {
+            return false;
+        }
+        if (!pY0 || !pY1 || !pCb || !pCr) {
+            return false;
+        }
+        if (!begin_src_layout(SRC_YUV420)) {
+            return false;
+        }
+        if (m_all_stream_writes_succeeded) {
+            load_mcu_yuv420(static_cast<const uint8*>(pY0), static_cast<const uint8*>(pY1),
+                            static_cast<const uint8*>(pCb), static_cast<const uint8*>(pCr), chroma_step);
+        }
+        return m_all_stream_writes_succeeded;
+    }
+
+    bool jpeg_encoder::process_scanline_yuyv(const void* pScanline)
+    {
+        if ((m_pass_num < 1) || (m_pass_num > 2)) {
+            return false;
+        }
+        if (((m_params.m_subsampling != H2V1) && (m_params.m_subsampling != H2V2)) || (m_image_bpp != 3) || (m_image_x & 1)) {
+            return false;
+        }
+        if (!pScanline || !begin_src_layout(SRC_YUV422)) {
+            return false;
+        }
+        if (m_all_stream_writes_succeeded) {
+            load_mcu_yuyv(static_cast<const uint8*>(pScanline));
+        }
+        return m_all_stream_writes_succeeded;
+    }
+
+    bool jpeg_encoder::process_coefficients(const int16* pCoefficients)
+    {
+        if ((m_pass_num != 2) || (m_src_layout != SRC_COEF) || !pCoefficients) {
+            return false;
+        }
+        if (m_all_stream_writes_succeeded) {
+            code_coefficient_block(pCoefficients);
+        }
+        return m_all_stream_writes_succeeded;
+    }
+
+    // The source layout may only change at MCU row boundaries, encoders fed with coefficients keep theirs
+    bool jpeg_encoder::begin_src_layout(src_layout_t layout)
+    {
+        if (m_mcu_y_ofs == 0 && m_src_layout != SRC_COEF) {
+            m_src_layout = layout;
+        }
+        return m_src_layout == layout;
+    }
+
 } // namespace jpge
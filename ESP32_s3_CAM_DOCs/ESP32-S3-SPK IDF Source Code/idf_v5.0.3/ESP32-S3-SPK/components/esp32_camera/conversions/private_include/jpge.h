@@ -4,6 +4,8 @@
 #ifndef JPEG_ENCODER_H
 #define JPEG_ENCODER_H
 
+#include <stddef.h>
+
 namespace jpge
 {
     typedef unsigned char  uint8;
@@ -12,13 +14,14 @@ namespace jpge
     typedef unsigned short uint16;
     typedef unsigned int   uint32;
     typedef unsigned int   uint;
+    typedef unsigned long long uint64;
 
     // JPEG chroma subsampling factors. Y_ONLY (grayscale images) and H2V2 (color images) are the most common.
     enum subsampling_t { Y_ONLY = 0, H1V1 = 1, H2V1 = 2, H2V2 = 3 };
 
     // JPEG compression parameters structure.
     struct params {
-            inline params() : m_quality(85), m_subsampling(H2V2) { }
+            inline params() : m_quality(85), m_subsampling(H2V2), m_restart_rows(0), m_two_pass_flush(false), m_two_pass_buffer(0), m_quant_tables(NULL) { }
 
             inline bool check() const {
                 if ((m_quality < 1) || (m_quality > 100)) {
@@ -27,6 +30,14 @@ namespace jpge
                 if ((uint)m_subsampling > (uint)H2V2) {
                     return false;
                 }
+                if (m_restart_rows < 0) {
+                    return false;
+                }
+                for (int i = 0; m_quant_tables && i < 128; i++) {
+                    if (!m_quant_tables[i]) {
+                        return false;
+                    }
+                }
                 return true;
             }
 
@@ -39,15 +50,50 @@ namespace jpge
             // 2 = H2V1 subsampling (YCbCr 2x1x1, 4 blocks per MCU)
             // 3 = H2V2 subsampling (YCbCr 4x1x1, 6 blocks per MCU-- very common)
             subsampling_t m_subsampling;
+
+            // Restart interval in MCU rows, 0 disables restart markers.
+            // Every interval starts byte aligned with a RSTn marker and fresh DC predictions,
+            // so stripes made of whole intervals can be entropy coded independently.
+            int m_restart_rows;
+
+            // Two pass compression: the first pass only gathers the symbol statistics of the image, the second
+            // codes it with Huffman tables built from them. Smaller files for the time of the first pass.
+            // Needs the whole image in one encoder, stripes are not supported.
+            bool m_two_pass_flush;
+
+            // Bytes the first pass may keep its symbols in, about 1.5 per symbol. When they all fit, the second pass
+            // codes them from there, else the scanlines are fed to the encoder again (see get_total_passes()).
+            uint m_two_pass_buffer;
+
+            // Quantization tables to use instead of the ones of m_quality: 64 luma then 64 chroma values of 1-255,
+            // in zig-zag order as the DQT segment holds them. NULL for the tables of m_quality.
+            const uint8 *m_quant_tables;
+    };
+
+    // The quantization tables jpeg_encoder uses at quality, in the layout of params::m_quant_tables.
+    void get_quant_tables(int quality, uint8 *pTables);
+
+    // Canonical Huffman codes of the DC luma, DC chroma, AC luma and AC chroma tables, and their DHT form.
+    struct huff_tables {
+        uint codes[4][256];
+        uint8 code_sizes[4][256];
+        uint8 bits[4][17];
+        uint8 val[4][256];
     };
     
     // Output stream abstract class - used by the jpeg_encoder class to write to the output stream.
     // put_buf() is generally called with len==JPGE_OUT_BUF_SIZE bytes, but for headers it'll be called with smaller amounts.
+    // Streams that keep the output in memory can also hand out a window of it, which the encoder fills directly
+    // and passes back with commit_window() instead of copying its own buffer with put_buf().
     class output_stream {
         public:
             virtual ~output_stream() { };
             virtual bool put_buf(const void* Pbuf, int len) = 0;
             virtual uint get_size() const = 0;
+            // Where the next bytes of the stream go and how many fit there, NULL if the stream has no such memory.
+            virtual uint8* get_window(uint &len) { len = 0; return NULL; }
+            // Adds the first len bytes of the window to the stream.
+            virtual bool commit_window(uint len) { return false; }
     };
     
     // Lower level jpeg_encoder class - useful if more control is needed than the above helper functions.
@@ -64,12 +110,49 @@ namespace jpge
             // Returns false on out of memory or if a stream write fails.
             bool init(output_stream *pStream, int width, int height, int src_channels, const params &comp_params = params());
 
+            // Initializes the compressor for a horizontal stripe of the image starting at MCU row first_mcu_row,
+            // which must be a multiple of comp_params.m_restart_rows. Only the stripe at row 0 emits the headers
+            // and only the last stripe emits EOI, so the outputs of all stripes concatenated in order form one JPEG.
+            // Feed the stripe's scanlines to process_scanline() and finish it with NULL as usual.
+            bool init_stripe(output_stream *pStream, int width, int height, int src_channels, const params &comp_params, int first_mcu_row, bool last_stripe);
+
+            // Initializes the compressor for quantized DCT coefficients instead of scanlines, see process_coefficients().
+            // comp_params.m_quant_tables are the tables they are quantized with. Two pass compression is not supported.
+            bool init_coefficients(output_stream *pStream, int width, int height, const params &comp_params);
+
             // Call this method with each source scanline.
             // width * src_channels bytes per scanline is expected (RGB or Y format).
             // You must call with NULL after all scanlines are processed to finish compression.
             // Returns false on out of memory or if a stream write fails.
             bool process_scanline(const void* pScanline);
 
+            // Call this method instead of process_scanline() with each pair of scanlines of 4:2:0 YCbCr source data,
+            // for H2V2 encoders with 3 channels. The samples go straight into the MCUs, without color conversion or chroma downsampling.
+            // pY0, pY1 - width luma samples of two consecutive scanlines.
+            // pCb, pCr - (width + 1) / 2 chroma samples each, shared by both scanlines and chroma_step bytes apart:
+            //            1 for planar (I420) data, 2 for semi-planar (NV12/NV21) data.
+            // The scanline methods may only be mixed at MCU row boundaries. Finish with process_scanline(NULL).
+            // Returns false on out of memory, if a stream write fails or if the encoder is not H2V2.
+            bool process_scanlines_yuv420(const void* pY0, const void* pY1, const void* pCb, const void* pCr, int chroma_step = 1);
+
+            // Call this method instead of process_scanline() with each scanline of YUYV (4:2:2 YCbCr) source data,
+            // width * 2 bytes ordered Y0 Cb Y1 Cr, for H2V1 or H2V2 encoders with 3 channels and an even width.
+            // The samples go straight into the MCUs, H2V2 only averages the chroma of line pairs.
+            // Finish with process_scanline(NULL).
+            bool process_scanline_yuyv(const void* pScanline);
+
+            // Call this method instead of process_scanline() with each block of an encoder made by init_coefficients():
+            // its 64 quantized coefficients in zig-zag order, the DC one as its value and not as a difference.
+            // The blocks come in the order of the MCUs, the luma blocks left to right and top to bottom, then Cb and Cr,
+            // as process_mcu_row() codes them. Nothing is transformed, the coefficients are only entropy coded.
+            // Finish with process_scanline(NULL).
+            bool process_coefficients(const int16* pCoefficients);
+
+            // How many times all scanlines are fed to the encoder, each time finished with process_scanline(NULL).
+            // Two pass encoders return 2 until their first pass is finished, and 1 from then on if the symbols
+            // of the first pass fit into m_two_pass_buffer and the image was coded from them.
+            uint get_total_passes() const;
+
             // Deinitializes the compressor, freeing any allocated memory. May be called at any time.
             void deinit();
 
@@ -78,7 +161,12 @@ namespace jpge
             jpeg_encoder &operator =(const jpeg_encoder &);
 
             typedef int32 sample_array_t;
-            enum { JPGE_OUT_BUF_SIZE = 512 };
+            // How the MCU lines hold the source: interleaved YCbCr, or Y, Cb and Cr planes with one chroma line per two or per one luma line.
+            // Encoders fed with coefficients have no MCU lines.
+            enum src_layout_t { SRC_YCC = 0, SRC_YUV420, SRC_YUV422, SRC_COEF };
+            enum { JPGE_OUT_BUF_SIZE = 512, JPGE_MIN_WINDOW = 64 };
+            struct quant_tables;
+            struct huff_stats;
 
             output_stream *m_pStream;
             params m_params;
@@ -89,24 +177,40 @@ namespace jpge
             int m_image_bpl_xlt, m_image_bpl_mcu;
             int m_mcus_per_row;
             int m_mcu_x, m_mcu_y;
+            int m_mcu_row;
+            bool m_last_stripe;
+            src_layout_t m_src_layout;
             uint8 *m_mcu_lines[16];
             uint8 m_mcu_y_ofs;
+            int m_mcu_block;                // next block of the MCU row, coefficient input only
             sample_array_t m_sample_array[64];
             int16 m_coefficient_array[64];
 
+            quant_tables *m_quant;          // of this encoder, see params::m_quant_tables
             int m_last_dc_val[3];
             uint8 m_out_buf[JPGE_OUT_BUF_SIZE];
             uint8 *m_pOut_buf;
-            uint m_out_buf_left;
-            uint32 m_bit_buffer;
+            uint m_out_buf_size, m_out_buf_left;
+            bool m_out_window;
+            uint64 m_bit_buffer;
             uint m_bits_in;
             uint8 m_pass_num;
             bool m_all_stream_writes_succeeded;
 
+            huff_tables *m_huff;            // the standard tables, or m_opt_huff in two pass mode
+            huff_tables *m_opt_huff;
+            huff_stats *m_huff_stats;       // symbol counts of the first pass
+            uint32 *m_symbols;              // symbols of the first pass with their magnitude bits
+            uint m_symbols_len, m_symbols_size, m_symbols_pos;  // 32-bit words
+            uint64 m_symbol_buffer;
+            uint m_symbol_bits;
+
             bool jpg_open(int p_x_res, int p_y_res, int src_channels);
 
             void flush_output_buffer();
             void put_bits(uint bits, uint len);
+            void emit_bits_word();
+            void flush_bits();
 
             void emit_byte(uint8 i);
             void emit_word(uint i);
@@ -118,21 +222,37 @@ namespace jpge
             void emit_dht(uint8 *bits, uint8 *val, int index, bool ac_flag);
             void emit_dhts();
             void emit_sos();
+            void emit_dri();
+            void emit_restart();
+            void emit_markers();
 
-            void compute_quant_table(int32 *dst, const int16 *src);
+            void compute_quant_recip(int table);
             void load_quantized_coefficients(int component_num);
 
             void load_block_8_8_grey(int x);
             void load_block_8_8(int x, int y, int c);
             void load_block_16_8(int x, int c);
             void load_block_16_8_8(int x, int c);
+            void load_block_8_8_plane(int y, int x);
+            void load_block_8_16_plane(int x);
 
+            void store_symbol(uint sym, uint bits, uint nbits);
+            uint code_stored_symbol(int table);
+            void code_coefficients_pass_one(int component_num);
             void code_coefficients_pass_two(int component_num);
+            void code_symbols();
+            void code_coefficients(int component_num);
             void code_block(int component_num);
+            void code_coefficient_block(const int16 *pSrc);
+            void optimize_huffman_table(int table_num, int table_len);
 
             void process_mcu_row();
             bool process_end_of_image();
+            bool terminate_pass_one();
             void load_mcu(const void* src);
+            void load_mcu_yuv420(const uint8 *pY0, const uint8 *pY1, const uint8 *pCb, const uint8 *pCr, int chroma_step);
+            void load_mcu_yuyv(const uint8 *pSrc);
+            bool begin_src_layout(src_layout_t layout);
             void clear();
             void init();
     };
@@ -18,10 +18,28 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 
 void yuv2rgb(uint8_t y, uint8_t u, uint8_t v, uint8_t *r, uint8_t *g, uint8_t *b);
 
+/*
+ * Line kernels, pixels may be any count, YUYV converts whole pixel pairs only.
+ * Their output is identical to yuv2rgb() and the per-pixel loops they replace.
+ */
+
+// YUYV to RGB888 in B, G, R byte order, as fmt2rgb888() writes it
+void yuv422_to_rgb888(const uint8_t *src, uint8_t *dst, size_t pixels);
+
+// YUYV to RGB565 in little endian byte order, as jpg2rgb565() writes it
+void yuv422_to_rgb565(const uint8_t *src, uint8_t *dst, size_t pixels);
+
+// RGB565 as the camera sends it, big endian, to RGB888 in B, G, R byte order
+void rgb565_to_rgb888(const uint8_t *src, uint8_t *dst, size_t pixels);
+
+// Swap the bytes of each RGB565 pixel, between camera and CPU byte order. src may equal dst.
+void rgb565_swap(const uint8_t *src, uint8_t *dst, size_t pixels);
+
 #ifdef __cplusplus
 }
 #endif
@@ -21,6 +21,13 @@
 #include "jpge.h"
 #include "yuv.h"
 
+#if CONFIG_CAMERA_JPEG_ENCODE_STRIPES > 1
+#include <new>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#endif
+
 #if defined(ARDUINO_ARCH_ESP32) && defined(CONFIG_ARDUHAL_ESP_LOG)
 #include "esp32-hal-log.h"
 #define TAG ""
@@ -88,7 +95,329 @@ static IRAM_ATTR void convert_line_format(uint8_t * src, pixformat_t format, uin
     }
 }
 
-bool convert_image(uint8_t *src, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, jpge::output_stream *dst_stream)
+/*
+ * yuv2rgb() reads sensor YUV as limited range, Y 16-235 and Cb/Cr 16-240, while JPEG YCbCr is full range.
+ * YUYV lines are only stretched to full range through these tables on their way to jpge.
+ */
+static uint8_t s_full_range_y[256], s_full_range_c[256];
+static bool s_full_range_ready;
+
+static void full_range_init()
+{
+    if (s_full_range_ready) {
+        return;
+    }
+    for (int i = 0; i < 256; i++) {
+        int y = ((i - 16) * 255 * 2 + 219) / (2 * 219);
+        int c = (i - 128) * 255;
+        c = 128 + ((c < 0) ? -((112 - c) / 224) : (c + 112) / 224);
+        s_full_range_y[i] = (y < 0) ? 0 : (y > 255) ? 255 : y;
+        s_full_range_c[i] = (c < 0) ? 0 : (c > 255) ? 255 : c;
+    }
+    s_full_range_ready = true;
+}
+
+static IRAM_ATTR void convert_line_yuyv(const uint8_t *src, uint8_t *dst, size_t width, size_t line)
+{
+    size_t l = width * 2;
+    src += l * line;
+    for (size_t i = 0; i < l; i += 2) {
+        dst[i] = s_full_range_y[src[i]];
+        dst[i+1] = s_full_range_c[src[i+1]];
+    }
+}
+
+/*
+ * The LCD_CAM converter writes YUV420 in limited range unless it is set to full range,
+ * such lines are stretched through the tables above as YUYV ones are.
+ */
+#ifndef JPG_YUV420_FULL_RANGE
+#if CONFIG_CAMERA_CONVERTER_ENABLED && !CONFIG_LCD_CAM_CONV_FULL_RANGE_ENABLED
+#define JPG_YUV420_FULL_RANGE 0
+#else
+#define JPG_YUV420_FULL_RANGE 1
+#endif
+#endif
+
+/*
+ * PIXFORMAT_YUV420 as the LCD_CAM converter writes it: 1.5 bytes per pixel on every line,
+ * Y0 U Y1 on even lines and Y0 V Y1 on odd lines, one chroma sample per two pixels.
+ * The luma of the line pair is gathered into line, full range chroma goes to jpge in place,
+ * limited range chroma is stretched into line behind the luma.
+ */
+static IRAM_ATTR bool encode_yuv420_lines(jpge::jpeg_encoder *encoder, const uint8_t *src, uint8_t *line, size_t width, size_t row)
+{
+    const size_t stride = width * 3 / 2;
+    const uint8_t *l0 = src + stride * row, *l1 = l0 + stride;
+    uint8_t *y0 = line, *y1 = line + width;
+#if JPG_YUV420_FULL_RANGE
+    for (size_t i = 0, o = 0; o < width; i += 3, o += 2) {
+        y0[o] = l0[i];
+        y0[o+1] = l0[i+2];
+        y1[o] = l1[i];
+        y1[o+1] = l1[i+2];
+    }
+    return encoder->process_scanlines_yuv420(y0, y1, l0 + 1, l1 + 1, 3);
+#else
+    uint8_t *u = y1 + width, *v = u + width / 2;
+    for (size_t i = 0, o = 0; o < width; i += 3, o += 2) {
+        y0[o] = s_full_range_y[l0[i]];
+        y0[o+1] = s_full_range_y[l0[i+2]];
+        y1[o] = s_full_range_y[l1[i]];
+        y1[o+1] = s_full_range_y[l1[i+2]];
+        u[o/2] = s_full_range_c[l0[i+1]];
+        v[o/2] = s_full_range_c[l1[i+1]];
+    }
+    return encoder->process_scanlines_yuv420(y0, y1, u, v, 1);
+#endif
+}
+
+// Feed lines [first_line, last_line) of src to the encoder, line holds width * num_channels bytes
+static bool encode_lines(jpge::jpeg_encoder *encoder, uint8_t *src, pixformat_t format, uint8_t *line, uint16_t width, int num_channels, int first_line, int last_line)
+{
+    if (format == PIXFORMAT_YUV420) {
+        for (int i = first_line; i < last_line; i += 2) {
+            if (!encode_yuv420_lines(encoder, src, line, width, i)) {
+                ESP_LOGE(TAG, "JPG process line %u failed", i);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // YUYV goes to jpge as is, odd widths have no complete last pixel pair and take the RGB path
+    if (format == PIXFORMAT_YUV422 && !(width & 1)) {
+        for (int i = first_line; i < last_line; i++) {
+            convert_line_yuyv(src, line, width, i);
+            if (!encoder->process_scanline_yuyv(line)) {
+                ESP_LOGE(TAG, "JPG process line %u failed", i);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    for (int i = first_line; i < last_line; i++) {
+        convert_line_format(src, format, line, width, num_channels, i);
+        if (!encoder->process_scanline(line)) {
+            ESP_LOGE(TAG, "JPG process line %u failed", i);
+            return false;
+        }
+    }
+    return true;
+}
+
+#if CONFIG_CAMERA_JPEG_ENCODE_STRIPES > 1
+#define JPG_STRIPE_TASK_STACK 3072
+
+class buffer_stream : public jpge::output_stream {
+protected:
+    uint8_t *out_buf;
+    size_t max_len, index;
+
+public:
+    buffer_stream() : out_buf(NULL), max_len(0), index(0) { }
+
+    virtual ~buffer_stream()
+    {
+        free(out_buf);
+    }
+
+    bool reserve(size_t len)
+    {
+        if (len <= max_len) {
+            return true;
+        }
+        uint8_t *buf = (uint8_t *)_malloc(len);
+        if (!buf) {
+            return false;
+        }
+        if (index) {
+            memcpy(buf, out_buf, index);
+        }
+        free(out_buf);
+        out_buf = buf;
+        max_len = len;
+        return true;
+    }
+
+    virtual bool put_buf(const void* pBuf, int len)
+    {
+        if (!pBuf || !len) {
+            return true;
+        }
+        if (index + len > max_len && !reserve((index + len) * 2)) {
+            ESP_LOGE(TAG, "JPG stripe buffer malloc failed");
+            return false;
+        }
+        memcpy(out_buf + index, pBuf, len);
+        index += len;
+        return true;
+    }
+
+    virtual jpge::uint get_size() const
+    {
+        return index;
+    }
+
+    virtual uint8_t *get_window(jpge::uint &len)
+    {
+        if (max_len - index < 1024 && !reserve((index + 1024) * 2)) {
+            len = 0;
+            return NULL;
+        }
+        len = max_len - index;
+        return out_buf + index;
+    }
+
+    virtual bool commit_window(jpge::uint len)
+    {
+        index += len;
+        return true;
+    }
+
+    const uint8_t *get_data() const
+    {
+        return out_buf;
+    }
+};
+
+typedef struct {
+    jpge::jpeg_encoder *encoder;
+    uint8_t *src;
+    pixformat_t format;
+    uint16_t width;
+    int num_channels;
+    int first_line;
+    int last_line;
+    bool result;
+    SemaphoreHandle_t done;
+} jpg_stripe_t;
+
+static bool encode_stripe(jpg_stripe_t *stripe)
+{
+    uint8_t* line = (uint8_t*)_malloc(stripe->width * stripe->num_channels);
+    if(!line) {
+        ESP_LOGE(TAG, "Scan line malloc failed");
+        return false;
+    }
+
+    bool result = encode_lines(stripe->encoder, stripe->src, stripe->format, line, stripe->width, stripe->num_channels, stripe->first_line, stripe->last_line);
+    free(line);
+    if (!result) {
+        return false;
+    }
+
+    if (!stripe->encoder->process_scanline(NULL)) {
+        ESP_LOGE(TAG, "JPG stripe finish failed");
+        return false;
+    }
+    return true;
+}
+
+static void encode_stripe_task(void *arg)
+{
+    jpg_stripe_t *stripe = (jpg_stripe_t *)arg;
+    stripe->result = encode_stripe(stripe);
+    xSemaphoreGive(stripe->done);
+    vTaskDelete(NULL);
+}
+
+/*
+ * Split the image into horizontal stripes of whole MCU rows and encode them in parallel.
+ * Restart markers after every MCU row make the stripes independent, stripe 0 is encoded
+ * on the calling task straight into dst_stream, the others on helper tasks into buffers
+ * that are appended in order once all stripes are done.
+ */
+static bool convert_image_striped(uint8_t *src, uint16_t width, uint16_t height, pixformat_t format, int num_channels, const jpge::params &comp_params, jpge::output_stream *dst_stream, int num_stripes)
+{
+    const int mcu_height = (comp_params.m_subsampling == jpge::H2V2) ? 16 : 8;
+    const int mcu_rows = (height + mcu_height - 1) / mcu_height;
+    jpg_stripe_t stripes[CONFIG_CAMERA_JPEG_ENCODE_STRIPES];
+    buffer_stream buffers[CONFIG_CAMERA_JPEG_ENCODE_STRIPES];
+    jpge::params params = comp_params;
+    bool result = true;
+    int i;
+
+    params.m_restart_rows = 1;
+    memset(stripes, 0, sizeof(stripes));
+
+    // Encoders are initialized here, one after the other, as jpge shares its table caches between instances
+    for (i = 0; i < num_stripes; i++) {
+        int first_row = (mcu_rows * i) / num_stripes;
+        int last_row = (mcu_rows * (i + 1)) / num_stripes;
+        jpge::output_stream *stream = (i == 0) ? dst_stream : &buffers[i];
+
+        stripes[i].src = src;
+        stripes[i].format = format;
+        stripes[i].width = width;
+        stripes[i].num_channels = num_channels;
+        stripes[i].first_line = first_row * mcu_height;
+        stripes[i].last_line = (last_row * mcu_height < height) ? last_row * mcu_height : height;
+        stripes[i].encoder = new (std::nothrow) jpge::jpeg_encoder();
+        if (!stripes[i].encoder) {
+            ESP_LOGE(TAG, "JPG encoder alloc failed");
+            result = false;
+            break;
+        }
+        if (i && !buffers[i].reserve((size_t)width * (stripes[i].last_line - stripes[i].first_line) / 4)) {
+            ESP_LOGE(TAG, "JPG stripe buffer malloc failed");
+            result = false;
+            break;
+        }
+        if (!stripes[i].encoder->init_stripe(stream, width, height, num_channels, params, first_row, i == num_stripes - 1)) {
+            ESP_LOGE(TAG, "JPG encoder init failed");
+            result = false;
+            break;
+        }
+    }
+
+    if (result) {
+        for (i = 1; i < num_stripes; i++) {
+            stripes[i].done = xSemaphoreCreateBinary();
+            if (!stripes[i].done || xTaskCreatePinnedToCore(encode_stripe_task, "jpg_stripe", JPG_STRIPE_TASK_STACK, &stripes[i], uxTaskPriorityGet(NULL),
+                                                            NULL, (xPortGetCoreID() + i) % portNUM_PROCESSORS) != pdPASS) {
+                // no helper task, encode the stripe on this task after stripe 0
+                ESP_LOGW(TAG, "JPG stripe %d task create failed", i);
+                if (stripes[i].done) {
+                    vSemaphoreDelete(stripes[i].done);
+                    stripes[i].done = NULL;
+                }
+            }
+        }
+
+        result = encode_stripe(&stripes[0]);
+
+        for (i = 1; i < num_stripes; i++) {
+            if (stripes[i].done) {
+                xSemaphoreTake(stripes[i].done, portMAX_DELAY);
+                vSemaphoreDelete(stripes[i].done);
+            } else {
+                stripes[i].result = encode_stripe(&stripes[i]);
+            }
+            result = result && stripes[i].result;
+        }
+
+        for (i = 1; result && i < num_stripes; i++) {
+            result = dst_stream->put_buf(buffers[i].get_data(), buffers[i].get_size());
+        }
+        if (result) {
+            result = dst_stream->put_buf(NULL, 0);
+        }
+    }
+
+    for (i = 0; i < num_stripes; i++) {
+        delete stripes[i].encoder;
+    }
+    return result;
+}
+#endif
+
+/*
+ * optimize builds the Huffman tables for the image: the symbols of a first pass are kept in a buffer of
+ * CONFIG_CAMERA_JPEG_OPTIMIZE_BUFFER_KB and coded with them, bigger images are encoded twice. Never striped.
+ */
+bool convert_image(uint8_t *src, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, jpge::output_stream *dst_stream, bool optimize)
 {
     int num_channels = 3;
     jpge::subsampling_t subsampling = jpge::H2V2;
@@ -96,6 +425,12 @@ bool convert_image(uint8_t *src, uint16_t width, uint16_t height, pixformat_t fo
     if(format == PIXFORMAT_GRAYSCALE) {
         num_channels = 1;
         subsampling = jpge::Y_ONLY;
+    } else if(format == PIXFORMAT_YUV420 && ((width | height) & 1)) {
+        ESP_LOGE(TAG, "YUV420 needs even width and height");
+        return false;
+    }
+    if(format == PIXFORMAT_YUV422 || (format == PIXFORMAT_YUV420 && !JPG_YUV420_FULL_RANGE)) {
+        full_range_init();
     }
 
     if(!quality) {
@@ -107,6 +442,14 @@ bool convert_image(uint8_t *src, uint16_t width, uint16_t height, pixformat_t fo
     jpge::params comp_params = jpge::params();
     comp_params.m_subsampling = subsampling;
     comp_params.m_quality = quality;
+    comp_params.m_two_pass_flush = optimize;
+    comp_params.m_two_pass_buffer = CONFIG_CAMERA_JPEG_OPTIMIZE_BUFFER_KB * 1024;
+
+#if CONFIG_CAMERA_JPEG_ENCODE_STRIPES > 1
+    if (!optimize && height >= 2 * CONFIG_CAMERA_JPEG_ENCODE_STRIPES * 16) {
+        return convert_image_striped(src, width, height, format, num_channels, comp_params, dst_stream, CONFIG_CAMERA_JPEG_ENCODE_STRIPES);
+    }
+#endif
 
     jpge::jpeg_encoder dst_image;
 
@@ -121,22 +464,17 @@ bool convert_image(uint8_t *src, uint16_t width, uint16_t height, pixformat_t fo
         return false;
     }
 
-    for (int i = 0; i < height; i++) {
-        convert_line_format(src, format, line, width, num_channels, i);
-        if (!dst_image.process_scanline(line)) {
-            ESP_LOGE(TAG, "JPG process line %u failed", i);
-            free(line);
-            return false;
+    bool result = true;
+    for (jpge::uint pass = 0; result && pass < dst_image.get_total_passes(); pass++) {
+        result = encode_lines(&dst_image, src, format, line, width, num_channels, 0, height);
+        if (result && !dst_image.process_scanline(NULL)) {
+            ESP_LOGE(TAG, "JPG image finish failed");
+            result = false;
         }
     }
     free(line);
-
-    if (!dst_image.process_scanline(NULL)) {
-        ESP_LOGE(TAG, "JPG image finish failed");
-        return false;
-    }
     dst_image.deinit();
-    return true;
+    return result;
 }
 
 class callback_stream : public jpge::output_stream {
@@ -153,7 +491,7 @@ public:
         index += ocb(oarg, index, data, len);
         return true;
     }
-    virtual size_t get_size() const
+    virtual jpge::uint get_size() const
     {
         return index;
     }
@@ -162,7 +500,7 @@ public:
 bool fmt2jpg_cb(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, jpg_out_cb cb, void * arg)
 {
     callback_stream dst_stream(cb, arg);
-    return convert_image(src, width, height, format, quality, &dst_stream);
+    return convert_image(src, width, height, format, quality, &dst_stream, false);
 }
 
 bool frame2jpg_cb(camera_fb_t * fb, uint8_t quality, jpg_out_cb cb, void * arg)
@@ -176,9 +514,10 @@ class memory_stream : public jpge::output_stream {
 protected:
     uint8_t *out_buf;
     size_t max_len, index;
+    bool overflow;
 
 public:
-    memory_stream(void *pBuf, uint buf_size) : out_buf(static_cast<uint8_t*>(pBuf)), max_len(buf_size), index(0) { }
+    memory_stream(void *pBuf, uint buf_size) : out_buf(static_cast<uint8_t*>(pBuf)), max_len(buf_size), index(0), overflow(false) { }
 
     virtual ~memory_stream() { }
 
@@ -191,6 +530,7 @@ public:
         if ((size_t)len > (max_len - index)) {
             //ESP_LOGW(TAG, "JPG output overflow: %d bytes (%d,%d,%d)", len - (max_len - index), len, index, max_len);
             len = max_len - index;
+            overflow = true;
         }
         if (len) {
             memcpy(out_buf + index, pBuf, len);
@@ -199,13 +539,31 @@ public:
         return true;
     }
 
-    virtual size_t get_size() const
+    virtual jpge::uint get_size() const
     {
         return index;
     }
+
+    virtual uint8_t *get_window(jpge::uint &len)
+    {
+        len = max_len - index;
+        return out_buf + index;
+    }
+
+    virtual bool commit_window(jpge::uint len)
+    {
+        index += len;
+        return true;
+    }
+
+    // the output did not fit and was cut off
+    bool overflowed() const
+    {
+        return overflow;
+    }
 };
 
-bool fmt2jpg(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, uint8_t ** out, size_t * out_len)
+static bool convert_image_to_buffer(uint8_t *src, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, bool optimize, uint8_t ** out, size_t * out_len)
 {
     //todo: allocate proper buffer for holding JPEG data
     //this should be enough for CIF frame size
@@ -219,7 +577,7 @@ bool fmt2jpg(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixf
     }
     memory_stream dst_stream(jpg_buf, jpg_buf_len);
 
-    if(!convert_image(src, width, height, format, quality, &dst_stream)) {
+    if(!convert_image(src, width, height, format, quality, &dst_stream, optimize)) {
         free(jpg_buf);
         return false;
     }
@@ -229,7 +587,162 @@ bool fmt2jpg(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixf
     return true;
 }
 
+bool fmt2jpg(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, uint8_t ** out, size_t * out_len)
+{
+    return convert_image_to_buffer(src, width, height, format, quality, false, out, out_len);
+}
+
 bool frame2jpg(camera_fb_t * fb, uint8_t quality, uint8_t ** out, size_t * out_len)
 {
     return fmt2jpg(fb->buf, fb->len, fb->width, fb->height, fb->format, quality, out, out_len);
 }
+
+bool fmt2jpg_optimized(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, uint8_t ** out, size_t * out_len)
+{
+    return convert_image_to_buffer(src, width, height, format, quality, true, out, out_len);
+}
+
+bool frame2jpg_optimized(camera_fb_t * fb, uint8_t quality, uint8_t ** out, size_t * out_len)
+{
+    return fmt2jpg_optimized(fb->buf, fb->len, fb->width, fb->height, fb->format, quality, out, out_len);
+}
+
+/*
+ * Requantization: the coefficients of each block are entropy decoded, divided down to the quantization tables
+ * of quality and entropy coded again. Nothing is transformed and only one block is held at a time.
+ */
+typedef struct {
+    const uint8_t *src;
+    jpge::output_stream *dst_stream;
+    jpge::jpeg_encoder *encoder;
+    uint8_t quality;
+    uint8_t quant[128];         // of the output, luma then chroma
+    bool result;
+} jpg_requant_t;
+
+static size_t requant_read(void * arg, size_t index, uint8_t *buf, size_t len)
+{
+    jpg_requant_t *requant = (jpg_requant_t *)arg;
+    if (buf) {
+        memcpy(buf, requant->src + index, len);
+    }
+    return len;
+}
+
+static bool requant_start(jpg_requant_t *requant, const jpg_coef_info_t *info)
+{
+    jpge::params comp_params = jpge::params();
+    if (info->mcu_w == 1 && info->mcu_h == 1) {
+        comp_params.m_subsampling = jpge::H1V1;
+    } else if (info->mcu_w == 2 && info->mcu_h == 1) {
+        comp_params.m_subsampling = jpge::H2V1;
+    } else if (info->mcu_w == 2 && info->mcu_h == 2) {
+        comp_params.m_subsampling = jpge::H2V2;
+    } else {
+        ESP_LOGE(TAG, "JPG MCU of %ux%u blocks is not supported", info->mcu_w, info->mcu_h);
+        return false;
+    }
+
+    // Quantizers finer than the ones of the source would only code its rounding again, they are raised to them.
+    // Cb and Cr may have tables of their own in the source, the output shares one for both.
+    jpge::get_quant_tables(requant->quality, requant->quant);
+    for (int i = 0; i < 64; i++) {
+        uint16_t y = info->quant[0][i];
+        uint16_t c = info->quant[1][i] > info->quant[2][i] ? info->quant[1][i] : info->quant[2][i];
+        if (y > 255 || c > 255) {
+            ESP_LOGE(TAG, "JPG 16-bit quantization tables are not supported");
+            return false;
+        }
+        if (requant->quant[i] < y) {
+            requant->quant[i] = y;
+        }
+        if (requant->quant[64 + i] < c) {
+            requant->quant[64 + i] = c;
+        }
+    }
+    comp_params.m_quant_tables = requant->quant;
+
+    if (!requant->encoder->init_coefficients(requant->dst_stream, info->width, info->height, comp_params)) {
+        ESP_LOGE(TAG, "JPG encoder init failed");
+        return false;
+    }
+    return true;
+}
+
+static bool requant_block(void * arg, const jpg_coef_info_t *info, const int16_t *coef, uint8_t component)
+{
+    jpg_requant_t *requant = (jpg_requant_t *)arg;
+    if (!coef) {
+        return requant_start(requant, info);
+    }
+
+    // Round to nearest, symmetric around zero. Most coefficients are zero and stay zero.
+    const uint16_t *qs = info->quant[component];
+    const uint8_t *qd = requant->quant + (component ? 64 : 0);
+    int16_t block[64];
+    for (int i = 0; i < 64; i++) {
+        int c = coef[i];
+        if (c && qs[i] != qd[i]) {
+            int n = ((c < 0 ? -c : c) * qs[i] + (qd[i] >> 1)) / qd[i];
+            c = c < 0 ? -n : n;
+        }
+        block[i] = c;
+    }
+    if (!requant->encoder->process_coefficients(block)) {
+        ESP_LOGE(TAG, "JPG process block failed");
+        return false;
+    }
+    return true;
+}
+
+static bool requantize_image(const uint8_t *src, size_t src_len, uint8_t quality, jpge::output_stream *dst_stream)
+{
+    jpge::jpeg_encoder encoder;
+    jpg_requant_t requant;
+
+    requant.src = src;
+    requant.dst_stream = dst_stream;
+    requant.encoder = &encoder;
+    requant.quality = quality ? (quality > 100 ? 100 : quality) : 1;
+
+    if (esp_jpg_decode_coefficients(src_len, requant_read, requant_block, &requant) != ESP_OK) {
+        return false;
+    }
+    if (!encoder.process_scanline(NULL)) {
+        ESP_LOGE(TAG, "JPG image finish failed");
+        return false;
+    }
+    return true;
+}
+
+bool jpg2jpg_cb(const uint8_t *src, size_t src_len, uint8_t quality, jpg_out_cb cb, void * arg)
+{
+    callback_stream dst_stream(cb, arg);
+    return requantize_image(src, src_len, quality, &dst_stream);
+}
+
+bool jpg2jpg(const uint8_t *src, size_t src_len, uint8_t quality, uint8_t ** out, size_t * out_len)
+{
+    // coarser quantizers never make the image bigger, unless the source was coded with Huffman tables of its own
+    size_t jpg_buf_len = src_len + 1024;
+    uint8_t * jpg_buf = (uint8_t *)_malloc(jpg_buf_len);
+    if(jpg_buf == NULL) {
+        ESP_LOGE(TAG, "JPG buffer malloc failed");
+        return false;
+    }
+    memory_stream dst_stream(jpg_buf, jpg_buf_len);
+
+    if (!requantize_image(src, src_len, quality, &dst_stream)) {
+        free(jpg_buf);
+        return false;
+    }
+    if (dst_stream.overflowed()) {
+        ESP_LOGE(TAG, "JPG output is over %u bytes, use jpg2jpg_cb()", jpg_buf_len);
+        free(jpg_buf);
+        return false;
+    }
+
+    *out = jpg_buf;
+    *out_len = dst_stream.get_size();
+    return true;
+}
@@ -11,6 +11,7 @@
 // WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 // See the License for the specific language governing permissions and
 // limitations under the License.
+#include <string.h>
 #include "yuv.h"
 #include "esp_attr.h"
 
@@ -296,3 +297,155 @@ void IRAM_ATTR yuv2rgb(uint8_t y, uint8_t u, uint8_t v, uint8_t *r, uint8_t *g,
     *g = YUYV_CONSTRAIN(gi);
     *b = YUYV_CONSTRAIN(bi);
 }
+
+/*
+ * Line kernels. Without packed 32 bit multiplies, as on the ESP32 family, they read the table
+ * once per pixel pair instead of twice per pixel and skip the call per pixel.
+ *
+ * With them, on hosts, they compute the table instead: every column is c * (x - 16) or
+ * c * (x - 128) divided by 8192 and truncated towards zero, with
+ *   vY = 9535, vVr = 13075, vVg = -3204, vUg = -6656, vUb = 16531
+ * which gives the table's values for all 256 inputs. Blocks of 16 pixels without lookups
+ * have independent lanes, so the compiler vectorizes them.
+ */
+#if defined(__SSE4_1__) || defined(__ARM_NEON)
+#define YUV_VECTOR 1
+#else
+#define YUV_VECTOR 0
+#endif
+
+static inline uint8_t yuv_clamp(int32_t v)
+{
+    return (v < 0) ? 0 : ((v > 255) ? 255 : v);
+}
+
+#if YUV_VECTOR
+#define YUV_BLOCK 16    // pixels, 8 YUYV pixel pairs
+
+static inline int32_t yuv_mul(int32_t c, int32_t d)
+{
+    int32_t p = c * d;
+    return (p + ((p >> 31) & 8191)) >> 13;
+}
+
+// One block of YUYV to R, G and B planes
+static inline void yuv422_block(const uint8_t *src, uint8_t *r, uint8_t *g, uint8_t *b)
+{
+    int32_t y[YUV_BLOCK], rv[YUV_BLOCK], guv[YUV_BLOCK], bu[YUV_BLOCK];
+    for (int i = 0; i < YUV_BLOCK; i += 2) {
+        int32_t u = src[2 * i + 1] - 128, v = src[2 * i + 3] - 128;
+        y[i] = yuv_mul(9535, src[2 * i] - 16);
+        y[i + 1] = yuv_mul(9535, src[2 * i + 2] - 16);
+        rv[i] = rv[i + 1] = yuv_mul(13075, v);
+        guv[i] = guv[i + 1] = yuv_mul(-6656, u) + yuv_mul(-3204, v);
+        bu[i] = bu[i + 1] = yuv_mul(16531, u);
+    }
+    for (int i = 0; i < YUV_BLOCK; i++) {
+        r[i] = yuv_clamp(y[i] + rv[i]);
+        g[i] = yuv_clamp(y[i] + guv[i]);
+        b[i] = yuv_clamp(y[i] + bu[i]);
+    }
+}
+
+// Converts the next block, the last pixels of a line through a padded copy. Returns the pixels in it.
+static inline size_t yuv422_next_block(const uint8_t *src, size_t pixels, uint8_t *r, uint8_t *g, uint8_t *b)
+{
+    if (pixels >= YUV_BLOCK) {
+        yuv422_block(src, r, g, b);
+        return YUV_BLOCK;
+    }
+    uint8_t tail[YUV_BLOCK * 2] = { 0 };
+    memcpy(tail, src, pixels * 2);
+    yuv422_block(tail, r, g, b);
+    return pixels;
+}
+#else
+// The table terms of one YUYV pixel pair
+static inline void yuv422_pair(const uint8_t *src, int32_t *y0, int32_t *y1, int32_t *rv, int32_t *guv, int32_t *bu)
+{
+    const yuv_table_row *u = &yuv_table[src[1]], *v = &yuv_table[src[3]];
+    *y0 = yuv_table[src[0]].vY;
+    *y1 = yuv_table[src[2]].vY;
+    *rv = v->vVr;
+    *guv = u->vUg + v->vVg;
+    *bu = u->vUb;
+}
+#endif
+
+void IRAM_ATTR yuv422_to_rgb888(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    pixels &= ~1;
+#if YUV_VECTOR
+    uint8_t r[YUV_BLOCK], g[YUV_BLOCK], b[YUV_BLOCK];
+    while (pixels) {
+        size_t n = yuv422_next_block(src, pixels, r, g, b);
+        for (size_t i = 0; i < n; i++, dst += 3) {
+            dst[0] = b[i];
+            dst[1] = g[i];
+            dst[2] = r[i];
+        }
+        src += n * 2;
+        pixels -= n;
+    }
+#else
+    int32_t y0, y1, rv, guv, bu;
+    for (; pixels; pixels -= 2, src += 4, dst += 6) {
+        yuv422_pair(src, &y0, &y1, &rv, &guv, &bu);
+        dst[0] = yuv_clamp(y0 + bu);
+        dst[1] = yuv_clamp(y0 + guv);
+        dst[2] = yuv_clamp(y0 + rv);
+        dst[3] = yuv_clamp(y1 + bu);
+        dst[4] = yuv_clamp(y1 + guv);
+        dst[5] = yuv_clamp(y1 + rv);
+    }
+#endif
+}
+
+static inline void rgb565_put(uint8_t *dst, uint8_t r, uint8_t g, uint8_t b)
+{
+    dst[0] = ((g & 0x1C) << 3) | (b >> 3);
+    dst[1] = (r & 0xF8) | (g >> 5);
+}
+
+void IRAM_ATTR yuv422_to_rgb565(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    pixels &= ~1;
+#if YUV_VECTOR
+    uint8_t r[YUV_BLOCK], g[YUV_BLOCK], b[YUV_BLOCK];
+    while (pixels) {
+        size_t n = yuv422_next_block(src, pixels, r, g, b);
+        for (size_t i = 0; i < n; i++, dst += 2) {
+            rgb565_put(dst, r[i], g[i], b[i]);
+        }
+        src += n * 2;
+        pixels -= n;
+    }
+#else
+    int32_t y0, y1, rv, guv, bu;
+    for (; pixels; pixels -= 2, src += 4, dst += 4) {
+        yuv422_pair(src, &y0, &y1, &rv, &guv, &bu);
+        rgb565_put(dst, yuv_clamp(y0 + rv), yuv_clamp(y0 + guv), yuv_clamp(y0 + bu));
+        rgb565_put(dst + 2, yuv_clamp(y1 + rv), yuv_clamp(y1 + guv), yuv_clamp(y1 + bu));
+    }
+#endif
+}
+
+void IRAM_ATTR rgb565_to_rgb888(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    for (size_t i = 0; i < pixels; i++, src += 2, dst += 3) {
+        uint8_t hb = src[0], lb = src[1];
+        dst[0] = (lb & 0x1F) << 3;
+        dst[1] = (hb & 0x07) << 5 | (lb & 0xE0) >> 3;
+        dst[2] = hb & 0xF8;
+    }
+}
+
+void IRAM_ATTR rgb565_swap(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    // byte accesses, frame buffers and line buffers need not be 16 bit aligned
+    for (size_t i = 0; i < pixels; i++, src += 2, dst += 2) {
+        uint8_t hb = src[0];
+        dst[0] = src[1];
+        dst[1] = hb;
+    }
+}
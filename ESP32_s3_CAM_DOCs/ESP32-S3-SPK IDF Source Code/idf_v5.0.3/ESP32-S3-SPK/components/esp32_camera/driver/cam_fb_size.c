@@ -0,0 +1,97 @@
+#include "cam_fb_size.h"
+
+static size_t round_up(size_t size)
+{
+    return (size + CAM_FB_SIZE_GRANULE - 1) / CAM_FB_SIZE_GRANULE * CAM_FB_SIZE_GRANULE;
+}
+
+static size_t clamp_target(const cam_fb_size_t *s, size_t size)
+{
+    size = round_up(size);
+    if (size < s->size_min) {
+        return s->size_min;
+    }
+    if (size > s->size_limit) {
+        return s->size_limit;
+    }
+    return size;
+}
+
+static void hist_add(cam_fb_size_t *s, size_t len)
+{
+    uint32_t bucket = len / s->bucket_size;
+    if (bucket >= CAM_FB_SIZE_BUCKETS) {
+        bucket = CAM_FB_SIZE_BUCKETS - 1;
+    }
+    s->hist[bucket]++;
+    if (++s->hist_total >= CAM_FB_SIZE_WINDOW) {
+        s->hist_total = 0;
+        for (int i = 0; i < CAM_FB_SIZE_BUCKETS; i++) {
+            s->hist[i] /= 2;
+            s->hist_total += s->hist[i];
+        }
+    }
+}
+
+// Upper end of the bucket the percentile falls into
+static size_t hist_percentile(const cam_fb_size_t *s)
+{
+    uint32_t need = (s->hist_total * s->percentile + 99) / 100;
+    uint32_t sum = 0;
+    for (int i = 0; i < CAM_FB_SIZE_BUCKETS; i++) {
+        sum += s->hist[i];
+        if (sum >= need && sum) {
+            return (i + 1) * s->bucket_size;
+        }
+    }
+    return s->size_limit;
+}
+
+void cam_fb_size_init(cam_fb_size_t *s, size_t initial, size_t limit, uint8_t percentile, uint8_t headroom)
+{
+    *s = (cam_fb_size_t) { 0 };
+    s->size_limit = round_up(limit);
+    s->size_min = CAM_FB_SIZE_GRANULE * 4;
+    if (s->size_min > s->size_limit) {
+        s->size_min = s->size_limit;
+    }
+    s->bucket_size = (s->size_limit + CAM_FB_SIZE_BUCKETS - 1) / CAM_FB_SIZE_BUCKETS;
+    s->percentile = percentile;
+    s->headroom = headroom;
+    s->target = clamp_target(s, initial);
+}
+
+bool cam_fb_size_add(cam_fb_size_t *s, size_t len)
+{
+    hist_add(s, len);
+    s->frames++;
+    if (len > s->size_max) {
+        s->size_max = len;
+    }
+    if (++s->since_update < CAM_FB_SIZE_INTERVAL) {
+        return false;
+    }
+    s->since_update = 0;
+
+    s->size_pct = hist_percentile(s);
+    size_t target = clamp_target(s, s->size_pct + s->size_pct * s->headroom / 100);
+    // Shrinking needs half a window of frames since the start, so the histogram means something, and a real gain
+    if (target > s->target || (s->frames >= CAM_FB_SIZE_WINDOW / 2 && target < s->target - s->target / 4)) {
+        s->target = target;
+        return true;
+    }
+    return false;
+}
+
+bool cam_fb_size_overflow(cam_fb_size_t *s, size_t fb_size)
+{
+    s->overflows++;
+    // The frame was larger than fb_size, by how much is unknown
+    hist_add(s, fb_size + 1);
+    size_t target = clamp_target(s, fb_size + fb_size / 2);
+    if (target > s->target) {
+        s->target = target;
+        return true;
+    }
+    return false;
+}
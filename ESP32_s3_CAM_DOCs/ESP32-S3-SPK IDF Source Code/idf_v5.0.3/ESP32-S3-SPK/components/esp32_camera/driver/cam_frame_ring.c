@@ -0,0 +1,124 @@
+#include <stddef.h>
+#include "cam_frame_ring.h"
+
+// Every access is sequentially consistent: cam_take registers as a waiter and then looks
+// for a ready frame, cam_task publishes a frame and then looks for waiters. One of the
+// two has to see the other, which acquire/release alone does not guarantee.
+#define TAG_LOAD(p)             __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define TAG_STORE(p, v)         __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+#define TAG_CAS(p, old, new)    __atomic_compare_exchange_n((p), &(old), (new), false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+
+#define TAG_STATE(t)            ((cam_frame_state_t)((t) & CAM_FRAME_STATE_MASK))
+#define TAG_WITH(t, state)      (((t) & ~(uint32_t)CAM_FRAME_STATE_MASK) | (state))
+
+// Oldest ready frame and its tag, -1 if none. ready gets the number of ready frames.
+static int find_oldest(const cam_frame_ring_t *r, uint32_t *tag, uint32_t *ready)
+{
+    int oldest = -1;
+    *ready = 0;
+    for (uint32_t x = 0; x < r->count; x++) {
+        uint32_t t = TAG_LOAD(&r->tag[x]);
+        if (TAG_STATE(t) != CAM_FRAME_READY) {
+            continue;
+        }
+        (*ready)++;
+        // sequence numbers wrap, compare their distance
+        if (oldest < 0 || (int32_t)(t - *tag) < 0) {
+            oldest = x;
+            *tag = t;
+        }
+    }
+    return oldest;
+}
+
+void cam_frame_ring_init(cam_frame_ring_t *r, uint32_t *tags, uint32_t count, uint32_t ready_max)
+{
+    r->tag = tags;
+    r->count = count;
+    r->ready_max = ready_max ? ready_max : 1;
+    r->seq = 0;
+    r->dropped = 0;
+    for (uint32_t x = 0; x < count; x++) {
+        TAG_STORE(&r->tag[x], CAM_FRAME_FREE);
+    }
+}
+
+int cam_frame_ring_acquire(cam_frame_ring_t *r, int hint)
+{
+    if (hint >= 0 && hint < (int)r->count && cam_frame_ring_state(r, hint) == CAM_FRAME_FILL) {
+        return hint;
+    }
+    for (uint32_t x = 0; x < r->count; x++) {
+        uint32_t t = TAG_LOAD(&r->tag[x]);
+        // only the producer moves frames out of FREE, the swap cannot lose a frame
+        if (TAG_STATE(t) == CAM_FRAME_FREE && TAG_CAS(&r->tag[x], t, TAG_WITH(t, CAM_FRAME_FILL))) {
+            return x;
+        }
+    }
+    return -1;
+}
+
+uint32_t cam_frame_ring_publish(cam_frame_ring_t *r, int pos)
+{
+    uint32_t dropped = 0;
+    uint32_t tag = 0, ready;
+    int oldest;
+
+    // consumers may take frames meanwhile, so count again after every drop
+    while ((oldest = find_oldest(r, &tag, &ready)) >= 0 && ready >= r->ready_max) {
+        if (TAG_CAS(&r->tag[oldest], tag, TAG_WITH(tag, CAM_FRAME_FREE))) {
+            dropped++;
+        }
+    }
+    r->dropped += dropped;
+
+    TAG_STORE(&r->tag[pos], (r->seq << CAM_FRAME_STATE_BITS) | CAM_FRAME_READY);
+    TAG_STORE(&r->seq, r->seq + 1);
+    return dropped;
+}
+
+int cam_frame_ring_take(cam_frame_ring_t *r)
+{
+    uint32_t tag = 0, ready;
+    int oldest;
+
+    while (1) {
+        // Every frame published before seq was read is seen by the scan. A frame published
+        // during the scan may be newer than one the scan passed too early, so look again.
+        uint32_t seq = TAG_LOAD(&r->seq);
+        oldest = find_oldest(r, &tag, &ready);
+        if (oldest < 0) {
+            return -1;
+        }
+        if ((int32_t)(tag - (seq << CAM_FRAME_STATE_BITS)) > 0) {
+            continue;
+        }
+        // fails when another consumer took it or the producer dropped it, look again
+        if (TAG_CAS(&r->tag[oldest], tag, TAG_WITH(tag, CAM_FRAME_TAKEN))) {
+            return oldest;
+        }
+    }
+}
+
+bool cam_frame_ring_give(cam_frame_ring_t *r, int pos)
+{
+    uint32_t t = TAG_LOAD(&r->tag[pos]);
+    while (TAG_STATE(t) == CAM_FRAME_TAKEN) {
+        if (TAG_CAS(&r->tag[pos], t, TAG_WITH(t, CAM_FRAME_FREE))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void cam_frame_ring_give_all(cam_frame_ring_t *r)
+{
+    for (uint32_t x = 0; x < r->count; x++) {
+        cam_frame_ring_give(r, x);
+    }
+}
+
+cam_frame_state_t cam_frame_ring_state(const cam_frame_ring_t *r, int pos)
+{
+    return TAG_STATE(TAG_LOAD(&r->tag[pos]));
+}
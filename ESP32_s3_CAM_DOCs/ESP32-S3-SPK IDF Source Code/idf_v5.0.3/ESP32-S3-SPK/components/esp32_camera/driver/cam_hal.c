@@ -26,12 +26,43 @@
 #include "esp32/rom/ets_sys.h"  // will be removed in idf v5.0
 #elif CONFIG_IDF_TARGET_ESP32S2
 #include "esp32s2/rom/ets_sys.h"
+#include "esp32s2/rom/cache.h"
 #elif CONFIG_IDF_TARGET_ESP32S3
 #include "esp32s3/rom/ets_sys.h"
+#include "esp32s3/rom/cache.h"
 #endif
 #endif // ESP_IDF_VERSION_MAJOR
 #define ESP_CAMERA_ETS_PRINTF ets_printf
 
+#define CAM_CACHE_LINE_MAX         64
+
+#if CONFIG_CAMERA_JPEG_FB_ADAPTIVE
+#define CAM_FB_PERCENTILE          CONFIG_CAMERA_JPEG_FB_PERCENTILE
+#define CAM_FB_HEADROOM            CONFIG_CAMERA_JPEG_FB_HEADROOM
+#else
+#define CAM_FB_PERCENTILE          99
+#define CAM_FB_HEADROOM            20
+#endif
+
+#if CONFIG_CAMERA_TELEMETRY
+// Stage times of camera_frame_timing_t are counted from the VSYNC starting the frame
+#define CAM_TELEMETRY_NOW()                 esp_timer_get_time()
+#define CAM_TELEMETRY_STAMP(frame, stage)   ((frame)->timing.stage = CAM_TELEMETRY_NOW() - (frame)->timing.vsync_us)
+#define CAM_TELEMETRY_COPY(frame, start)    ((frame)->timing.copy_us += CAM_TELEMETRY_NOW() - (start))
+#else
+#define CAM_TELEMETRY_NOW()                 0
+#define CAM_TELEMETRY_STAMP(frame, stage)   do { } while (0)
+#define CAM_TELEMETRY_COPY(frame, start)    do { (void)(start); } while (0)
+#endif
+
+#if CONFIG_CAMERA_JPEG_EOI_TRACKING
+// JPEG frames copied out of the DMA buffers are followed marker by marker as they arrive,
+// so the EOI is known at VSYNC and nothing after it is copied
+#define CAM_JPEG_TRACK(buf, len)            cam_jpeg_scan(&cam_obj->jpeg_scan, (buf), (len))
+#else
+#define CAM_JPEG_TRACK(buf, len)            do { } while (0)
+#endif
+
 #if CONFIG_CAMERA_TASK_STACK_SIZE
 #define CAM_TASK_STACK             CONFIG_CAMERA_TASK_STACK_SIZE
 #else
@@ -41,49 +72,85 @@
 static const char *TAG = "cam_hal";
 static cam_obj_t *cam_obj = NULL;
 
-static const uint32_t JPEG_SOI_MARKER = 0xFFD8FF;  // written in little-endian for esp32
 static const uint16_t JPEG_EOI_MARKER = 0xD9FF;  // written in little-endian for esp32
 
 static int cam_verify_jpeg_soi(const uint8_t *inbuf, uint32_t length)
 {
-    for (uint32_t i = 0; i < length; i++) {
-        if (memcmp(&inbuf[i], &JPEG_SOI_MARKER, 3) == 0) {
-            //ESP_LOGW(TAG, "SOI: %d", (int) i);
-            return i;
-        }
+    int offset = cam_jpeg_find_soi(inbuf, length);
+    if (offset < 0) {
+        ESP_LOGW(TAG, "NO-SOI");
     }
-    ESP_LOGW(TAG, "NO-SOI");
-    return -1;
+    return offset;
 }
 
 static int cam_verify_jpeg_eoi(const uint8_t *inbuf, uint32_t length)
 {
-    int offset = -1;
-    uint8_t *dptr = (uint8_t *)inbuf + length - 2;
-    while (dptr > inbuf) {
-        if (memcmp(dptr, &JPEG_EOI_MARKER, 2) == 0) {
-            offset = dptr - inbuf;
-            //ESP_LOGW(TAG, "EOI: %d", length - (offset + 2));
-            return offset;
+    return cam_jpeg_find_eoi(inbuf, length);
+}
+
+// PSRAM mode: the DMA writes the frame behind the data cache, drop the cached lines
+// of buf[start, end) before the CPU reads what was written there
+static void cam_invalidate_cache(const uint8_t *buf, uint32_t start, uint32_t end)
+{
+#if CONFIG_IDF_TARGET_ESP32S2 || CONFIG_IDF_TARGET_ESP32S3
+    if (end > start) {
+        Cache_Invalidate_Addr((uint32_t)&buf[start], end - start);
+    }
+#endif
+}
+
+// PSRAM mode: the DMA wrote last full half buffers and then the partial one at index last.
+// Look for the EOI in that last half buffer only, the result is left in cam_obj->jpeg_scan.
+// Only the written part of the frame buffer is invalidated, the first half buffer already
+// was for the SOI check.
+static void cam_psram_jpeg_scan(const uint8_t *buf, uint32_t last, size_t fb_size)
+{
+    cam_jpeg_scan_t *scan = &cam_obj->jpeg_scan;
+    uint32_t half = cam_obj->dma_half_buffer_size;
+    uint32_t start = last * half;
+    uint32_t end = start + half;
+
+    // the descriptors cover the whole half buffers of the frame buffer, the DMA writes nothing behind them
+    if (end > fb_size / half * half) {
+        end = fb_size / half * half;
+    }
+    cam_invalidate_cache(buf, last ? half : 0, end);
+
+    cam_jpeg_scan_reset(scan);
+    if (last) {
+        // Behind the headers there is only entropy coded data and the EOI. The EOI may have
+        // ended the previous half buffer, or 0xFF padding after it may have reached into this
+        // one: start before the 0xFF bytes that end the previous half buffer, and two bytes more.
+        while (start > 2 && buf[start - 1] == 0xFF) {
+            start--;
         }
-        dptr--;
+        start -= 2;
+        cam_jpeg_scan_entropy(scan, start);
     }
-    return -1;
+    cam_jpeg_scan(scan, buf, end);
 }
 
 static bool cam_get_next_frame(int * frame_pos)
 {
-    if(!cam_obj->frames[*frame_pos].en){
-        for (int x = 0; x < cam_obj->frame_cnt; x++) {
-            if (cam_obj->frames[x].en) {
-                *frame_pos = x;
-                return true;
-            }
-        }
-    } else {
-        return true;
+    int pos = cam_frame_ring_acquire(&cam_obj->frame_ring, *frame_pos);
+    if (pos < 0) {
+        return false;
+    }
+    *frame_pos = pos;
+    return true;
+}
+
+static void cam_publish_frame(int frame_pos)
+{
+#if CONFIG_CAMERA_TELEMETRY
+    cam_frame_t *frame = &cam_obj->frames[frame_pos];
+    CAM_TELEMETRY_STAMP(frame, ready_us);
+    cam_telemetry_frame(&cam_obj->telemetry, &frame->timing, frame->fb.len);
+#endif
+    cam_frame_ring_publish(&cam_obj->frame_ring, frame_pos);
+    if (__atomic_load_n(&cam_obj->frame_waiters, __ATOMIC_SEQ_CST)) {
+        xSemaphoreGive(cam_obj->frame_ready);
     }
-    return false;
 }
 
 static bool cam_start_frame(int * frame_pos)
@@ -95,6 +162,12 @@ static bool cam_start_frame(int * frame_pos)
             uint64_t us = (uint64_t)esp_timer_get_time();
             cam_obj->frames[*frame_pos].fb.timestamp.tv_sec = us / 1000000UL;
             cam_obj->frames[*frame_pos].fb.timestamp.tv_usec = us % 1000000UL;
+            cam_obj->frames[*frame_pos].jpeg_eoi = 0;
+#if CONFIG_CAMERA_TELEMETRY
+            memset(&cam_obj->frames[*frame_pos].timing, 0, sizeof(camera_frame_timing_t));
+            cam_obj->frames[*frame_pos].timing.vsync_us = us;
+#endif
+            cam_jpeg_scan_reset(&cam_obj->jpeg_scan);
             return true;
         }
     }
@@ -106,14 +179,28 @@ void IRAM_ATTR ll_cam_send_event(cam_obj_t *cam, cam_event_t cam_event, BaseType
     if (xQueueSendFromISR(cam->event_queue, (void *)&cam_event, HPTaskAwoken) != pdTRUE) {
         ll_cam_stop(cam);
         cam->state = CAM_STATE_IDLE;
+        //the VSYNC and the DMA interrupt both get here
+        CAM_TELEMETRY_COUNT(&cam->telemetry, ev_ovf);
         ESP_CAMERA_ETS_PRINTF(DRAM_STR("cam_hal: EV-%s-OVF\r\n"), cam_event==CAM_IN_SUC_EOF_EVENT ? DRAM_STR("EOF") : DRAM_STR("VSYNC"));
     }
 }
 
+// The frame does not fit into its buffer. Counted once, the frame is dropped at VSYNC.
+static void cam_fb_overflow(bool *fb_ovf, const cam_frame_t *frame)
+{
+    if (!*fb_ovf) {
+        *fb_ovf = true;
+        CAM_TELEMETRY_COUNT(&cam_obj->telemetry, fb_ovf);
+        ESP_LOGW(TAG, "FB-OVF");
+        cam_fb_size_overflow(&cam_obj->fb_sizer, frame->fb_size);
+    }
+}
+
 //Copy fram from DMA dma_buffer to fram dma_buffer
 static void cam_task(void *arg)
 {
     int cnt = 0;
+    bool fb_ovf = false;
     int frame_pos = 0;
     cam_obj->state = CAM_STATE_IDLE;
     cam_event_t cam_event = 0;
@@ -133,86 +220,131 @@ static void cam_task(void *arg)
                         cam_obj->state = CAM_STATE_READ_BUF;
                     }
                     cnt = 0;
+                    fb_ovf = false;
                 }
             }
             break;
 
             case CAM_STATE_READ_BUF: {
-                camera_fb_t * frame_buffer_event = &cam_obj->frames[frame_pos].fb;
+                cam_frame_t * frame = &cam_obj->frames[frame_pos];
+                camera_fb_t * frame_buffer_event = &frame->fb;
                 size_t pixels_per_dma = (cam_obj->dma_half_buffer_size * cam_obj->fb_bytes_per_pixel) / (cam_obj->dma_bytes_per_item * cam_obj->in_bytes_per_pixel);
 
                 if (cam_event == CAM_IN_SUC_EOF_EVENT) {
-                    if(!cam_obj->psram_mode){
-                        if (cam_obj->fb_size < (frame_buffer_event->len + pixels_per_dma)) {
-                            ESP_LOGW(TAG, "FB-OVF");
+                    //With CONFIG_CAMERA_JPEG_EOI_TRACKING data after the JPEG EOI is not copied at all
+                    if(!cam_obj->psram_mode && cam_obj->jpeg_scan.eoi < 0){
+                        if (frame->fb_size < (frame_buffer_event->len + pixels_per_dma)) {
+                            cam_fb_overflow(&fb_ovf, frame);
                             ll_cam_stop(cam_obj);
                             DBG_PIN_SET(0);
                             continue;
                         }
+                        int64_t copy_start = CAM_TELEMETRY_NOW();
                         frame_buffer_event->len += ll_cam_memcpy(cam_obj,
                             &frame_buffer_event->buf[frame_buffer_event->len],
                             &cam_obj->dma_buffer[(cnt % cam_obj->dma_half_buffer_cnt) * cam_obj->dma_half_buffer_size],
                             cam_obj->dma_half_buffer_size);
+                        if (cam_obj->jpeg_mode) {
+                            CAM_JPEG_TRACK(frame_buffer_event->buf, frame_buffer_event->len);
+                        }
+                        CAM_TELEMETRY_COPY(frame, copy_start);
+                    } else if (cam_obj->psram_mode && cam_obj->jpeg_mode &&
+                               (cnt + 1) * cam_obj->dma_half_buffer_size > frame->fb_size) {
+                        //half buffer cnt did not fit, the circular descriptors wrote it over the start of the frame buffer
+                        cam_fb_overflow(&fb_ovf, frame);
+                        ll_cam_stop(cam_obj);
+                        DBG_PIN_SET(0);
+                        continue;
                     }
                     //Check for JPEG SOI in the first buffer. stop if not found
-                    if (cam_obj->jpeg_mode && cnt == 0 && cam_verify_jpeg_soi(frame_buffer_event->buf, frame_buffer_event->len) != 0) {
-                        ll_cam_stop(cam_obj);
-                        cam_obj->state = CAM_STATE_IDLE;
+                    if (cam_obj->jpeg_mode && cnt == 0) {
+                        size_t soi_len = frame_buffer_event->len;
+                        if (cam_obj->psram_mode) {
+                            //fb.len stays 0 while the DMA writes the frame buffer directly
+                            soi_len = cam_obj->dma_half_buffer_size;
+                            cam_invalidate_cache(frame_buffer_event->buf, 0, soi_len);
+                        }
+                        if (cam_verify_jpeg_soi(frame_buffer_event->buf, soi_len) != 0) {
+                            CAM_TELEMETRY_COUNT(&cam_obj->telemetry, no_soi);
+                            ll_cam_stop(cam_obj);
+                            cam_obj->state = CAM_STATE_IDLE;
+                        }
+                    }
+                    if (cnt == 0) {
+                        CAM_TELEMETRY_STAMP(frame, first_eof_us);
                     }
                     cnt++;
 
                 } else if (cam_event == CAM_VSYNC_EVENT) {
                     //DBG_PIN_SET(1);
                     ll_cam_stop(cam_obj);
+                    CAM_TELEMETRY_STAMP(frame, end_us);
 
                     if (cnt || !cam_obj->jpeg_mode || cam_obj->psram_mode) {
                         if (cam_obj->jpeg_mode) {
-                            if (!cam_obj->psram_mode) {
-                                if (cam_obj->fb_size < (frame_buffer_event->len + pixels_per_dma)) {
-                                    ESP_LOGW(TAG, "FB-OVF");
+                            if (!cam_obj->psram_mode && cam_obj->jpeg_scan.eoi < 0) {
+                                if (frame->fb_size < (frame_buffer_event->len + pixels_per_dma)) {
+                                    cam_fb_overflow(&fb_ovf, frame);
                                     cnt--;
                                 } else {
+                                    int64_t copy_start = CAM_TELEMETRY_NOW();
                                     frame_buffer_event->len += ll_cam_memcpy(cam_obj,
                                         &frame_buffer_event->buf[frame_buffer_event->len],
                                         &cam_obj->dma_buffer[(cnt % cam_obj->dma_half_buffer_cnt) * cam_obj->dma_half_buffer_size],
                                         cam_obj->dma_half_buffer_size);
+                                    CAM_JPEG_TRACK(frame_buffer_event->buf, frame_buffer_event->len);
+                                    CAM_TELEMETRY_COPY(frame, copy_start);
                                 }
                             }
                             cnt++;
                         }
 
-                        cam_obj->frames[frame_pos].en = 0;
+                        bool drop = false;
 
                         if (cam_obj->psram_mode) {
                             if (cam_obj->jpeg_mode) {
+                                //trimmed at the EOI below when it is in the last half buffer
+                                int64_t copy_start = CAM_TELEMETRY_NOW();
                                 frame_buffer_event->len = cnt * cam_obj->dma_half_buffer_size;
+                                cam_psram_jpeg_scan(frame_buffer_event->buf, cnt - 1, frame->fb_size);
+                                CAM_TELEMETRY_COPY(frame, copy_start);
+                                //the last half buffer is past the end of the frame buffer: a frame that filled it
+                                //exactly ends with the EOI, anything the DMA wrote after that went over the SOI
+                                if (!fb_ovf && cnt * cam_obj->dma_half_buffer_size > frame->fb_size) {
+                                    cam_invalidate_cache(frame_buffer_event->buf, 0, cam_obj->dma_half_buffer_size);
+                                    if (cam_obj->jpeg_scan.eoi < 0 ||
+                                        cam_verify_jpeg_soi(frame_buffer_event->buf, cam_obj->dma_half_buffer_size) != 0) {
+                                        cam_fb_overflow(&fb_ovf, frame);
+                                    }
+                                }
                             } else {
                                 frame_buffer_event->len = cam_obj->recv_size;
                             }
                         } else if (!cam_obj->jpeg_mode) {
                             if (frame_buffer_event->len != cam_obj->fb_size) {
-                                cam_obj->frames[frame_pos].en = 1;
+                                drop = true;
+                                CAM_TELEMETRY_COUNT(&cam_obj->telemetry, fb_size_err);
                                 ESP_LOGE(TAG, "FB-SIZE: %u != %u", frame_buffer_event->len, (unsigned) cam_obj->fb_size);
                             }
                         }
-                        //send frame
-                        if(!cam_obj->frames[frame_pos].en && xQueueSend(cam_obj->frame_buffer_queue, (void *)&frame_buffer_event, 0) != pdTRUE) {
-                            //pop frame buffer from the queue
-                            camera_fb_t * fb2 = NULL;
-                            if(xQueueReceive(cam_obj->frame_buffer_queue, &fb2, 0) == pdTRUE) {
-                                //push the new frame to the end of the queue
-                                if (xQueueSend(cam_obj->frame_buffer_queue, (void *)&frame_buffer_event, 0) != pdTRUE) {
-                                    cam_obj->frames[frame_pos].en = 1;
-                                    ESP_LOGE(TAG, "FBQ-SND");
-                                }
-                                //free the popped buffer
-                                cam_give(fb2);
+                        //the EOI was found while receiving, cam_take does not have to search for it
+                        if (cam_obj->jpeg_scan.eoi >= 0) {
+                            frame_buffer_event->len = cam_obj->jpeg_scan.eoi + sizeof(JPEG_EOI_MARKER);
+                            cam_obj->frames[frame_pos].jpeg_eoi = 1;
+                        }
+                        if (cam_obj->jpeg_mode) {
+                            if (fb_ovf) {
+                                //incomplete frame
+                                drop = true;
                             } else {
-                                //queue is full and we could not pop a frame from it
-                                cam_obj->frames[frame_pos].en = 1;
-                                ESP_LOGE(TAG, "FBQ-RCV");
+                                cam_fb_size_add(&cam_obj->fb_sizer, frame_buffer_event->len);
                             }
                         }
+                        //send frame, the oldest waiting frame is dropped when too many wait.
+                        //a dropped frame stays with cam_task and is filled again
+                        if (!drop) {
+                            cam_publish_frame(frame_pos);
+                        }
                     }
 
                     if(!cam_start_frame(&frame_pos)){
@@ -221,6 +353,7 @@ static void cam_task(void *arg)
                         cam_obj->frames[frame_pos].fb.len = 0;
                     }
                     cnt = 0;
+                    fb_ovf = false;
                 }
             }
             break;
@@ -248,6 +381,58 @@ static lldesc_t * allocate_dma_descriptors(uint32_t count, uint16_t size, uint8_
     return dma;
 }
 
+// Allocate a frame buffer of fb_size bytes and, in PSRAM mode, the node_cnt DMA descriptors
+// that write into it. The frame keeps its old buffer when this fails.
+static esp_err_t cam_alloc_frame(cam_frame_t *frame, size_t fb_size, uint32_t node_cnt)
+{
+    uint8_t dma_align = 0;
+    size_t alloc_size = fb_size * sizeof(uint8_t);
+    if (cam_obj->psram_mode) {
+        dma_align = ll_cam_get_dma_align(cam_obj);
+        //frame buffers own whole cache lines, so invalidating them never drops a neighbour's data
+        if (dma_align < CAM_CACHE_LINE_MAX) {
+            dma_align = CAM_CACHE_LINE_MAX;
+        }
+        alloc_size += 2 * dma_align;
+    }
+
+    ESP_LOGI(TAG, "Allocating %d Byte frame buffer in %s", alloc_size, cam_obj->fb_caps & MALLOC_CAP_SPIRAM ? "PSRAM" : "OnBoard RAM");
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 3, 0)
+    // In IDF v4.2 and earlier, memory returned by heap_caps_aligned_alloc must be freed using heap_caps_aligned_free.
+    // And heap_caps_aligned_free is deprecated on v4.3.
+    uint8_t *buf = (uint8_t *)heap_caps_aligned_alloc(16, alloc_size, cam_obj->fb_caps);
+#else
+    uint8_t *buf = (uint8_t *)heap_caps_malloc(alloc_size, cam_obj->fb_caps);
+#endif
+    if (buf == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    size_t offset = 0;
+    lldesc_t *dma = NULL;
+    if (cam_obj->psram_mode) {
+        //align PSRAM buffer
+        offset = dma_align - ((uint32_t)buf & (dma_align - 1));
+        dma = allocate_dma_descriptors(node_cnt, cam_obj->dma_node_buffer_size, buf + offset);
+        if (dma == NULL) {
+            free(buf);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    if (frame->fb.buf) {
+        free(frame->fb.buf - frame->fb_offset);
+    }
+    if (frame->dma) {
+        free(frame->dma);
+    }
+    frame->fb.buf = buf + offset;
+    frame->fb_offset = offset;
+    frame->fb_size = fb_size;
+    frame->dma = dma;
+    return ESP_OK;
+}
+
 static esp_err_t cam_dma_config(const camera_config_t *config)
 {
     bool ret = ll_cam_dma_sizes(cam_obj);
@@ -267,46 +452,26 @@ static esp_err_t cam_dma_config(const camera_config_t *config)
 
     cam_obj->frames = (cam_frame_t *)heap_caps_calloc(1, cam_obj->frame_cnt * sizeof(cam_frame_t), MALLOC_CAP_DEFAULT);
     CAM_CHECK(cam_obj->frames != NULL, "frames malloc failed", ESP_FAIL);
+    cam_obj->frame_tags = (uint32_t *)heap_caps_calloc(cam_obj->frame_cnt, sizeof(uint32_t), MALLOC_CAP_INTERNAL);
+    CAM_CHECK(cam_obj->frame_tags != NULL, "frame tags malloc failed", ESP_FAIL);
 
-    uint8_t dma_align = 0;
     size_t fb_size = cam_obj->fb_size;
-    if (cam_obj->psram_mode) {
-        dma_align = ll_cam_get_dma_align(cam_obj);
-        if (cam_obj->fb_size < cam_obj->recv_size) {
-            fb_size = cam_obj->recv_size;
-        }
+    if (cam_obj->psram_mode && cam_obj->fb_size < cam_obj->recv_size) {
+        fb_size = cam_obj->recv_size;
     }
 
     /* Allocate memory for frame buffer */
-    size_t alloc_size = fb_size * sizeof(uint8_t) + dma_align;
-    uint32_t _caps = MALLOC_CAP_8BIT;
+    cam_obj->fb_caps = MALLOC_CAP_8BIT;
     if (CAMERA_FB_IN_DRAM == config->fb_location) {
-        _caps |= MALLOC_CAP_INTERNAL;
+        cam_obj->fb_caps |= MALLOC_CAP_INTERNAL;
     } else {
-        _caps |= MALLOC_CAP_SPIRAM;
+        cam_obj->fb_caps |= MALLOC_CAP_SPIRAM;
     }
     for (int x = 0; x < cam_obj->frame_cnt; x++) {
-        cam_obj->frames[x].dma = NULL;
-        cam_obj->frames[x].fb_offset = 0;
-        cam_obj->frames[x].en = 0;
-        ESP_LOGI(TAG, "Allocating %d Byte frame buffer in %s", alloc_size, _caps & MALLOC_CAP_SPIRAM ? "PSRAM" : "OnBoard RAM");
-#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(4, 3, 0)
-        // In IDF v4.2 and earlier, memory returned by heap_caps_aligned_alloc must be freed using heap_caps_aligned_free.
-        // And heap_caps_aligned_free is deprecated on v4.3.
-        cam_obj->frames[x].fb.buf = (uint8_t *)heap_caps_aligned_alloc(16, alloc_size, _caps);
-#else
-        cam_obj->frames[x].fb.buf = (uint8_t *)heap_caps_malloc(alloc_size, _caps);
-#endif
-        CAM_CHECK(cam_obj->frames[x].fb.buf != NULL, "frame buffer malloc failed", ESP_FAIL);
+        CAM_CHECK(cam_alloc_frame(&cam_obj->frames[x], fb_size, cam_obj->dma_node_cnt) == ESP_OK, "frame buffer malloc failed", ESP_FAIL);
         if (cam_obj->psram_mode) {
-            //align PSRAM buffer. TODO: save the offset so proper address can be freed later
-            cam_obj->frames[x].fb_offset = dma_align - ((uint32_t)cam_obj->frames[x].fb.buf & (dma_align - 1));
-            cam_obj->frames[x].fb.buf += cam_obj->frames[x].fb_offset;
             ESP_LOGI(TAG, "Frame[%d]: Offset: %u, Addr: 0x%08X", x, cam_obj->frames[x].fb_offset, (unsigned) cam_obj->frames[x].fb.buf);
-            cam_obj->frames[x].dma = allocate_dma_descriptors(cam_obj->dma_node_cnt, cam_obj->dma_node_buffer_size, cam_obj->frames[x].fb.buf);
-            CAM_CHECK(cam_obj->frames[x].dma != NULL, "frame dma malloc failed", ESP_FAIL);
         }
-        cam_obj->frames[x].en = 1;
     }
 
     if (!cam_obj->psram_mode) {
@@ -380,6 +545,13 @@ esp_err_t cam_config(const camera_config_t *config, framesize_t frame_size, uint
         cam_obj->fb_size = cam_obj->width * cam_obj->height * cam_obj->fb_bytes_per_pixel;
     }
 
+    cam_fb_size_init(&cam_obj->fb_sizer, cam_obj->recv_size, cam_obj->width * cam_obj->height / 2,
+                     CAM_FB_PERCENTILE, CAM_FB_HEADROOM);
+    cam_obj->fb_resizes = 0;
+#if CONFIG_CAMERA_TELEMETRY
+    cam_telemetry_init(&cam_obj->telemetry);
+#endif
+
     ret = cam_dma_config(config);
     CAM_CHECK_GOTO(ret == ESP_OK, "cam_dma_config failed", err);
 
@@ -390,12 +562,14 @@ esp_err_t cam_config(const camera_config_t *config, framesize_t frame_size, uint
     cam_obj->event_queue = xQueueCreate(queue_size, sizeof(cam_event_t));
     CAM_CHECK_GOTO(cam_obj->event_queue != NULL, "event_queue create failed", err);
 
-    size_t frame_buffer_queue_len = cam_obj->frame_cnt;
+    size_t frame_ready_max = cam_obj->frame_cnt;
     if (config->grab_mode == CAMERA_GRAB_LATEST && cam_obj->frame_cnt > 1) {
-        frame_buffer_queue_len = cam_obj->frame_cnt - 1;
+        frame_ready_max = cam_obj->frame_cnt - 1;
     }
-    cam_obj->frame_buffer_queue = xQueueCreate(frame_buffer_queue_len, sizeof(camera_fb_t*));
-    CAM_CHECK_GOTO(cam_obj->frame_buffer_queue != NULL, "frame_buffer_queue create failed", err);
+    cam_frame_ring_init(&cam_obj->frame_ring, cam_obj->frame_tags, cam_obj->frame_cnt, frame_ready_max);
+    cam_obj->frame_waiters = 0;
+    cam_obj->frame_ready = xSemaphoreCreateCounting(cam_obj->frame_cnt, 0);
+    CAM_CHECK_GOTO(cam_obj->frame_ready != NULL, "frame_ready create failed", err);
 
     ret = ll_cam_init_isr(cam_obj);
     CAM_CHECK_GOTO(ret == ESP_OK, "cam intr alloc failed", err);
@@ -430,8 +604,8 @@ esp_err_t cam_deinit(void)
     if (cam_obj->event_queue) {
         vQueueDelete(cam_obj->event_queue);
     }
-    if (cam_obj->frame_buffer_queue) {
-        vQueueDelete(cam_obj->frame_buffer_queue);
+    if (cam_obj->frame_ready) {
+        vSemaphoreDelete(cam_obj->frame_ready);
     }
 
     ll_cam_deinit(cam_obj);
@@ -451,6 +625,9 @@ esp_err_t cam_deinit(void)
         }
         free(cam_obj->frames);
     }
+    if (cam_obj->frame_tags) {
+        free(cam_obj->frame_tags);
+    }
 
     free(cam_obj);
     cam_obj = NULL;
@@ -468,13 +645,40 @@ void cam_start(void)
     ll_cam_vsync_intr_enable(cam_obj, true);
 }
 
+// Take the oldest ready frame. Only waits on the semaphore when no frame is ready yet.
+static camera_fb_t *cam_take_frame(TickType_t timeout)
+{
+    TickType_t start = xTaskGetTickCount();
+    int pos = cam_frame_ring_take(&cam_obj->frame_ring);
+    while (pos < 0) {
+        TickType_t waited = xTaskGetTickCount() - start;
+        if (waited >= timeout) {
+            return NULL;
+        }
+        //register before looking again, so a frame published in between wakes us up
+        __atomic_add_fetch(&cam_obj->frame_waiters, 1, __ATOMIC_SEQ_CST);
+        pos = cam_frame_ring_take(&cam_obj->frame_ring);
+        if (pos < 0) {
+            //another consumer may get the frame first, then wait again
+            xSemaphoreTake(cam_obj->frame_ready, timeout - waited);
+            pos = cam_frame_ring_take(&cam_obj->frame_ring);
+        }
+        __atomic_sub_fetch(&cam_obj->frame_waiters, 1, __ATOMIC_SEQ_CST);
+    }
+    CAM_TELEMETRY_STAMP(&cam_obj->frames[pos], taken_us);
+    return &cam_obj->frames[pos].fb;
+}
+
 camera_fb_t *cam_take(TickType_t timeout)
 {
-    camera_fb_t *dma_buffer = NULL;
     TickType_t start = xTaskGetTickCount();
-    xQueueReceive(cam_obj->frame_buffer_queue, (void *)&dma_buffer, timeout);
+    camera_fb_t *dma_buffer = cam_take_frame(timeout);
     if (dma_buffer) {
         if(cam_obj->jpeg_mode){
+            if (__containerof(dma_buffer, cam_frame_t, fb)->jpeg_eoi) {
+                // already trimmed at the EOI by cam_task
+                return dma_buffer;
+            }
             // find the end marker for JPEG. Data after that can be discarded
             int offset_e = cam_verify_jpeg_eoi(dma_buffer->buf, dma_buffer->len);
             if (offset_e >= 0) {
@@ -482,6 +686,7 @@ camera_fb_t *cam_take(TickType_t timeout)
                 dma_buffer->len = offset_e + sizeof(JPEG_EOI_MARKER);
                 return dma_buffer;
             } else {
+                CAM_TELEMETRY_COUNT(&cam_obj->telemetry, no_eoi);
                 ESP_LOGW(TAG, "NO-EOI");
                 cam_give(dma_buffer);
                 return cam_take(timeout - (xTaskGetTickCount() - start));//recurse!!!!
@@ -492,23 +697,90 @@ camera_fb_t *cam_take(TickType_t timeout)
         }
         return dma_buffer;
     } else {
+        CAM_TELEMETRY_COUNT(&cam_obj->telemetry, timeouts);
         ESP_LOGW(TAG, "Failed to get the frame on time!");
     }
     return NULL;
 }
 
+#if CONFIG_CAMERA_JPEG_FB_ADAPTIVE
+// Bring a JPEG frame buffer that was given back to the size the frame statistics ask for.
+// cam_task does not touch the frame while it is taken.
+static void cam_resize_frame(cam_frame_t *frame)
+{
+    size_t target = cam_obj->fb_sizer.target;
+    if (!cam_obj->jpeg_mode || frame->fb_size == target) {
+        return;
+    }
+    if (cam_alloc_frame(frame, target, target / cam_obj->dma_node_buffer_size) == ESP_OK) {
+        cam_obj->fb_resizes++;
+    } else {
+        ESP_LOGW(TAG, "FB-RESIZE: no memory for %u Byte", (unsigned) target);
+    }
+}
+#endif
+
 void cam_give(camera_fb_t *dma_buffer)
 {
     for (int x = 0; x < cam_obj->frame_cnt; x++) {
         if (&cam_obj->frames[x].fb == dma_buffer) {
-            cam_obj->frames[x].en = 1;
+            if (cam_frame_ring_state(&cam_obj->frame_ring, x) != CAM_FRAME_TAKEN) {
+                ESP_LOGE(TAG, "FB-GIVE: frame %d was not taken", x);
+                break;
+            }
+#if CONFIG_CAMERA_TELEMETRY
+            cam_frame_t *frame = &cam_obj->frames[x];
+            CAM_TELEMETRY_STAMP(frame, returned_us);
+            frame->timing.len = frame->fb.len;
+            cam_telemetry_commit(&cam_obj->telemetry, &frame->timing);
+#endif
+#if CONFIG_CAMERA_JPEG_FB_ADAPTIVE
+            cam_resize_frame(&cam_obj->frames[x]);
+#endif
+            cam_frame_ring_give(&cam_obj->frame_ring, x);
             break;
         }
     }
 }
 
 void cam_give_all(void) {
-    for (int x = 0; x < cam_obj->frame_cnt; x++) {
-        cam_obj->frames[x].en = 1;
-    }
+    cam_frame_ring_give_all(&cam_obj->frame_ring);
+}
+
+void cam_get_fb_stats(camera_fb_stats_t *stats)
+{
+    const cam_fb_size_t *sizer = &cam_obj->fb_sizer;
+#if CONFIG_CAMERA_JPEG_FB_ADAPTIVE
+    stats->fb_size = sizer->target;
+#else
+    stats->fb_size = cam_obj->frames[0].fb_size;
+#endif
+    stats->size_pct = sizer->size_pct;
+    stats->size_max = sizer->size_max;
+    stats->frames = sizer->frames;
+    stats->overflows = sizer->overflows;
+    stats->resizes = cam_obj->fb_resizes;
+    stats->dropped = cam_obj->frame_ring.dropped;
+}
+
+esp_err_t cam_get_telemetry(camera_telemetry_t *telemetry)
+{
+#if CONFIG_CAMERA_TELEMETRY
+    cam_telemetry_summary(&cam_obj->telemetry, telemetry);
+    telemetry->dropped = cam_obj->frame_ring.dropped;
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t cam_get_frame_timings(camera_frame_timing_t *timings, size_t *count)
+{
+#if CONFIG_CAMERA_TELEMETRY
+    *count = cam_telemetry_history(&cam_obj->telemetry, timings, *count);
+    return ESP_OK;
+#else
+    *count = 0;
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
 }
@@ -0,0 +1,176 @@
+#include <stddef.h>
+#include <string.h>
+#include "cam_jpeg_scan.h"
+
+static const uint32_t JPEG_SOI_MARKER = 0xFFD8FF;  // written in little-endian for esp32
+static const uint16_t JPEG_EOI_MARKER = 0xD9FF;  // written in little-endian for esp32
+
+// A word holds a 0xFF byte when its complement holds a zero byte
+#define HAS_FF_BYTE(w)  ((~(w) - 0x01010101UL) & (w) & 0x80808080UL)
+
+typedef enum {
+    SCAN_MARKER = 0,    // expecting the 0xFF of the next marker
+    SCAN_MARKER_ID,     // after a 0xFF, expecting the marker code
+    SCAN_LENGTH_HI,
+    SCAN_LENGTH_LO,
+    SCAN_SKIP,          // inside a segment payload
+    SCAN_ENTROPY,       // inside entropy coded data
+    SCAN_ENTROPY_FF,    // after a 0xFF in entropy coded data
+    SCAN_DONE,          // EOI found, or the data is not a JPEG (eoi stays -1)
+} scan_state_t;
+
+// JPEG data has a 0xFF only every few hundred bytes, so it is searched a word at a time.
+uint32_t cam_jpeg_find_ff(const uint8_t *inbuf, uint32_t start, uint32_t end)
+{
+    uint32_t i = start;
+    while (i < end && ((uintptr_t)&inbuf[i] & 3)) {
+        if (inbuf[i] == 0xFF) {
+            return i;
+        }
+        i++;
+    }
+    while (i + 4 <= end && !HAS_FF_BYTE(*(const uint32_t *)&inbuf[i])) {
+        i += 4;
+    }
+    while (i < end && inbuf[i] != 0xFF) {
+        i++;
+    }
+    return i;
+}
+
+// Offset of the last 0xFF in inbuf[start, end), -1 when there is none
+static int find_ff_reverse(const uint8_t *inbuf, uint32_t start, uint32_t end)
+{
+    uint32_t i = end;
+    while (i > start && ((uintptr_t)&inbuf[i] & 3)) {
+        if (inbuf[--i] == 0xFF) {
+            return i;
+        }
+    }
+    while (i >= start + 4 && !HAS_FF_BYTE(*(const uint32_t *)&inbuf[i - 4])) {
+        i -= 4;
+    }
+    while (i > start) {
+        if (inbuf[--i] == 0xFF) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int cam_jpeg_find_soi(const uint8_t *inbuf, uint32_t length)
+{
+    uint32_t i = 0;
+    while (length >= 3 && (i = cam_jpeg_find_ff(inbuf, i, length - 2)) < length - 2) {
+        if (memcmp(&inbuf[i], &JPEG_SOI_MARKER, 3) == 0) {
+            return i;
+        }
+        i++;
+    }
+    return -1;
+}
+
+int cam_jpeg_find_eoi(const uint8_t *inbuf, uint32_t length)
+{
+    int offset = length - 1;
+    if (length < 3) {
+        return -1;
+    }
+    while ((offset = find_ff_reverse(inbuf, 1, offset)) >= 0) {
+        if (memcmp(&inbuf[offset], &JPEG_EOI_MARKER, 2) == 0) {
+            return offset;
+        }
+    }
+    return -1;
+}
+
+void cam_jpeg_scan_reset(cam_jpeg_scan_t *scan)
+{
+    scan->pos = 0;
+    scan->skip = 0;
+    scan->eoi = -1;
+    scan->state = SCAN_MARKER;
+    scan->marker = 0;
+}
+
+void cam_jpeg_scan_entropy(cam_jpeg_scan_t *scan, uint32_t pos)
+{
+    cam_jpeg_scan_reset(scan);
+    scan->pos = pos;
+    scan->state = SCAN_ENTROPY;
+}
+
+bool cam_jpeg_scan(cam_jpeg_scan_t *scan, const uint8_t *inbuf, uint32_t end)
+{
+    uint32_t i = scan->pos;
+    while (i < end && scan->state != SCAN_DONE) {
+        uint8_t c = inbuf[i];
+        switch (scan->state) {
+            case SCAN_MARKER:
+                scan->state = c == 0xFF ? SCAN_MARKER_ID : SCAN_DONE;
+                i++;
+                break;
+
+            case SCAN_ENTROPY_FF:
+                if (c == 0x00 || (c >= 0xD0 && c <= 0xD7)) {
+                    // stuffed 0xFF or restart marker, the entropy coded data goes on
+                    scan->state = SCAN_ENTROPY;
+                    i++;
+                    break;
+                }
+                // any other marker ends the scan
+                /* fall through */
+            case SCAN_MARKER_ID:
+                i++;
+                if (c == 0xD9) {
+                    scan->eoi = i - 2;
+                    scan->state = SCAN_DONE;
+                } else if (c == 0xFF) {
+                    scan->state = SCAN_MARKER_ID;   // fill byte
+                } else if (c == 0xD8 || c == 0x01 || (c >= 0xD0 && c <= 0xD7)) {
+                    scan->state = SCAN_MARKER;      // marker without a segment
+                } else {
+                    scan->marker = c;
+                    scan->state = SCAN_LENGTH_HI;
+                }
+                break;
+
+            case SCAN_LENGTH_HI:
+                scan->skip = c << 8;
+                scan->state = SCAN_LENGTH_LO;
+                i++;
+                break;
+
+            case SCAN_LENGTH_LO:
+                scan->skip |= c;
+                i++;
+                if (scan->skip < 2) {
+                    scan->state = SCAN_DONE;
+                } else {
+                    scan->skip -= 2;
+                    scan->state = SCAN_SKIP;
+                }
+                break;
+
+            case SCAN_SKIP: {
+                uint32_t n = end - i < scan->skip ? end - i : scan->skip;
+                i += n;
+                scan->skip -= n;
+                if (!scan->skip) {
+                    scan->state = scan->marker == 0xDA ? SCAN_ENTROPY : SCAN_MARKER;
+                }
+            }
+            break;
+
+            case SCAN_ENTROPY:
+                i = cam_jpeg_find_ff(inbuf, i, end);
+                if (i < end) {
+                    scan->state = SCAN_ENTROPY_FF;
+                    i++;
+                }
+                break;
+        }
+    }
+    scan->pos = i;
+    return scan->eoi >= 0;
+}
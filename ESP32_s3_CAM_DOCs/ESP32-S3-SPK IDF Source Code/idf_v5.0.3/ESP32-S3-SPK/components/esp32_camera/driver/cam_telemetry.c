@@ -0,0 +1,116 @@
+#include <string.h>
+#include "cam_telemetry.h"
+
+static void stage_add(camera_stage_stats_t *stage, uint64_t *sum, uint32_t us)
+{
+    *sum += us;
+    if (us > stage->max_us) {
+        stage->max_us = us;
+    }
+}
+
+// History entry n, false if it is being written or was overwritten meanwhile
+static bool read_slot(const cam_telemetry_t *t, uint32_t n, camera_frame_timing_t *out)
+{
+    const cam_telemetry_slot_t *slot = &t->slot[n % CAM_TELEMETRY_HISTORY];
+    uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if (seq != 2 * n + 2) {
+        return false;
+    }
+    memcpy(out, &slot->timing, sizeof(*out));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq;
+}
+
+void cam_telemetry_init(cam_telemetry_t *t)
+{
+    memset(t, 0, sizeof(*t));
+}
+
+void cam_telemetry_frame(cam_telemetry_t *t, const camera_frame_timing_t *timing, size_t len)
+{
+    uint32_t bucket = 0;
+    if (len >> 12) {
+        bucket = 32 - __builtin_clz(len >> 12);
+        if (bucket >= CAMERA_TELEMETRY_SIZE_BUCKETS) {
+            bucket = CAMERA_TELEMETRY_SIZE_BUCKETS - 1;
+        }
+    }
+    __atomic_fetch_add(&t->size_hist[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&t->frames, 1, __ATOMIC_RELAXED);
+
+    if (t->last_vsync_us) {
+        int32_t interval = timing->vsync_us - t->last_vsync_us;
+        int32_t period = t->period_us;
+        t->period_us = period ? period + (interval - period) / 8 : interval;
+    }
+    t->last_vsync_us = timing->vsync_us;
+}
+
+void cam_telemetry_commit(cam_telemetry_t *t, const camera_frame_timing_t *timing)
+{
+    uint32_t n = __atomic_fetch_add(&t->head, 1, __ATOMIC_RELAXED);
+    cam_telemetry_slot_t *slot = &t->slot[n % CAM_TELEMETRY_HISTORY];
+
+    __atomic_store_n(&slot->seq, 2 * n + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->timing = *timing;
+    __atomic_store_n(&slot->seq, 2 * n + 2, __ATOMIC_RELEASE);
+}
+
+size_t cam_telemetry_history(const cam_telemetry_t *t, camera_frame_timing_t *out, size_t count)
+{
+    uint32_t head = __atomic_load_n(&t->head, __ATOMIC_ACQUIRE);
+    uint32_t n = head > CAM_TELEMETRY_HISTORY ? head - CAM_TELEMETRY_HISTORY : 0;
+    if (head - n > count) {
+        n = head - count;
+    }
+    size_t filled = 0;
+    for (; n != head; n++) {
+        if (read_slot(t, n, &out[filled])) {
+            filled++;
+        }
+    }
+    return filled;
+}
+
+void cam_telemetry_summary(const cam_telemetry_t *t, camera_telemetry_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->frames = __atomic_load_n(&t->frames, __ATOMIC_RELAXED);
+    out->ev_ovf = __atomic_load_n(&t->ev_ovf, __ATOMIC_RELAXED);
+    out->fb_ovf = __atomic_load_n(&t->fb_ovf, __ATOMIC_RELAXED);
+    out->no_soi = __atomic_load_n(&t->no_soi, __ATOMIC_RELAXED);
+    out->no_eoi = __atomic_load_n(&t->no_eoi, __ATOMIC_RELAXED);
+    out->fb_size_err = __atomic_load_n(&t->fb_size_err, __ATOMIC_RELAXED);
+    out->timeouts = __atomic_load_n(&t->timeouts, __ATOMIC_RELAXED);
+    for (int i = 0; i < CAMERA_TELEMETRY_SIZE_BUCKETS; i++) {
+        out->size_hist[i] = __atomic_load_n(&t->size_hist[i], __ATOMIC_RELAXED);
+    }
+    uint32_t period = __atomic_load_n(&t->period_us, __ATOMIC_RELAXED);
+    out->fps = period ? 1000000.0f / period : 0;
+
+    // one entry at a time, the whole history does not need to fit on the caller's stack
+    uint64_t receive = 0, process = 0, wait = 0, hold = 0, copy = 0;
+    uint32_t head = __atomic_load_n(&t->head, __ATOMIC_ACQUIRE);
+    uint32_t n = head > CAM_TELEMETRY_HISTORY ? head - CAM_TELEMETRY_HISTORY : 0;
+    camera_frame_timing_t timing;
+    for (; n != head; n++) {
+        if (!read_slot(t, n, &timing)) {
+            continue;
+        }
+        stage_add(&out->receive, &receive, timing.end_us);
+        stage_add(&out->process, &process, timing.ready_us - timing.end_us);
+        stage_add(&out->wait, &wait, timing.taken_us - timing.ready_us);
+        stage_add(&out->hold, &hold, timing.returned_us - timing.taken_us);
+        stage_add(&out->copy, &copy, timing.copy_us);
+        out->history++;
+    }
+    if (out->history) {
+        out->receive.avg_us = receive / out->history;
+        out->process.avg_us = process / out->history;
+        out->wait.avg_us = wait / out->history;
+        out->hold.avg_us = hold / out->history;
+        out->copy.avg_us = copy / out->history;
+    }
+}
@@ -484,3 +484,27 @@ void esp_camera_return_all(void) {
     cam_give_all();
 }
 
+esp_err_t esp_camera_get_fb_stats(camera_fb_stats_t *stats)
+{
+    if (s_state == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    cam_get_fb_stats(stats);
+    return ESP_OK;
+}
+
+esp_err_t esp_camera_get_telemetry(camera_telemetry_t *telemetry)
+{
+    if (s_state == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return cam_get_telemetry(telemetry);
+}
+
+esp_err_t esp_camera_get_frame_timings(camera_frame_timing_t *timings, size_t *count)
+{
+    if (s_state == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return cam_get_frame_timings(timings, count);
+}
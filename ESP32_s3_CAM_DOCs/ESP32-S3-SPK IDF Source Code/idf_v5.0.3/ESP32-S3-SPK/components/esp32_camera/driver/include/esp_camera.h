@@ -169,6 +169,68 @@ typedef struct {
     struct timeval timestamp;   /*!< Timestamp since boot of the first DMA buffer of the frame */
 } camera_fb_t;
 
+/**
+ * @brief JPEG frame size and frame buffer statistics
+ */
+typedef struct {
+    size_t fb_size;             /*!< Size of the JPEG frame buffers, adapted to the frames with CONFIG_CAMERA_JPEG_FB_ADAPTIVE */
+    size_t size_pct;            /*!< Recent JPEG frame size at the configured percentile */
+    size_t size_max;            /*!< Largest JPEG frame */
+    uint32_t frames;            /*!< JPEG frames measured */
+    uint32_t overflows;         /*!< Frames dropped because they did not fit into their frame buffer */
+    uint32_t resizes;           /*!< Frame buffers reallocated to a new size */
+    uint32_t dropped;           /*!< Waiting frames dropped for newer ones (CAMERA_GRAB_LATEST) */
+} camera_fb_stats_t;
+
+#define CAMERA_TELEMETRY_SIZE_BUCKETS   10
+
+/**
+ * @brief Path of one frame through the capture pipeline (CONFIG_CAMERA_TELEMETRY)
+ *
+ * Stage times are microseconds after vsync_us, 0 if the frame did not get there.
+ */
+typedef struct {
+    int64_t vsync_us;           /*!< esp_timer time cam_task started the frame at its VSYNC */
+    uint32_t first_eof_us;      /*!< First DMA buffer of the frame received */
+    uint32_t end_us;            /*!< VSYNC ending the frame received */
+    uint32_t ready_us;          /*!< Frame complete and waiting for the application */
+    uint32_t taken_us;          /*!< Returned by esp_camera_fb_get() */
+    uint32_t returned_us;       /*!< Given back with esp_camera_fb_return() */
+    uint32_t copy_us;           /*!< Time cam_task spent copying and scanning DMA buffers for it */
+    uint32_t len;               /*!< Frame length in bytes */
+} camera_frame_timing_t;
+
+/**
+ * @brief Average and longest duration of a pipeline stage over the recent frames
+ */
+typedef struct {
+    uint32_t avg_us;
+    uint32_t max_us;
+} camera_stage_stats_t;
+
+/**
+ * @brief Capture pipeline counters and timings (CONFIG_CAMERA_TELEMETRY)
+ */
+typedef struct {
+    uint32_t frames;            /*!< Frames handed to the application */
+    uint32_t ev_ovf;            /*!< DMA events lost because cam_task fell behind (EV-OVF) */
+    uint32_t fb_ovf;            /*!< Frames that did not fit into their frame buffer (FB-OVF) */
+    uint32_t no_soi;            /*!< JPEG frames without a start marker */
+    uint32_t no_eoi;            /*!< JPEG frames without an end marker (NO-EOI) */
+    uint32_t fb_size_err;       /*!< Raw frames of the wrong size (FB-SIZE) */
+    uint32_t dropped;           /*!< Waiting frames dropped for newer ones */
+    uint32_t timeouts;          /*!< esp_camera_fb_get() calls that got no frame */
+    float fps;                  /*!< Frames handed to the application per second, recent average */
+    uint32_t history;           /*!< Recent returned frames the stage statistics are taken from */
+    camera_stage_stats_t receive;   /*!< VSYNC to VSYNC: the sensor sending the frame */
+    camera_stage_stats_t process;   /*!< Last VSYNC to ready: the last copy and the end marker search */
+    camera_stage_stats_t wait;      /*!< Ready to esp_camera_fb_get() returning it */
+    camera_stage_stats_t hold;      /*!< esp_camera_fb_get() to esp_camera_fb_return() */
+    camera_stage_stats_t copy;      /*!< cam_task copy and scan time */
+    uint32_t size_hist[CAMERA_TELEMETRY_SIZE_BUCKETS]; /*!< Frames by length: bucket 0 below 4 KB, bucket i below 4 KB << i,
+                                                            the last bucket all larger frames */
+} camera_telemetry_t;
+
 #define ESP_ERR_CAMERA_BASE 0x20000
 #define ESP_ERR_CAMERA_NOT_DETECTED             (ESP_ERR_CAMERA_BASE + 1)
 #define ESP_ERR_CAMERA_FAILED_TO_SET_FRAME_SIZE (ESP_ERR_CAMERA_BASE + 2)
@@ -242,6 +304,42 @@ esp_err_t esp_camera_load_from_nvs(const char *key);
  */
 void esp_camera_return_all(void);
 
+/**
+ * @brief Get the JPEG frame size and frame buffer statistics
+ *
+ * @param stats  Filled with the statistics
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_STATE if the driver hasn't been initialized yet
+ */
+esp_err_t esp_camera_get_fb_stats(camera_fb_stats_t *stats);
+
+/**
+ * @brief Get the capture pipeline counters and stage timings
+ *
+ * @param telemetry  Filled with the counters and timings
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_STATE if the driver hasn't been initialized yet
+ *      - ESP_ERR_NOT_SUPPORTED if CONFIG_CAMERA_TELEMETRY is off
+ */
+esp_err_t esp_camera_get_telemetry(camera_telemetry_t *telemetry);
+
+/**
+ * @brief Get the timings of the most recently returned frames, oldest first
+ *
+ * @param timings  Array of count entries
+ * @param count    Entries in timings, set to the number filled in
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_STATE if the driver hasn't been initialized yet
+ *      - ESP_ERR_NOT_SUPPORTED if CONFIG_CAMERA_TELEMETRY is off
+ */
+esp_err_t esp_camera_get_frame_timings(camera_frame_timing_t *timings, size_t *count);
+
 
 #ifdef __cplusplus
 }
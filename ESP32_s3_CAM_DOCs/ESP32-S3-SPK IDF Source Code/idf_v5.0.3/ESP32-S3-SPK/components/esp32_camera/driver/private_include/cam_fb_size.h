@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CAM_FB_SIZE_BUCKETS     64      /* histogram buckets between 0 and the size limit */
+#define CAM_FB_SIZE_WINDOW      512     /* frames after which the histogram is halved, so old scenes fade out */
+#define CAM_FB_SIZE_INTERVAL    32      /* frames between two target updates */
+#define CAM_FB_SIZE_GRANULE     1024    /* frame buffer sizes are multiples of this (the JPEG DMA half buffer) */
+
+/**
+ * @brief JPEG frame size statistics and the frame buffer size they ask for
+ *
+ * Frame sizes go into a histogram that forgets old frames. Every CAM_FB_SIZE_INTERVAL frames
+ * the target buffer size becomes the configured percentile of it plus headroom. The target
+ * grows at once but only shrinks by more than a quarter, so buffers are not reallocated for
+ * small changes. A frame that did not fit grows the target by half right away.
+ */
+typedef struct {
+    uint16_t hist[CAM_FB_SIZE_BUCKETS]; /*!< The last bucket also counts every larger frame */
+    uint32_t hist_total;
+    uint32_t bucket_size;
+    size_t size_min;                    /*!< Bounds of the target */
+    size_t size_limit;
+    size_t target;                      /*!< Size the frame buffers should have */
+    size_t size_pct;                    /*!< Frame size at the percentile at the last update */
+    size_t size_max;                    /*!< Largest frame seen */
+    uint32_t frames;                    /*!< Frames measured */
+    uint32_t overflows;                 /*!< Frames that did not fit into their buffer */
+    uint32_t since_update;
+    uint8_t percentile;
+    uint8_t headroom;                   /*!< Percent added to the percentile size */
+} cam_fb_size_t;
+
+/**
+ * @brief Start with buffers of initial bytes, never grow beyond limit
+ */
+void cam_fb_size_init(cam_fb_size_t *s, size_t initial, size_t limit, uint8_t percentile, uint8_t headroom);
+
+/**
+ * @brief A JPEG frame of len bytes was received
+ *
+ * @return true when the target changed
+ */
+bool cam_fb_size_add(cam_fb_size_t *s, size_t len);
+
+/**
+ * @brief A frame did not fit into a buffer of fb_size bytes and was dropped
+ *
+ * @return true when the target changed
+ */
+bool cam_fb_size_overflow(cam_fb_size_t *s, size_t fb_size);
+
+#ifdef __cplusplus
+}
+#endif
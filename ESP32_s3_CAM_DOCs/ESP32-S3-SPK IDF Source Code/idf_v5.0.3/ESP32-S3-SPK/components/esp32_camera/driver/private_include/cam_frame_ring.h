@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Owner of a frame buffer
+ */
+typedef enum {
+    CAM_FRAME_FREE = 0,     /*!< Unused, cam_task may fill it */
+    CAM_FRAME_FILL,         /*!< cam_task is receiving into it */
+    CAM_FRAME_READY,        /*!< Complete, waiting for a consumer */
+    CAM_FRAME_TAKEN,        /*!< Held by the application */
+} cam_frame_state_t;
+
+#define CAM_FRAME_STATE_BITS    2
+#define CAM_FRAME_STATE_MASK    ((1 << CAM_FRAME_STATE_BITS) - 1)
+
+/**
+ * @brief Frame buffer ownership without locks or queues
+ *
+ * Every frame has one tag word holding its state and, for ready frames, the sequence
+ * number it was published with. Ownership moves only by compare-and-swap of the whole
+ * tag, so a frame is never owned twice and a stale tag (a frame dropped and published
+ * again in between) never matches. cam_task is the only producer, any task may take
+ * and give frames. Consumers take the ready frame with the lowest sequence number.
+ * When more than ready_max frames would be ready, the producer drops the oldest.
+ */
+typedef struct {
+    uint32_t *tag;          /*!< count words, only accessed atomically */
+    uint32_t count;
+    uint32_t ready_max;     /*!< Frames that may wait for a consumer at once */
+    uint32_t seq;           /*!< Sequence number of the next frame, only the producer writes it */
+    uint32_t dropped;       /*!< Producer only: ready frames dropped for newer ones */
+} cam_frame_ring_t;
+
+/**
+ * @brief Set up count frames with the tag words in tags, all of them free
+ */
+void cam_frame_ring_init(cam_frame_ring_t *r, uint32_t *tags, uint32_t count, uint32_t ready_max);
+
+/**
+ * @brief Producer: get a frame to receive into
+ *
+ * @param hint  Frame the producer used last. It is kept when it was not published.
+ *
+ * @return Frame index, -1 if every frame is ready or taken
+ */
+int cam_frame_ring_acquire(cam_frame_ring_t *r, int hint);
+
+/**
+ * @brief Producer: hand the filled frame to the consumers
+ *
+ * @return Number of older ready frames dropped to make room
+ */
+uint32_t cam_frame_ring_publish(cam_frame_ring_t *r, int pos);
+
+/**
+ * @brief Consumer: take the oldest ready frame
+ *
+ * @return Frame index, -1 if no frame is ready
+ */
+int cam_frame_ring_take(cam_frame_ring_t *r);
+
+/**
+ * @brief Consumer: give a taken frame back
+ *
+ * @return false if the frame was not taken (returned twice)
+ */
+bool cam_frame_ring_give(cam_frame_ring_t *r, int pos);
+
+/**
+ * @brief Give back every taken frame
+ */
+void cam_frame_ring_give_all(cam_frame_ring_t *r);
+
+cam_frame_state_t cam_frame_ring_state(const cam_frame_ring_t *r, int pos);
+
+#ifdef __cplusplus
+}
+#endif
@@ -57,6 +57,12 @@ void cam_give(camera_fb_t *dma_buffer);
 
 void cam_give_all(void);
 
+void cam_get_fb_stats(camera_fb_stats_t *stats);
+
+esp_err_t cam_get_telemetry(camera_telemetry_t *telemetry);
+
+esp_err_t cam_get_frame_timings(camera_frame_timing_t *timings, size_t *count);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Follows the JPEG marker structure of a frame while it is received
+ *
+ * Segment payloads are skipped by their length and entropy coded data is searched
+ * a word at a time, so the real EOI is found, not some 0xFFD9 in a table or in
+ * stale DMA data behind the frame, and nothing behind it is ever read.
+ */
+typedef struct {
+    uint32_t pos;       /*!< Offset of the next byte to look at */
+    uint32_t skip;      /*!< Segment payload bytes left to skip */
+    int32_t eoi;        /*!< Offset of the EOI marker, -1 while not found */
+    uint8_t state;
+    uint8_t marker;     /*!< Marker whose segment length is being read */
+} cam_jpeg_scan_t;
+
+/**
+ * @brief Offset of the first 0xFF in inbuf[start, end), end when there is none
+ */
+uint32_t cam_jpeg_find_ff(const uint8_t *inbuf, uint32_t start, uint32_t end);
+
+/**
+ * @brief Offset of the first SOI marker in inbuf[0, length), -1 when there is none
+ */
+int cam_jpeg_find_soi(const uint8_t *inbuf, uint32_t length);
+
+/**
+ * @brief Offset of the last EOI marker in inbuf[0, length), searched backwards, -1 when there is none
+ */
+int cam_jpeg_find_eoi(const uint8_t *inbuf, uint32_t length);
+
+/**
+ * @brief Start following a new frame from its first byte
+ */
+void cam_jpeg_scan_reset(cam_jpeg_scan_t *scan);
+
+/**
+ * @brief Start following a frame inside its entropy coded data at offset pos
+ */
+void cam_jpeg_scan_entropy(cam_jpeg_scan_t *scan, uint32_t pos);
+
+/**
+ * @brief Walk inbuf[scan->pos, end), the part of the frame received since the last call
+ *
+ * @return true once the EOI is known, its offset is in scan->eoi
+ */
+bool cam_jpeg_scan(cam_jpeg_scan_t *scan, const uint8_t *inbuf, uint32_t end);
+
+#ifdef __cplusplus
+}
+#endif
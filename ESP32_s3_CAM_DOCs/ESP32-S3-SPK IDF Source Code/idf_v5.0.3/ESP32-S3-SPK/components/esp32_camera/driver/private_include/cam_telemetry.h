@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_camera.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CAM_TELEMETRY_HISTORY   32      /* returned frames whose timings are kept */
+
+/**
+ * @brief One history entry. seq is odd while the entry is written, so readers can skip it.
+ */
+typedef struct {
+    uint32_t seq;
+    camera_frame_timing_t timing;
+} cam_telemetry_slot_t;
+
+/**
+ * @brief Capture pipeline counters and the timings of the last returned frames
+ *
+ * Counters are bumped with atomic adds, from cam_task, the VSYNC/DMA interrupt and the
+ * tasks taking frames. Frames are written into the history when they are given back, by
+ * whichever task does that, without a lock: every writer claims its own slot.
+ */
+typedef struct {
+    uint32_t frames;
+    uint32_t ev_ovf;
+    uint32_t fb_ovf;
+    uint32_t no_soi;
+    uint32_t no_eoi;
+    uint32_t fb_size_err;
+    uint32_t timeouts;
+    uint32_t size_hist[CAMERA_TELEMETRY_SIZE_BUCKETS];
+    int64_t last_vsync_us;              /*!< cam_task only: start of the last published frame */
+    uint32_t period_us;                 /*!< cam_task only: recent average time between published frames */
+    uint32_t head;                      /*!< History entries written so far */
+    cam_telemetry_slot_t slot[CAM_TELEMETRY_HISTORY];
+} cam_telemetry_t;
+
+#if CONFIG_CAMERA_TELEMETRY
+#define CAM_TELEMETRY_COUNT(t, counter)     __atomic_fetch_add(&(t)->counter, 1, __ATOMIC_RELAXED)
+#else
+#define CAM_TELEMETRY_COUNT(t, counter)     do { } while (0)
+#endif
+
+void cam_telemetry_init(cam_telemetry_t *t);
+
+/**
+ * @brief cam_task handed a frame of len bytes to the application
+ */
+void cam_telemetry_frame(cam_telemetry_t *t, const camera_frame_timing_t *timing, size_t len);
+
+/**
+ * @brief A frame was given back, keep its timings
+ */
+void cam_telemetry_commit(cam_telemetry_t *t, const camera_frame_timing_t *timing);
+
+/**
+ * @brief Copy up to count of the kept timings into out, oldest first
+ *
+ * @return Number of timings copied
+ */
+size_t cam_telemetry_history(const cam_telemetry_t *t, camera_frame_timing_t *out, size_t count);
+
+/**
+ * @brief Counters plus stage statistics over the kept timings
+ */
+void cam_telemetry_summary(const cam_telemetry_t *t, camera_telemetry_t *out);
+
+#ifdef __cplusplus
+}
+#endif
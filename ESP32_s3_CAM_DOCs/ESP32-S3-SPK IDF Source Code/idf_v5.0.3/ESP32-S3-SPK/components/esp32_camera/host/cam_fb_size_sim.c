@@ -0,0 +1,208 @@
+// Frame buffer sizing simulation: runs synthetic JPEG frame size traces, or one read from a file,
+// through driver/cam_fb_size.c as cam_hal does with CAMERA_JPEG_FB_ADAPTIVE. The buffers take the
+// target size when they are given back. Prints the frames that overflowed, the reallocations and
+// the memory the buffers took against the frames they held, and checks each synthetic trace
+// against what the sizing promises.
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include "sdkconfig.h"
+#include "cam_fb_size.h"
+
+#define SIM_BUFFERS_MAX 8
+
+typedef struct {
+    uint32_t frames;
+    uint32_t overflows;
+    uint32_t resizes;
+    uint64_t frame_bytes;       // of the frames that fit
+    uint64_t buffer_bytes;      // of all the buffers, summed per frame
+    size_t target;
+} sim_result_t;
+
+static uint32_t s_rand = 1;
+
+// xorshift32, every run gives the same traces
+static uint32_t sim_rand(void)
+{
+    s_rand ^= s_rand << 13;
+    s_rand ^= s_rand >> 17;
+    s_rand ^= s_rand << 5;
+    return s_rand;
+}
+
+// size with up to 10% noise, as JPEG frames of one scene
+static size_t sim_noisy(size_t size)
+{
+    return size - size / 10 + sim_rand() % (size / 5 + 1);
+}
+
+typedef struct {
+    const char *name;
+    const char *expect;
+    size_t (*size)(uint32_t n);
+    uint32_t frames;
+    // limits the run is checked against, 0 for none
+    uint32_t overflows_max;
+    uint32_t resizes_max;
+    size_t target_max;
+    double ratio_max;           // buffer memory per byte of frame
+} sim_trace_t;
+
+// a quiet scene, then a busy one at four times the size
+static size_t trace_growth(uint32_t n)
+{
+    return sim_noisy(n < 600 ? 15000 : 60000);
+}
+
+// a busy scene, then a quiet one
+static size_t trace_shrink(uint32_t n)
+{
+    return sim_noisy(n < 1200 ? 60000 : 15000);
+}
+
+// a steady scene with one frame in 400 three times as large, below the percentile
+static size_t trace_outliers(uint32_t n)
+{
+    return sim_noisy(sim_rand() % 400 == 0 ? 90000 : 30000);
+}
+
+// the scene slowly gets busier
+static size_t trace_ramp(uint32_t n)
+{
+    return sim_noisy(10000 + n * 20);
+}
+
+static const sim_trace_t s_traces[] = {
+    { "growth", "a few overflows until the target grew", trace_growth, 1800, 8, 12, 96 * 1024, 2.0 },
+    { "shrink", "the target follows the quiet scene down", trace_shrink, 6000, 0, 8, 24 * 1024, 3.0 },
+    { "outliers", "rare large frames are dropped, the target stays", trace_outliers, 4000, 20, 40, 56 * 1024, 1.8 },
+    { "ramp", "the target grows ahead of the frames", trace_ramp, 3000, 4, 40, 96 * 1024, 1.8 },
+};
+
+// Frames are received into the buffers in turn, each is given back and resized before its next frame
+static void sim_run(size_t (*size)(uint32_t n), FILE *file, uint32_t frames, size_t initial, size_t limit,
+                    uint32_t buffers, sim_result_t *res)
+{
+    cam_fb_size_t sizer;
+    size_t fb[SIM_BUFFERS_MAX];
+
+    cam_fb_size_init(&sizer, initial, limit, CONFIG_CAMERA_JPEG_FB_PERCENTILE, CONFIG_CAMERA_JPEG_FB_HEADROOM);
+    for (uint32_t i = 0; i < buffers; i++) {
+        fb[i] = sizer.target;
+    }
+    memset(res, 0, sizeof(*res));
+    for (uint32_t n = 0; file || n < frames; n++) {
+        size_t len;
+        if (file) {
+            unsigned long v;
+            if (fscanf(file, "%lu", &v) != 1) {
+                break;
+            }
+            len = v;
+        } else {
+            len = size(n);
+        }
+        size_t *buf = &fb[n % buffers];
+        res->frames++;
+        for (uint32_t i = 0; i < buffers; i++) {
+            res->buffer_bytes += fb[i];
+        }
+        if (len > *buf) {
+            res->overflows++;
+            cam_fb_size_overflow(&sizer, *buf);
+        } else {
+            res->frame_bytes += len;
+            cam_fb_size_add(&sizer, len);
+        }
+        if (*buf != sizer.target) {
+            *buf = sizer.target;
+            res->resizes++;
+        }
+    }
+    res->target = sizer.target;
+}
+
+// mean size of a buffer against the mean size of the frames that fit
+static double sim_ratio(const sim_result_t *res, uint32_t buffers)
+{
+    uint32_t fit = res->frames - res->overflows;
+    return fit ? (double)res->buffer_bytes / buffers / res->frames / ((double)res->frame_bytes / fit) : 0;
+}
+
+static void sim_print(const char *name, const sim_result_t *res, uint32_t buffers)
+{
+    printf("%-10s %5u frames  %4u overflowed  %4u resizes  final target %6zu  buffer/frame %.2f\n", name,
+           res->frames, res->overflows, res->resizes, res->target, sim_ratio(res, buffers));
+}
+
+static void sim_usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options] [sizes.txt]\n"
+            "  -i bytes     initial buffer size (96000, an SVGA JPEG buffer)\n"
+            "  -l bytes     largest buffer size (240000)\n"
+            "  -n count     frame buffers (2)\n"
+            "A file holds frame sizes in bytes, one per line, else the synthetic traces run.\n"
+            "Their limits are checked for the default buffers only.\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    size_t initial = 800 * 600 / 5, limit = 800 * 600 / 2;
+    uint32_t buffers = 2;
+    bool check = true;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:l:n:h")) != -1) {
+        check = false;
+        switch (opt) {
+            case 'i': initial = strtoul(optarg, NULL, 0); break;
+            case 'l': limit = strtoul(optarg, NULL, 0); break;
+            case 'n': buffers = strtoul(optarg, NULL, 0); break;
+            default:
+                sim_usage(argv[0]);
+                return 2;
+        }
+    }
+    if (argc - optind > 1 || buffers == 0 || buffers > SIM_BUFFERS_MAX || initial == 0 || limit < initial) {
+        sim_usage(argv[0]);
+        return 2;
+    }
+
+    printf("percentile %d, headroom %d%%, %u buffers of %zu bytes, at most %zu\n", CONFIG_CAMERA_JPEG_FB_PERCENTILE,
+           CONFIG_CAMERA_JPEG_FB_HEADROOM, buffers, initial, limit);
+    sim_result_t res;
+    if (optind < argc) {
+        FILE *f = fopen(argv[optind], "r");
+        if (!f) {
+            fprintf(stderr, "cannot open %s\n", argv[optind]);
+            return 1;
+        }
+        sim_run(NULL, f, 0, initial, limit, buffers, &res);
+        fclose(f);
+        sim_print(argv[optind], &res, buffers);
+        return 0;
+    }
+
+    int result = 0;
+    for (size_t t = 0; t < sizeof(s_traces) / sizeof(s_traces[0]); t++) {
+        const sim_trace_t *trace = &s_traces[t];
+        s_rand = 1;
+        sim_run(trace->size, NULL, trace->frames, initial, limit, buffers, &res);
+        sim_print(trace->name, &res, buffers);
+        if (check && ((trace->overflows_max && res.overflows > trace->overflows_max) ||
+            (!trace->overflows_max && res.overflows) ||
+            res.resizes > trace->resizes_max || res.target > trace->target_max ||
+            sim_ratio(&res, buffers) > trace->ratio_max)) {
+            printf("           expected %s: at most %u overflowed, %u resizes, a target of %zu, buffer/frame %.2f\n",
+                   trace->expect, trace->overflows_max, trace->resizes_max, trace->target_max, trace->ratio_max);
+            result = 1;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,195 @@
+// Stress test of the frame ring of driver/cam_frame_ring.c: a producer fills and publishes frames
+// as cam_task does while consumer threads take and give them back. Built with ThreadSanitizer, the
+// frame contents are plain memory, so a frame owned by two threads at once is reported as a race.
+// Checks that every published frame is taken at most once, that taken and dropped frames add up to
+// the published ones, that consumers see frames in order and that a frame cannot be given twice.
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include <getopt.h>
+#include "cam_frame_ring.h"
+
+namespace {
+
+struct stress_frame {
+    uint32_t id;        // number of the frame it holds, written by its owner only
+    uint32_t filling;   // set while the producer writes it
+};
+
+struct stress {
+    cam_frame_ring_t ring;
+    std::vector<uint32_t> tags;
+    std::vector<stress_frame> frames;
+    std::vector<std::atomic<uint32_t>> taken;  // times each frame id was taken
+    std::atomic<bool> done{false};
+    std::atomic<uint32_t> errors{0};
+    uint32_t published = 0;
+    uint32_t aborted = 0;
+    uint32_t stalls = 0;
+
+    stress(uint32_t count, uint32_t ready_max, uint32_t frames_total)
+        : tags(count), frames(count), taken(frames_total)
+    {
+        cam_frame_ring_init(&ring, tags.data(), count, ready_max);
+    }
+};
+
+void stress_error(stress &s, const char *fmt, uint32_t a, uint32_t b)
+{
+    if (s.errors.fetch_add(1) < 10) {
+        std::fprintf(stderr, fmt, a, b);
+    }
+}
+
+// cam_task: every eighth frame is abandoned and received again into the same buffer, as when
+// a JPEG frame has no EOI
+void stress_producer(stress &s, uint32_t frames_total)
+{
+    int pos = -1;
+    uint32_t id = 0, n = 0;
+    while (id < frames_total) {
+        pos = cam_frame_ring_acquire(&s.ring, pos);
+        if (pos < 0) {
+            s.stalls++;
+            std::this_thread::yield();
+            continue;
+        }
+        stress_frame &f = s.frames[pos];
+        f.filling = 1;
+        f.id = id;
+        f.filling = 0;
+        if (++n % 8 == 0) {
+            s.aborted++;
+            continue;
+        }
+        cam_frame_ring_publish(&s.ring, pos);
+        s.published++;
+        id++;
+        std::this_thread::yield();  // the next frame takes a while to arrive
+    }
+    s.done = true;
+}
+
+// esp_camera_fb_get() and esp_camera_fb_return()
+void stress_consumer(stress &s, uint32_t hold, uint32_t *count)
+{
+    uint32_t last = 0;
+    bool first = true;
+    while (true) {
+        // read done first: when it is set every frame is published and the ring is drained below
+        bool finished = s.done;
+        int pos = cam_frame_ring_take(&s.ring);
+        if (pos < 0) {
+            if (finished) {
+                return;
+            }
+            std::this_thread::yield();
+            continue;
+        }
+        stress_frame &f = s.frames[pos];
+        uint32_t id = f.id;
+        if (f.filling) {
+            stress_error(s, "frame %u in buffer %u taken while it is filled\n", id, pos);
+        }
+        if (id >= s.taken.size() || s.taken[id].fetch_add(1) != 0) {
+            stress_error(s, "frame %u in buffer %u taken twice\n", id, pos);
+        }
+        if (!first && id <= last) {
+            stress_error(s, "frame %u taken after frame %u\n", id, last);
+        }
+        first = false;
+        last = id;
+        for (uint32_t i = 0; i < hold; i++) {
+            std::this_thread::yield();
+        }
+        f.id = UINT32_MAX;
+        if (!cam_frame_ring_give(&s.ring, pos)) {
+            stress_error(s, "buffer %u could not be given back%.0u\n", pos, 0);
+        }
+        (*count)++;
+    }
+}
+
+void stress_usage(const char *prog)
+{
+    std::fprintf(stderr,
+                 "usage: %s [options]\n"
+                 "  -b buffers   frame buffers (3)\n"
+                 "  -r ready     frames that may wait for a consumer (buffers - 1)\n"
+                 "  -c consumers consumer threads (3)\n"
+                 "  -f frames    frames to publish (200000)\n"
+                 "  -y yields    yields a consumer holds a frame for (2)\n",
+                 prog);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    uint32_t buffers = 3, ready_max = 0, consumers = 3, frames_total = 200000, hold = 2;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:r:c:f:y:h")) != -1) {
+        switch (opt) {
+            case 'b': buffers = std::strtoul(optarg, NULL, 0); break;
+            case 'r': ready_max = std::strtoul(optarg, NULL, 0); break;
+            case 'c': consumers = std::strtoul(optarg, NULL, 0); break;
+            case 'f': frames_total = std::strtoul(optarg, NULL, 0); break;
+            case 'y': hold = std::strtoul(optarg, NULL, 0); break;
+            default:
+                stress_usage(argv[0]);
+                return 2;
+        }
+    }
+    if (optind != argc || buffers < 2 || consumers == 0 || frames_total == 0) {
+        stress_usage(argv[0]);
+        return 2;
+    }
+    if (ready_max == 0) {
+        ready_max = buffers - 1;
+    }
+
+    stress s(buffers, ready_max, frames_total);
+    std::vector<uint32_t> counts(consumers);
+    std::vector<std::thread> threads;
+    for (uint32_t i = 0; i < consumers; i++) {
+        threads.emplace_back(stress_consumer, std::ref(s), hold, &counts[i]);
+    }
+    threads.emplace_back(stress_producer, std::ref(s), frames_total);
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    uint32_t taken = 0;
+    for (uint32_t c : counts) {
+        taken += c;
+    }
+    for (uint32_t x = 0; x < buffers; x++) {
+        cam_frame_state_t state = cam_frame_ring_state(&s.ring, x);
+        if (state == CAM_FRAME_READY || state == CAM_FRAME_TAKEN) {
+            stress_error(s, "buffer %u left in state %u\n", x, state);
+        }
+    }
+    // with every thread done a frame given back twice is noticed, and it stays free
+    int pos = cam_frame_ring_acquire(&s.ring, -1);
+    cam_frame_ring_publish(&s.ring, pos);
+    pos = cam_frame_ring_take(&s.ring);
+    if (pos < 0 || !cam_frame_ring_give(&s.ring, pos) || cam_frame_ring_give(&s.ring, pos) ||
+        cam_frame_ring_state(&s.ring, pos) != CAM_FRAME_FREE) {
+        stress_error(s, "buffer %u given back twice%.0u\n", pos, 0);
+    }
+    if (taken + s.ring.dropped != s.published) {
+        stress_error(s, "%u frames taken and dropped of %u published\n", taken + s.ring.dropped, s.published);
+    }
+    std::printf("%u buffers, %u ready, %u consumers: %u frames published, %u abandoned, %u taken, %u dropped, "
+                "%u producer stalls\n",
+                buffers, ready_max, consumers, s.published, s.aborted, taken, s.ring.dropped, s.stalls);
+    if (s.errors) {
+        std::printf("%u errors\n", s.errors.load());
+        return 1;
+    }
+    return 0;
+}
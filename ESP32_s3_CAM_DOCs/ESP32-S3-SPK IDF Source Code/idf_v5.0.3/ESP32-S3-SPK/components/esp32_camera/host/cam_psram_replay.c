@@ -0,0 +1,248 @@
+// Replay of JPEG frames laid out at the edges of the DMA half buffers of PSRAM mode, where
+// the DMA writes the frame buffers and cam_hal only looks at the last half buffer for the EOI.
+// Each case pads a JPEG with a comment segment so that its EOI lands where the case wants it,
+// plays the frames through the simulated LCD_CAM/GDMA and checks that every frame
+// esp_camera_fb_get() returns ends at its EOI and is byte for byte the padded JPEG.
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_camera.h"
+#include "img_converters.h"
+#include "cam_sim.h"
+
+#define REPLAY_HALF         1024    // DMA half buffer of PSRAM JPEG mode
+#define REPLAY_FB_SIZE      (320 * 240 / 5)
+#define REPLAY_FRAMES_MAX   4
+
+typedef struct {
+    int32_t end;        // frame length in half buffers plus this many bytes, the EOI is its last two
+    uint32_t pad;       // 0xFF bytes the sensor sends after the EOI
+} replay_frame_t;
+
+typedef struct {
+    const char *name;
+    replay_frame_t frames[REPLAY_FRAMES_MAX];
+    bool dropped;       // the frames do not fit, none may be returned
+} replay_case_t;
+
+// frame ends are counted from the end of the half buffers the JPEG fills with its comment segment,
+// -1 ends the frame at the end of the frame buffer
+static const replay_case_t s_cases[] = {
+    { "EOI in the last 2 bytes of a half", { { 1024, 0 } } },
+    { "EOI split across halves", { { 1025, 0 } } },
+    { "EOI in the middle of a half", { { 1500, 0 } } },
+    { "EOI followed by 0xFF padding", { { 1014, 300 } } },
+    { "EOI ending a half, a half of padding", { { 1024, 1024 } } },
+    { "EOI split, padding into the next half", { { 1025, 1100 } } },
+    { "shorter frames over longer ones", { { 4000, 0 }, { 1025, 0 }, { 3024, 200 }, { 1024, 0 } } },
+    { "EOI at the end of the frame buffer", { { -1, 0 } } },
+    { "padding past the end of the frame buffer", { { -1, 100 } }, true },
+};
+#define REPLAY_CASES (sizeof(s_cases) / sizeof(s_cases[0]))
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+} replay_buf_t;
+
+static size_t replay_write(void *arg, size_t index, const void *data, size_t len)
+{
+    replay_buf_t *buf = (replay_buf_t *)arg;
+    uint8_t *p = (uint8_t *)realloc(buf->data, index + len);
+    if (!p) {
+        return 0;
+    }
+    buf->data = p;
+    memcpy(p + index, data, len);
+    buf->len = index + len;
+    return len;
+}
+
+// a QVGA JPEG of a noisy gradient, small enough to leave room for padding in the frame buffer
+static bool replay_encode(replay_buf_t *jpg)
+{
+    enum { W = 320, H = 240 };
+    uint8_t *rgb = (uint8_t *)malloc(W * H * 3);
+    if (!rgb) {
+        return false;
+    }
+    srand(1);
+    for (size_t i = 0; i < W * H; i++) {
+        rgb[i * 3] = i % W * 255 / W + rand() % 16;
+        rgb[i * 3 + 1] = i / W * 255 / H + rand() % 16;
+        rgb[i * 3 + 2] = rand() % 64;
+    }
+    memset(jpg, 0, sizeof(*jpg));
+    bool ok = fmt2jpg_cb(rgb, W * H * 3, W, H, PIXFORMAT_RGB888, 20, replay_write, jpg);
+    free(rgb);
+    return ok;
+}
+
+// jpg grown to len bytes by a comment segment behind the SOI, then pad 0xFF bytes
+static uint8_t *replay_frame(const replay_buf_t *jpg, size_t len, size_t pad)
+{
+    size_t com = len - jpg->len;
+    uint8_t *frame = (uint8_t *)malloc(len + pad);
+    if (!frame) {
+        return NULL;
+    }
+    memcpy(frame, jpg->data, 2);
+    frame[2] = 0xFF;
+    frame[3] = 0xFE;
+    frame[4] = (com - 2) >> 8;
+    frame[5] = com - 2;
+    memset(frame + 6, 'c', com - 4);
+    memcpy(frame + 2 + com, jpg->data + 2, jpg->len - 2);
+    memset(frame + len, 0xFF, pad);
+    return frame;
+}
+
+static int replay_case(const replay_case_t *c, const replay_buf_t *jpg, uint32_t seconds)
+{
+    uint8_t *frame[REPLAY_FRAMES_MAX] = { 0 };
+    size_t len[REPLAY_FRAMES_MAX] = { 0 };
+    char path[REPLAY_FRAMES_MAX][32];
+    const char *paths[REPLAY_FRAMES_MAX];
+    size_t count = 0, base = (jpg->len + 4 + REPLAY_HALF - 1) / REPLAY_HALF * REPLAY_HALF;
+    int failed = 0;
+
+    for (; count < REPLAY_FRAMES_MAX && c->frames[count].end; count++) {
+        const replay_frame_t *f = &c->frames[count];
+        len[count] = f->end < 0 ? REPLAY_FB_SIZE : base + f->end;
+        if (len[count] > REPLAY_FB_SIZE) {
+            fprintf(stderr, "%s: the JPEG of %zu bytes is too large\n", c->name, jpg->len);
+            exit(1);
+        }
+        frame[count] = replay_frame(jpg, len[count], f->pad);
+        snprintf(path[count], sizeof(path[count]), "psram_replay_%zu.jpg", count);
+        paths[count] = path[count];
+        FILE *file = fopen(path[count], "wb");
+        if (!frame[count] || !file || fwrite(frame[count], 1, len[count] + f->pad, file) != len[count] + f->pad) {
+            fprintf(stderr, "cannot write %s\n", path[count]);
+            exit(1);
+        }
+        fclose(file);
+    }
+
+    cam_sim_config_t sim = {
+        .frames = paths,
+        .frame_count = count,
+        .loop = true,
+        .fps = 20,
+        .vblank_us = 1000,
+        .seed = 1,
+    };
+    camera_config_t config = {
+        .pin_pwdn = -1,
+        .pin_reset = -1,
+        .pin_xclk = -1,
+        .pin_sccb_sda = -1,
+        .pin_sccb_scl = -1,
+        .pin_d7 = -1, .pin_d6 = -1, .pin_d5 = -1, .pin_d4 = -1,
+        .pin_d3 = -1, .pin_d2 = -1, .pin_d1 = -1, .pin_d0 = -1,
+        .pin_vsync = -1,
+        .pin_href = -1,
+        .pin_pclk = -1,
+        .xclk_freq_hz = 16000000,   // PSRAM mode
+        .pixel_format = PIXFORMAT_JPEG,
+        .frame_size = FRAMESIZE_QVGA,
+        .jpeg_quality = 12,
+        .fb_count = 2,
+        .fb_location = CAMERA_FB_IN_PSRAM,
+        .grab_mode = CAMERA_GRAB_WHEN_EMPTY,
+    };
+    if (cam_sim_set_config(&sim) != ESP_OK || esp_camera_init(&config) != ESP_OK) {
+        fprintf(stderr, "%s: camera init failed\n", c->name);
+        exit(1);
+    }
+
+    uint32_t taken = 0, wrong = 0;
+    int64_t end = esp_timer_get_time() + seconds * 1000000LL;
+    while (esp_timer_get_time() < end) {
+        camera_fb_t *fb = esp_camera_fb_get();
+        if (!fb) {
+            continue;
+        }
+        taken++;
+        bool match = false;
+        for (size_t i = 0; i < count && !match; i++) {
+            match = fb->len == len[i] && memcmp(fb->buf, frame[i], len[i]) == 0;
+        }
+        if (!match && wrong++ < 3) {
+            size_t at = 0;
+            while (at < fb->len && at < len[0] && fb->buf[at] == frame[0][at]) {
+                at++;
+            }
+            printf("  a %zu byte frame is none of the frames sent, it differs from the first one at byte %zu\n", fb->len, at);
+        }
+        esp_camera_fb_return(fb);
+    }
+    cam_sim_stats_t sent;
+    camera_fb_stats_t fb_stats;
+    cam_sim_get_stats(&sent);
+    esp_camera_get_fb_stats(&fb_stats);
+    esp_camera_deinit();
+
+    printf("%-42s", c->name);
+    for (size_t i = 0; i < count; i++) {
+        printf(" %zu+%u", len[i], c->frames[i].pad);
+    }
+    printf(" bytes: %u sent, %u taken, %u wrong, %u overflowed\n", sent.frames, taken, wrong, fb_stats.overflows);
+    if (wrong || (c->dropped ? taken != 0 : (fb_stats.overflows || taken < sent.frames / 2))) {
+        printf("  expected %s\n", c->dropped ? "every frame dropped" : "every frame returned as it was sent");
+        failed = 1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        remove(path[i]);
+        free(frame[i]);
+    }
+    return failed;
+}
+
+static void replay_usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -t seconds   run time of each case (1)\n"
+            "  -v           driver log, repeat for more\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t seconds = 1;
+    int opt;
+
+    esp_timer_get_time();
+    host_log_level = ESP_LOG_NONE;
+    while ((opt = getopt(argc, argv, "t:vh")) != -1) {
+        switch (opt) {
+            case 't': seconds = strtoul(optarg, NULL, 0); break;
+            case 'v': host_log_level++; break;
+            default:
+                replay_usage(argv[0]);
+                return 2;
+        }
+    }
+    if (optind != argc || seconds == 0) {
+        replay_usage(argv[0]);
+        return 2;
+    }
+
+    replay_buf_t jpg;
+    if (!replay_encode(&jpg)) {
+        fprintf(stderr, "cannot encode the JPEG\n");
+        return 1;
+    }
+    int failed = 0;
+    for (size_t i = 0; i < REPLAY_CASES; i++) {
+        failed += replay_case(&s_cases[i], &jpg, seconds);
+    }
+    free(jpg.data);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,299 @@
+// Capture benchmark on the simulated camera: frame rate, latency and drop rate of the
+// driver while consumer tasks take frames as an application does.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <sys/resource.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_camera.h"
+#include "cam_sim.h"
+
+#define BENCH_CONSUMERS_MAX     8
+
+typedef struct {
+    uint32_t hold_ms;           // time a frame is held, as if it was processed
+    uint32_t taken;
+    uint32_t corrupt;           // JPEG frames that differ from every recorded frame
+    uint32_t *latency_us;       // VSYNC to esp_camera_fb_get() returning, per frame
+    size_t latency_cap;
+    volatile bool stop;
+    SemaphoreHandle_t done;
+} bench_consumer_t;
+
+static bool bench_frame_matches(const camera_fb_t *fb)
+{
+    size_t len;
+    const uint8_t *data;
+    for (size_t n = 0; (data = cam_sim_frame(n, &len)) != NULL; n++) {
+        if (len == fb->len && memcmp(data, fb->buf, len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void bench_consumer_task(void *arg)
+{
+    bench_consumer_t *c = (bench_consumer_t *)arg;
+    while (!c->stop) {
+        camera_fb_t *fb = esp_camera_fb_get();
+        if (fb == NULL) {
+            continue;
+        }
+        int64_t vsync_us = (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+        uint32_t latency = esp_timer_get_time() - vsync_us;
+        if (c->taken == c->latency_cap) {
+            c->latency_cap = c->latency_cap ? 2 * c->latency_cap : 1024;
+            c->latency_us = (uint32_t *)realloc(c->latency_us, c->latency_cap * sizeof(uint32_t));
+        }
+        c->latency_us[c->taken++] = latency;
+        if (fb->format == PIXFORMAT_JPEG && !bench_frame_matches(fb)) {
+            c->corrupt++;
+        }
+        if (c->hold_ms) {
+            vTaskDelay(c->hold_ms / portTICK_PERIOD_MS);
+        }
+        esp_camera_fb_return(fb);
+    }
+    xSemaphoreGive(c->done);
+    vTaskDelete(NULL);
+}
+
+static int bench_cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// CPU time of all threads of the process: the driver, the simulated sensor and the consumers
+static int64_t bench_cpu_us(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (int64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static void bench_stage(const char *name, const camera_stage_stats_t *stage)
+{
+    printf("  %-8s avg %6" PRIu32 " us  max %6" PRIu32 " us\n", name, stage->avg_us, stage->max_us);
+}
+
+static void bench_usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options] frame_file...\n"
+            "  -f fps       sensor frame rate (25)\n"
+            "  -r bytes     bytes per second while a frame is sent, 0 to spread it over the period (0)\n"
+            "  -b us        blanking after VSYNC and after the last byte (1000)\n"
+            "  -j us        VSYNC jitter (0)\n"
+            "  -S seed      jitter seed (1)\n"
+            "  -s WxH       frame size (800x600)\n"
+            "  -F format    jpeg, yuv422, rgb565 or gray (jpeg)\n"
+            "  -n count     frame buffers (2)\n"
+            "  -l           CAMERA_GRAB_LATEST instead of CAMERA_GRAB_WHEN_EMPTY\n"
+            "  -p           PSRAM mode, the DMA writes the frame buffers (16 MHz XCLK)\n"
+            "  -t seconds   run time (10)\n"
+            "  -w ms        time each frame is held by the consumer (0)\n"
+            "  -c count     consumer tasks (1)\n"
+            "  -v           driver log, repeat for more\n",
+            prog);
+}
+
+static bool bench_parse_size(const char *arg, framesize_t *size)
+{
+    unsigned w, h;
+    if (sscanf(arg, "%ux%u", &w, &h) != 2) {
+        return false;
+    }
+    for (int i = 0; i < FRAMESIZE_INVALID; i++) {
+        if (resolution[i].width == w && resolution[i].height == h) {
+            *size = (framesize_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool bench_parse_format(const char *arg, pixformat_t *format)
+{
+    static const struct {
+        const char *name;
+        pixformat_t format;
+    } formats[] = {
+        {"jpeg", PIXFORMAT_JPEG},
+        {"yuv422", PIXFORMAT_YUV422},
+        {"rgb565", PIXFORMAT_RGB565},
+        {"gray", PIXFORMAT_GRAYSCALE},
+    };
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        if (strcmp(arg, formats[i].name) == 0) {
+            *format = formats[i].format;
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char **argv)
+{
+    cam_sim_config_t sim = {
+        .loop = true,
+        .fps = 25,
+        .vblank_us = 1000,
+        .seed = 1,
+    };
+    camera_config_t config = {
+        .pin_pwdn = -1,
+        .pin_reset = -1,
+        .pin_xclk = -1,
+        .pin_sccb_sda = -1,
+        .pin_sccb_scl = -1,
+        .pin_d7 = -1, .pin_d6 = -1, .pin_d5 = -1, .pin_d4 = -1,
+        .pin_d3 = -1, .pin_d2 = -1, .pin_d1 = -1, .pin_d0 = -1,
+        .pin_vsync = -1,
+        .pin_href = -1,
+        .pin_pclk = -1,
+        .xclk_freq_hz = 20000000,
+        .pixel_format = PIXFORMAT_JPEG,
+        .frame_size = FRAMESIZE_SVGA,
+        .jpeg_quality = 12,
+        .fb_count = 2,
+        .fb_location = CAMERA_FB_IN_PSRAM,
+        .grab_mode = CAMERA_GRAB_WHEN_EMPTY,
+    };
+    uint32_t seconds = 10, hold_ms = 0, consumers = 1;
+    int opt;
+
+    esp_timer_get_time();
+    while ((opt = getopt(argc, argv, "f:r:b:j:S:s:F:n:lpt:w:c:vh")) != -1) {
+        switch (opt) {
+            case 'f': sim.fps = strtoul(optarg, NULL, 0); break;
+            case 'r': sim.byte_rate = strtoul(optarg, NULL, 0); break;
+            case 'b': sim.vblank_us = strtoul(optarg, NULL, 0); break;
+            case 'j': sim.jitter_us = strtoul(optarg, NULL, 0); break;
+            case 'S': sim.seed = strtoul(optarg, NULL, 0); break;
+            case 's':
+                if (!bench_parse_size(optarg, &config.frame_size)) {
+                    fprintf(stderr, "unknown frame size %s\n", optarg);
+                    return 2;
+                }
+                break;
+            case 'F':
+                if (!bench_parse_format(optarg, &config.pixel_format)) {
+                    fprintf(stderr, "unknown format %s\n", optarg);
+                    return 2;
+                }
+                break;
+            case 'n': config.fb_count = strtoul(optarg, NULL, 0); break;
+            case 'l': config.grab_mode = CAMERA_GRAB_LATEST; break;
+            case 'p': config.xclk_freq_hz = 16000000; break;
+            case 't': seconds = strtoul(optarg, NULL, 0); break;
+            case 'w': hold_ms = strtoul(optarg, NULL, 0); break;
+            case 'c': consumers = strtoul(optarg, NULL, 0); break;
+            case 'v': host_log_level++; break;
+            default:
+                bench_usage(argv[0]);
+                return 2;
+        }
+    }
+    if (optind == argc || consumers == 0 || consumers > BENCH_CONSUMERS_MAX) {
+        bench_usage(argv[0]);
+        return 2;
+    }
+    sim.frames = (const char *const *)&argv[optind];
+    sim.frame_count = argc - optind;
+
+    esp_err_t err = cam_sim_set_config(&sim);
+    if (err != ESP_OK) {
+        fprintf(stderr, "cannot load the frames: %s\n", esp_err_to_name(err));
+        return 1;
+    }
+    err = esp_camera_init(&config);
+    if (err != ESP_OK) {
+        fprintf(stderr, "camera init failed: 0x%x\n", err);
+        return 1;
+    }
+
+    bench_consumer_t consumer[BENCH_CONSUMERS_MAX] = { 0 };
+    int64_t start = esp_timer_get_time();
+    int64_t cpu_start = bench_cpu_us();
+    for (uint32_t i = 0; i < consumers; i++) {
+        consumer[i].hold_ms = hold_ms;
+        consumer[i].done = xSemaphoreCreateBinary();
+        xTaskCreate(bench_consumer_task, "consumer", 4096, &consumer[i], 5, NULL);
+    }
+    vTaskDelay(seconds * 1000 / portTICK_PERIOD_MS);
+    for (uint32_t i = 0; i < consumers; i++) {
+        consumer[i].stop = true;
+    }
+    for (uint32_t i = 0; i < consumers; i++) {
+        xSemaphoreTake(consumer[i].done, portMAX_DELAY);
+        vSemaphoreDelete(consumer[i].done);
+    }
+    double elapsed = (esp_timer_get_time() - start) / 1e6;
+    int64_t cpu_us = bench_cpu_us() - cpu_start;
+
+    cam_sim_stats_t sent;
+    camera_fb_stats_t fb_stats;
+    camera_telemetry_t telemetry;
+    cam_sim_get_stats(&sent);
+    esp_camera_get_fb_stats(&fb_stats);
+    bool has_telemetry = esp_camera_get_telemetry(&telemetry) == ESP_OK;
+    esp_camera_deinit();
+
+    uint32_t taken = 0, corrupt = 0;
+    for (uint32_t i = 0; i < consumers; i++) {
+        taken += consumer[i].taken;
+        corrupt += consumer[i].corrupt;
+    }
+    uint32_t *latency = (uint32_t *)malloc((taken ? taken : 1) * sizeof(uint32_t));
+    uint64_t latency_sum = 0;
+    for (uint32_t i = 0, n = 0; i < consumers; i++) {
+        memcpy(&latency[n], consumer[i].latency_us, consumer[i].taken * sizeof(uint32_t));
+        n += consumer[i].taken;
+        free(consumer[i].latency_us);
+    }
+    for (uint32_t i = 0; i < taken; i++) {
+        latency_sum += latency[i];
+    }
+    qsort(latency, taken, sizeof(uint32_t), bench_cmp_u32);
+
+    printf("run            %.2f s, %u consumer(s), hold %" PRIu32 " ms\n", elapsed, (unsigned) consumers, hold_ms);
+    printf("sensor         %" PRIu32 " frames, %" PRIu64 " bytes, %" PRIu32 " late, %" PRIu32 " host stalls\n",
+           sent.frames, sent.bytes, sent.late_frames, sent.stalls);
+    printf("interrupts     %" PRIu32 " vsync, %" PRIu32 " eof, %" PRIu32 " lost, %" PRIu64 " bytes while the DMA was stopped\n",
+           sent.vsync_events, sent.eof_events, sent.lost_events, sent.lost_bytes);
+    printf("taken          %" PRIu32 " frames, %.2f fps\n", taken, taken / elapsed);
+    printf("lost           %" PRIu32 " frames (%.1f%%), %" PRIu32 " dropped for newer ones, %" PRIu32 " overflowed\n",
+           sent.frames > taken ? sent.frames - taken : 0,
+           sent.frames ? 100.0 * (sent.frames > taken ? sent.frames - taken : 0) / sent.frames : 0.0,
+           fb_stats.dropped, fb_stats.overflows);
+    printf("corrupt        %" PRIu32 " frames\n", corrupt);
+    if (taken) {
+        printf("latency        avg %" PRIu64 " us, p50 %" PRIu32 " us, p99 %" PRIu32 " us, max %" PRIu32 " us\n",
+               latency_sum / taken, latency[taken / 2], latency[(uint64_t)taken * 99 / 100], latency[taken - 1]);
+    }
+    printf("cpu            %.1f%%, %" PRIu64 " us per frame sent\n", cpu_us / elapsed / 1e4,
+           sent.frames ? (uint64_t)cpu_us / sent.frames : 0);
+    printf("frame buffers  %u bytes, frame size p%d %u bytes, max %u bytes, %" PRIu32 " resizes\n",
+           (unsigned) fb_stats.fb_size, CONFIG_CAMERA_JPEG_FB_PERCENTILE, (unsigned) fb_stats.size_pct,
+           (unsigned) fb_stats.size_max, fb_stats.resizes);
+    if (has_telemetry) {
+        printf("telemetry      %.2f fps, %" PRIu32 " frames, no SOI %" PRIu32 ", no EOI %" PRIu32 ", event overflows %" PRIu32 "\n",
+               telemetry.fps, telemetry.frames, telemetry.no_soi, telemetry.no_eoi, telemetry.ev_ovf);
+        bench_stage("receive", &telemetry.receive);
+        bench_stage("process", &telemetry.process);
+        bench_stage("wait", &telemetry.wait);
+        bench_stage("hold", &telemetry.hold);
+        bench_stage("copy", &telemetry.copy);
+    }
+    free(latency);
+    return corrupt ? 1 : 0;
+}
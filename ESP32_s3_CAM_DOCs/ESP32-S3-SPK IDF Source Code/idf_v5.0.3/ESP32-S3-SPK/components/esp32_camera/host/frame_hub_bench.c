@@ -0,0 +1,419 @@
+// Stream replay of the application's frame hub (main/frame_hub.c) on the simulated camera.
+// Stream clients take frames from the hub as camera_http.c does and write them as
+// multipart/x-mixed-replace parts to local sockets with the send buffer of lwIP. A reader at
+// the other end of each socket takes the bytes at the bandwidth of the client's network, fast
+// or slow, and checks that every part is one of the frames sent, byte for byte.
+// Prints the frames each client got, the aggregate frame rate, and the memory the hub held:
+// frames referenced at once and heap above the idle camera.
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_camera.h"
+#include "img_converters.h"
+#include "cam_sim.h"
+#include "frame_hub.h"
+
+#define BENCH_FRAMES        4       // synthetic frames, of different sizes
+#define BENCH_SEGMENT       1460    // bytes a reader takes at a time, a TCP segment
+#define BENCH_PART_BOUNDARY "123456789000000000000987654321"
+
+static const char *s_boundary = "\r\n--" BENCH_PART_BOUNDARY "\r\n";
+static const char *s_part = "Content-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n";
+
+typedef struct {
+    int fd[2];                  // the sender task writes fd[0], the reader thread reads fd[1]
+    uint32_t rate;              // bytes per second the reader takes, 0 for as fast as it can
+    frame_hub_sub_t *sub;
+    volatile bool stop;
+    SemaphoreHandle_t done;
+    pthread_t reader;
+    uint8_t *body;              // the part being read
+    size_t body_size;
+    uint8_t seg[BENCH_SEGMENT];
+    size_t seg_pos, seg_len;
+    uint64_t bytes;
+    int64_t start;
+    uint32_t sent;              // frames written by the sender
+    uint32_t received;          // parts that were one of the frames sent
+    uint32_t broken;            // parts that were not
+} bench_client_t;
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+} bench_buf_t;
+
+static bool bench_send(int fd, const void *buf, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+    while (len) {
+        ssize_t sent = send(fd, p, len, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            return false;
+        }
+        p += sent;
+        len -= sent;
+    }
+    return true;
+}
+
+// the loop of stream_client_task(), on a local socket
+static void bench_sender_task(void *arg)
+{
+    bench_client_t *c = (bench_client_t *)arg;
+    char part[128];
+
+    while (!c->stop) {
+        frame_hub_frame_t *frame = frame_hub_get(c->sub, pdMS_TO_TICKS(100));
+        if (!frame) {
+            continue;
+        }
+        int hlen = snprintf(part, sizeof(part), s_part, (unsigned)frame->len);
+        bool ok = bench_send(c->fd[0], s_boundary, strlen(s_boundary)) && bench_send(c->fd[0], part, hlen) &&
+                  bench_send(c->fd[0], frame->buf, frame->len);
+        frame_hub_release(frame);
+        if (!ok) {
+            break;
+        }
+        c->sent++;
+    }
+    frame_hub_unsubscribe(c->sub);
+    shutdown(c->fd[0], SHUT_WR);
+    xSemaphoreGive(c->done);
+    vTaskDelete(NULL);
+}
+
+// next byte of the stream, -1 at its end, taken a segment at a time at the client's rate
+static int bench_getc(bench_client_t *c)
+{
+    if (c->seg_pos == c->seg_len) {
+        if (c->rate) {
+            int64_t due = c->start + (int64_t)(c->bytes * 1000000 / c->rate);
+            int64_t now = esp_timer_get_time();
+            if (due > now) {
+                usleep(due - now);
+            }
+        }
+        ssize_t len = recv(c->fd[1], c->seg, sizeof(c->seg), 0);
+        if (len <= 0) {
+            return -1;
+        }
+        c->seg_pos = 0;
+        c->seg_len = len;
+        c->bytes += len;
+    }
+    return c->seg[c->seg_pos++];
+}
+
+static bool bench_expect(bench_client_t *c, const char *s)
+{
+    for (; *s; s++) {
+        if (bench_getc(c) != (uint8_t)*s) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool bench_is_frame(const uint8_t *buf, size_t len)
+{
+    size_t frame_len;
+    const uint8_t *frame;
+    for (size_t n = 0; (frame = cam_sim_frame(n, &frame_len)) != NULL; n++) {
+        if (frame_len == len && memcmp(frame, buf, len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void *bench_reader(void *arg)
+{
+    bench_client_t *c = (bench_client_t *)arg;
+    char header[128];
+    unsigned len;
+
+    c->start = esp_timer_get_time();
+    while (bench_expect(c, s_boundary)) {
+        size_t n = 0;
+        int ch;
+        while (n < sizeof(header) - 1 && (ch = bench_getc(c)) >= 0) {
+            header[n++] = ch;
+            if (n >= 4 && memcmp(&header[n - 4], "\r\n\r\n", 4) == 0) {
+                break;
+            }
+        }
+        header[n] = '\0';
+        if (sscanf(header, s_part, &len) != 1 || len > c->body_size) {
+            c->broken++;
+            break;
+        }
+        for (n = 0; n < len && (ch = bench_getc(c)) >= 0; n++) {
+            c->body[n] = ch;
+        }
+        if (n < len) {
+            break;
+        }
+        if (bench_is_frame(c->body, len)) {
+            c->received++;
+        } else {
+            c->broken++;
+        }
+    }
+    return NULL;
+}
+
+static size_t bench_write(void *arg, size_t index, const void *data, size_t len)
+{
+    bench_buf_t *buf = (bench_buf_t *)arg;
+    uint8_t *p = (uint8_t *)realloc(buf->data, index + len);
+    if (!p) {
+        return 0;
+    }
+    buf->data = p;
+    memcpy(p + index, data, len);
+    buf->len = index + len;
+    return len;
+}
+
+// a VGA JPEG of a noisy gradient, its size set by the quality
+static bool bench_synthetic(const char *path, uint32_t seed, uint8_t quality)
+{
+    enum { W = 640, H = 480 };
+    uint8_t *rgb = (uint8_t *)malloc(W * H * 3);
+    bench_buf_t jpg = { 0 };
+    if (!rgb) {
+        return false;
+    }
+    srand(seed);
+    for (size_t i = 0; i < W * H; i++) {
+        rgb[i * 3] = i % W * 255 / W + rand() % 32;
+        rgb[i * 3 + 1] = i / W * 255 / H + rand() % 32;
+        rgb[i * 3 + 2] = rand() % 64;
+    }
+    bool ok = fmt2jpg_cb(rgb, W * H * 3, W, H, PIXFORMAT_RGB888, quality, bench_write, &jpg);
+    free(rgb);
+    FILE *f = ok ? fopen(path, "wb") : NULL;
+    ok = f && fwrite(jpg.data, 1, jpg.len, f) == jpg.len;
+    if (f) {
+        fclose(f);
+    }
+    free(jpg.data);
+    return ok;
+}
+
+// heap in use, small blocks and mmapped ones
+static size_t bench_heap(void)
+{
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+static void bench_usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options] [frame.jpg...]\n"
+            "  -c count     fast clients (2)\n"
+            "  -s count     slow clients (1)\n"
+            "  -r bytes     bytes per second a slow client reads (200000)\n"
+            "  -R bytes     bytes per second a fast client reads, 0 for no limit (0)\n"
+            "  -b bytes     socket send buffer, lwIP's TCP_SND_BUF (5744)\n"
+            "  -f fps       sensor frame rate (25)\n"
+            "  -n count     camera frame buffers (4)\n"
+            "  -t seconds   run time (5)\n"
+            "  -m percent   fail unless every fast client got this share of the frames captured (0)\n"
+            "  -v           driver log, repeat for more\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    cam_sim_config_t sim = {
+        .loop = true,
+        .fps = 25,
+        .vblank_us = 1000,
+        .seed = 1,
+    };
+    camera_config_t config = {
+        .pin_pwdn = -1,
+        .pin_reset = -1,
+        .pin_xclk = -1,
+        .pin_sccb_sda = -1,
+        .pin_sccb_scl = -1,
+        .pin_d7 = -1, .pin_d6 = -1, .pin_d5 = -1, .pin_d4 = -1,
+        .pin_d3 = -1, .pin_d2 = -1, .pin_d1 = -1, .pin_d0 = -1,
+        .pin_vsync = -1,
+        .pin_href = -1,
+        .pin_pclk = -1,
+        .xclk_freq_hz = 20000000,
+        .pixel_format = PIXFORMAT_JPEG,
+        .frame_size = FRAMESIZE_VGA,
+        .jpeg_quality = 12,
+        .fb_count = 4,              // as main/include/camera_config.h
+        .fb_location = CAMERA_FB_IN_PSRAM,
+        .grab_mode = CAMERA_GRAB_WHEN_EMPTY,
+    };
+    uint32_t fast = 2, slow = 1, slow_rate = 200000, fast_rate = 0, sndbuf = 5744, seconds = 5, min_pct = 0;
+    int opt;
+
+    esp_timer_get_time();
+    host_log_level = ESP_LOG_NONE;
+    while ((opt = getopt(argc, argv, "c:s:r:R:b:f:n:t:m:vh")) != -1) {
+        switch (opt) {
+            case 'c': fast = strtoul(optarg, NULL, 0); break;
+            case 's': slow = strtoul(optarg, NULL, 0); break;
+            case 'r': slow_rate = strtoul(optarg, NULL, 0); break;
+            case 'R': fast_rate = strtoul(optarg, NULL, 0); break;
+            case 'b': sndbuf = strtoul(optarg, NULL, 0); break;
+            case 'f': sim.fps = strtoul(optarg, NULL, 0); break;
+            case 'n': config.fb_count = strtoul(optarg, NULL, 0); break;
+            case 't': seconds = strtoul(optarg, NULL, 0); break;
+            case 'm': min_pct = strtoul(optarg, NULL, 0); break;
+            case 'v': host_log_level++; break;
+            default:
+                bench_usage(argv[0]);
+                return 2;
+        }
+    }
+    uint32_t clients = fast + slow;
+    if (clients == 0 || clients > FRAME_HUB_MAX_SUBS || seconds == 0 || slow_rate == 0) {
+        bench_usage(argv[0]);
+        return 2;
+    }
+
+    char path[BENCH_FRAMES][32];
+    const char *paths[BENCH_FRAMES];
+    if (optind < argc) {
+        sim.frames = (const char *const *)&argv[optind];
+        sim.frame_count = argc - optind;
+    } else {
+        for (uint32_t i = 0; i < BENCH_FRAMES; i++) {
+            snprintf(path[i], sizeof(path[i]), "frame_hub_bench_%u.jpg", (unsigned)i);
+            paths[i] = path[i];
+            if (!bench_synthetic(path[i], i + 1, 10 + 10 * i)) {
+                fprintf(stderr, "cannot write %s\n", path[i]);
+                return 1;
+            }
+        }
+        sim.frames = paths;
+        sim.frame_count = BENCH_FRAMES;
+    }
+    esp_err_t err = cam_sim_set_config(&sim);
+    if (optind == argc) {
+        for (uint32_t i = 0; i < BENCH_FRAMES; i++) {
+            remove(path[i]);
+        }
+    }
+    if (err != ESP_OK) {
+        fprintf(stderr, "cannot load the frames: %s\n", esp_err_to_name(err));
+        return 1;
+    }
+    size_t len_max = 0, len;
+    for (size_t n = 0; cam_sim_frame(n, &len) != NULL; n++) {
+        len_max = len > len_max ? len : len_max;
+    }
+    if (esp_camera_init(&config) != ESP_OK || frame_hub_start() != ESP_OK) {
+        fprintf(stderr, "camera init failed\n");
+        return 1;
+    }
+
+    bench_client_t *client = (bench_client_t *)calloc(clients, sizeof(bench_client_t));
+    for (uint32_t i = 0; i < clients; i++) {
+        bench_client_t *c = &client[i];
+        c->rate = i < fast ? fast_rate : slow_rate;
+        c->body_size = len_max;
+        c->body = (uint8_t *)malloc(len_max);
+        c->done = xSemaphoreCreateBinary();
+        int buf_size = sndbuf;
+        if (!c->body || !c->done || socketpair(AF_UNIX, SOCK_STREAM, 0, c->fd) != 0 ||
+            setsockopt(c->fd[0], SOL_SOCKET, SO_SNDBUF, &buf_size, sizeof(buf_size)) != 0 ||
+            setsockopt(c->fd[1], SOL_SOCKET, SO_RCVBUF, &buf_size, sizeof(buf_size)) != 0) {
+            fprintf(stderr, "cannot set up client %u\n", (unsigned)i);
+            return 1;
+        }
+    }
+
+    // the camera's buffers are allocated, what the hub and the clients take comes on top
+    size_t heap_idle = bench_heap(), heap_max = heap_idle;
+    camera_fb_stats_t fb_stats;
+    cam_sim_stats_t sent;
+    frame_hub_stats_t hub;
+    esp_camera_get_fb_stats(&fb_stats);
+    cam_sim_get_stats(&sent);
+    uint32_t sensor_start = sent.frames;
+    int64_t start = esp_timer_get_time();
+    for (uint32_t i = 0; i < clients; i++) {
+        bench_client_t *c = &client[i];
+        c->sub = frame_hub_subscribe();
+        if (!c->sub || pthread_create(&c->reader, NULL, bench_reader, c) != 0 ||
+            xTaskCreate(bench_sender_task, "stream_client", 4096, c, 5, NULL) != pdPASS) {
+            fprintf(stderr, "cannot start client %u\n", (unsigned)i);
+            return 1;
+        }
+    }
+    while (esp_timer_get_time() - start < seconds * 1000000LL) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+        size_t heap = bench_heap();
+        heap_max = heap > heap_max ? heap : heap_max;
+    }
+    frame_hub_get_stats(&hub);
+    cam_sim_get_stats(&sent);
+    double elapsed = (esp_timer_get_time() - start) / 1e6;
+    for (uint32_t i = 0; i < clients; i++) {
+        client[i].stop = true;
+    }
+    for (uint32_t i = 0; i < clients; i++) {
+        bench_client_t *c = &client[i];
+        xSemaphoreTake(c->done, portMAX_DELAY);
+        pthread_join(c->reader, NULL);
+        vSemaphoreDelete(c->done);
+        close(c->fd[0]);
+        close(c->fd[1]);
+        free(c->body);
+    }
+
+    uint32_t sensor = sent.frames - sensor_start, received = 0, broken = 0;
+    bool short_fast = false;
+    printf("run            %.2f s, %u fast client(s)%s, %u slow at %u bytes/s, %u byte send buffers\n", elapsed,
+           (unsigned)fast, fast_rate ? "" : " without limit", (unsigned)slow, (unsigned)slow_rate, (unsigned)sndbuf);
+    printf("camera         %" PRIu32 " frames sent, %" PRIu32 " captured by the hub (%.2f fps), %d frame buffers\n",
+           sensor, hub.frames, hub.frames / elapsed, config.fb_count);
+    for (uint32_t i = 0; i < clients; i++) {
+        bench_client_t *c = &client[i];
+        printf("  %s %u        %" PRIu32 " frames (%.2f fps), %" PRIu64 " bytes, %" PRIu32 " broken\n",
+               i < fast ? "fast" : "slow", (unsigned)i, c->received, c->received / elapsed, c->bytes, c->broken);
+        received += c->received;
+        broken += c->broken;
+        if (i < fast && (uint64_t)c->received * 100 < (uint64_t)hub.frames * min_pct) {
+            short_fast = true;
+        }
+    }
+    printf("aggregate      %" PRIu32 " frames, %.2f fps, %" PRIu32 " skipped by clients behind\n",
+           received, received / elapsed, hub.dropped);
+    printf("memory         %" PRIu32 " of %d frames referenced at most, %u byte frame buffers, heap peak +%zu KB\n",
+           hub.in_flight_max, FRAME_HUB_MAX_FRAMES, (unsigned)fb_stats.fb_size, (heap_max - heap_idle) / 1024);
+    free(client);
+
+    if (broken || hub.in_flight_max > FRAME_HUB_MAX_FRAMES) {
+        printf("FAILED: %" PRIu32 " parts were none of the frames sent\n", broken);
+        return 1;
+    }
+    if (short_fast) {
+        printf("FAILED: a fast client got less than %u%% of the frames captured\n", (unsigned)min_pct);
+        return 1;
+    }
+    return 0;
+}
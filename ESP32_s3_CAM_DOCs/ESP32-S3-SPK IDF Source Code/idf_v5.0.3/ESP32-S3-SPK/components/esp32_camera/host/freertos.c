@@ -0,0 +1,328 @@
+// FreeRTOS tasks, queues and semaphores on pthreads
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+
+static const char *TAG = "freertos";
+
+struct host_task {
+    pthread_t thread;
+    TaskFunction_t fn;
+    void *arg;
+    UBaseType_t priority;
+    SemaphoreHandle_t notify;   // counts the notifications given to the task
+};
+
+struct host_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    uint8_t *items;         // NULL for semaphores, only the count matters
+    UBaseType_t item_size;
+    UBaseType_t length;
+    UBaseType_t head;
+    UBaseType_t count;
+};
+
+static pthread_key_t s_task_key;
+static pthread_once_t s_task_key_once = PTHREAD_ONCE_INIT;
+
+static void task_key_create(void)
+{
+    pthread_key_create(&s_task_key, NULL);
+}
+
+// absolute CLOCK_MONOTONIC deadline ticks from now
+static struct timespec deadline_after(TickType_t ticks)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += ticks / 1000;
+    ts.tv_nsec += (long)(ticks % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return ts;
+}
+
+// wait until changed is signalled, false once the deadline passed
+static bool queue_wait(QueueHandle_t q, TickType_t ticks, const struct timespec *deadline)
+{
+    if (ticks == 0) {
+        return false;
+    }
+    if (ticks == portMAX_DELAY) {
+        pthread_cond_wait(&q->changed, &q->lock);
+        return true;
+    }
+    return pthread_cond_timedwait(&q->changed, &q->lock, deadline) != ETIMEDOUT;
+}
+
+static void queue_unlock(void *arg)
+{
+    pthread_mutex_unlock(&((QueueHandle_t)arg)->lock);
+}
+
+int host_thread_create(pthread_t *thread, int rt_priority, void *(*fn)(void *), void *arg)
+{
+    static bool s_no_rt;
+    if (!__atomic_load_n(&s_no_rt, __ATOMIC_RELAXED)) {
+        pthread_attr_t attr;
+        struct sched_param param = { .sched_priority = rt_priority };
+        pthread_attr_init(&attr);
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        pthread_attr_setschedparam(&attr, &param);
+        int ret = pthread_create(thread, &attr, fn, arg);
+        pthread_attr_destroy(&attr);
+        if (ret != EPERM) {
+            return ret;
+        }
+        __atomic_store_n(&s_no_rt, true, __ATOMIC_RELAXED);
+        ESP_LOGI(TAG, "No permission for real-time threads, task priorities are ignored");
+    }
+    return pthread_create(thread, NULL, fn, arg);
+}
+
+static void *task_main(void *arg)
+{
+    TaskHandle_t task = (TaskHandle_t)arg;
+    pthread_setspecific(s_task_key, task);
+    task->fn(task->arg);
+    vTaskDelete(NULL);
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core_id)
+{
+    pthread_once(&s_task_key_once, task_key_create);
+    TaskHandle_t task = (TaskHandle_t)calloc(1, sizeof(struct host_task));
+    if (task == NULL) {
+        return pdFAIL;
+    }
+    task->fn = fn;
+    task->arg = arg;
+    task->priority = priority;
+    task->notify = xSemaphoreCreateCounting(UINT32_MAX, 0);
+    if (task->notify == NULL || host_thread_create(&task->thread, 1 + priority, task_main, task) != 0) {
+        if (task->notify) {
+            vSemaphoreDelete(task->notify);
+        }
+        free(task);
+        return pdFAIL;
+    }
+    if (handle) {
+        *handle = task;
+    }
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task == NULL || pthread_equal(task->thread, pthread_self())) {
+        // as on FreeRTOS, the handle of a task that ended itself is gone
+        task = (TaskHandle_t)pthread_getspecific(s_task_key);
+        if (task) {
+            vSemaphoreDelete(task->notify);
+            free(task);
+        }
+        pthread_detach(pthread_self());
+        pthread_exit(NULL);
+    }
+    pthread_cancel(task->thread);
+    pthread_join(task->thread, NULL);
+    vSemaphoreDelete(task->notify);
+    free(task);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    struct timespec deadline = deadline_after(ticks);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+    }
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (TickType_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    xSemaphoreGive(task->notify);
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks)
+{
+    pthread_once(&s_task_key_once, task_key_create);
+    TaskHandle_t task = (TaskHandle_t)pthread_getspecific(s_task_key);
+    if (task == NULL || xSemaphoreTake(task->notify, ticks) != pdTRUE) {
+        return 0;
+    }
+    uint32_t count = 1;
+    while (clear_on_exit && xSemaphoreTake(task->notify, 0) == pdTRUE) {
+        count++;
+    }
+    return count;
+}
+
+void vTaskSetTimeOutState(TimeOut_t *timeout)
+{
+    timeout->entered = xTaskGetTickCount();
+}
+
+BaseType_t xTaskCheckForTimeOut(TimeOut_t *timeout, TickType_t *ticks_left)
+{
+    if (*ticks_left == portMAX_DELAY) {
+        return pdFALSE;
+    }
+    TickType_t now = xTaskGetTickCount();
+    TickType_t elapsed = now - timeout->entered;
+    if (elapsed >= *ticks_left) {
+        *ticks_left = 0;
+        return pdTRUE;
+    }
+    *ticks_left -= elapsed;
+    timeout->entered = now;
+    return pdFALSE;
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task)
+{
+    if (task == NULL) {
+        pthread_once(&s_task_key_once, task_key_create);
+        task = (TaskHandle_t)pthread_getspecific(s_task_key);
+    }
+    return task ? task->priority : 1;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    QueueHandle_t q = (QueueHandle_t)calloc(1, sizeof(struct host_queue));
+    if (q == NULL) {
+        return NULL;
+    }
+    if (item_size) {
+        q->items = (uint8_t *)malloc(length * item_size);
+        if (q->items == NULL) {
+            free(q);
+            return NULL;
+        }
+    }
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&q->changed, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&q->lock, NULL);
+    q->item_size = item_size;
+    q->length = length;
+    return q;
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count)
+{
+    QueueHandle_t q = xQueueCreate(max_count, 0);
+    if (q) {
+        q->count = initial_count;
+    }
+    return q;
+}
+
+void vQueueDelete(QueueHandle_t q)
+{
+    pthread_cond_destroy(&q->changed);
+    pthread_mutex_destroy(&q->lock);
+    free(q->items);
+    free(q);
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t ticks)
+{
+    struct timespec deadline = deadline_after(ticks == portMAX_DELAY ? 0 : ticks);
+    BaseType_t ret = pdTRUE;
+
+    pthread_mutex_lock(&q->lock);
+    pthread_cleanup_push(queue_unlock, q);
+    while (q->count == q->length) {
+        if (!queue_wait(q, ticks, &deadline)) {
+            ret = pdFALSE;
+            break;
+        }
+    }
+    if (ret == pdTRUE) {
+        if (q->items) {
+            memcpy(&q->items[((q->head + q->count) % q->length) * q->item_size], item, q->item_size);
+        }
+        q->count++;
+        pthread_cond_broadcast(&q->changed);
+    }
+    pthread_cleanup_pop(1);
+    return ret;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t q, const void *item, BaseType_t *woken)
+{
+    BaseType_t ret = xQueueSend(q, item, 0);
+    if (ret == pdTRUE && woken) {
+        *woken = pdTRUE;
+    }
+    return ret;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks)
+{
+    struct timespec deadline = deadline_after(ticks == portMAX_DELAY ? 0 : ticks);
+    BaseType_t ret = pdTRUE;
+
+    pthread_mutex_lock(&q->lock);
+    // a task deleted while it waits here is cancelled inside the wait, with the lock held
+    pthread_cleanup_push(queue_unlock, q);
+    while (q->count == 0) {
+        if (!queue_wait(q, ticks, &deadline)) {
+            ret = pdFALSE;
+            break;
+        }
+    }
+    if (ret == pdTRUE) {
+        if (q->items) {
+            memcpy(item, &q->items[q->head * q->item_size], q->item_size);
+            q->head = (q->head + 1) % q->length;
+        }
+        q->count--;
+        pthread_cond_broadcast(&q->changed);
+    }
+    pthread_cleanup_pop(1);
+    return ret;
+}
+
+BaseType_t xQueueReset(QueueHandle_t q)
+{
+    pthread_mutex_lock(&q->lock);
+    q->head = 0;
+    q->count = 0;
+    pthread_cond_broadcast(&q->changed);
+    pthread_mutex_unlock(&q->lock);
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q)
+{
+    pthread_mutex_lock(&q->lock);
+    UBaseType_t count = q->count;
+    pthread_mutex_unlock(&q->lock);
+    return count;
+}
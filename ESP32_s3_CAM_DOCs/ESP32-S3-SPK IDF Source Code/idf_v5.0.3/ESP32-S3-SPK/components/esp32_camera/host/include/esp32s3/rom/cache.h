@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stdint.h>
+
+// host memory is coherent, the simulated DMA writes through the CPU
+static inline void Cache_Invalidate_Addr(uint32_t addr, uint32_t size)
+{
+}
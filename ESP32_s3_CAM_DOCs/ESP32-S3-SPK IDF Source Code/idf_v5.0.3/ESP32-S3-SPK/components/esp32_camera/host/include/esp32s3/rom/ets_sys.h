@@ -0,0 +1,5 @@
+#pragma once
+
+#include <stdio.h>
+
+#define ets_printf(format, ...)     fprintf(stderr, format, ##__VA_ARGS__)
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+
+// Same layout as the ROM header. The link word is 32 bit as on the chip, so the simulated
+// DMA never follows it: cam_hal allocates every descriptor chain as one circular array.
+typedef struct lldesc_s {
+    volatile uint32_t size : 12,
+             length: 12,
+             offset: 5,
+             sosf  : 1,
+             eof   : 1,
+             owner : 1;
+    volatile uint8_t *buf;
+    union {
+        volatile uint32_t empty;
+        struct lldesc_s *qe;
+    };
+} lldesc_t;
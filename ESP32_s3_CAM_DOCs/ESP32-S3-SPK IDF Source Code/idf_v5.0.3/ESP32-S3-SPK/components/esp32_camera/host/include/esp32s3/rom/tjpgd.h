@@ -0,0 +1,4 @@
+#pragma once
+
+// no ROM on the host, the software decoder in target/tjpgd.c has the same API
+#include <tjpgd.h>  // target/jpeg_include, not this file
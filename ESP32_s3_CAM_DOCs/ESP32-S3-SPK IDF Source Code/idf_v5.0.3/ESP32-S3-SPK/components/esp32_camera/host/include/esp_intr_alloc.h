@@ -0,0 +1,3 @@
+#pragma once
+
+typedef struct intr_handle_data_t *intr_handle_t;
@@ -0,0 +1,43 @@
+#pragma once
+
+// pthread stand-in for the part of the FreeRTOS API the camera component uses.
+// One tick is one millisecond, tasks are threads, the priority and core are ignored.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+// pulled in by portmacro.h on the target, the driver relies on that
+#include "esp_attr.h"
+#include "esp_intr_alloc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE                 0
+#define pdTRUE                  1
+#define pdPASS                  pdTRUE
+#define pdFAIL                  pdFALSE
+#define portMAX_DELAY           ((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS      1
+#define portTICK_RATE_MS        portTICK_PERIOD_MS
+#define pdMS_TO_TICKS(ms)       ((TickType_t)(ms))
+#define portNUM_PROCESSORS      2
+#define configMAX_PRIORITIES    25
+#define tskNO_AFFINITY          0x7FFFFFFF
+#define portYIELD_FROM_ISR()    do { } while (0)
+
+// newlib's sys/cdefs.h provides this on the target
+#ifndef __containerof
+#define __containerof(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+#endif
+
+BaseType_t xPortGetCoreID(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "FreeRTOS.h"
+#include "queue.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// like FreeRTOS, a semaphore is a queue of empty items
+typedef QueueHandle_t SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count);
+
+#define xSemaphoreCreateBinary()                xSemaphoreCreateCounting(1, 0)
+#define xSemaphoreCreateMutex()                 xSemaphoreCreateCounting(1, 1)
+#define xSemaphoreGive(sem)                     xQueueSend((sem), NULL, 0)
+#define xSemaphoreGiveFromISR(sem, woken)       xQueueSendFromISR((sem), NULL, (woken))
+#define xSemaphoreTake(sem, ticks)              xQueueReceive((sem), NULL, (ticks))
+#define vSemaphoreDelete(sem)                   vQueueDelete(sem)
+
+#ifdef __cplusplus
+}
+#endif
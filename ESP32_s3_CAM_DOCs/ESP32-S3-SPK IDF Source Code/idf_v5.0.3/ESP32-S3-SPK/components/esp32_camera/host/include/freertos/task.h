@@ -0,0 +1,59 @@
+#pragma once
+
+#include <pthread.h>
+#include "FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct host_task *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+typedef struct {
+    TickType_t entered;
+} TimeOut_t;
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core_id);
+
+#define xTaskCreate(fn, name, stack_depth, arg, priority, handle) \
+    xTaskCreatePinnedToCore(fn, name, stack_depth, arg, priority, handle, tskNO_AFFINITY)
+
+/**
+ * @brief NULL ends the calling task. Another task is cancelled at its next blocking call and joined.
+ */
+void vTaskDelete(TaskHandle_t task);
+
+void vTaskDelay(TickType_t ticks);
+
+TickType_t xTaskGetTickCount(void);
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task);
+
+/**
+ * @brief Task notifications as a counting semaphore, xTaskNotifyGive() adds one
+ */
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks);
+
+void vTaskSetTimeOutState(TimeOut_t *timeout);
+
+/**
+ * @brief pdTRUE once the ticks left since vTaskSetTimeOutState() ran out, else they are reduced by the time passed
+ */
+BaseType_t xTaskCheckForTimeOut(TimeOut_t *timeout, TickType_t *ticks_left);
+
+/**
+ * @brief Start a thread with SCHED_FIFO rt_priority, as FreeRTOS would preempt for it
+ *
+ * Tasks run at 1 + their FreeRTOS priority. Without permission for real-time threads
+ * every thread gets the normal scheduler, then a busy host may delay cam_task more
+ * than the chip would.
+ */
+int host_thread_create(pthread_t *thread, int rt_priority, void *(*fn)(void *), void *arg);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,242 @@
+// JPEG EOI search benchmark: the time cam_hal spends finding the end of a JPEG frame received
+// without PSRAM, by each way it can do it:
+//   memcmp     the per-byte backward memcmp() loop cam_take used first
+//   backward   cam_jpeg_find_eoi(), the word-at-a-time backward search cam_take does now
+//   tracker    cam_jpeg_scan() called after every DMA half buffer, CONFIG_CAMERA_JPEG_EOI_TRACKING
+// Frames are laid into a buffer as cam_task copies them, whole half buffers, and the bytes behind
+// the frame are zero or, with -s, the tail of a longer frame received before. All three searches
+// must find the EOI of the frame on zero tails, the tracker also on stale tails.
+// Without frame files, frames encoded from a synthetic image at a few qualities are used.
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include "esp_timer.h"
+#include "img_converters.h"
+#include "cam_jpeg_scan.h"
+
+// through a pointer, as on the target where memcmp() is a library call and not inlined
+static int (*volatile bench_memcmp)(const void *, const void *, size_t) = memcmp;
+
+typedef struct {
+    uint8_t *jpg;
+    size_t len;
+    int eoi;        // offset of the EOI the frame ends with
+    char name[64];
+} bench_frame_t;
+
+// the search of cam_verify_jpeg_eoi() before it looked for 0xFF bytes a word at a time
+static int bench_eoi_memcmp(const uint8_t *inbuf, uint32_t length)
+{
+    static const uint16_t JPEG_EOI_MARKER = 0xD9FF;
+    const uint8_t *dptr = inbuf + length - 2;
+    while (dptr > inbuf) {
+        if (bench_memcmp(dptr, &JPEG_EOI_MARKER, 2) == 0) {
+            return dptr - inbuf;
+        }
+        dptr--;
+    }
+    return -1;
+}
+
+static int bench_eoi_backward(const uint8_t *inbuf, uint32_t length)
+{
+    return cam_jpeg_find_eoi(inbuf, length);
+}
+
+// as cam_task calls it, once per half buffer copied, until the EOI is found
+static uint32_t s_half = 4096;
+
+static int bench_eoi_tracker(const uint8_t *inbuf, uint32_t length)
+{
+    cam_jpeg_scan_t scan;
+    cam_jpeg_scan_reset(&scan);
+    for (uint32_t end = s_half; end <= length; end += s_half) {
+        if (cam_jpeg_scan(&scan, inbuf, end)) {
+            break;
+        }
+    }
+    return scan.eoi;
+}
+
+typedef int (*bench_search_t)(const uint8_t *inbuf, uint32_t length);
+
+static const struct {
+    const char *name;
+    bench_search_t search;
+} bench_searches[] = {
+    { "memcmp", bench_eoi_memcmp },
+    { "backward", bench_eoi_backward },
+    { "tracker", bench_eoi_tracker },
+};
+#define BENCH_SEARCHES (sizeof(bench_searches) / sizeof(bench_searches[0]))
+
+static bool bench_load(const char *path, bench_frame_t *frame)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    frame->len = ftell(f);
+    rewind(f);
+    frame->jpg = (uint8_t *)malloc(frame->len);
+    bool ok = frame->jpg && fread(frame->jpg, 1, frame->len, f) == frame->len;
+    fclose(f);
+    snprintf(frame->name, sizeof(frame->name), "%s", path);
+    return ok;
+}
+
+static size_t bench_write(void *arg, size_t index, const void *data, size_t len)
+{
+    bench_frame_t *frame = (bench_frame_t *)arg;
+    uint8_t *jpg = (uint8_t *)realloc(frame->jpg, index + len);
+    if (!jpg) {
+        return 0;
+    }
+    frame->jpg = jpg;
+    memcpy(jpg + index, data, len);
+    frame->len = index + len;
+    return len;
+}
+
+// a noisy gradient, encoded at the quality
+static bool bench_synthetic(uint16_t width, uint16_t height, uint8_t quality, bench_frame_t *frame)
+{
+    uint8_t *rgb = (uint8_t *)malloc((size_t)width * height * 3);
+    if (!rgb) {
+        return false;
+    }
+    srand(width + quality);
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            uint8_t *p = rgb + (y * width + x) * 3;
+            p[0] = x * 255 / width + rand() % 32;
+            p[1] = y * 255 / height + rand() % 32;
+            p[2] = (x + y) % 256;
+        }
+    }
+    memset(frame, 0, sizeof(*frame));
+    bool ok = fmt2jpg_cb(rgb, (size_t)width * height * 3, width, height, PIXFORMAT_RGB888, quality, bench_write, frame);
+    free(rgb);
+    snprintf(frame->name, sizeof(frame->name), "%ux%u q%u", width, height, quality);
+    return ok;
+}
+
+static void bench_usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options] [frame.jpg...]\n"
+            "  -b bytes     DMA half buffer size (4096)\n"
+            "  -n count     searches per frame and way (200)\n"
+            "  -s           stale data of a longer frame behind each frame\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t count = 200;
+    bool stale = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:n:sh")) != -1) {
+        switch (opt) {
+            case 'b': s_half = strtoul(optarg, NULL, 0); break;
+            case 'n': count = strtoul(optarg, NULL, 0); break;
+            case 's': stale = true; break;
+            default:
+                bench_usage(argv[0]);
+                return 2;
+        }
+    }
+    if (count == 0 || s_half < 64 || s_half % 4) {
+        bench_usage(argv[0]);
+        return 2;
+    }
+
+    static const struct {
+        uint16_t width, height;
+        uint8_t quality;
+    } synthetic[] = { { 320, 240, 30 }, { 640, 480, 12 }, { 800, 600, 30 }, { 800, 600, 60 }, { 1600, 1200, 40 } };
+    size_t frames = optind < argc ? (size_t)(argc - optind) : sizeof(synthetic) / sizeof(synthetic[0]);
+    bench_frame_t *frame = (bench_frame_t *)calloc(frames, sizeof(bench_frame_t));
+    size_t len_max = 0;
+    for (size_t n = 0; n < frames; n++) {
+        bool ok = optind < argc ? bench_load(argv[optind + n], &frame[n])
+                                : bench_synthetic(synthetic[n].width, synthetic[n].height, synthetic[n].quality, &frame[n]);
+        frame[n].eoi = ok ? cam_jpeg_find_eoi(frame[n].jpg, frame[n].len) : -1;
+        if (frame[n].eoi < 0 || frame[n].eoi + 2 != (int)frame[n].len || cam_jpeg_find_soi(frame[n].jpg, frame[n].len) != 0) {
+            fprintf(stderr, "%s is not a JPEG frame ending with its EOI\n", optind < argc ? argv[optind + n] : frame[n].name);
+            return 1;
+        }
+        if (frame[n].len > len_max) {
+            len_max = frame[n].len;
+        }
+    }
+
+    // every frame gets at least one more half buffer, as cam_task copies a half buffer past the EOI
+    size_t buf_size = (len_max / s_half + 2) * s_half;
+    uint8_t *buf = (uint8_t *)malloc(buf_size);
+    // the tail of a longer frame: entropy coded data and its EOI at the end
+    uint8_t *tail = (uint8_t *)malloc(buf_size);
+    for (size_t i = 0; i < buf_size; i++) {
+        tail[i] = rand() % 255;
+    }
+    tail[buf_size - 2] = 0xFF;
+    tail[buf_size - 1] = 0xD9;
+
+    printf("%zu frames, %u byte half buffers, %s tails, us per frame:\n", frames, s_half, stale ? "stale" : "zero");
+    printf("  %-24s %8s", "frame", "bytes");
+    for (size_t k = 0; k < BENCH_SEARCHES; k++) {
+        printf(" %9s", bench_searches[k].name);
+    }
+    printf("\n");
+
+    double total_us[BENCH_SEARCHES] = { 0 };
+    int failed = 0;
+    for (size_t n = 0; n < frames; n++) {
+        size_t len = (frame[n].len / s_half + 1) * s_half;
+        memcpy(buf, frame[n].jpg, frame[n].len);
+        if (stale) {
+            memcpy(buf + frame[n].len, tail + frame[n].len, len - frame[n].len);
+            buf[len - 2] = 0xFF;
+            buf[len - 1] = 0xD9;
+        } else {
+            memset(buf + frame[n].len, 0, len - frame[n].len);
+        }
+
+        printf("  %-24.24s %8zu", frame[n].name, frame[n].len);
+        for (size_t k = 0; k < BENCH_SEARCHES; k++) {
+            int eoi = bench_searches[k].search(buf, len);
+            int64_t start = esp_timer_get_time();
+            for (uint32_t i = 0; i < count; i++) {
+                eoi = bench_searches[k].search(buf, len);
+            }
+            double us = (double)(esp_timer_get_time() - start) / count;
+            total_us[k] += us;
+            printf(" %9.2f", us);
+            // backward searches find the stale EOI, that is why the tracker exists
+            if (eoi != frame[n].eoi && !(stale && k < 2)) {
+                printf("\n  %s found the EOI at %d, not at %d", bench_searches[k].name, eoi, frame[n].eoi);
+                failed++;
+            }
+        }
+        printf("\n");
+        free(frame[n].jpg);
+    }
+    printf("  %-33s", "mean");
+    for (size_t k = 0; k < BENCH_SEARCHES; k++) {
+        printf(" %9.2f", total_us[k] / frames);
+    }
+    printf("\n");
+    free(frame);
+    free(buf);
+    free(tail);
+    if (failed) {
+        printf("%d searches missed the EOI\n", failed);
+        return 1;
+    }
+    return 0;
+}
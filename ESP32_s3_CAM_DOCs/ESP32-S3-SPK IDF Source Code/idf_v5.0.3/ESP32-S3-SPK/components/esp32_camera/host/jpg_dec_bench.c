@@ -0,0 +1,500 @@
+// JPEG decoder benchmark: esp_jpg_decode() time of JPEG frame files, and a checksum of the RGB
+// output to compare builds with different CAMERA_JPEG_FASTDECODE levels.
+// With -j the frames are also decoded concurrently, by a decode queue and by threads calling
+// esp_jpg_decode() at once, and every output is compared with the one decoded alone.
+// With -b regions of every frame are decoded at every scale with esp_jpg_decode_bands() and
+// compared with the full decode: the whole image, single pixels, edges, single lines and
+// regions that are not MCU aligned or reach over the image.
+// With -c the checksums are written to a file, or compared with the ones in it: a run of a build
+// with another CAMERA_JPEG_FASTDECODE level against the file checks that it decodes the same pixels.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include "esp_timer.h"
+#include "esp_jpg_decode.h"
+
+typedef struct {
+    const uint8_t *jpg;
+    uint8_t *rgb;
+    uint16_t width;
+    uint16_t height;
+} bench_frame_t;
+
+typedef struct {
+    const char *path;
+    uint8_t *jpg;
+    size_t len;
+    uint32_t checksum;          // of the output decoded alone
+} bench_file_t;
+
+typedef struct {
+    const bench_file_t *files;
+    size_t file_count;
+    jpg_scale_t scale;
+    uint32_t rounds;
+    uint32_t decodes;           // updated atomically
+    uint32_t mismatches;
+} bench_concurrent_t;
+
+typedef struct {
+    bench_frame_t src;          // first, bench_read() gets the run, only jpg is set
+    const bench_frame_t *full;  // the image decoded with esp_jpg_decode()
+    jpg_rect_t roi;             // the region clipped to the image
+    uint16_t next_line;         // first line of the next band
+    uint32_t bands;
+    uint32_t starts;            // NULL data calls before and after the bands
+    uint32_t ends;
+    uint32_t mismatches;
+} bench_bands_t;
+
+typedef struct {
+    bench_frame_t frame;        // first, the decode callbacks get the job
+    bench_concurrent_t *run;
+    const bench_file_t *file;
+} bench_job_t;
+
+static size_t bench_read(void *arg, size_t index, uint8_t *buf, size_t len)
+{
+    bench_frame_t *frame = (bench_frame_t *)arg;
+    if (buf) {
+        memcpy(buf, frame->jpg + index, len);
+    }
+    return len;
+}
+
+static bool bench_write(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data)
+{
+    bench_frame_t *frame = (bench_frame_t *)arg;
+    if (!data) {
+        if (x == 0 && y == 0 && !frame->rgb) {
+            frame->width = w;
+            frame->height = h;
+            frame->rgb = (uint8_t *)calloc((size_t)w * h, 3);
+        }
+        return frame->rgb != NULL;
+    }
+    // MCUs at the right and bottom edge reach over the scaled image size
+    for (int i = 0; i < h && y + i < frame->height; i++) {
+        if (x < frame->width) {
+            size_t n = x + w > frame->width ? frame->width - x : w;
+            memcpy(frame->rgb + ((size_t)(y + i) * frame->width + x) * 3, data + (size_t)i * w * 3, n * 3);
+        }
+    }
+    return true;
+}
+
+static uint8_t *bench_load(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    rewind(f);
+    uint8_t *data = (uint8_t *)malloc(*len);
+    if (data && fread(data, 1, *len, f) != *len) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    return data;
+}
+
+// FNV-1a
+static uint32_t bench_checksum(const uint8_t *data, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ data[i]) * 16777619u;
+    }
+    return h;
+}
+
+static uint32_t bench_frame_checksum(const bench_frame_t *frame)
+{
+    return bench_checksum(frame->rgb, (size_t)frame->width * frame->height * 3);
+}
+
+static bool bench_find_checksum(FILE *f, const char *key, uint32_t *checksum)
+{
+    char line[1024];
+    rewind(f);
+    while (fgets(line, sizeof(line), f)) {
+        char *sep = strrchr(line, ' ');
+        if (sep && (size_t)(sep - line) == strlen(key) && strncmp(line, key, sep - line) == 0) {
+            *checksum = strtoul(sep + 1, NULL, 16);
+            return true;
+        }
+    }
+    return false;
+}
+
+// writes the checksum of the frame at the scale to the file, or compares it with the one in it
+static bool bench_check_checksum(FILE *f, bool compare, const char *path, uint32_t scale, uint32_t checksum)
+{
+    char key[1024];
+    uint32_t expected;
+    snprintf(key, sizeof(key), "%s s%" PRIu32, path, scale);
+    if (!compare) {
+        fprintf(f, "%s %08" PRIx32 "\n", key, checksum);
+        return true;
+    }
+    if (!bench_find_checksum(f, key, &expected)) {
+        fprintf(stderr, "%s: no checksum at scale %" PRIu32 "\n", path, scale);
+        return false;
+    }
+    if (expected != checksum) {
+        fprintf(stderr, "%s: checksum %08" PRIx32 " at scale %" PRIu32 ", %08" PRIx32 " in the file\n", path, checksum,
+                scale, expected);
+        return false;
+    }
+    return true;
+}
+
+// the bands must come in order, at the left of the region, as wide as it, and hold its pixels of the full decode
+static bool bench_band_write(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data)
+{
+    bench_bands_t *run = (bench_bands_t *)arg;
+    const bench_frame_t *full = run->full;
+    if (!data) {
+        if (x == 0 && y == 0 && !run->bands && !run->starts) {
+            run->starts++;
+            run->mismatches += w != full->width || h != full->height;
+        } else {
+            run->ends++;
+        }
+        return true;
+    }
+    run->bands++;
+    if (x != run->roi.x || w != run->roi.w || y != run->next_line || !h || y + h > run->roi.y + run->roi.h) {
+        run->mismatches++;
+        return false;
+    }
+    for (int i = 0; i < h; i++) {
+        if (memcmp(data + (size_t)i * w * 3, full->rgb + ((size_t)(y + i) * full->width + x) * 3, (size_t)w * 3)) {
+            run->mismatches++;
+        }
+    }
+    run->next_line = y + h;
+    return true;
+}
+
+// decodes a region of the frame in bands, NULL for the whole image, and compares it with the full decode
+static bool bench_region(const bench_frame_t *full, size_t len, jpg_scale_t scale, const jpg_rect_t *roi)
+{
+    bench_bands_t run = {
+        .src = { .jpg = full->jpg },
+        .full = full,
+        .roi = { 0, 0, full->width, full->height },
+    };
+    if (roi) {
+        run.roi.x = roi->x;
+        run.roi.y = roi->y;
+        run.roi.w = roi->w < full->width - roi->x ? roi->w : full->width - roi->x;
+        run.roi.h = roi->h < full->height - roi->y ? roi->h : full->height - roi->y;
+    }
+    run.next_line = run.roi.y;
+    size_t tile_len = JPG_BAND_LEN(run.roi.w, scale);
+    uint8_t *tile = (uint8_t *)malloc(tile_len);
+    esp_err_t err = esp_jpg_decode_bands(len, scale, roi, tile, tile_len, bench_read, bench_band_write, &run);
+    free(tile);
+    if (err != ESP_OK || run.starts != 1 || run.ends != 1 || run.mismatches ||
+        run.next_line != run.roi.y + run.roi.h) {
+        fprintf(stderr, "%ux%u at %u,%u of %ux%u: error %d, %" PRIu32 " bands, %" PRIu32 " differ, to line %u\n",
+                run.roi.w, run.roi.h, run.roi.x, run.roi.y, full->width, full->height, err, run.bands,
+                run.mismatches, run.next_line);
+        return false;
+    }
+    return true;
+}
+
+// regions that are not in the image, and a tile that does not hold a line, are refused before the writer is called
+static bool bench_region_refused(const bench_frame_t *full, size_t len, jpg_scale_t scale, jpg_rect_t roi,
+                                 size_t tile_len, esp_err_t expected)
+{
+    bench_bands_t run = { .src = { .jpg = full->jpg }, .full = full, .roi = roi };
+    uint8_t *tile = (uint8_t *)malloc(tile_len + 1);
+    esp_err_t err = esp_jpg_decode_bands(len, scale, &roi, tile, tile_len, bench_read, bench_band_write, &run);
+    free(tile);
+    if (err != expected || run.starts || run.bands) {
+        fprintf(stderr, "%ux%u at %u,%u of %ux%u with a tile of %zu bytes: error %d, %d expected\n", roi.w, roi.h,
+                roi.x, roi.y, full->width, full->height, tile_len, err, expected);
+        return false;
+    }
+    return true;
+}
+
+// every scale: the full decode, then the regions in bands; the number of regions that differ or -1
+static int bench_bands(const char *path, const uint8_t *jpg, size_t len, FILE *checksums, bool compare)
+{
+    int differ = 0;
+    for (uint32_t scale = 0; scale <= JPG_SCALE_MAX; scale++) {
+        bench_frame_t full = { .jpg = jpg };
+        if (esp_jpg_decode(len, (jpg_scale_t)scale, bench_read, bench_write, &full) != ESP_OK) {
+            fprintf(stderr, "cannot decode %s at scale %" PRIu32 "\n", path, scale);
+            free(full.rgb);
+            return -1;
+        }
+        uint16_t w = full.width, h = full.height;
+        uint32_t checksum = bench_frame_checksum(&full);
+        if (checksums && !bench_check_checksum(checksums, compare, path, scale, checksum)) {
+            differ++;
+        }
+
+        const jpg_rect_t regions[] = {
+            { 0, 0, 1, 1 },                 // first pixel
+            { w - 1, h - 1, 1, 1 },         // last pixel, in the edge MCU
+            { w - 1, 0, 1, h },             // right column
+            { 0, h - 1, w, 1 },             // bottom line
+            { 0, h / 2, w, 1 },             // a line in the middle of the image
+            { 3, 5, 17, 9 },                // not MCU aligned
+            { w / 2 + 1, 7, 1, h },         // a column from an odd line to the bottom
+            { w / 3, h / 3, w, h },         // over the right and bottom edge, clipped
+        };
+        uint32_t tested = 1;
+        differ += !bench_region(&full, len, (jpg_scale_t)scale, NULL);
+        for (size_t i = 0; i < sizeof(regions) / sizeof(regions[0]); i++) {
+            if (regions[i].x < w && regions[i].y < h) {
+                differ += !bench_region(&full, len, (jpg_scale_t)scale, &regions[i]);
+                tested++;
+            }
+        }
+        differ += !bench_region_refused(&full, len, (jpg_scale_t)scale, (jpg_rect_t){ w, 0, 1, 1 }, JPG_BAND_LEN(1, scale),
+                                        ESP_ERR_INVALID_ARG);
+        differ += !bench_region_refused(&full, len, (jpg_scale_t)scale, (jpg_rect_t){ 0, 0, 0, 1 }, JPG_BAND_LEN(1, scale),
+                                        ESP_ERR_INVALID_ARG);
+        differ += !bench_region_refused(&full, len, (jpg_scale_t)scale, (jpg_rect_t){ 0, 0, w, 1 }, (size_t)w * 3 - 1,
+                                        ESP_ERR_INVALID_SIZE);
+        printf("%s: scale %" PRIu32 " %ux%u  rgb %08" PRIx32 "  %" PRIu32 " regions in bands\n", path, scale, w, h,
+               checksum, tested);
+        free(full.rgb);
+    }
+    return differ;
+}
+
+static void bench_check(bench_concurrent_t *run, const bench_file_t *file, const bench_frame_t *frame, esp_err_t err)
+{
+    __atomic_fetch_add(&run->decodes, 1, __ATOMIC_RELAXED);
+    if (err != ESP_OK || !frame->rgb || bench_frame_checksum(frame) != file->checksum) {
+        fprintf(stderr, "%s: concurrent decode differs\n", file->path);
+        __atomic_fetch_add(&run->mismatches, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void bench_job_done(void *arg, esp_err_t err)
+{
+    bench_job_t *job = (bench_job_t *)arg;
+    bench_check(job->run, job->file, &job->frame, err);
+    free(job->frame.rgb);
+    free(job);
+}
+
+// every frame, rounds times, through a decode queue with the given workers
+static int64_t bench_queue(bench_concurrent_t *run, size_t workers)
+{
+    jpg_decode_queue_t queue;
+    int64_t start_us = esp_timer_get_time();
+    if (esp_jpg_decode_queue_create(workers, 2 * workers, &queue) != ESP_OK) {
+        return -1;
+    }
+    for (uint32_t r = 0; r < run->rounds; r++) {
+        for (size_t i = 0; i < run->file_count; i++) {
+            bench_job_t *job = (bench_job_t *)calloc(1, sizeof(bench_job_t));
+            job->run = run;
+            job->file = &run->files[i];
+            job->frame.jpg = job->file->jpg;
+            jpg_decode_job_t decode = {
+                .len = job->file->len,
+                .scale = run->scale,
+                .reader = bench_read,
+                .writer = bench_write,
+                .done = bench_job_done,
+                .arg = job,
+            };
+            esp_jpg_decode_queue_submit(queue, &decode, UINT32_MAX);
+        }
+    }
+    esp_jpg_decode_queue_delete(queue);
+    return esp_timer_get_time() - start_us;
+}
+
+// every thread decodes every frame, rounds times, with esp_jpg_decode() and its shared context
+static void *bench_thread(void *arg)
+{
+    bench_concurrent_t *run = (bench_concurrent_t *)arg;
+    for (uint32_t r = 0; r < run->rounds; r++) {
+        for (size_t i = 0; i < run->file_count; i++) {
+            bench_frame_t frame = { .jpg = run->files[i].jpg };
+            esp_err_t err = esp_jpg_decode(run->files[i].len, run->scale, bench_read, bench_write, &frame);
+            bench_check(run, &run->files[i], &frame, err);
+            free(frame.rgb);
+        }
+    }
+    return NULL;
+}
+
+static int64_t bench_threads(bench_concurrent_t *run, size_t count)
+{
+    pthread_t threads[count];
+    int64_t start_us = esp_timer_get_time();
+    for (size_t i = 0; i < count; i++) {
+        pthread_create(&threads[i], NULL, bench_thread, run);
+    }
+    for (size_t i = 0; i < count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    return esp_timer_get_time() - start_us;
+}
+
+static void bench_usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options] frame.jpg...\n"
+            "  -s scale     output scale 0 to 3, the image is divided by 1 << scale (0)\n"
+            "  -n count     decodes per frame, the fastest counts (20)\n"
+            "  -j jobs      then decode count rounds of the frames with a decode queue of this many workers,\n"
+            "               and with this many threads, and compare the output (0)\n"
+            "  -b           decode regions at every scale in bands and compare them with the full decode, no timing\n"
+            "  -c file      write the output checksums to the file, or compare them with the ones in it\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t scale = 0, count = 20, jobs = 0;
+    bool bands = false;
+    const char *checksum_path = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:n:j:bc:h")) != -1) {
+        switch (opt) {
+            case 's': scale = strtoul(optarg, NULL, 0); break;
+            case 'n': count = strtoul(optarg, NULL, 0); break;
+            case 'j': jobs = strtoul(optarg, NULL, 0); break;
+            case 'b': bands = true; break;
+            case 'c': checksum_path = optarg; break;
+            default:
+                bench_usage(argv[0]);
+                return 2;
+        }
+    }
+    if (optind == argc || count == 0 || scale > JPG_SCALE_MAX || (bands && jobs)) {
+        bench_usage(argv[0]);
+        return 2;
+    }
+
+    FILE *checksums = NULL;
+    bool compare = false;
+    if (checksum_path) {
+        checksums = fopen(checksum_path, "r");
+        compare = checksums != NULL;
+        if (!checksums && !(checksums = fopen(checksum_path, "w"))) {
+            fprintf(stderr, "cannot create %s\n", checksum_path);
+            return 1;
+        }
+    }
+
+    if (bands) {
+        int differ = 0;
+        for (int n = optind; n < argc; n++) {
+            size_t jpg_len;
+            uint8_t *jpg = bench_load(argv[n], &jpg_len);
+            int failed = jpg ? bench_bands(argv[n], jpg, jpg_len, checksums, compare) : -1;
+            free(jpg);
+            if (failed < 0) {
+                fprintf(stderr, "cannot decode %s\n", argv[n]);
+                return 1;
+            }
+            differ += failed;
+        }
+        printf("all frames: %d differ\n", differ);
+        if (checksums) {
+            fclose(checksums);
+        }
+        return differ ? 1 : 0;
+    }
+
+    size_t file_count = argc - optind;
+    bench_file_t *files = (bench_file_t *)calloc(file_count, sizeof(bench_file_t));
+    uint64_t all_pixels = 0;
+    int64_t all_us = 0;
+    int result = 0;
+    for (int n = optind; n < argc; n++) {
+        bench_file_t *file = &files[n - optind];
+        bench_frame_t frame = { 0 };
+        size_t jpg_len;
+        uint8_t *jpg = bench_load(argv[n], &jpg_len);
+        frame.jpg = jpg;
+        if (!jpg) {
+            fprintf(stderr, "cannot read %s\n", argv[n]);
+            return 1;
+        }
+
+        int64_t best_us = INT64_MAX;
+        for (uint32_t i = 0; i < count; i++) {
+            int64_t start_us = esp_timer_get_time();
+            esp_err_t err = esp_jpg_decode(jpg_len, (jpg_scale_t)scale, bench_read, bench_write, &frame);
+            int64_t us = esp_timer_get_time() - start_us;
+            if (err != ESP_OK) {
+                fprintf(stderr, "cannot decode %s\n", argv[n]);
+                return 1;
+            }
+            if (us < best_us) {
+                best_us = us;
+            }
+        }
+
+        // MPix/s counts the pixels of the JPEG, at every scale all of its data is decoded
+        uint64_t pixels = (uint64_t)(frame.width << scale) * (frame.height << scale);
+        file->path = argv[n];
+        file->jpg = jpg;
+        file->len = jpg_len;
+        file->checksum = bench_frame_checksum(&frame);
+        if (checksums && !bench_check_checksum(checksums, compare, argv[n], scale, file->checksum)) {
+            result = 1;
+        }
+        printf("%s: %ux%u  %.3f ms  %.2f MPix/s  rgb %08" PRIx32 "\n", argv[n], frame.width, frame.height,
+               best_us / 1e3, pixels / (double)best_us, file->checksum);
+        all_pixels += pixels;
+        all_us += best_us;
+        free(frame.rgb);
+    }
+    printf("all frames: %.3f ms  %.2f MPix/s\n", all_us / 1e3, all_pixels / (double)all_us);
+    if (checksums) {
+        fclose(checksums);
+    }
+
+    if (jobs) {
+        bench_concurrent_t run = {
+            .files = files,
+            .file_count = file_count,
+            .scale = (jpg_scale_t)scale,
+            .rounds = count,
+        };
+        const char *names[] = { "decode queue", "threads" };
+        for (int mode = 0; mode < 2; mode++) {
+            run.decodes = run.mismatches = 0;
+            int64_t us = mode == 0 ? bench_queue(&run, jobs) : bench_threads(&run, jobs);
+            uint64_t decoded = mode == 0 ? count : (uint64_t)count * jobs;
+            if (us < 0) {
+                fprintf(stderr, "cannot create the decode queue\n");
+                return 1;
+            }
+            printf("%s of %" PRIu32 ": %" PRIu32 " decodes  %.3f ms  %.2f MPix/s  %" PRIu32 " differ\n", names[mode], jobs,
+                   run.decodes, us / 1e3, all_pixels * decoded / (double)us, run.mismatches);
+            if (run.mismatches || run.decodes != decoded * file_count) {
+                result = 1;
+            }
+        }
+    }
+    for (size_t i = 0; i < file_count; i++) {
+        free(files[i].jpg);
+    }
+    free(files);
+    return result;
+}
@@ -0,0 +1,435 @@
+// JPEG encoder benchmark: encode time of recorded frames with fmt2jpg() or fmt2jpg_optimized(),
+// and with CAMERA_JPGE_PROFILE the part of it spent in the entropy coder.
+// With -c the output checksums are written to a file, or compared with the ones in it: a run of a
+// CAMERA_JPGE_VECTOR_DCT build against the file of a scalar build checks that both encode the same bytes.
+// With -p the output of fmt2jpg() is decoded and compared with the one of fmt2jpg_optimized(), which is
+// never striped: with CAMERA_JPEG_ENCODE_STRIPES > 1 the stitched stripes must give the same pixels.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include "sdkconfig.h"
+#include "esp_timer.h"
+#include "esp_cpu.h"
+#include "esp_jpg_decode.h"
+#include "img_converters.h"
+
+#if JPGE_PROFILE
+extern uint64_t jpge_entropy_cycles;
+#endif
+
+// the range to_jpg.cpp expects YUV420 in, -DCAMERA_CONV_LIMITED_RANGE=ON sets it to 0 for both
+#ifndef JPG_YUV420_FULL_RANGE
+#define JPG_YUV420_FULL_RANGE 1
+#endif
+
+typedef struct {
+    const uint8_t *jpg;
+    uint8_t *rgb;
+    uint16_t width;
+    uint16_t height;
+} bench_frame_t;
+
+static size_t bench_read(void *arg, size_t index, uint8_t *buf, size_t len)
+{
+    bench_frame_t *frame = (bench_frame_t *)arg;
+    if (buf) {
+        memcpy(buf, frame->jpg + index, len);
+    }
+    return len;
+}
+
+static bool bench_write(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data)
+{
+    bench_frame_t *frame = (bench_frame_t *)arg;
+    if (!data) {
+        if (x == 0 && y == 0) {
+            frame->width = w;
+            frame->height = h;
+            frame->rgb = (uint8_t *)malloc((size_t)w * h * 3);
+        }
+        return frame->rgb != NULL;
+    }
+    for (int i = 0; i < h; i++) {
+        memcpy(frame->rgb + ((size_t)(y + i) * frame->width + x) * 3, data + (size_t)i * w * 3, (size_t)w * 3);
+    }
+    return true;
+}
+
+static uint8_t *bench_load(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    rewind(f);
+    uint8_t *data = (uint8_t *)malloc(*len);
+    if (data && fread(data, 1, *len, f) != *len) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    return data;
+}
+
+// FNV-1a of the output JPEG
+static uint32_t bench_checksum(const uint8_t *data, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ data[i]) * 16777619u;
+    }
+    return h;
+}
+
+// the checksum the file has for path, false when it has none
+static bool bench_find_checksum(FILE *f, const char *path, uint32_t *checksum)
+{
+    char line[1024];
+    rewind(f);
+    while (fgets(line, sizeof(line), f)) {
+        char *sep = strrchr(line, ' ');
+        if (sep && (size_t)(sep - line) == strlen(path) && strncmp(line, path, sep - line) == 0) {
+            *checksum = strtoul(sep + 1, NULL, 16);
+            return true;
+        }
+    }
+    return false;
+}
+
+// 1 if the pixels of both JPEGs are the same, 0 if not, -1 if one does not decode
+static int bench_compare_pixels(const uint8_t *a, size_t a_len, const uint8_t *b, size_t b_len)
+{
+    bench_frame_t frames[2] = { { .jpg = a }, { .jpg = b } };
+    size_t lens[2] = { a_len, b_len };
+    int result = -1;
+    for (int i = 0; i < 2; i++) {
+        if (esp_jpg_decode(lens[i], JPG_SCALE_NONE, bench_read, bench_write, &frames[i]) != ESP_OK) {
+            goto out;
+        }
+    }
+    result = frames[0].width == frames[1].width && frames[0].height == frames[1].height &&
+             memcmp(frames[0].rgb, frames[1].rgb, (size_t)frames[0].width * frames[0].height * 3) == 0;
+out:
+    free(frames[0].rgb);
+    free(frames[1].rgb);
+    return result;
+}
+
+static uint8_t bench_clip(int v)
+{
+    return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+// PSNR of the decoded JPEG against the frame, -1 if it does not decode
+static double bench_psnr(const bench_frame_t *src, const uint8_t *jpg, size_t len)
+{
+    bench_frame_t frame = { .jpg = jpg };
+    double err = 0;
+    size_t n = (size_t)src->width * src->height * 3;
+    if (esp_jpg_decode(len, JPG_SCALE_NONE, bench_read, bench_write, &frame) != ESP_OK ||
+        frame.width != src->width || frame.height != src->height) {
+        free(frame.rgb);
+        return -1;
+    }
+    for (size_t i = 0; i < n; i++) {
+        int d = frame.rgb[i] - src->rgb[i];
+        err += d * d;
+    }
+    free(frame.rgb);
+    return err ? 10 * log10(255.0 * 255.0 * n / err) : 99;
+}
+
+// YUV420 needs even sizes, the last column and line of odd sized frames are dropped
+static void bench_crop_even(bench_frame_t *frame)
+{
+    uint16_t width = frame->width & ~1;
+    for (int i = 0; i < frame->height; i++) {
+        memmove(frame->rgb + (size_t)i * width * 3, frame->rgb + (size_t)i * frame->width * 3, (size_t)width * 3);
+    }
+    frame->width = width;
+    frame->height &= ~1;
+}
+
+// the decoded RGB888 frame as the LCD_CAM converter writes YUV420: Y0 U Y1 on even lines, Y0 V Y1 on odd
+// lines, the chroma of each pixel pair, BT.601 in the range to_jpg.cpp expects
+static uint8_t *bench_convert_yuv420(const bench_frame_t *frame, size_t *len)
+{
+    size_t stride = (size_t)frame->width * 3 / 2;
+    uint8_t *out = (uint8_t *)malloc(stride * frame->height);
+    if (!out) {
+        return NULL;
+    }
+    for (int y = 0; y < frame->height; y++) {
+        for (int x = 0; x < frame->width; x += 2) {
+            const uint8_t *p = frame->rgb + ((size_t)y * frame->width + x) * 3;
+            uint8_t *o = out + y * stride + x / 2 * 3;
+            int r = (p[0] + p[3] + 1) / 2, g = (p[1] + p[4] + 1) / 2, b = (p[2] + p[5] + 1) / 2;
+#if JPG_YUV420_FULL_RANGE
+            o[0] = bench_clip((77 * p[0] + 150 * p[1] + 29 * p[2] + 128) >> 8);
+            o[2] = bench_clip((77 * p[3] + 150 * p[4] + 29 * p[5] + 128) >> 8);
+            o[1] = (y & 1) ? bench_clip(((128 * r - 107 * g - 21 * b + 128) >> 8) + 128)
+                           : bench_clip(((-43 * r - 85 * g + 128 * b + 128) >> 8) + 128);
+#else
+            o[0] = bench_clip(((66 * p[0] + 129 * p[1] + 25 * p[2] + 128) >> 8) + 16);
+            o[2] = bench_clip(((66 * p[3] + 129 * p[4] + 25 * p[5] + 128) >> 8) + 16);
+            o[1] = (y & 1) ? bench_clip(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128)
+                           : bench_clip(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+#endif
+        }
+    }
+    *len = stride * frame->height;
+    return out;
+}
+
+// the decoded RGB888 frame in the pixel format the sensor would send, BT.601 limited range for YUV
+static uint8_t *bench_convert(const bench_frame_t *frame, pixformat_t format, size_t *len)
+{
+    if (format == PIXFORMAT_YUV420) {
+        return bench_convert_yuv420(frame, len);
+    }
+    size_t pixels = (size_t)frame->width * frame->height;
+    size_t bpp = format == PIXFORMAT_RGB888 ? 3 : format == PIXFORMAT_GRAYSCALE ? 1 : 2;
+    uint8_t *out = (uint8_t *)malloc(pixels * bpp);
+    if (!out) {
+        return NULL;
+    }
+    for (size_t i = 0; i < pixels; i++) {
+        int r = frame->rgb[i * 3], g = frame->rgb[i * 3 + 1], b = frame->rgb[i * 3 + 2];
+        int y = bench_clip(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+        switch (format) {
+            case PIXFORMAT_RGB888:
+                out[i * 3] = b;
+                out[i * 3 + 1] = g;
+                out[i * 3 + 2] = r;
+                break;
+            case PIXFORMAT_RGB565: {
+                uint16_t c = ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+                out[i * 2] = c >> 8;
+                out[i * 2 + 1] = c;
+                break;
+            }
+            case PIXFORMAT_GRAYSCALE:
+                out[i] = y;
+                break;
+            default:
+                out[i * 2] = y;
+                if (i & 1) {
+                    out[i * 2 + 1] = bench_clip(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+                } else {
+                    out[i * 2 + 1] = bench_clip(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+                }
+                break;
+        }
+    }
+    *len = pixels * bpp;
+    return out;
+}
+
+static void bench_usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options] frame.jpg...\n"
+            "  -F format    yuv422, yuv420, rgb565, rgb888 or gray, the frames are converted to it (yuv422),\n"
+            "               yuv420 as the LCD_CAM converter writes it\n"
+            "  -q quality   JPEG quality (80)\n"
+            "  -n count     encodes per frame, the fastest counts (20)\n"
+            "  -o           encode with Huffman tables built for each frame, fmt2jpg_optimized()\n"
+            "  -c file      write the output checksums to file, or compare them with it if it exists\n"
+            "  -p           compare the decoded pixels with the ones of a single task fmt2jpg_optimized(),\n"
+            "               not with -o or gray, which esp_jpg_decode() cannot decode, and print their PSNR\n"
+            "  -m dB        with -p, exit with 1 when the PSNR of a frame is lower (0)\n",
+            prog);
+}
+
+static bool bench_parse_format(const char *arg, pixformat_t *format)
+{
+    static const struct {
+        const char *name;
+        pixformat_t format;
+    } formats[] = {
+        {"yuv422", PIXFORMAT_YUV422},
+        {"yuv420", PIXFORMAT_YUV420},
+        {"rgb565", PIXFORMAT_RGB565},
+        {"rgb888", PIXFORMAT_RGB888},
+        {"gray", PIXFORMAT_GRAYSCALE},
+    };
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        if (strcmp(arg, formats[i].name) == 0) {
+            *format = formats[i].format;
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char **argv)
+{
+    pixformat_t format = PIXFORMAT_YUV422;
+    uint32_t quality = 80, count = 20;
+    bool optimize = false, pixels = false;
+    double min_psnr = 0;
+    const char *checksum_path = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "F:q:n:oc:pm:h")) != -1) {
+        switch (opt) {
+            case 'F':
+                if (!bench_parse_format(optarg, &format)) {
+                    fprintf(stderr, "unknown format %s\n", optarg);
+                    return 2;
+                }
+                break;
+            case 'q': quality = strtoul(optarg, NULL, 0); break;
+            case 'n': count = strtoul(optarg, NULL, 0); break;
+            case 'o': optimize = true; break;
+            case 'c': checksum_path = optarg; break;
+            case 'p': pixels = true; break;
+            case 'm': min_psnr = strtod(optarg, NULL); break;
+            default:
+                bench_usage(argv[0]);
+                return 2;
+        }
+    }
+    if (optind == argc || count == 0 || quality == 0 || quality > 100 || (pixels && (optimize || format == PIXFORMAT_GRAYSCALE))) {
+        bench_usage(argv[0]);
+        return 2;
+    }
+
+    FILE *checksums = NULL;
+    bool compare = false;
+    if (checksum_path) {
+        checksums = fopen(checksum_path, "r");
+        compare = checksums != NULL;
+        if (!checksums && !(checksums = fopen(checksum_path, "w"))) {
+            fprintf(stderr, "cannot create %s\n", checksum_path);
+            return 1;
+        }
+    }
+
+    // the MCUs of fmt2jpg(), 16x16 pixels with the H2V2 chroma of color formats, 8x8 for grayscale
+    int mcu_size = format == PIXFORMAT_GRAYSCALE ? 8 : 16;
+    uint64_t all_cycles = 0, all_entropy = 0, all_bytes = 0, all_mcus = 0, all_pixels = 0;
+    int64_t all_us = 0;
+    int result = 0, differ = 0;
+    for (int n = optind; n < argc; n++) {
+        bench_frame_t frame = { 0 };
+        size_t jpg_len, src_len;
+        uint8_t *jpg = bench_load(argv[n], &jpg_len);
+        frame.jpg = jpg;
+        if (!jpg || esp_jpg_decode(jpg_len, JPG_SCALE_NONE, bench_read, bench_write, &frame) != ESP_OK) {
+            fprintf(stderr, "cannot decode %s\n", argv[n]);
+            return 1;
+        }
+        if (format == PIXFORMAT_YUV420) {
+            bench_crop_even(&frame);
+        }
+        uint8_t *src = bench_convert(&frame, format, &src_len);
+
+        int64_t best_us = INT64_MAX;
+        uint64_t cycles = 0, entropy = 0;
+        uint32_t checksum = 0;
+        size_t out_len = 0;
+        int same = 1;
+        double psnr = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            uint8_t *out;
+#if JPGE_PROFILE
+            uint64_t entropy_start = jpge_entropy_cycles;
+#endif
+            int64_t start_us = esp_timer_get_time();
+            esp_cpu_cycle_count_t start = esp_cpu_get_cycle_count();
+            bool ok = optimize ? fmt2jpg_optimized(src, src_len, frame.width, frame.height, format, quality, &out, &out_len)
+                               : fmt2jpg(src, src_len, frame.width, frame.height, format, quality, &out, &out_len);
+            if (!ok) {
+                fprintf(stderr, "cannot encode %s\n", argv[n]);
+                return 1;
+            }
+            cycles += (esp_cpu_cycle_count_t)(esp_cpu_get_cycle_count() - start);
+            int64_t us = esp_timer_get_time() - start_us;
+#if JPGE_PROFILE
+            entropy += jpge_entropy_cycles - entropy_start;
+#endif
+            checksum = bench_checksum(out, out_len);
+            if (pixels && i == 0) {
+                uint8_t *ref;
+                size_t ref_len;
+                if (!fmt2jpg_optimized(src, src_len, frame.width, frame.height, format, quality, &ref, &ref_len)) {
+                    fprintf(stderr, "cannot encode %s\n", argv[n]);
+                    return 1;
+                }
+                same = bench_compare_pixels(out, out_len, ref, ref_len);
+                psnr = bench_psnr(&frame, out, out_len);
+                free(ref);
+            }
+            free(out);
+            if (us < best_us) {
+                best_us = us;
+            }
+        }
+
+        uint64_t mcus = (uint64_t)((frame.width + mcu_size - 1) / mcu_size) * ((frame.height + mcu_size - 1) / mcu_size);
+        printf("%s: %ux%u %zu bytes  %.3f ms  %.1f ns/px  %.0f MCU/s  checksum %08" PRIx32, argv[n], frame.width,
+               frame.height, out_len, best_us / 1e3, best_us * 1e3 / ((double)frame.width * frame.height),
+               mcus * 1e6 / best_us, checksum);
+        if (entropy) {
+            printf("  entropy coder %.1f%%", 100.0 * entropy / cycles);
+        }
+        if (pixels) {
+            printf("  PSNR %.2f dB", psnr);
+        }
+        printf("\n");
+        if (same != 1) {
+            fprintf(stderr, "%s: %s\n", argv[n], same < 0 ? "the output does not decode" : "the pixels differ from a single task encode");
+            result = 1;
+            differ++;
+        }
+        if (pixels && psnr < min_psnr) {
+            fprintf(stderr, "%s: PSNR %.2f dB, lower than %.2f dB\n", argv[n], psnr, min_psnr);
+            result = 1;
+        }
+        if (checksums && !compare) {
+            fprintf(checksums, "%s %08" PRIx32 "\n", argv[n], checksum);
+        } else if (checksums) {
+            uint32_t expected;
+            if (!bench_find_checksum(checksums, argv[n], &expected)) {
+                fprintf(stderr, "%s: no checksum in %s\n", argv[n], checksum_path);
+                result = 1;
+            } else if (expected != checksum) {
+                fprintf(stderr, "%s: checksum %08" PRIx32 ", %08" PRIx32 " in %s\n", argv[n], checksum, expected,
+                        checksum_path);
+                result = 1;
+            }
+        }
+        all_mcus += mcus;
+        all_pixels += (uint64_t)frame.width * frame.height;
+        all_cycles += cycles;
+        all_entropy += entropy;
+        all_bytes += out_len;
+        all_us += best_us;
+        free(src);
+        free(frame.rgb);
+        free(jpg);
+    }
+    printf("all frames: %" PRIu64 " bytes  %.3f ms  %.0f MCU/s\n", all_bytes, all_us / 1e3, all_mcus * 1e6 / all_us);
+    printf("throughput: %.2f MPix/s, %.1f cycles/px with %d encode stripes\n", all_pixels / (double)all_us,
+           all_cycles / ((double)all_pixels * count), optimize ? 1 : CONFIG_CAMERA_JPEG_ENCODE_STRIPES);
+    if (pixels) {
+        printf("pixels of %d frames differ from the single task encode\n", differ);
+    }
+    if (all_entropy) {
+        printf("entropy coder share of all encodes: %.1f%%\n", 100.0 * all_entropy / all_cycles);
+    }
+    if (checksums) {
+        fclose(checksums);
+        if (compare) {
+            printf("checksums %s %s\n", result ? "differ from" : "match", checksum_path);
+        }
+    }
+    return result;
+}
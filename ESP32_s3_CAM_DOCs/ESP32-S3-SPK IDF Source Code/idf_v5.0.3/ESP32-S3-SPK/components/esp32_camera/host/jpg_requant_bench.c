@@ -0,0 +1,198 @@
+// JPEG requantization benchmark: jpg2jpg() time and output size on JPEG frame files, against decoding them
+// with esp_jpg_decode() and encoding the pixels again with fmt2jpg() at the same quality.
+// Both outputs are decoded and compared with the decoded source by their PSNR.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include "esp_timer.h"
+#include "esp_jpg_decode.h"
+#include "img_converters.h"
+
+typedef struct {
+    const uint8_t *jpg;
+    uint8_t *rgb;
+    uint16_t width;
+    uint16_t height;
+} bench_frame_t;
+
+static size_t bench_read(void *arg, size_t index, uint8_t *buf, size_t len)
+{
+    bench_frame_t *frame = (bench_frame_t *)arg;
+    if (buf) {
+        memcpy(buf, frame->jpg + index, len);
+    }
+    return len;
+}
+
+static bool bench_write(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data)
+{
+    bench_frame_t *frame = (bench_frame_t *)arg;
+    if (!data) {
+        if (x == 0 && y == 0 && !frame->rgb) {
+            frame->width = w;
+            frame->height = h;
+            frame->rgb = (uint8_t *)calloc((size_t)w * h, 3);
+        }
+        return frame->rgb != NULL;
+    }
+    // MCUs at the right and bottom edge reach over the image size
+    for (int i = 0; i < h && y + i < frame->height; i++) {
+        if (x < frame->width) {
+            size_t n = x + w > frame->width ? frame->width - x : w;
+            memcpy(frame->rgb + ((size_t)(y + i) * frame->width + x) * 3, data + (size_t)i * w * 3, n * 3);
+        }
+    }
+    return true;
+}
+
+static uint8_t *bench_load(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    rewind(f);
+    uint8_t *data = (uint8_t *)malloc(*len);
+    if (data && fread(data, 1, *len, f) != *len) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    return data;
+}
+
+static bool bench_decode(const uint8_t *jpg, size_t len, bench_frame_t *frame)
+{
+    memset(frame, 0, sizeof(*frame));
+    frame->jpg = jpg;
+    if (esp_jpg_decode(len, JPG_SCALE_NONE, bench_read, bench_write, frame) != ESP_OK) {
+        free(frame->rgb);
+        frame->rgb = NULL;
+        return false;
+    }
+    return true;
+}
+
+// what a requantization replaces: the pixels of the JPEG, in the BGR order of PIXFORMAT_RGB888, encoded again
+static bool bench_reencode(const uint8_t *jpg, size_t len, uint8_t quality, uint8_t **out, size_t *out_len)
+{
+    bench_frame_t frame;
+    if (!bench_decode(jpg, len, &frame)) {
+        return false;
+    }
+    size_t pixels = (size_t)frame.width * frame.height;
+    for (size_t i = 0; i < pixels; i++) {
+        uint8_t r = frame.rgb[i * 3];
+        frame.rgb[i * 3] = frame.rgb[i * 3 + 2];
+        frame.rgb[i * 3 + 2] = r;
+    }
+    bool ok = fmt2jpg(frame.rgb, pixels * 3, frame.width, frame.height, PIXFORMAT_RGB888, quality, out, out_len);
+    free(frame.rgb);
+    return ok;
+}
+
+// of the decoded output against the decoded source, -1 if the output does not decode
+static double bench_psnr(const bench_frame_t *src, const uint8_t *jpg, size_t len)
+{
+    bench_frame_t frame;
+    if (!bench_decode(jpg, len, &frame)) {
+        return -1;
+    }
+    double err = 0;
+    size_t n = (size_t)src->width * src->height * 3;
+    if (frame.width != src->width || frame.height != src->height) {
+        free(frame.rgb);
+        return -1;
+    }
+    for (size_t i = 0; i < n; i++) {
+        int d = frame.rgb[i] - src->rgb[i];
+        err += d * d;
+    }
+    free(frame.rgb);
+    return err ? 10 * log10(255.0 * 255.0 * n / err) : 99;
+}
+
+static void bench_usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options] frame.jpg...\n"
+            "  -q quality   JPEG quality of the copies (50)\n"
+            "  -n count     runs per frame, the fastest counts (10)\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t quality = 50, count = 10;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "q:n:h")) != -1) {
+        switch (opt) {
+            case 'q': quality = strtoul(optarg, NULL, 0); break;
+            case 'n': count = strtoul(optarg, NULL, 0); break;
+            default:
+                bench_usage(argv[0]);
+                return 2;
+        }
+    }
+    if (optind == argc || count == 0 || quality == 0 || quality > 100) {
+        bench_usage(argv[0]);
+        return 2;
+    }
+
+    uint64_t all_src = 0, all_bytes[2] = { 0 };
+    int64_t all_us[2] = { 0 };
+    int result = 0;
+    for (int n = optind; n < argc; n++) {
+        bench_frame_t src;
+        size_t jpg_len;
+        uint8_t *jpg = bench_load(argv[n], &jpg_len);
+        if (!jpg || !bench_decode(jpg, jpg_len, &src)) {
+            fprintf(stderr, "cannot decode %s\n", argv[n]);
+            return 1;
+        }
+
+        printf("%s: %ux%u %zu bytes\n", argv[n], src.width, src.height, jpg_len);
+        const char *names[] = { "requantize", "decode+encode" };
+        for (int mode = 0; mode < 2; mode++) {
+            int64_t best_us = INT64_MAX;
+            uint8_t *out = NULL;
+            size_t out_len = 0;
+            for (uint32_t i = 0; i < count; i++) {
+                free(out);
+                int64_t start_us = esp_timer_get_time();
+                bool ok = mode == 0 ? jpg2jpg(jpg, jpg_len, quality, &out, &out_len)
+                                    : bench_reencode(jpg, jpg_len, quality, &out, &out_len);
+                int64_t us = esp_timer_get_time() - start_us;
+                if (!ok) {
+                    fprintf(stderr, "%s: %s failed\n", argv[n], names[mode]);
+                    return 1;
+                }
+                if (us < best_us) {
+                    best_us = us;
+                }
+            }
+            double psnr = bench_psnr(&src, out, out_len);
+            printf("  %-14s %7zu bytes  %8.3f ms  PSNR %.2f dB\n", names[mode], out_len, best_us / 1e3, psnr);
+            if (psnr < 0) {
+                fprintf(stderr, "%s: the %s output does not decode\n", argv[n], names[mode]);
+                result = 1;
+            }
+            all_bytes[mode] += out_len;
+            all_us[mode] += best_us;
+            free(out);
+        }
+        all_src += jpg_len;
+        free(src.rgb);
+        free(jpg);
+    }
+    printf("all frames: %" PRIu64 " bytes, requantized %" PRIu64 " bytes %.3f ms, decoded and encoded %" PRIu64 " bytes %.3f ms\n",
+           all_src, all_bytes[0], all_us[0] / 1e3, all_bytes[1], all_us[1] / 1e3);
+    return result;
+}
@@ -0,0 +1,234 @@
+// Pixel format conversion benchmark: cycles per pixel of the line kernels of yuv.c against the
+// per-pixel yuv2rgb() loop they replace. The kernels are first checked against yuv2rgb() and the
+// former loops for every y/u/v combination, every RGB565 value and short and odd pixel counts.
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include "esp_cpu.h"
+#include "yuv.h"
+
+#define BENCH_GUARD 0xA5
+
+typedef void (*bench_kernel_t)(const uint8_t *src, uint8_t *dst, size_t pixels);
+
+// the loop of fmt2rgb888() and fmt2bmp() before the kernels
+static void ref_yuv422_to_rgb888(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    uint8_t r, g, b;
+    for (size_t i = 0; i < pixels / 2; i++, src += 4) {
+        yuv2rgb(src[0], src[1], src[3], &r, &g, &b);
+        *dst++ = b;
+        *dst++ = g;
+        *dst++ = r;
+        yuv2rgb(src[2], src[1], src[3], &r, &g, &b);
+        *dst++ = b;
+        *dst++ = g;
+        *dst++ = r;
+    }
+}
+
+// yuv2rgb() packed as jpg2rgb565() writes RGB565, little endian
+static void ref_rgb565_put(uint8_t *dst, uint8_t r, uint8_t g, uint8_t b)
+{
+    uint16_t c = ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+    dst[0] = c & 0xFF;
+    dst[1] = c >> 8;
+}
+
+static void ref_yuv422_to_rgb565(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    uint8_t r, g, b;
+    for (size_t i = 0; i < pixels / 2; i++, src += 4, dst += 4) {
+        yuv2rgb(src[0], src[1], src[3], &r, &g, &b);
+        ref_rgb565_put(dst, r, g, b);
+        yuv2rgb(src[2], src[1], src[3], &r, &g, &b);
+        ref_rgb565_put(dst + 2, r, g, b);
+    }
+}
+
+// the loop of fmt2rgb888() and fmt2bmp() before the kernels
+static void ref_rgb565_to_rgb888(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    uint8_t hb, lb;
+    for (size_t i = 0; i < pixels; i++) {
+        hb = *src++;
+        lb = *src++;
+        *dst++ = (lb & 0x1F) << 3;
+        *dst++ = (hb & 0x07) << 5 | (lb & 0xE0) >> 3;
+        *dst++ = hb & 0xF8;
+    }
+}
+
+static void ref_rgb565_swap(const uint8_t *src, uint8_t *dst, size_t pixels)
+{
+    for (size_t i = 0; i < pixels; i++) {
+        uint16_t c = src[2 * i] << 8 | src[2 * i + 1];
+        dst[2 * i] = c & 0xFF;
+        dst[2 * i + 1] = c >> 8;
+    }
+}
+
+static const struct {
+    const char *name;
+    bench_kernel_t kernel;
+    bench_kernel_t ref;
+    size_t bpp;
+} bench_kernels[] = {
+    { "yuv422_to_rgb888", yuv422_to_rgb888, ref_yuv422_to_rgb888, 3 },
+    { "yuv422_to_rgb565", yuv422_to_rgb565, ref_yuv422_to_rgb565, 2 },
+    { "rgb565_to_rgb888", rgb565_to_rgb888, ref_rgb565_to_rgb888, 3 },
+    { "rgb565_swap", rgb565_swap, ref_rgb565_swap, 2 },
+};
+#define BENCH_KERNELS (sizeof(bench_kernels) / sizeof(bench_kernels[0]))
+
+// converts src with the kernel and its reference, true if they write the same bytes and nothing after them
+static bool bench_compare(size_t k, const uint8_t *src, size_t pixels, uint8_t *out, uint8_t *ref)
+{
+    size_t len = pixels * bench_kernels[k].bpp;
+    memset(out, BENCH_GUARD, len + 16);
+    memset(ref, BENCH_GUARD, len + 16);
+    bench_kernels[k].kernel(src, out, pixels);
+    bench_kernels[k].ref(src, ref, pixels);
+    return memcmp(out, ref, len + 16) == 0;
+}
+
+static int bench_check(void)
+{
+    enum { LINE = 512 };
+    uint8_t src[LINE * 2], out[LINE * 3 + 16], ref[LINE * 3 + 16];
+    int failed = 0;
+
+    // every y/u/v combination: a line per u and v with y0 counting up and y1 down
+    for (int u = 0; u < 256; u++) {
+        for (int v = 0; v < 256; v++) {
+            for (int y = 0; y < 256; y++) {
+                src[y * 4] = y;
+                src[y * 4 + 1] = u;
+                src[y * 4 + 2] = 255 - y;
+                src[y * 4 + 3] = v;
+            }
+            for (size_t k = 0; k < 2; k++) {
+                if (!bench_compare(k, src, LINE, out, ref)) {
+                    printf("%s differs from yuv2rgb() for u %d v %d\n", bench_kernels[k].name, u, v);
+                    failed++;
+                }
+            }
+        }
+    }
+
+    // every RGB565 value
+    for (int c = 0; c < 65536; c += LINE) {
+        for (int i = 0; i < LINE; i++) {
+            src[i * 2] = (c + i) >> 8;
+            src[i * 2 + 1] = c + i;
+        }
+        for (size_t k = 2; k < BENCH_KERNELS; k++) {
+            if (!bench_compare(k, src, LINE, out, ref)) {
+                printf("%s differs from the former loop for 0x%04x-0x%04x\n", bench_kernels[k].name, c, c + LINE - 1);
+                failed++;
+            }
+        }
+    }
+
+    // short and odd pixel counts, YUYV converts whole pairs only and writes nothing after them
+    srand(1);
+    for (size_t i = 0; i < sizeof(src); i++) {
+        src[i] = rand();
+    }
+    for (size_t pixels = 0; pixels <= 67; pixels++) {
+        for (size_t k = 0; k < BENCH_KERNELS; k++) {
+            if (!bench_compare(k, src + 2, pixels, out, ref)) {
+                printf("%s differs for %zu pixels\n", bench_kernels[k].name, pixels);
+                failed++;
+            }
+        }
+    }
+
+    // in place byte swap
+    memcpy(ref, src, sizeof(src));
+    rgb565_swap(ref, ref, LINE);
+    ref_rgb565_swap(src, out, LINE);
+    if (memcmp(out, ref, LINE * 2) != 0) {
+        printf("rgb565_swap differs in place\n");
+        failed++;
+    }
+
+    printf("%s\n", failed ? "check failed" : "all conversions match yuv2rgb() and the former loops");
+    return failed ? 1 : 0;
+}
+
+static double bench_cycles(bench_kernel_t kernel, const uint8_t *src, uint8_t *dst, size_t pixels, uint32_t count)
+{
+    esp_cpu_cycle_count_t best = UINT32_MAX;
+    for (uint32_t i = 0; i < count; i++) {
+        esp_cpu_cycle_count_t start = esp_cpu_get_cycle_count();
+        kernel(src, dst, pixels);
+        esp_cpu_cycle_count_t cycles = esp_cpu_get_cycle_count() - start;
+        if (cycles < best) {
+            best = cycles;
+        }
+    }
+    return (double)best / pixels;
+}
+
+static void bench_usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -W width     frame width (800)\n"
+            "  -H height    frame height (600)\n"
+            "  -n count     conversions per kernel, the fastest counts (50)\n"
+            "  -c           only check the kernels\n",
+            prog);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t width = 800, height = 600, count = 50;
+    bool check_only = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "W:H:n:ch")) != -1) {
+        switch (opt) {
+            case 'W': width = strtoul(optarg, NULL, 0); break;
+            case 'H': height = strtoul(optarg, NULL, 0); break;
+            case 'n': count = strtoul(optarg, NULL, 0); break;
+            case 'c': check_only = true; break;
+            default:
+                bench_usage(argv[0]);
+                return 2;
+        }
+    }
+    if (optind != argc || count == 0 || width == 0 || height == 0) {
+        bench_usage(argv[0]);
+        return 2;
+    }
+
+    int result = bench_check();
+    if (result || check_only) {
+        return result;
+    }
+
+    size_t pixels = (size_t)width * height;
+    uint8_t *src = (uint8_t *)malloc(pixels * 2);
+    uint8_t *dst = (uint8_t *)malloc(pixels * 3);
+    if (!src || !dst) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for (size_t i = 0; i < pixels * 2; i++) {
+        src[i] = rand();
+    }
+
+    printf("%ux%u, cycles per pixel:\n", width, height);
+    printf("  %-18s %6.2f\n", "yuv2rgb per pixel", bench_cycles(ref_yuv422_to_rgb888, src, dst, pixels, count));
+    for (size_t k = 0; k < BENCH_KERNELS; k++) {
+        printf("  %-18s %6.2f\n", bench_kernels[k].name, bench_cycles(bench_kernels[k].kernel, src, dst, pixels, count));
+    }
+    free(src);
+    free(dst);
+    return 0;
+}
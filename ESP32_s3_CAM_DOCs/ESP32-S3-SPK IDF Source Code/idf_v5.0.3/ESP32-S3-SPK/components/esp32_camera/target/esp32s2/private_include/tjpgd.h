@@ -90,6 +90,10 @@ struct JDEC {
 /* TJpgDec API functions */
 JRESULT jd_prepare (JDEC*, UINT(*)(JDEC*,BYTE*,UINT), void*, UINT, void*);
 JRESULT jd_decomp (JDEC*, UINT(*)(JDEC*,void*,JRECT*), BYTE);
+JRESULT jd_decomp_dc (JDEC*, UINT(*)(JDEC*,void*,JRECT*));
+JRESULT jd_decomp_rect (JDEC*, UINT(*)(JDEC*,void*,JRECT*), BYTE, const JRECT*);
+JRESULT jd_decomp_coef (JDEC*, UINT(*)(JDEC*,const SHORT*,UINT));
+JRESULT jd_get_qt (JDEC*, UINT, WORD*);
 
 
 #ifdef __cplusplus
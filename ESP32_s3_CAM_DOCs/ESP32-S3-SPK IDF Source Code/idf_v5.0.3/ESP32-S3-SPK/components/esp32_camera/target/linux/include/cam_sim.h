@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief How the simulated sensor sends frames
+ *
+ * Every frame period the sensor raises VSYNC, waits vblank_us and then sends the bytes of
+ * the next frame file at byte_rate, leaving vblank_us before the next VSYNC. The simulated DMA
+ * writes them through the descriptors cam_hal set up and raises an EOF for every DMA half
+ * buffer, as the LCD_CAM module does.
+ * Bytes sent while the DMA is stopped are lost, as on the chip.
+ */
+typedef struct {
+    const char *const *frames;  /*!< Recorded frame files: JPEG, or raw frames of the configured format */
+    size_t frame_count;
+    bool loop;                  /*!< Start again with the first file after the last, else stop sending */
+    uint32_t fps;               /*!< VSYNC rate. The sensor slows down when a frame takes longer to send */
+    uint32_t byte_rate;         /*!< Bytes per second while a frame is sent, 0 to spread it over the period between the blanking */
+    uint32_t vblank_us;         /*!< Blanking from VSYNC to the first byte of the frame, and after its last byte */
+    uint32_t jitter_us;         /*!< Every VSYNC comes up to this much early or late */
+    uint32_t seed;              /*!< Seed of the jitter, runs with the same seed send at the same times */
+} cam_sim_config_t;
+
+/**
+ * @brief What the simulated sensor and DMA did so far
+ */
+typedef struct {
+    uint32_t frames;            /*!< Frames sent */
+    uint32_t vsync_events;      /*!< VSYNC interrupts delivered to cam_hal */
+    uint32_t eof_events;        /*!< DMA EOF interrupts delivered to cam_hal */
+    uint32_t lost_events;       /*!< Interrupts cam_hal had no room for in its event queue */
+    uint64_t bytes;             /*!< Bytes sent */
+    uint64_t lost_bytes;        /*!< Bytes sent while the DMA was stopped */
+    uint32_t late_frames;       /*!< Frames that started late because the previous one took longer than a period */
+    uint32_t stalls;            /*!< Times the host ran the sensor thread over 1 ms late. Its timeline moves by the delay */
+} cam_sim_stats_t;
+
+/**
+ * @brief Load the frame files and set the timing. Call before esp_camera_init().
+ *
+ * The files are read into memory once, so disk access does not disturb the timing.
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_INVALID_ARG if there are no frames or fps is 0
+ *      - ESP_ERR_NOT_FOUND if a file cannot be read
+ *      - ESP_ERR_INVALID_STATE if the camera is running
+ */
+esp_err_t cam_sim_set_config(const cam_sim_config_t *config);
+
+/**
+ * @brief Frame file n, as it was loaded
+ */
+const uint8_t *cam_sim_frame(size_t n, size_t *len);
+
+void cam_sim_get_stats(cam_sim_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
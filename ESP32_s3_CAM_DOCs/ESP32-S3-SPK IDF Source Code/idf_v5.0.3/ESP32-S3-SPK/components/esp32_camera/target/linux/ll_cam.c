@@ -0,0 +1,545 @@
+// Copyright 2010-2020 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Simulated LCD_CAM module and GDMA channel of the ESP32-S3 for the host build.
+// A sensor thread plays recorded frames: it raises VSYNC, writes the frame bytes through
+// the DMA descriptors cam_hal set up and raises an EOF for every DMA half buffer. The
+// interrupts are calls of ll_cam_send_event() from that thread, with the lock held, so
+// once cam_stop() returns no interrupt reaches cam_hal anymore.
+
+#define _GNU_SOURCE     // PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ll_cam.h"
+#include "cam_hal.h"
+#include "cam_sim.h"
+
+static const char *TAG = "sim ll_cam";
+
+#define SIM_LATE_US     1000    // the sensor thread woke up this late, the host stalled it
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+} sim_frame_t;
+
+typedef struct {
+    pthread_mutex_t lock;               // recursive: ll_cam_send_event() calls ll_cam_stop() on a full queue
+    pthread_cond_t wake;
+    pthread_t thread;
+    bool started;
+    bool quit;
+
+    cam_sim_config_t config;
+    sim_frame_t *frames;
+    size_t frame_count;
+    uint32_t jitter_state;
+
+    cam_obj_t *cam;
+    bool vsync_en;
+    bool dma_running;
+    lldesc_t *dma;                      // descriptor array the DMA writes through
+    uint32_t dma_node_cnt;
+    size_t dma_written;                 // bytes written since ll_cam_start()
+
+    cam_sim_stats_t stats;
+} cam_sim_t;
+
+static cam_sim_t s_sim = {
+    .lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP,
+};
+
+static int64_t sim_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Sleep until the monotonic time us, false when the sensor is told to quit meanwhile.
+// When the host wakes the thread late, sending everything that is due at once would be a
+// burst of interrupts no sensor produces. The delay is added to *shift, which moves the
+// rest of the schedule.
+static bool sim_wait_until(int64_t us, int64_t *shift)
+{
+    struct timespec ts = {
+        .tv_sec = us / 1000000,
+        .tv_nsec = (us % 1000000) * 1000,
+    };
+    pthread_mutex_lock(&s_sim.lock);
+    while (!s_sim.quit && pthread_cond_timedwait(&s_sim.wake, &s_sim.lock, &ts) != ETIMEDOUT) {
+    }
+    bool run = !s_sim.quit;
+    int64_t late = sim_now_us() - us;
+    if (late > SIM_LATE_US) {
+        s_sim.stats.stalls++;
+        *shift += late;
+    }
+    pthread_mutex_unlock(&s_sim.lock);
+    return run;
+}
+
+static int32_t sim_jitter(void)
+{
+    uint32_t range = s_sim.config.jitter_us;
+    if (range == 0) {
+        return 0;
+    }
+    // xorshift32, the same seed gives the same VSYNC times
+    uint32_t x = s_sim.jitter_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    s_sim.jitter_state = x;
+    return (int32_t)(x % (2 * range + 1)) - (int32_t)range;
+}
+
+static void sim_send_event(cam_event_t event)
+{
+    // the FreeRTOS shim reports every successful send as a woken task
+    BaseType_t sent = pdFALSE;
+    ll_cam_send_event(s_sim.cam, event, &sent);
+    if (sent != pdTRUE) {
+        s_sim.stats.lost_events++;
+    } else if (event == CAM_VSYNC_EVENT) {
+        s_sim.stats.vsync_events++;
+    } else {
+        s_sim.stats.eof_events++;
+    }
+}
+
+// Write len bytes through the descriptor chain, which is circular as on the chip
+static void sim_dma_write(const uint8_t *data, size_t len)
+{
+    uint32_t node_size = s_sim.cam->dma_node_buffer_size;
+    while (len) {
+        size_t node = (s_sim.dma_written / node_size) % s_sim.dma_node_cnt;
+        size_t offset = s_sim.dma_written % node_size;
+        size_t n = node_size - offset;
+        if (n > len) {
+            n = len;
+        }
+        memcpy((uint8_t *)s_sim.dma[node].buf + offset, data, n);
+        s_sim.dma[node].length = offset + n;
+        s_sim.dma_written += n;
+        data += n;
+        len -= n;
+    }
+}
+
+// The sensor sends one half buffer worth of the frame
+static void sim_send_chunk(const uint8_t *data, size_t len)
+{
+    uint32_t half = s_sim.cam->dma_half_buffer_size;
+    pthread_mutex_lock(&s_sim.lock);
+    s_sim.stats.bytes += len;
+    if (s_sim.vsync_en && s_sim.dma_running) {
+        sim_dma_write(data, len);
+        if (s_sim.dma_written % half == 0) {
+            sim_send_event(CAM_IN_SUC_EOF_EVENT);
+        }
+    } else {
+        s_sim.stats.lost_bytes += len;
+    }
+    pthread_mutex_unlock(&s_sim.lock);
+}
+
+static void *sim_sensor_task(void *arg)
+{
+    int64_t period = 1000000 / s_sim.config.fps;
+    int64_t vsync = sim_now_us();
+    size_t n = 0;
+
+    while (sim_wait_until(vsync, &vsync)) {
+        pthread_mutex_lock(&s_sim.lock);
+        if (s_sim.vsync_en) {
+            sim_send_event(CAM_VSYNC_EVENT);
+        }
+        pthread_mutex_unlock(&s_sim.lock);
+
+        if (n == s_sim.frame_count) {
+            if (!s_sim.config.loop) {
+                // VSYNC keeps coming, cam_hal publishes the last frame on the first one
+                vsync += period;
+                continue;
+            }
+            n = 0;
+        }
+        const sim_frame_t *frame = &s_sim.frames[n++];
+        uint32_t half = s_sim.cam->dma_half_buffer_size;
+        int64_t start = vsync + s_sim.config.vblank_us;
+        // blanking before the first and after the last byte, as between the lines of the sensor
+        int64_t duration = period - 2 * s_sim.config.vblank_us;
+        if (s_sim.config.byte_rate) {
+            duration = (int64_t)frame->len * 1000000 / s_sim.config.byte_rate;
+        }
+
+        for (size_t sent = 0; sent < frame->len;) {
+            size_t len = frame->len - sent;
+            if (len > half) {
+                len = half;
+            }
+            // the half buffer is complete once its last byte arrived
+            if (!sim_wait_until(start + (int64_t)(sent + len) * duration / frame->len, &start)) {
+                return NULL;
+            }
+            sim_send_chunk(&frame->data[sent], len);
+            sent += len;
+        }
+
+        pthread_mutex_lock(&s_sim.lock);
+        s_sim.stats.frames++;
+        pthread_mutex_unlock(&s_sim.lock);
+
+        // stalls while the frame was sent moved it, and the next VSYNC with it
+        int64_t next = start - s_sim.config.vblank_us + period + sim_jitter();
+        int64_t end = start + duration;
+        if (next < end) {
+            // the frame took longer than a period, the sensor starts the next one late
+            pthread_mutex_lock(&s_sim.lock);
+            s_sim.stats.late_frames++;
+            pthread_mutex_unlock(&s_sim.lock);
+            next = end;
+        }
+        vsync = next;
+    }
+    return NULL;
+}
+
+static void sim_free_frames(void)
+{
+    for (size_t i = 0; i < s_sim.frame_count; i++) {
+        free(s_sim.frames[i].data);
+    }
+    free(s_sim.frames);
+    s_sim.frames = NULL;
+    s_sim.frame_count = 0;
+}
+
+static esp_err_t sim_load_frame(const char *path, sim_frame_t *frame)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        ESP_LOGE(TAG, "Cannot open %s", path);
+        return ESP_ERR_NOT_FOUND;
+    }
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+    long len = -1;
+    if (fseek(f, 0, SEEK_END) == 0) {
+        len = ftell(f);
+    }
+    if (len > 0 && fseek(f, 0, SEEK_SET) == 0) {
+        frame->data = (uint8_t *)malloc(len);
+        frame->len = len;
+        if (frame->data == NULL) {
+            ret = ESP_ERR_NO_MEM;
+        } else if (fread(frame->data, 1, len, f) == (size_t)len) {
+            ret = ESP_OK;
+        }
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Cannot read %s", path);
+    }
+    fclose(f);
+    return ret;
+}
+
+esp_err_t cam_sim_set_config(const cam_sim_config_t *config)
+{
+    if (config == NULL || config->frames == NULL || config->frame_count == 0 || config->fps == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (s_sim.started) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    sim_free_frames();
+    s_sim.frames = (sim_frame_t *)calloc(config->frame_count, sizeof(sim_frame_t));
+    if (s_sim.frames == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    s_sim.frame_count = config->frame_count;
+    for (size_t i = 0; i < config->frame_count; i++) {
+        esp_err_t ret = sim_load_frame(config->frames[i], &s_sim.frames[i]);
+        if (ret != ESP_OK) {
+            sim_free_frames();
+            return ret;
+        }
+    }
+    s_sim.config = *config;
+    s_sim.config.frames = NULL;     // the caller's array may go away
+    s_sim.jitter_state = config->seed ? config->seed : 1;
+    return ESP_OK;
+}
+
+const uint8_t *cam_sim_frame(size_t n, size_t *len)
+{
+    if (n >= s_sim.frame_count) {
+        return NULL;
+    }
+    *len = s_sim.frames[n].len;
+    return s_sim.frames[n].data;
+}
+
+void cam_sim_get_stats(cam_sim_stats_t *stats)
+{
+    pthread_mutex_lock(&s_sim.lock);
+    *stats = s_sim.stats;
+    pthread_mutex_unlock(&s_sim.lock);
+}
+
+bool IRAM_ATTR ll_cam_stop(cam_obj_t *cam)
+{
+    pthread_mutex_lock(&s_sim.lock);
+    s_sim.dma_running = false;
+    pthread_mutex_unlock(&s_sim.lock);
+    return true;
+}
+
+esp_err_t ll_cam_deinit(cam_obj_t *cam)
+{
+    if (s_sim.started) {
+        pthread_mutex_lock(&s_sim.lock);
+        s_sim.quit = true;
+        pthread_cond_signal(&s_sim.wake);
+        pthread_mutex_unlock(&s_sim.lock);
+        pthread_join(s_sim.thread, NULL);
+        pthread_cond_destroy(&s_sim.wake);
+        s_sim.started = false;
+    }
+    s_sim.cam = NULL;
+    s_sim.vsync_en = false;
+    s_sim.dma_running = false;
+    return ESP_OK;
+}
+
+bool ll_cam_start(cam_obj_t *cam, int frame_pos)
+{
+    pthread_mutex_lock(&s_sim.lock);
+    if (!cam->psram_mode) {
+        s_sim.dma = cam->dma;
+        s_sim.dma_node_cnt = cam->dma_node_cnt;
+    } else {
+        // JPEG frame buffers may have been resized, each has its own number of nodes
+        s_sim.dma = cam->frames[frame_pos].dma;
+        s_sim.dma_node_cnt = cam->frames[frame_pos].fb_size / cam->dma_node_buffer_size;
+    }
+    s_sim.dma_written = 0;
+    s_sim.dma_running = true;
+    pthread_mutex_unlock(&s_sim.lock);
+    return true;
+}
+
+esp_err_t ll_cam_config(cam_obj_t *cam, const camera_config_t *config)
+{
+    if (s_sim.frame_count == 0) {
+        ESP_LOGE(TAG, "No frames to play, call cam_sim_set_config() first");
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_sim.cam = cam;
+    memset(&s_sim.stats, 0, sizeof(s_sim.stats));
+    cam->dma_num = 0;
+    ESP_LOGI(TAG, "Simulated camera: %u frames, %u fps", (unsigned) s_sim.frame_count, (unsigned) s_sim.config.fps);
+    return ESP_OK;
+}
+
+void ll_cam_vsync_intr_enable(cam_obj_t *cam, bool en)
+{
+    pthread_mutex_lock(&s_sim.lock);
+    s_sim.vsync_en = en;
+    pthread_mutex_unlock(&s_sim.lock);
+}
+
+esp_err_t ll_cam_set_pin(cam_obj_t *cam, const camera_config_t *config)
+{
+    return ESP_OK;
+}
+
+esp_err_t ll_cam_init_isr(cam_obj_t *cam)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&s_sim.wake, &attr);
+    pthread_condattr_destroy(&attr);
+
+    s_sim.quit = false;
+    // the interrupts preempt every task
+    if (host_thread_create(&s_sim.thread, 1 + configMAX_PRIORITIES, sim_sensor_task, NULL) != 0) {
+        ESP_LOGE(TAG, "Sensor thread creation failed");
+        pthread_cond_destroy(&s_sim.wake);
+        return ESP_FAIL;
+    }
+    s_sim.started = true;
+    return ESP_OK;
+}
+
+void ll_cam_do_vsync(cam_obj_t *cam)
+{
+    // the simulated LCD_CAM module has no frame sync to reset
+}
+
+uint8_t ll_cam_get_dma_align(cam_obj_t *cam)
+{
+    return 16;
+}
+
+static bool ll_cam_calc_rgb_dma(cam_obj_t *cam){
+    size_t node_max = LCD_CAM_DMA_NODE_BUFFER_MAX_SIZE / cam->dma_bytes_per_item;
+    size_t line_width = cam->width * cam->in_bytes_per_pixel;
+    size_t node_size = node_max;
+    size_t nodes_per_line = 1;
+    size_t lines_per_node = 1;
+
+    // Calculate DMA Node Size so that it's divisable by or divisor of the line width
+    if(line_width >= node_max){
+        // One or more nodes will be requied for one line
+        for(size_t i = node_max; i > 0; i=i-1){
+            if ((line_width % i) == 0) {
+                node_size = i;
+                nodes_per_line = line_width / node_size;
+                break;
+            }
+        }
+    } else {
+        // One or more lines can fit into one node
+        for(size_t i = node_max; i > 0; i=i-1){
+            if ((i % line_width) == 0) {
+                node_size = i;
+                lines_per_node = node_size / line_width;
+                while((cam->height % lines_per_node) != 0){
+                    lines_per_node = lines_per_node - 1;
+                    node_size = lines_per_node * line_width;
+                }
+                break;
+            }
+        }
+    }
+
+    ESP_LOGI(TAG, "node_size: %4u, nodes_per_line: %u, lines_per_node: %u",
+            (unsigned) (node_size * cam->dma_bytes_per_item), (unsigned) nodes_per_line, (unsigned) lines_per_node);
+
+    cam->dma_node_buffer_size = node_size * cam->dma_bytes_per_item;
+
+    size_t dma_half_buffer_max = CONFIG_CAMERA_DMA_BUFFER_SIZE_MAX / 2 / cam->dma_bytes_per_item;
+    if (line_width > dma_half_buffer_max) {
+        ESP_LOGE(TAG, "Resolution too high");
+        return 0;
+    }
+
+    // Calculate minimum EOF size = max(mode_size, line_size)
+    size_t dma_half_buffer_min = node_size * nodes_per_line;
+
+    // Calculate max EOF size divisable by node size
+    size_t dma_half_buffer = (dma_half_buffer_max / dma_half_buffer_min) * dma_half_buffer_min;
+
+    // Adjust EOF size so that height will be divisable by the number of lines in each EOF
+    size_t lines_per_half_buffer = dma_half_buffer / line_width;
+    while((cam->height % lines_per_half_buffer) != 0){
+        dma_half_buffer = dma_half_buffer - dma_half_buffer_min;
+        lines_per_half_buffer = dma_half_buffer / line_width;
+    }
+
+    // Calculate DMA size
+    size_t dma_buffer_max = 2 * dma_half_buffer_max;
+    if (cam->psram_mode) {
+        dma_buffer_max = cam->recv_size / cam->dma_bytes_per_item;
+    }
+    size_t dma_buffer_size = dma_buffer_max;
+    if (!cam->psram_mode) {
+        dma_buffer_size =(dma_buffer_max / dma_half_buffer) * dma_half_buffer;
+    }
+
+    ESP_LOGI(TAG, "dma_half_buffer_min: %5u, dma_half_buffer: %5u, lines_per_half_buffer: %2u, dma_buffer_size: %5u",
+            (unsigned) (dma_half_buffer_min * cam->dma_bytes_per_item), (unsigned) (dma_half_buffer * cam->dma_bytes_per_item),
+            (unsigned) lines_per_half_buffer, (unsigned) (dma_buffer_size * cam->dma_bytes_per_item));
+
+    cam->dma_buffer_size = dma_buffer_size * cam->dma_bytes_per_item;
+    cam->dma_half_buffer_size = dma_half_buffer * cam->dma_bytes_per_item;
+    cam->dma_half_buffer_cnt = cam->dma_buffer_size / cam->dma_half_buffer_size;
+    return 1;
+}
+
+bool ll_cam_dma_sizes(cam_obj_t *cam)
+{
+    cam->dma_bytes_per_item = 1;
+    if (cam->jpeg_mode) {
+        if (cam->psram_mode) {
+            cam->dma_buffer_size = cam->recv_size;
+            cam->dma_half_buffer_size = 1024;
+            cam->dma_half_buffer_cnt = cam->dma_buffer_size / cam->dma_half_buffer_size;
+            cam->dma_node_buffer_size = cam->dma_half_buffer_size;
+        } else {
+            cam->dma_half_buffer_cnt = 16;
+            cam->dma_buffer_size = cam->dma_half_buffer_cnt * 1024;
+            cam->dma_half_buffer_size = cam->dma_buffer_size / cam->dma_half_buffer_cnt;
+            cam->dma_node_buffer_size = cam->dma_half_buffer_size;
+        }
+    } else {
+        return ll_cam_calc_rgb_dma(cam);
+    }
+    return 1;
+}
+
+size_t IRAM_ATTR ll_cam_memcpy(cam_obj_t *cam, uint8_t *out, const uint8_t *in, size_t len)
+{
+    // YUV to Grayscale
+    if (cam->in_bytes_per_pixel == 2 && cam->fb_bytes_per_pixel == 1) {
+        size_t end = len / 8;
+        for (size_t i = 0; i < end; ++i) {
+            out[0] = in[0];
+            out[1] = in[2];
+            out[2] = in[4];
+            out[3] = in[6];
+            out += 4;
+            in += 8;
+        }
+        return len / 2;
+    }
+
+    // just memcpy
+    memcpy(out, in, len);
+    return len;
+}
+
+esp_err_t ll_cam_set_sample_mode(cam_obj_t *cam, pixformat_t pix_format, uint32_t xclk_freq_hz, uint16_t sensor_pid)
+{
+    if (pix_format == PIXFORMAT_GRAYSCALE) {
+        if (sensor_pid == OV3660_PID || sensor_pid == OV5640_PID || sensor_pid == NT99141_PID || sensor_pid == SC031GS_PID || sensor_pid == BF20A6_PID) {
+            cam->in_bytes_per_pixel = 1;       // camera sends Y8
+        } else {
+            cam->in_bytes_per_pixel = 2;       // camera sends YU/YV
+        }
+        cam->fb_bytes_per_pixel = 1;       // frame buffer stores Y8
+    } else if (pix_format == PIXFORMAT_YUV422 || pix_format == PIXFORMAT_RGB565) {
+        cam->in_bytes_per_pixel = 2;       // for DMA receive
+        cam->fb_bytes_per_pixel = 2;       // frame buffer stores YU/YV/RGB565
+    } else if (pix_format == PIXFORMAT_JPEG) {
+        cam->in_bytes_per_pixel = 1;
+        cam->fb_bytes_per_pixel = 1;
+    } else {
+        ESP_LOGE(TAG, "Requested format is not supported");
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    return ESP_OK;
+}
+
+// implements function from xclk.c to allow dynamic XCLK change
+esp_err_t xclk_timer_conf(int ledc_timer, int xclk_freq_hz)
+{
+    return ESP_OK;
+}
@@ -0,0 +1,99 @@
+/*
+ * SCCB of the host build: an OV2640 register file instead of the I2C bus.
+ *
+ * Register writes are kept and read back, the identification registers of the sensor
+ * bank hold the OV2640 values, so the sensor driver is probed and configured as usual.
+ */
+#include <stdbool.h>
+#include <string.h>
+#include "sccb.h"
+#include "sensor.h"
+#include "esp_err.h"
+
+#define SIM_BANK_SEL    0xFF
+#define SIM_BANK_SENSOR 0x01
+
+static uint8_t s_regs[2][256];      // DSP bank, sensor bank
+static bool s_ready;
+
+static uint8_t *sim_reg(uint8_t slv_addr, uint8_t reg)
+{
+    if (!s_ready || slv_addr != OV2640_SCCB_ADDR) {
+        return NULL;
+    }
+    if (reg == SIM_BANK_SEL) {
+        return &s_regs[0][SIM_BANK_SEL];
+    }
+    return &s_regs[s_regs[0][SIM_BANK_SEL] & SIM_BANK_SENSOR][reg];
+}
+
+int SCCB_Init(int pin_sda, int pin_scl)
+{
+    memset(s_regs, 0, sizeof(s_regs));
+    s_regs[SIM_BANK_SENSOR][0x0A] = OV2640_PID;     // PID
+    s_regs[SIM_BANK_SENSOR][0x0B] = 0x42;           // VER
+    s_regs[SIM_BANK_SENSOR][0x1C] = 0x7F;           // MIDH
+    s_regs[SIM_BANK_SENSOR][0x1D] = 0xA2;           // MIDL
+    s_ready = true;
+    return ESP_OK;
+}
+
+int SCCB_Use_Port(int i2c_num)
+{
+    return SCCB_Init(-1, -1);
+}
+
+int SCCB_Deinit(void)
+{
+    s_ready = false;
+    return ESP_OK;
+}
+
+uint8_t SCCB_Probe(void)
+{
+    return s_ready ? OV2640_SCCB_ADDR : 0;
+}
+
+uint8_t SCCB_Read(uint8_t slv_addr, uint8_t reg)
+{
+    uint8_t *r = sim_reg(slv_addr, reg);
+    return r ? *r : 0xFF;
+}
+
+int SCCB_Write(uint8_t slv_addr, uint8_t reg, uint8_t data)
+{
+    uint8_t *r = sim_reg(slv_addr, reg);
+    if (r == NULL) {
+        return -1;
+    }
+    // the identification registers are read only
+    if (r >= &s_regs[SIM_BANK_SENSOR][0x0A] && r <= &s_regs[SIM_BANK_SENSOR][0x0B]) {
+        return 0;
+    }
+    if (r >= &s_regs[SIM_BANK_SENSOR][0x1C] && r <= &s_regs[SIM_BANK_SENSOR][0x1D]) {
+        return 0;
+    }
+    *r = data;
+    return 0;
+}
+
+// 16 bit register addresses belong to other sensors, they are not there
+uint8_t SCCB_Read16(uint8_t slv_addr, uint16_t reg)
+{
+    return 0xFF;
+}
+
+int SCCB_Write16(uint8_t slv_addr, uint16_t reg, uint8_t data)
+{
+    return -1;
+}
+
+uint16_t SCCB_Read_Addr16_Val16(uint8_t slv_addr, uint16_t reg)
+{
+    return 0xFFFF;
+}
+
+int SCCB_Write_Addr16_Val16(uint8_t slv_addr, uint16_t reg, uint16_t data)
+{
+    return -1;
+}
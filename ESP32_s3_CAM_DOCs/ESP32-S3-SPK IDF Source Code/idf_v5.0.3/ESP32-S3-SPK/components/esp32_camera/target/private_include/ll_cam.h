@@ -34,6 +34,10 @@
 #include "freertos/queue.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
+#include "cam_fb_size.h"
+#include "cam_frame_ring.h"
+#include "cam_jpeg_scan.h"
+#include "cam_telemetry.h"
 
 #if __has_include("esp_private/periph_ctrl.h")
 # include "esp_private/periph_ctrl.h"
@@ -76,10 +80,14 @@ typedef enum {
 
 typedef struct {
     camera_fb_t fb;
-    uint8_t en;
+    uint8_t jpeg_eoi;   // fb.len was already trimmed to the JPEG EOI by cam_task
     //for RGB/YUV modes
     lldesc_t *dma;
     size_t fb_offset;
+    size_t fb_size;     // bytes the buffer holds, JPEG buffers may be resized at runtime
+#if CONFIG_CAMERA_TELEMETRY
+    camera_frame_timing_t timing;
+#endif
 } cam_frame_t;
 
 typedef struct {
@@ -98,7 +106,10 @@ typedef struct {
     cam_frame_t *frames;
 
     QueueHandle_t event_queue;
-    QueueHandle_t frame_buffer_queue;
+    cam_frame_ring_t frame_ring;        // who owns which frame buffer
+    uint32_t *frame_tags;
+    SemaphoreHandle_t frame_ready;      // given after a frame was published while cam_take waits
+    uint32_t frame_waiters;             // cam_take calls waiting, only accessed atomically
     TaskHandle_t task_handle;
     intr_handle_t cam_intr_handle;
 
@@ -127,6 +138,15 @@ typedef struct {
     uint32_t fb_size;
 
     cam_state_t state;
+    cam_jpeg_scan_t jpeg_scan;
+
+    //JPEG frame sizes and the frame buffer size they ask for
+    cam_fb_size_t fb_sizer;
+    uint32_t fb_caps;
+    uint32_t fb_resizes;
+#if CONFIG_CAMERA_TELEMETRY
+    cam_telemetry_t telemetry;
+#endif
 } cam_obj_t;
 
 
@@ -16,9 +16,38 @@
 / Oct 04,'11 R0.01  First release.
 / Feb 19,'12 R0.01a Fixed decompression fails when scan starts with an escape seq.
 / Sep 03,'12 R0.01b Added JD_TBLCLIP option.
+/-----------------------------------------------------------------------------/
+/ Local changes of the esp32-camera component:
+/  jd_decomp_dc(): 1/8 scale output from DC elements only.
+/  jd_decomp_rect(): output of a region only, other MCUs are not transformed.
+/  jd_decomp_coef(), jd_get_qt(): quantized coefficients and tables for requantization.
+/  JD_FASTDECODE: Huffman decoding from a bit reservoir and lookup tables.
 /----------------------------------------------------------------------------*/
 
+#include "sdkconfig.h"
+#if CONFIG_ESP_ROM_HAS_JPEG_DECODE
+/* jd_prepare() and jd_decomp() are in ROM, only jd_decomp_dc() and jd_decomp_rect() are built here. */
+/* It works on the same JDEC object, so it uses the ROM header. */
+#include "rom/tjpgd.h"
+#define JD_ROM_DECODER	1
+#else
 #include "tjpgd.h"
+#define JD_ROM_DECODER	0
+#endif
+
+#ifndef JD_FORMAT
+#define JD_FORMAT		0
+#endif
+
+/* Huffman decoding 0:bit by bit, 1:from a 32-bit bit reservoir, 2:and lookup tables of the short code words */
+#ifndef JD_FASTDECODE
+#define JD_FASTDECODE	CONFIG_CAMERA_JPEG_FASTDECODE
+#endif
+
+/* Code word bits indexing the lookup tables (9 or 10), 6 << JD_HUFFLUT_BITS bytes of the memory pool */
+#ifndef JD_HUFFLUT_BITS
+#define JD_HUFFLUT_BITS	9
+#endif
 
 #define SUPPORT_JPEG 1
 
@@ -125,6 +154,7 @@ BYTE BYTECLIP (
 
 
 
+#if !JD_ROM_DECODER || JD_FASTDECODE == 2
 /*-----------------------------------------------------------------------*/
 /* Allocate a memory block from memory pool                              */
 /*-----------------------------------------------------------------------*/
@@ -148,10 +178,12 @@ void* alloc_pool (	/* Pointer to allocated memory block (NULL:no memory availabl
 
 	return (void*)rp;	/* Return allocated memory block (NULL:no memory to allocate) */
 }
+#endif
 
 
 
 
+#if !JD_ROM_DECODER
 /*-----------------------------------------------------------------------*/
 /* Create de-quantization and prescaling tables with a DQT segment       */
 /*-----------------------------------------------------------------------*/
@@ -247,6 +279,172 @@ UINT create_huffman_tbl (	/* 0:OK, !0:Failed */
 
 
 
+#endif	/* !JD_ROM_DECODER */
+
+/*-----------------------------------------------------------------------*/
+/* Bit reservoir of the fast Huffman decoding                            */
+/*-----------------------------------------------------------------------*/
+/* The JDEC object has the layout of the ROM decoder, so the reservoir and
+/  the lookup tables are kept by the decompression function for one call. */
+
+typedef struct {
+	DWORD wreg;			/* Bit reservoir, the next bit of the stream at the MSB and zeros after the last one */
+	UINT dbit;			/* Number of stream bits in the reservoir */
+	UINT mark;			/* The reservoir stopped at a marker (the byte after its 0xFF), 1:end of input, 0:not stopped */
+#if JD_FASTDECODE == 2
+	BYTE* lutdc[2];		/* Lookup tables of the DC code words [id]: bit length << 4 | data, 0xFF:longer code word */
+	WORD* lutac[2];		/* Lookup tables of the AC code words [id]: bit length << 8 | data, 0xFFFF:longer code word */
+#endif
+} JBITS;
+
+
+
+#if JD_FASTDECODE == 2
+/*-----------------------------------------------------------------------*/
+/* Create the lookup tables of the code words up to JD_HUFFLUT_BITS      */
+/*-----------------------------------------------------------------------*/
+
+static
+void create_huffman_lut (
+	JDEC* jd,	/* Pointer to the decompressor object */
+	JBITS* bs	/* Bit reservoir to attach the tables to */
+)
+{
+	const UINT nl = 1 << JD_HUFFLUT_BITS;
+	UINT id, cls, bl, nd, i, span, ofs;
+	const BYTE *hb, *hd;
+	const WORD *hc;
+	BYTE *tdc;
+	WORD *tac;
+
+
+	bs->lutdc[0] = bs->lutdc[1] = 0;
+	bs->lutac[0] = bs->lutac[1] = 0;
+	tac = alloc_pool(jd, nl * 6);	/* Without room left in the pool every code word is searched */
+	if (!tac) return;
+	tdc = (BYTE*)(tac + nl * 2);
+
+	for (i = 0; i < nl * 2; i++) {	/* Mark all the entries as longer code words */
+		tac[i] = 0xFFFF; tdc[i] = 0xFF;
+	}
+	for (id = 0; id < 2; id++) {
+		bs->lutac[id] = tac + nl * id;
+		bs->lutdc[id] = tdc + nl * id;
+		for (cls = 0; cls < 2; cls++) {
+			hb = jd->huffbits[id][cls];
+			hc = jd->huffcode[id][cls];
+			hd = jd->huffdata[id][cls];
+			if (!hb) continue;
+			for (bl = 1; bl <= JD_HUFFLUT_BITS; bl++) {	/* Shortest code words first, as huffext() searches them */
+				span = 1 << (JD_HUFFLUT_BITS - bl);		/* Entries starting with the code word */
+				for (nd = *hb++; nd; nd--, hc++, hd++) {
+					ofs = (UINT)*hc << (JD_HUFFLUT_BITS - bl);
+					if (ofs >= nl) continue;			/* Broken table */
+					for (i = ofs; i < ofs + span; i++) {
+						if (cls) {
+							if (bs->lutac[id][i] == 0xFFFF) bs->lutac[id][i] = (WORD)(bl << 8 | *hd);
+						} else {
+							if (bs->lutdc[id][i] == 0xFF && *hd < 16) bs->lutdc[id][i] = (BYTE)(bl << 4 | *hd);
+						}
+					}
+				}
+			}
+		}
+	}
+}
+#endif
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Prepare the bit reservoir for a decompression                         */
+/*-----------------------------------------------------------------------*/
+
+static
+void init_bits (
+	JDEC* jd,	/* Pointer to the decompressor object, at the start of the scan */
+	JBITS* bs	/* Bit reservoir */
+)
+{
+	bs->wreg = 0; bs->dbit = 0; bs->mark = 0;
+#if JD_FASTDECODE == 2
+	create_huffman_lut(jd, bs);
+#endif
+}
+
+
+
+
+#if JD_FASTDECODE
+/*-----------------------------------------------------------------------*/
+/* Fill the bit reservoir from the input stream                          */
+/*-----------------------------------------------------------------------*/
+
+static
+void fill_bits (
+	JDEC* jd,	/* Pointer to the decompressor object */
+	JBITS* bs	/* Bit reservoir */
+)
+{
+	BYTE *dp;
+	UINT dc, d, f;
+
+
+	dc = jd->dctr; dp = jd->dptr;	/* Number of data available, read ptr */
+	f = 0;
+	while (bs->dbit <= 24 && !bs->mark) {
+		if (!dc) {			/* No input data is available, re-fill input buffer */
+			dp = jd->inbuf;	/* Top of input buffer */
+			dc = jd->infunc(jd, dp, JD_SZBUF);
+			if (!dc) {		/* The stream ends here, decoding fails when it needs bits after it */
+				bs->mark = 1; break;
+			}
+		} else {
+			dp++;			/* Next data ptr */
+		}
+		dc--;				/* Decrement number of available bytes */
+		d = *dp;
+		if (f) {			/* In flag sequence? */
+			f = 0;
+			if (d != 0) {	/* A marker ends the entropy coded segment */
+				bs->mark = d; break;
+			}
+			d = 0xFF;		/* The flag is a data 0xFF */
+		} else if (d == 0xFF) {
+			f = 1; continue;	/* Enter flag sequence, get trailing byte */
+		}
+		bs->wreg |= (DWORD)d << (24 - bs->dbit);
+		bs->dbit += 8;
+	}
+	jd->dctr = dc; jd->dptr = dp;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Remove N bits from the bit reservoir                                  */
+/*-----------------------------------------------------------------------*/
+
+static
+INT skip_bits (	/* d: OK, <0: error code */
+	JBITS* bs,	/* Bit reservoir */
+	UINT nbit,	/* Number of bits to remove */
+	INT d		/* Value to return */
+)
+{
+	if (nbit > bs->dbit)	/* Err: the segment ended at a marker or the stream ended */
+		return 0 - (INT)(bs->mark == 1 ? JDR_INP : JDR_FMT1);
+	bs->wreg <<= nbit;
+	bs->dbit -= nbit;
+
+	return d;
+}
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Extract N bits from input stream                                      */
 /*-----------------------------------------------------------------------*/
@@ -254,6 +452,78 @@ UINT create_huffman_tbl (	/* 0:OK, !0:Failed */
 static
 INT bitext (	/* >=0: extracted data, <0: error code */
 	JDEC* jd,	/* Pointer to the decompressor object */
+	JBITS* bs,	/* Bit reservoir */
+	UINT nbit	/* Number of bits to extract (1 to 11) */
+)
+{
+	if (bs->dbit < nbit) fill_bits(jd, bs);
+
+	return skip_bits(bs, nbit, (INT)(bs->wreg >> (32 - nbit)));
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Extract a huffman decoded data from input stream                      */
+/*-----------------------------------------------------------------------*/
+
+static
+INT huffext (		/* >=0: decoded data, <0: error code */
+	JDEC* jd,		/* Pointer to the decompressor object */
+	JBITS* bs,		/* Bit reservoir */
+	UINT id,		/* Huffman table ID (0:Y, 1:C) */
+	UINT cls		/* Table class (0:DC, 1:AC) */
+)
+{
+	const BYTE *hbits, *hdata;
+	const WORD *hcode;
+	UINT v, bl, nd;
+
+
+	if (bs->dbit < 16) fill_bits(jd, bs);	/* Room for the longest code word */
+
+	hbits = jd->huffbits[id][cls];
+	hcode = jd->huffcode[id][cls];
+	hdata = jd->huffdata[id][cls];
+	bl = 1;
+#if JD_FASTDECODE == 2
+	if (bs->lutac[0]) {
+		v = bs->wreg >> (32 - JD_HUFFLUT_BITS);	/* Look up the code word in the table */
+		if (cls) {
+			v = bs->lutac[id][v];
+			if (v != 0xFFFF) return skip_bits(bs, v >> 8, v & 0xFF);
+		} else {
+			v = bs->lutdc[id][v];
+			if (v != 0xFF) return skip_bits(bs, v >> 4, v & 0x0F);
+		}
+		for ( ; bl <= JD_HUFFLUT_BITS; bl++) {	/* Not in the table: skip the shorter code words */
+			nd = *hbits++;
+			hcode += nd; hdata += nd;
+		}
+	}
+#endif
+	for ( ; bl <= 16; bl++) {
+		v = bs->wreg >> (32 - bl);		/* Top bl bits of the reservoir */
+		for (nd = *hbits++; nd; nd--) {	/* Search the code word in this bit length */
+			if (v == *hcode++) return skip_bits(bs, bl, *hdata);	/* Matched? Return the decoded data */
+			hdata++;
+		}
+	}
+
+	return 0 - (INT)JDR_FMT1;	/* Err: code not found (may be collapted data) */
+}
+
+#else	/* JD_FASTDECODE */
+
+/*-----------------------------------------------------------------------*/
+/* Extract N bits from input stream                                      */
+/*-----------------------------------------------------------------------*/
+
+static
+INT bitext (	/* >=0: extracted data, <0: error code */
+	JDEC* jd,	/* Pointer to the decompressor object */
+	JBITS* bs,	/* Bit reservoir (not used) */
 	UINT nbit	/* Number of bits to extract (1 to 11) */
 )
 {
@@ -305,11 +575,14 @@ INT bitext (	/* >=0: extracted data, <0: error code */
 static
 INT huffext (			/* >=0: decoded data, <0: error code */
 	JDEC* jd,			/* Pointer to the decompressor object */
-	const BYTE* hbits,	/* Pointer to the bit distribution table */
-	const WORD* hcode,	/* Pointer to the code word table */
-	const BYTE* hdata	/* Pointer to the data table */
+	JBITS* bs,			/* Bit reservoir (not used) */
+	UINT id,			/* Huffman table ID (0:Y, 1:C) */
+	UINT cls			/* Table class (0:DC, 1:AC) */
 )
 {
+	const BYTE *hbits = jd->huffbits[id][cls];	/* Bit distribution table */
+	const WORD *hcode = jd->huffcode[id][cls];	/* Code word table */
+	const BYTE *hdata = jd->huffdata[id][cls];	/* Data table */
 	BYTE msk, s, *dp;
 	UINT dc, v, f, bl, nd;
 
@@ -356,6 +629,7 @@ INT huffext (			/* >=0: decoded data, <0: error code */
 
 	return 0 - (INT)JDR_FMT1;	/* Err: code not found (may be collapted data) */
 }
+#endif	/* JD_FASTDECODE */
 
 
 
@@ -479,15 +753,14 @@ void block_idct (
 
 static
 JRESULT mcu_load (
-	JDEC* jd		/* Pointer to the decompressor object */
+	JDEC* jd,		/* Pointer to the decompressor object */
+	JBITS* bs		/* Bit reservoir */
 )
 {
 	LONG *tmp = (LONG*)jd->workbuf;	/* Block working buffer for de-quantize and IDCT */
 	UINT blk, nby, nbc, i, z, id, cmp;
 	INT b, d, e;
 	BYTE *bp;
-	const BYTE *hb, *hd;
-	const WORD *hc;
 	const LONG *dqf;
 
 
@@ -500,14 +773,11 @@ JRESULT mcu_load (
 		id = cmp ? 1 : 0;						/* Huffman table ID of the component */
 
 		/* Extract a DC element from input stream */
-		hb = jd->huffbits[id][0];				/* Huffman table for the DC element */
-		hc = jd->huffcode[id][0];
-		hd = jd->huffdata[id][0];
-		b = huffext(jd, hb, hc, hd);			/* Extract a huffman coded data (bit length) */
+		b = huffext(jd, bs, id, 0);				/* Extract a huffman coded data (bit length) */
 		if (b < 0) return 0 - b;				/* Err: invalid code or input */
 		d = jd->dcv[cmp];						/* DC value of previous block */
 		if (b) {								/* If there is any difference from previous block */
-			e = bitext(jd, b);					/* Extract data bits */
+			e = bitext(jd, bs, b);				/* Extract data bits */
 			if (e < 0) return 0 - e;			/* Err: input */
 			b = 1 << (b - 1);					/* MSB position */
 			if (!(e & b)) e -= (b << 1) - 1;	/* Restore sign if needed */
@@ -519,12 +789,9 @@ JRESULT mcu_load (
 
 		/* Extract following 63 AC elements from input stream */
 		for (i = 1; i < 64; i++) tmp[i] = 0;	/* Clear rest of elements */
-		hb = jd->huffbits[id][1];				/* Huffman table for the AC elements */
-		hc = jd->huffcode[id][1];
-		hd = jd->huffdata[id][1];
 		i = 1;					/* Top of the AC elements */
 		do {
-			b = huffext(jd, hb, hc, hd);		/* Extract a huffman coded value (zero runs and bit length) */
+			b = huffext(jd, bs, id, 1);			/* Extract a huffman coded value (zero runs and bit length) */
 			if (b == 0) break;					/* EOB? */
 			if (b < 0) return 0 - b;			/* Err: invalid code or input error */
 			z = (UINT)b >> 4;					/* Number of leading zero elements */
@@ -533,7 +800,7 @@ JRESULT mcu_load (
 				if (i >= 64) return JDR_FMT1;	/* Too long zero run */
 			}
 			if (b &= 0x0F) {					/* Bit length */
-				d = bitext(jd, b);				/* Extract data bits */
+				d = bitext(jd, bs, b);			/* Extract data bits */
 				if (d < 0) return 0 - d;		/* Err: input device */
 				b = 1 << (b - 1);				/* MSB position */
 				if (!(d & b)) d -= (b << 1) - 1;/* Restore negative value if needed */
@@ -714,6 +981,7 @@ JRESULT mcu_output (
 static
 JRESULT restart (
 	JDEC* jd,	/* Pointer to the decompressor object */
+	JBITS* bs,	/* Bit reservoir */
 	WORD rstn	/* Expected restert sequense number */
 )
 {
@@ -723,9 +991,16 @@ JRESULT restart (
 
 
 	/* Discard padding bits and get two bytes from the input stream */
+	d = 0; i = 0;
+#if JD_FASTDECODE
+	if (bs->mark == 1) return JDR_INP;
+	if (bs->mark) {		/* The reservoir was filled up to the marker, it is read already */
+		d = 0xFF00 | bs->mark; i = 2;
+	}
+	bs->wreg = 0; bs->dbit = 0; bs->mark = 0;
+#endif
 	dp = jd->dptr; dc = jd->dctr;
-	d = 0;
-	for (i = 0; i < 2; i++) {
+	for ( ; i < 2; i++) {
 		if (!dc) {	/* No input data is available, re-fill input buffer */
 			dp = jd->inbuf;
 			dc = jd->infunc(jd, dp, JD_SZBUF);
@@ -751,6 +1026,7 @@ JRESULT restart (
 
 
 
+#if !JD_ROM_DECODER
 /*-----------------------------------------------------------------------*/
 /* Analyze the JPEG image and Initialize decompressor object             */
 /*-----------------------------------------------------------------------*/
@@ -937,6 +1213,7 @@ JRESULT jd_decomp (
 {
 	UINT x, y, mx, my;
 	WORD rst, rsc;
+	JBITS bs;
 	JRESULT rc;
 
 
@@ -947,16 +1224,17 @@ JRESULT jd_decomp (
 
 	jd->dcv[2] = jd->dcv[1] = jd->dcv[0] = 0;	/* Initialize DC values */
 	rst = rsc = 0;
+	init_bits(jd, &bs);
 
 	rc = JDR_OK;
 	for (y = 0; y < jd->height; y += my) {		/* Vertical loop of MCUs */
 		for (x = 0; x < jd->width; x += mx) {	/* Horizontal loop of MCUs */
 			if (jd->nrst && rst++ == jd->nrst) {	/* Process restart interval if enabled */
-				rc = restart(jd, rsc++);
+				rc = restart(jd, &bs, rsc++);
 				if (rc != JDR_OK) return rc;
 				rst = 1;
 			}
-			rc = mcu_load(jd);					/* Load an MCU (decompress huffman coded stream and apply IDCT) */
+			rc = mcu_load(jd, &bs);				/* Load an MCU (decompress huffman coded stream and apply IDCT) */
 			if (rc != JDR_OK) return rc;
 			rc = mcu_output(jd, outfunc, x, y);	/* Output the MCU (color space conversion, scaling and output) */
 			if (rc != JDR_OK) return rc;
@@ -965,6 +1243,338 @@ JRESULT jd_decomp (
 
 	return rc;
 }
+#endif	/* !JD_ROM_DECODER */
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Load an MCU keeping only the DC element of each block                 */
+/*-----------------------------------------------------------------------*/
+
+static
+JRESULT mcu_load_dc (
+	JDEC* jd,		/* Pointer to the decompressor object */
+	JBITS* bs,		/* Bit reservoir */
+	BYTE* dcb		/* Level shifted DC value of each block in the MCU */
+)
+{
+	UINT blk, nby, i, cmp, id;
+	INT b, d, e;
+	LONG v;
+
+
+	nby = jd->msx * jd->msy;	/* Number of Y blocks (1, 2 or 4) */
+
+	for (blk = 0; blk < nby + 2; blk++) {
+		cmp = (blk < nby) ? 0 : blk - nby + 1;	/* Component number 0:Y, 1:Cb, 2:Cr */
+		id = cmp ? 1 : 0;						/* Huffman table ID of the component */
+
+		/* Extract a DC element from input stream */
+		b = huffext(jd, bs, id, 0);
+		if (b < 0) return 0 - b;
+		d = jd->dcv[cmp];
+		if (b) {
+			e = bitext(jd, bs, b);
+			if (e < 0) return 0 - e;
+			b = 1 << (b - 1);
+			if (!(e & b)) e -= (b << 1) - 1;
+			d += e;
+			jd->dcv[cmp] = (SHORT)d;
+		}
+		v = d * jd->qttbl[jd->qtid[cmp]][0] >> 8;	/* De-quantize exactly as mcu_load() does */
+		dcb[blk] = (BYTE)((v / 256) + 128);			/* The average of the block */
+
+		/* Walk over the 63 AC elements without reconstructing them */
+		i = 1;
+		do {
+			b = huffext(jd, bs, id, 1);			/* Extract a huffman coded value (zero runs and bit length) */
+			if (b == 0) break;					/* EOB? */
+			if (b < 0) return 0 - b;
+			i += (UINT)b >> 4;					/* Skip zero elements */
+			if (i >= 64) return JDR_FMT1;		/* Too long zero run */
+			if (b &= 0x0F) {					/* Discard the data bits */
+				e = bitext(jd, bs, b);
+				if (e < 0) return 0 - e;
+			}
+		} while (++i < 64);
+	}
+
+	return JDR_OK;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Decompress the JPEG picture at 1/8 scale from DC elements only        */
+/*-----------------------------------------------------------------------*/
+
+JRESULT jd_decomp_dc (
+	JDEC* jd,								/* Initialized decompression object */
+	UINT (*outfunc)(JDEC*, void*, JRECT*)	/* RGB output function */
+)
+{
+	const INT CVACC = (sizeof (INT) > 2) ? 1024 : 128;
+	UINT x, y, mx, my, ow, oh, ox, oy, rx, ry, ix, iy, nby, bpp, szw, rw;
+	INT yy, cb, cr;
+	BYTE r, g, b, dcb[6], *op;
+	WORD rst, rsc;
+	JBITS bs;
+	JRESULT rc;
+	JRECT rect;
+
+
+	jd->scale = 3;
+	mx = jd->msx * 8; my = jd->msy * 8;		/* Size of the MCU (pixel) */
+	ow = jd->width >> 3; oh = jd->height >> 3;	/* Output size, partial blocks are rounded off like jd_decomp() does */
+	nby = jd->msx * jd->msy;
+	bpp = (JD_FORMAT == 1) ? 2 : 3;
+
+	/* No IDCT is done, so the working buffer of jd_prepare() collects output pixels of several MCUs */
+	szw = nby * 64 * 2 + 64;
+	if (szw < 256) szw = 256;
+	rw = szw / (nby * bpp) * jd->msx;		/* Output rectangle width (pixel) */
+
+	jd->dcv[2] = jd->dcv[1] = jd->dcv[0] = 0;
+	rst = rsc = 0;
+	init_bits(jd, &bs);
+	rect.left = 0; rect.right = 0;
+
+	for (y = 0; y < jd->height; y += my) {
+		oy = y >> 3;
+		ry = (oy + jd->msy <= oh) ? jd->msy : oh - oy;
+		for (x = 0; x < jd->width; x += mx) {
+			if (jd->nrst && rst++ == jd->nrst) {	/* Process restart interval if enabled */
+				rc = restart(jd, &bs, rsc++);
+				if (rc != JDR_OK) return rc;
+				rst = 1;
+			}
+			rc = mcu_load_dc(jd, &bs, dcb);
+			if (rc != JDR_OK) return rc;
+
+			ox = x >> 3;
+			if (ox % rw == 0) {						/* First MCU of an output rectangle */
+				rect.left = ox;
+				rect.right = ((ox + rw <= ow) ? ox + rw : ow) - 1;
+			}
+			rx = (ox + jd->msx <= ow) ? jd->msx : ow - ox;
+
+			/* Convert YCbCr to RGB, one pixel per block */
+			cb = dcb[nby] - 128;
+			cr = dcb[nby + 1] - 128;
+			for (iy = 0; iy < ry; iy++) {
+				op = (BYTE*)jd->workbuf + (iy * (rect.right + 1 - rect.left) + ox - rect.left) * bpp;
+				for (ix = 0; ix < rx; ix++) {
+					yy = dcb[iy * jd->msx + ix];
+					r = BYTECLIP(yy + ((INT)(1.402 * CVACC) * cr / CVACC));
+					g = BYTECLIP(yy - ((INT)(0.344 * CVACC) * cb + (INT)(0.714 * CVACC) * cr) / CVACC);
+					b = BYTECLIP(yy + ((INT)(1.772 * CVACC) * cb / CVACC));
+					if (JD_FORMAT == 1) {
+						*(WORD*)op = ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
+						op += 2;
+					} else {
+						*op++ = r; *op++ = g; *op++ = b;
+					}
+				}
+			}
+
+			/* Output the rectangle when its last MCU is done */
+			if (ry && rx && ox + rx > rect.right) {
+				rect.top = oy; rect.bottom = oy + ry - 1;
+				if (!outfunc(jd, jd->workbuf, &rect)) return JDR_INTR;
+			}
+		}
+	}
+
+	return JDR_OK;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Decompress the MCUs of the JPEG picture that overlap a region         */
+/*-----------------------------------------------------------------------*/
+
+JRESULT jd_decomp_rect (
+	JDEC* jd,								/* Initialized decompression object */
+	UINT (*outfunc)(JDEC*, void*, JRECT*),	/* RGB output function */
+	BYTE scale,								/* Output de-scaling factor (0 to 3) */
+	const JRECT* roi						/* Region in the scaled output, inclusive */
+)
+{
+	UINT x, y, mx, my;
+	BYTE dcb[6];
+	WORD rst, rsc;
+	JBITS bs;
+	JRESULT rc;
+
+
+	if (scale > (JD_USE_SCALE ? 3 : 0)) return JDR_PAR;
+	jd->scale = scale;
+
+	mx = jd->msx * 8; my = jd->msy * 8;			/* Size of the MCU (pixel) */
+
+	jd->dcv[2] = jd->dcv[1] = jd->dcv[0] = 0;
+	rst = rsc = 0;
+	init_bits(jd, &bs);
+
+	for (y = 0; y < jd->height; y += my) {
+		if ((y >> scale) > roi->bottom) break;	/* Nothing is left to output, the rest of the stream is not read */
+		for (x = 0; x < jd->width; x += mx) {
+			if (jd->nrst && rst++ == jd->nrst) {	/* Process restart interval if enabled */
+				rc = restart(jd, &bs, rsc++);
+				if (rc != JDR_OK) return rc;
+				rst = 1;
+			}
+			if (((y + my - 1) >> scale) < roi->top || ((x + mx - 1) >> scale) < roi->left || (x >> scale) > roi->right) {
+				rc = mcu_load_dc(jd, &bs, dcb);		/* Outside of the region: only keep the stream and the DC values in step */
+				if (rc != JDR_OK) return rc;
+				continue;
+			}
+			rc = mcu_load(jd, &bs);
+			if (rc != JDR_OK) return rc;
+			rc = mcu_output(jd, outfunc, x, y);
+			if (rc != JDR_OK) return rc;
+		}
+	}
+
+	return JDR_OK;
+}
+
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Load an MCU as quantized coefficients and output them block by block  */
+/*-----------------------------------------------------------------------*/
+
+static
+JRESULT mcu_load_coef (
+	JDEC* jd,		/* Pointer to the decompressor object */
+	JBITS* bs,		/* Bit reservoir */
+	UINT (*coeffunc)(JDEC*, const SHORT*, UINT)	/* Coefficient output function */
+)
+{
+	SHORT *coef = (SHORT*)jd->workbuf;	/* Elements of the block in zigzag order */
+	UINT blk, nby, i, cmp, id;
+	INT b, d, e;
+
+
+	nby = jd->msx * jd->msy;	/* Number of Y blocks (1, 2 or 4) */
+
+	for (blk = 0; blk < nby + 2; blk++) {
+		cmp = (blk < nby) ? 0 : blk - nby + 1;	/* Component number 0:Y, 1:Cb, 2:Cr */
+		id = cmp ? 1 : 0;						/* Huffman table ID of the component */
+
+		/* Extract a DC element from input stream */
+		b = huffext(jd, bs, id, 0);
+		if (b < 0) return 0 - b;
+		d = jd->dcv[cmp];
+		if (b) {
+			e = bitext(jd, bs, b);
+			if (e < 0) return 0 - e;
+			b = 1 << (b - 1);
+			if (!(e & b)) e -= (b << 1) - 1;
+			d += e;
+			jd->dcv[cmp] = (SHORT)d;
+		}
+		coef[0] = (SHORT)d;						/* The DC value itself, not its difference */
+
+		/* Extract following 63 AC elements from input stream, they are not de-quantized */
+		for (i = 1; i < 64; i++) coef[i] = 0;
+		i = 1;
+		do {
+			b = huffext(jd, bs, id, 1);			/* Extract a huffman coded value (zero runs and bit length) */
+			if (b == 0) break;					/* EOB? */
+			if (b < 0) return 0 - b;
+			i += (UINT)b >> 4;					/* Skip zero elements */
+			if (i >= 64) return JDR_FMT1;		/* Too long zero run */
+			if (b &= 0x0F) {
+				e = bitext(jd, bs, b);
+				if (e < 0) return 0 - e;
+				b = 1 << (b - 1);
+				if (!(e & b)) e -= (b << 1) - 1;
+				coef[i] = (SHORT)e;
+			}
+		} while (++i < 64);
+
+		if (!coeffunc(jd, coef, cmp)) return JDR_INTR;
+	}
+
+	return JDR_OK;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Output the quantized coefficients of every block of the JPEG picture  */
+/*-----------------------------------------------------------------------*/
+
+JRESULT jd_decomp_coef (
+	JDEC* jd,									/* Initialized decompression object */
+	UINT (*coeffunc)(JDEC*, const SHORT*, UINT)	/* Output function of a block: its 64 elements in zigzag order and its component */
+)
+{
+	UINT x, y, mx, my;
+	WORD rst, rsc;
+	JBITS bs;
+	JRESULT rc;
+
+
+	mx = jd->msx * 8; my = jd->msy * 8;			/* Size of the MCU (pixel) */
+
+	jd->dcv[2] = jd->dcv[1] = jd->dcv[0] = 0;
+	rst = rsc = 0;
+	init_bits(jd, &bs);
+
+	for (y = 0; y < jd->height; y += my) {
+		for (x = 0; x < jd->width; x += mx) {
+			if (jd->nrst && rst++ == jd->nrst) {	/* Process restart interval if enabled */
+				rc = restart(jd, &bs, rsc++);
+				if (rc != JDR_OK) return rc;
+				rst = 1;
+			}
+			rc = mcu_load_coef(jd, &bs, coeffunc);
+			if (rc != JDR_OK) return rc;
+		}
+	}
+
+	return JDR_OK;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Get the quantization table of a component as the DQT segment held it  */
+/*-----------------------------------------------------------------------*/
+
+JRESULT jd_get_qt (
+	JDEC* jd,		/* Initialized decompression object */
+	UINT cmp,		/* Component number 0:Y, 1:Cb, 2:Cr */
+	WORD* qt		/* 64 quantizers in zigzag order */
+)
+{
+	UINT i, z;
+	const LONG *dqf;
+
+
+	if (cmp > 2) return JDR_PAR;
+	dqf = jd->qttbl[jd->qtid[cmp]];
+	if (!dqf) return JDR_FMT1;
+	for (i = 0; i < 64; i++) {
+		z = ZIG(i);
+		qt[i] = (WORD)(dqf[z] / IPSF(z));	/* The table holds the quantizers with the scale factor of Arai algorithm applied */
+		if ((DWORD)dqf[z] != (DWORD)qt[i] * IPSF(z) || !qt[i]) return JDR_FMT1;
+	}
+
+	return JDR_OK;
+}
+
 #endif//SUPPORT_JPEG
 
 
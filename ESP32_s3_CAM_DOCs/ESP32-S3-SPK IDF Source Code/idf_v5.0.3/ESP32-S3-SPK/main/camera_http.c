@@ -1,20 +1,46 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
 #include "camera_http.h"
 #include "esp_err.h"
 #include "esp_log.h"
 #include "esp_http_server.h"
+#include "lwip/sockets.h"
+#include "freertos/semphr.h"
 #include "wifi_driver.h"
 #include "esp_camera.h"
 #include "esp_timer.h"
+#include "frame_hub.h"
 
 static char TAG[] = "camera http";
 
 #define PART_BOUNDARY "123456789000000000000987654321"
-static const char* _STREAM_CONTENT_TYPE = "multipart/x-mixed-replace;boundary=" PART_BOUNDARY;
+static const char* _STREAM_HEADER = "HTTP/1.1 200 OK\r\n"
+                                    "Content-Type: multipart/x-mixed-replace;boundary=" PART_BOUNDARY "\r\n"
+                                    "Access-Control-Allow-Origin: *\r\n"
+                                    "X-Framerate: 60\r\n\r\n";
 static const char* _STREAM_BOUNDARY = "\r\n--" PART_BOUNDARY "\r\n";
 static const char* _STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n";
 
+#define STREAM_CLIENT_STACK     4096
+#define STREAM_CLIENT_PRIO      5
+#define STREAM_FRAME_TIMEOUT_MS 3000
+#define METRICS_LINE_SIZE       384
+
+typedef struct {
+    int fd;
+    frame_hub_sub_t *sub;
+    SemaphoreHandle_t lock;         // held around every send, the server closes the socket under it
+    volatile bool closed;           // set under lock once the server closed the socket
+    uint8_t owners;
+} stream_client_t;
+
+static portMUX_TYPE s_stream_lock = portMUX_INITIALIZER_UNLOCKED;
+
 static esp_err_t http_send_jpg_handler(httpd_req_t *req);
 static esp_err_t jpg_stream_httpd_handler(httpd_req_t *req);
+static esp_err_t http_metrics_handler(httpd_req_t *req);
+static int http_close_fn(httpd_handle_t hd, int sockfd);
 void http_server_init(void)
 {
     httpd_handle_t server;
@@ -33,87 +59,186 @@ void http_server_init(void)
         .user_ctx = NULL
     };
 
+    httpd_uri_t metrics_uri = {
+        .uri = "/metrics",
+        .method = HTTP_GET,
+        .handler = http_metrics_handler,
+        .user_ctx = NULL
+    };
+
     httpd_config_t http_options = HTTPD_DEFAULT_CONFIG();
+    http_options.close_fn = http_close_fn;
 
+    ESP_ERROR_CHECK(frame_hub_start());
     ESP_ERROR_CHECK(httpd_start(&server, &http_options));
     ESP_ERROR_CHECK(httpd_register_uri_handler(server, &jpeg_stream_uri));
     ESP_ERROR_CHECK(httpd_register_uri_handler(server, &jpeg_uri));
+    ESP_ERROR_CHECK(httpd_register_uri_handler(server, &metrics_uri));
 }
 
-static esp_err_t jpg_stream_httpd_handler(httpd_req_t *req)
+/**
+  * @brief  Send the whole buffer on a detached stream socket
+  * @note   The fd is only written while the lock shows the server has not closed it,
+  *         once closed the number may already belong to another connection
+  */
+static esp_err_t stream_send(stream_client_t *client, const char *buf, size_t len)
 {
-    camera_fb_t *fb = NULL;
-    struct timeval _timestamp;
     esp_err_t res = ESP_OK;
-    size_t _jpg_buf_len = 0;
-    uint8_t *_jpg_buf = NULL;
-    char *part_buf[128];
 
-    static int64_t last_frame = 0;
-    if(!last_frame){
-        last_frame = esp_timer_get_time();
+    xSemaphoreTake(client->lock, portMAX_DELAY);
+    while (len){
+        int sent = client->closed ? -1 : send(client->fd, buf, len, 0);
+        if (sent <= 0){
+            res = ESP_FAIL;
+            break;
+        }
+        buf += sent;
+        len -= sent;
     }
+    xSemaphoreGive(client->lock);
+    return res;
+}
 
-    res = httpd_resp_set_type(req, _STREAM_CONTENT_TYPE);
-    if(res != ESP_OK){
-        return res;
+/**
+  * @brief  Drop one owner of a stream client, the sender task and the http session each own it
+  */
+static void stream_client_put(stream_client_t *client)
+{
+    portENTER_CRITICAL(&s_stream_lock);
+    bool last = --client->owners == 0;
+    portEXIT_CRITICAL(&s_stream_lock);
+    if (last){
+        vSemaphoreDelete(client->lock);
+        free(client);
     }
+}
 
-    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
-    httpd_resp_set_hdr(req, "X-Framerate", "60");
+/**
+  * @brief  http session free callback, called by the server after http_close_fn() closed the stream socket
+  */
+static void stream_client_closed(void *ctx)
+{
+    stream_client_put((stream_client_t *)ctx);
+}
 
-    while (true){
-        fb = esp_camera_fb_get();
-        if (!fb){
-            ESP_LOGE(TAG, "Camera capture failed");
-            res = ESP_FAIL;
-        }else{
-            _timestamp.tv_sec = fb->timestamp.tv_sec;
-            _timestamp.tv_usec = fb->timestamp.tv_usec;
-            if(fb->format != PIXFORMAT_JPEG){
-                bool jpeg_converted = frame2jpg(fb, 80, &_jpg_buf, &_jpg_buf_len);
-                esp_camera_fb_return(fb);
-                fb = NULL;
-                if (!jpeg_converted){
-                    ESP_LOGE(TAG, "JPEG compression failed");
-                    res = ESP_FAIL;
-                }
-            }else{
-                _jpg_buf_len = fb->len;
-                _jpg_buf = fb->buf;
+/**
+  * @brief  Socket close function of the server
+  * @note   Only stream sessions have a context. Their sender may be blocked in send(): the shutdown
+  *         wakes it, then the socket is closed under the lock so no send can reach a reused fd.
+  */
+static int http_close_fn(httpd_handle_t hd, int sockfd)
+{
+    stream_client_t *client = (stream_client_t *)httpd_sess_get_ctx(hd, sockfd);
+    if (!client){
+        return close(sockfd);
+    }
+
+    shutdown(sockfd, SHUT_RDWR);
+    xSemaphoreTake(client->lock, portMAX_DELAY);
+    client->closed = true;
+    int ret = close(sockfd);
+    xSemaphoreGive(client->lock);
+    return ret;
+}
+
+/**
+  * @brief  Per client sender, writes the frames published by the hub until the socket fails
+  * @note   Every client sends the same frame buffer, a client slower than the camera skips frames
+  */
+static void stream_client_task(void *param)
+{
+    stream_client_t *client = (stream_client_t *)param;
+    esp_err_t res = ESP_OK;
+    char part_buf[128];
+    int64_t last_frame = esp_timer_get_time();
+
+    while (res == ESP_OK){
+        frame_hub_frame_t *frame = frame_hub_get(client->sub, pdMS_TO_TICKS(STREAM_FRAME_TIMEOUT_MS));
+        if (!frame){
+            if (client->closed){
+                break;
             }
+            ESP_LOGW(TAG, "No frame in %d ms", STREAM_FRAME_TIMEOUT_MS);
+            continue;
         }
-        if(res == ESP_OK){
-            res = httpd_resp_send_chunk(req, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));
-        }
-        if(res == ESP_OK){
-            size_t hlen = snprintf((char *)part_buf, 128, _STREAM_PART, _jpg_buf_len, _timestamp.tv_sec, _timestamp.tv_usec);
-            res = httpd_resp_send_chunk(req, (const char *)part_buf, hlen);
-        }
-        if(res == ESP_OK){
-            res = httpd_resp_send_chunk(req, (const char *)_jpg_buf, _jpg_buf_len);
+
+        size_t jpg_buf_len = frame->len;
+        res = stream_send(client, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));
+        if (res == ESP_OK){
+            size_t hlen = snprintf(part_buf, sizeof(part_buf), _STREAM_PART, jpg_buf_len);
+            res = stream_send(client, part_buf, hlen);
         }
-        if(fb){
-            esp_camera_fb_return(fb);
-            fb = NULL;
-            _jpg_buf = NULL;
-        }else if(_jpg_buf){
-            free(_jpg_buf);
-            _jpg_buf = NULL;
-        }
-        if(res != ESP_OK){
-            break;
+        if (res == ESP_OK){
+            res = stream_send(client, (const char *)frame->buf, jpg_buf_len);
         }
+        frame_hub_release(frame);
+
         int64_t fr_end = esp_timer_get_time();
-        int64_t frame_time = fr_end - last_frame;
+        int64_t frame_time = (fr_end - last_frame) / 1000;
         last_frame = fr_end;
-        frame_time /= 1000;
-        ESP_LOGI(TAG, "MJPG: %lu KB %lu ms (%.1ffps)",(uint32_t)(_jpg_buf_len/1024),
-                (uint32_t)frame_time, 1000.0 / (uint32_t)frame_time);
+        ESP_LOGD(TAG, "MJPG[%d]: %lu KB %lu ms (%.1ffps)", client->fd, (uint32_t)(jpg_buf_len/1024),
+                (uint32_t)frame_time, frame_time ? 1000.0 / (uint32_t)frame_time : 0.0);
     }
 
-    last_frame = 0;
-    return res;
+    frame_hub_unsubscribe(client->sub);
+    // The server sees the shut down socket fail and closes the session itself. Closing it by fd
+    // from here could close another session that got the same fd in the meantime.
+    xSemaphoreTake(client->lock, portMAX_DELAY);
+    if (!client->closed){
+        shutdown(client->fd, SHUT_RDWR);
+    }
+    xSemaphoreGive(client->lock);
+    stream_client_put(client);
+    vTaskDelete(NULL);
+}
+
+/**
+  * @brief  http / URL（MJPEG视频流）处理函数
+  * @param  req ：HTTP请求数据结构
+  * @retval 参考esp_err
+  * @note   The socket is handed over to a sender task so the server stays free for other
+  *         clients, all viewers share the frames captured once by the frame hub
+  */
+static esp_err_t jpg_stream_httpd_handler(httpd_req_t *req)
+{
+    stream_client_t *client = calloc(1, sizeof(stream_client_t));
+    if (!client){
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    client->lock = xSemaphoreCreateMutex();
+    if (!client->lock){
+        free(client);
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    client->sub = frame_hub_subscribe();
+    if (!client->sub){
+        ESP_LOGW(TAG, "Too many stream clients");
+        vSemaphoreDelete(client->lock);
+        free(client);
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_send(req, NULL, 0);
+    }
+    client->fd = httpd_req_to_sockfd(req);
+    client->owners = 2;
+
+    // The response is written raw, chunked encoding would add framing to every send
+    if (httpd_send(req, _STREAM_HEADER, strlen(_STREAM_HEADER)) < 0 ||
+        xTaskCreate(stream_client_task, "stream_client", STREAM_CLIENT_STACK, client, STREAM_CLIENT_PRIO, NULL) != pdPASS){
+        ESP_LOGE(TAG, "Failed to start the stream");
+        frame_hub_unsubscribe(client->sub);
+        vSemaphoreDelete(client->lock);
+        free(client);
+        return ESP_FAIL;
+    }
+
+    // The server only closes the session after this handler returned, so http_close_fn() finds the context
+    req->sess_ctx = client;
+    req->free_ctx = stream_client_closed;
+    return ESP_OK;
 }
 
 /**
@@ -124,14 +249,20 @@ static esp_err_t jpg_stream_httpd_handler(httpd_req_t *req)
   */
 static esp_err_t http_send_jpg_handler(httpd_req_t *req)
 {
-    camera_fb_t *fb = NULL;
+    frame_hub_sub_t *sub = NULL;
+    frame_hub_frame_t *frame = NULL;
     esp_err_t res = ESP_OK;
     int64_t fr_start = esp_timer_get_time();
     char ts[32];
 
-    fb = esp_camera_fb_get();
-    if(!fb){
+    // Take the frame from the hub so snapshots do not compete with running streams for buffers
+    sub = frame_hub_subscribe();
+    if(sub){
+        frame = frame_hub_get(sub, pdMS_TO_TICKS(STREAM_FRAME_TIMEOUT_MS));
+    }
+    if(!frame){
         ESP_LOGE(TAG, "Camera capture failed");
+        frame_hub_unsubscribe(sub);
         httpd_resp_send_500(req);
         return ESP_FAIL;
     }
@@ -140,18 +271,106 @@ static esp_err_t http_send_jpg_handler(httpd_req_t *req)
     httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.jpg");
     httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
 
-    snprintf(ts, 32, "%lld .%06ld", fb->timestamp.tv_sec, fb->timestamp.tv_usec);
+    snprintf(ts, 32, "%lld .%06ld", frame->timestamp.tv_sec, frame->timestamp.tv_usec);
     httpd_resp_set_hdr(req, "X-Timestamp", (const char *)ts);
 
-    size_t fb_len = 0;
-    if(fb->format == PIXFORMAT_JPEG){
-        fb_len = fb->len;
-        res = httpd_resp_send(req, (const char *)fb->buf, fb->len);
-    }
-    esp_camera_fb_return(fb);
+    size_t fb_len = frame->len;
+    res = httpd_resp_send(req, (const char *)frame->buf, frame->len);
+    frame_hub_release(frame);
+    frame_hub_unsubscribe(sub);
 
     int64_t fr_end = esp_timer_get_time();
     ESP_LOGI(TAG, "JPG: %luB %lums", (uint32_t)(fb_len), (uint32_t)((fr_end - fr_start) / 1000));
 
     return res;
 }
+
+static void metrics_stage(char *buf, size_t len, const char *name, const camera_stage_stats_t *stage, bool last)
+{
+    snprintf(buf, len, "\"%s\":{\"avg\":%" PRIu32 ",\"max\":%" PRIu32 "}%s",
+             name, stage->avg_us, stage->max_us, last ? "" : ",");
+}
+
+/**
+  * @brief  http /metrics URL handler, capture pipeline counters and frame timings as JSON
+  * @param  req ：HTTP请求数据结构
+  * @retval 参考esp_err
+  * @note   "camera" is null and "timings" empty unless CONFIG_CAMERA_TELEMETRY is enabled.
+  *         Stage times are microseconds, timings are the last returned frames, oldest first.
+  */
+static esp_err_t http_metrics_handler(httpd_req_t *req)
+{
+    char buf[METRICS_LINE_SIZE];
+    camera_telemetry_t tel;
+    camera_fb_stats_t fb;
+    frame_hub_stats_t hub;
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+
+    snprintf(buf, sizeof(buf), "{\"uptime_us\":%lld,", esp_timer_get_time());
+    httpd_resp_sendstr_chunk(req, buf);
+
+    if (esp_camera_get_telemetry(&tel) == ESP_OK){
+        snprintf(buf, sizeof(buf), "\"camera\":{\"frames\":%" PRIu32 ",\"fps\":%.1f,\"ev_ovf\":%" PRIu32
+                 ",\"fb_ovf\":%" PRIu32 ",\"no_soi\":%" PRIu32 ",\"no_eoi\":%" PRIu32 ",\"fb_size_err\":%" PRIu32
+                 ",\"dropped\":%" PRIu32 ",\"timeouts\":%" PRIu32 ",\"history\":%" PRIu32 ",\"stages_us\":{",
+                 tel.frames, tel.fps, tel.ev_ovf, tel.fb_ovf, tel.no_soi, tel.no_eoi, tel.fb_size_err,
+                 tel.dropped, tel.timeouts, tel.history);
+        httpd_resp_sendstr_chunk(req, buf);
+        metrics_stage(buf, sizeof(buf), "receive", &tel.receive, false);
+        httpd_resp_sendstr_chunk(req, buf);
+        metrics_stage(buf, sizeof(buf), "process", &tel.process, false);
+        httpd_resp_sendstr_chunk(req, buf);
+        metrics_stage(buf, sizeof(buf), "wait", &tel.wait, false);
+        httpd_resp_sendstr_chunk(req, buf);
+        metrics_stage(buf, sizeof(buf), "hold", &tel.hold, false);
+        httpd_resp_sendstr_chunk(req, buf);
+        metrics_stage(buf, sizeof(buf), "copy", &tel.copy, true);
+        httpd_resp_sendstr_chunk(req, buf);
+
+        // size_hist[i] counts frames below 4 KB << i
+        httpd_resp_sendstr_chunk(req, "},\"size_hist\":[");
+        for (int i = 0; i < CAMERA_TELEMETRY_SIZE_BUCKETS; i++){
+            snprintf(buf, sizeof(buf), "%s%" PRIu32, i ? "," : "", tel.size_hist[i]);
+            httpd_resp_sendstr_chunk(req, buf);
+        }
+        httpd_resp_sendstr_chunk(req, "]},");
+    } else {
+        httpd_resp_sendstr_chunk(req, "\"camera\":null,");
+    }
+
+    if (esp_camera_get_fb_stats(&fb) == ESP_OK){
+        snprintf(buf, sizeof(buf), "\"fb\":{\"fb_size\":%u,\"size_pct\":%u,\"size_max\":%u,\"frames\":%" PRIu32
+                 ",\"overflows\":%" PRIu32 ",\"resizes\":%" PRIu32 ",\"dropped\":%" PRIu32 "},",
+                 (unsigned)fb.fb_size, (unsigned)fb.size_pct, (unsigned)fb.size_max, fb.frames,
+                 fb.overflows, fb.resizes, fb.dropped);
+        httpd_resp_sendstr_chunk(req, buf);
+    }
+
+    frame_hub_get_stats(&hub);
+    snprintf(buf, sizeof(buf), "\"hub\":{\"frames\":%" PRIu32 ",\"subs\":%" PRIu32 ",\"in_flight\":%" PRIu32
+             ",\"in_flight_max\":%" PRIu32 ",\"delivered\":%" PRIu32 ",\"dropped\":%" PRIu32 "},\"timings\":[",
+             hub.frames, hub.subs, hub.in_flight, hub.in_flight_max, hub.delivered, hub.dropped);
+    httpd_resp_sendstr_chunk(req, buf);
+
+    // Too big for the server task stack
+    size_t count = 32;
+    camera_frame_timing_t *timings = malloc(count * sizeof(camera_frame_timing_t));
+    if (!timings || esp_camera_get_frame_timings(timings, &count) != ESP_OK){
+        count = 0;
+    }
+    for (size_t i = 0; i < count; i++){
+        const camera_frame_timing_t *t = &timings[i];
+        snprintf(buf, sizeof(buf), "%s{\"vsync_us\":%lld,\"first_eof\":%" PRIu32 ",\"end\":%" PRIu32 ",\"ready\":%" PRIu32
+                 ",\"taken\":%" PRIu32 ",\"returned\":%" PRIu32 ",\"copy\":%" PRIu32 ",\"len\":%" PRIu32 "}",
+                 i ? "," : "", t->vsync_us, t->first_eof_us, t->end_us, t->ready_us, t->taken_us,
+                 t->returned_us, t->copy_us, t->len);
+        httpd_resp_sendstr_chunk(req, buf);
+    }
+    free(timings);
+
+    httpd_resp_sendstr_chunk(req, "]}");
+    return httpd_resp_sendstr_chunk(req, NULL);
+}
@@ -0,0 +1,267 @@
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_camera.h"
+#include "img_converters.h"
+#include "frame_hub.h"
+
+static char TAG[] = "frame hub";
+
+#define FRAME_HUB_TASK_STACK    4096
+#define FRAME_HUB_TASK_PRIO     5
+
+struct frame_hub_sub {
+    bool used;
+    uint32_t last_seq;              // sequence number of the last frame handed out
+    uint32_t delivered;
+    uint32_t dropped;
+    SemaphoreHandle_t ready;        // given by the capture task for every new frame
+};
+
+static struct {
+    SemaphoreHandle_t lock;
+    SemaphoreHandle_t frame_free;   // given whenever a frame slot becomes free
+    TaskHandle_t task;
+    frame_hub_frame_t frames[FRAME_HUB_MAX_FRAMES];
+    frame_hub_sub_t subs[FRAME_HUB_MAX_SUBS];
+    frame_hub_frame_t *latest;      // newest frame, the hub holds one reference to it
+    uint32_t num_subs;
+    uint32_t seq;
+    uint32_t in_flight;
+    uint32_t in_flight_max;
+    uint32_t delivered;
+    uint32_t dropped;
+} s_hub;
+
+static frame_hub_frame_t *frame_alloc(void)
+{
+    frame_hub_frame_t *frame = NULL;
+
+    xSemaphoreTake(s_hub.lock, portMAX_DELAY);
+    for (int i = 0; i < FRAME_HUB_MAX_FRAMES; i++) {
+        if (!s_hub.frames[i].refs) {
+            frame = &s_hub.frames[i];
+            memset(frame, 0, sizeof(*frame));
+            frame->refs = 1;
+            if (++s_hub.in_flight > s_hub.in_flight_max) {
+                s_hub.in_flight_max = s_hub.in_flight;
+            }
+            break;
+        }
+    }
+    xSemaphoreGive(s_hub.lock);
+    return frame;
+}
+
+void frame_hub_release(frame_hub_frame_t *frame)
+{
+    if (!frame) {
+        return;
+    }
+
+    // Once only one reference is left the frame is no longer the latest one,
+    // so nobody can take a new reference while its buffer is being returned.
+    xSemaphoreTake(s_hub.lock, portMAX_DELAY);
+    bool last = frame->refs == 1;
+    if (!last) {
+        frame->refs--;
+    }
+    xSemaphoreGive(s_hub.lock);
+    if (!last) {
+        return;
+    }
+
+    if (frame->fb) {
+        esp_camera_fb_return(frame->fb);
+    } else {
+        free((void *)frame->buf);
+    }
+
+    xSemaphoreTake(s_hub.lock, portMAX_DELAY);
+    frame->refs = 0;
+    s_hub.in_flight--;
+    xSemaphoreGive(s_hub.lock);
+    xSemaphoreGive(s_hub.frame_free);
+}
+
+static void frame_hub_task(void *param)
+{
+    int64_t last_frame = esp_timer_get_time();
+
+    while (true) {
+        if (!s_hub.num_subs) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            last_frame = esp_timer_get_time();
+            continue;
+        }
+
+        frame_hub_frame_t *frame = frame_alloc();
+        if (!frame) {
+            // Every slot is still being sent by a slow subscriber
+            xSemaphoreTake(s_hub.frame_free, pdMS_TO_TICKS(100));
+            continue;
+        }
+
+        camera_fb_t *fb = esp_camera_fb_get();
+        if (!fb) {
+            ESP_LOGE(TAG, "Camera capture failed");
+            frame_hub_release(frame);
+            continue;
+        }
+        frame->timestamp = fb->timestamp;
+        if (fb->format != PIXFORMAT_JPEG) {
+            uint8_t *jpg_buf = NULL;
+            size_t jpg_buf_len = 0;
+            bool jpeg_converted = frame2jpg(fb, 80, &jpg_buf, &jpg_buf_len);
+            esp_camera_fb_return(fb);
+            if (!jpeg_converted) {
+                ESP_LOGE(TAG, "JPEG compression failed");
+                frame_hub_release(frame);
+                continue;
+            }
+            frame->buf = jpg_buf;
+            frame->len = jpg_buf_len;
+        } else {
+            frame->fb = fb;
+            frame->buf = fb->buf;
+            frame->len = fb->len;
+        }
+
+        size_t frame_len = frame->len;
+        frame_hub_frame_t *old = frame;
+        xSemaphoreTake(s_hub.lock, portMAX_DELAY);
+        if (s_hub.num_subs) {
+            frame->seq = ++s_hub.seq;
+            old = s_hub.latest;
+            s_hub.latest = frame;
+            for (int i = 0; i < FRAME_HUB_MAX_SUBS; i++) {
+                if (s_hub.subs[i].used) {
+                    xSemaphoreGive(s_hub.subs[i].ready);
+                }
+            }
+        }
+        xSemaphoreGive(s_hub.lock);
+        frame_hub_release(old);
+
+        int64_t fr_end = esp_timer_get_time();
+        int64_t frame_time = (fr_end - last_frame) / 1000;
+        last_frame = fr_end;
+        ESP_LOGD(TAG, "MJPG: %lu KB %lu ms (%.1ffps) to %lu subscribers", (uint32_t)(frame_len / 1024),
+                 (uint32_t)frame_time, frame_time ? 1000.0 / (uint32_t)frame_time : 0.0, s_hub.num_subs);
+    }
+}
+
+esp_err_t frame_hub_start(void)
+{
+    if (s_hub.task) {
+        return ESP_OK;
+    }
+
+    s_hub.lock = xSemaphoreCreateMutex();
+    s_hub.frame_free = xSemaphoreCreateBinary();
+    if (!s_hub.lock || !s_hub.frame_free) {
+        return ESP_ERR_NO_MEM;
+    }
+    for (int i = 0; i < FRAME_HUB_MAX_SUBS; i++) {
+        s_hub.subs[i].ready = xSemaphoreCreateBinary();
+        if (!s_hub.subs[i].ready) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    if (xTaskCreate(frame_hub_task, "frame_hub", FRAME_HUB_TASK_STACK, NULL, FRAME_HUB_TASK_PRIO, &s_hub.task) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create capture task");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+frame_hub_sub_t *frame_hub_subscribe(void)
+{
+    frame_hub_sub_t *sub = NULL;
+
+    xSemaphoreTake(s_hub.lock, portMAX_DELAY);
+    for (int i = 0; i < FRAME_HUB_MAX_SUBS; i++) {
+        if (!s_hub.subs[i].used) {
+            sub = &s_hub.subs[i];
+            sub->used = true;
+            sub->last_seq = 0;
+            sub->delivered = 0;
+            sub->dropped = 0;
+            xSemaphoreTake(sub->ready, 0);
+            s_hub.num_subs++;
+            break;
+        }
+    }
+    xSemaphoreGive(s_hub.lock);
+
+    if (sub) {
+        xTaskNotifyGive(s_hub.task);
+    }
+    return sub;
+}
+
+void frame_hub_unsubscribe(frame_hub_sub_t *sub)
+{
+    frame_hub_frame_t *old = NULL;
+
+    if (!sub) {
+        return;
+    }
+
+    xSemaphoreTake(s_hub.lock, portMAX_DELAY);
+    ESP_LOGI(TAG, "Subscriber done: %lu frames delivered, %lu dropped", sub->delivered, sub->dropped);
+    sub->used = false;
+    // Hand the buffer back to the camera when nobody is watching
+    if (!--s_hub.num_subs) {
+        old = s_hub.latest;
+        s_hub.latest = NULL;
+    }
+    xSemaphoreGive(s_hub.lock);
+    frame_hub_release(old);
+}
+
+frame_hub_frame_t *frame_hub_get(frame_hub_sub_t *sub, TickType_t timeout)
+{
+    TimeOut_t time_out;
+
+    vTaskSetTimeOutState(&time_out);
+    while (true) {
+        xSemaphoreTake(s_hub.lock, portMAX_DELAY);
+        frame_hub_frame_t *frame = s_hub.latest;
+        if (frame && frame->seq != sub->last_seq) {
+            frame->refs++;
+            if (sub->last_seq) {
+                uint32_t skipped = frame->seq - sub->last_seq - 1;
+                sub->dropped += skipped;
+                s_hub.dropped += skipped;
+            }
+            sub->last_seq = frame->seq;
+            sub->delivered++;
+            s_hub.delivered++;
+            xSemaphoreGive(s_hub.lock);
+            return frame;
+        }
+        xSemaphoreGive(s_hub.lock);
+
+        if (xTaskCheckForTimeOut(&time_out, &timeout) == pdTRUE) {
+            return NULL;
+        }
+        xSemaphoreTake(sub->ready, timeout);
+    }
+}
+
+void frame_hub_get_stats(frame_hub_stats_t *stats)
+{
+    xSemaphoreTake(s_hub.lock, portMAX_DELAY);
+    stats->frames = s_hub.seq;
+    stats->subs = s_hub.num_subs;
+    stats->in_flight = s_hub.in_flight;
+    stats->in_flight_max = s_hub.in_flight_max;
+    stats->delivered = s_hub.delivered;
+    stats->dropped = s_hub.dropped;
+    xSemaphoreGive(s_hub.lock);
+}
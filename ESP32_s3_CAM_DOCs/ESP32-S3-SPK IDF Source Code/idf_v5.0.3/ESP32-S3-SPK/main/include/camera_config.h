@@ -51,6 +51,8 @@ static camera_config_t camera_config = {
     .frame_size = FRAMESIZE_VGA,    //QQVGA-UXGA Do not use sizes above QVGA when not JPEG
 
     .jpeg_quality = 12, //0-63 lower number means higher quality
-    .fb_count = 2       //if more than one, i2s runs in continuous mode. Use only with JPEG
+    .fb_count = 4       //if more than one, i2s runs in continuous mode. Use only with JPEG
+                        //the stream hub keeps the latest frame while a slow client may still send an older one,
+                        //with 3 a slow client cost the others a third of the frames (host/frame_hub_bench)
 };
 #endif
\ No newline at end of file
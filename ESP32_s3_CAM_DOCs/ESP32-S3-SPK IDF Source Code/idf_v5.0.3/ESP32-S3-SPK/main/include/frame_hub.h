@@ -0,0 +1,63 @@
+#ifndef _FRAME_HUB__H_
+#define _FRAME_HUB__H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/time.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "esp_camera.h"
+
+#define FRAME_HUB_MAX_SUBS      5   // concurrent subscribers (stream clients and snapshots)
+#define FRAME_HUB_MAX_FRAMES    3   // frames referenced at once: the latest one plus those still being sent
+
+/**
+  * @brief  A captured JPEG frame shared by every subscriber
+  * @note   buf is read only, it is returned to the camera (or freed) when the last reference is released
+  */
+typedef struct {
+    const uint8_t *buf;             // JPEG data
+    size_t len;                     // JPEG length in bytes
+    struct timeval timestamp;       // capture time taken from the camera frame buffer
+    uint32_t seq;                   // capture sequence number, starts at 1
+
+    camera_fb_t *fb;                // backing camera frame buffer, NULL when buf was converted to JPEG
+    uint32_t refs;                  // references held by the hub and the subscribers
+} frame_hub_frame_t;
+
+typedef struct frame_hub_sub frame_hub_sub_t;
+
+typedef struct {
+    uint32_t frames;                // frames captured
+    uint32_t subs;                  // current subscribers
+    uint32_t in_flight;             // frames referenced right now
+    uint32_t in_flight_max;         // high water mark of in_flight
+    uint32_t delivered;             // frames handed to subscribers
+    uint32_t dropped;               // frames subscribers skipped because they were behind
+} frame_hub_stats_t;
+
+/**
+  * @brief  Start the capture task, the camera must already be initialized
+  */
+esp_err_t frame_hub_start(void);
+
+/**
+  * @brief  Register a subscriber, capture runs while there is at least one
+  * @retval NULL when all FRAME_HUB_MAX_SUBS slots are taken
+  */
+frame_hub_sub_t *frame_hub_subscribe(void);
+void frame_hub_unsubscribe(frame_hub_sub_t *sub);
+
+/**
+  * @brief  Take a reference to the newest frame the subscriber has not seen yet
+  * @param  sub ：subscriber
+  * @param  timeout ：ticks to wait for a new frame
+  * @retval frame to pass to frame_hub_release() when done, NULL on timeout
+  * @note   A subscriber slower than the camera skips the frames it missed, it never queues them
+  */
+frame_hub_frame_t *frame_hub_get(frame_hub_sub_t *sub, TickType_t timeout);
+void frame_hub_release(frame_hub_frame_t *frame);
+
+void frame_hub_get_stats(frame_hub_stats_t *stats);
+
+#endif
@@ -1,5 +1,6 @@
 #include <Arduino.h>
 #include "camera.h"
+#include "jpeg_luma.h"
 
 // Camera configuration
 static camera_config_t camera_config = {
@@ -90,10 +91,23 @@ camera_fb_t* capturePhoto() {
     return fb;
 }
 
-camera_fb_t* captureGrayscale() {
-    // Just capture JPEG - we'll handle it differently
-    // Switching formats on-the-fly doesn't work reliably
-    return capturePhoto();
+camera_fb_t* captureGrayscale(uint8_t* luma, int width, int height) {
+    // Format switching on the fly does not work reliably, so the JPEG frame is
+    // decoded at 1/8 scale instead: tjpgd then only needs the DC coefficient of
+    // every 8x8 block and skips the inverse DCT.
+    camera_fb_t* fb = capturePhoto();
+    if (!fb) {
+        return NULL;
+    }
+
+    if (!decodeJpegLuma(fb->buf, fb->len, luma, width, height)) {
+        if (DEBUG_SERIAL_ENABLED) {
+            Serial.println("Luma decode failed");
+        }
+        releasePhoto(fb);
+        return NULL;
+    }
+    return fb;
 }
 
 void releasePhoto(camera_fb_t* fb) {
@@ -10,8 +10,9 @@ bool initCamera();
 // Capture photo and return frame buffer (JPEG)
 camera_fb_t* capturePhoto();
 
-// Capture grayscale frame for motion detection
-camera_fb_t* captureGrayscale();
+// Capture a frame and decode its luma at 1/8 scale into luma (width x height) for
+// motion detection. Returns the JPEG frame so it can be kept, release it when done.
+camera_fb_t* captureGrayscale(uint8_t* luma, int width, int height);
 
 // Release frame buffer
 void releasePhoto(camera_fb_t* fb);
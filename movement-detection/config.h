@@ -13,6 +13,9 @@ extern const int MOTION_COOLDOWN_MS;
 extern const int PIR_TRIGGER_DURATION_MS;
 extern const int PHOTOS_PER_BURST;
 extern const int PHOTO_BURST_DELAY_MS;
+extern const bool CAMERA_MOTION_ENABLED;
+extern const int MOTION_THRESHOLD;
+extern const int MOTION_MIN_AREA_PERCENT;
 extern const bool SD_CARD_ENABLED;
 extern const char* SD_PHOTO_DIR;
 extern const bool TELEGRAM_ENABLED;
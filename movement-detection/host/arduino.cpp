@@ -0,0 +1,72 @@
+// Arduino core stand-ins for the host tests
+
+#include <stdarg.h>
+#include <time.h>
+#include "Arduino.h"
+
+bool host_serial_enabled = false;
+HostSerial Serial;
+
+static uint64_t monotonicUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t startUs = monotonicUs();
+
+unsigned long millis() {
+    return (monotonicUs() - startUs) / 1000;
+}
+
+unsigned long micros() {
+    return monotonicUs() - startUs;
+}
+
+void hostAdvanceTime(unsigned long ms) {
+    startUs -= (uint64_t)ms * 1000;
+}
+
+long random(long max) {
+    return max > 0 ? rand() % max : 0;
+}
+
+long random(long min, long max) {
+    return max > min ? min + random(max - min) : min;
+}
+
+void delay(unsigned long ms) {
+    struct timespec ts = { (time_t)(ms / 1000), (long)(ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+void* ps_malloc(size_t size) {
+    return malloc(size);
+}
+
+int HostSerial::printf(const char* format, ...) {
+    if (!host_serial_enabled) {
+        return 0;
+    }
+    va_list args;
+    va_start(args, format);
+    int n = vprintf(format, args);
+    va_end(args);
+    return n;
+}
+
+size_t HostSerial::print(const char* s) {
+    return host_serial_enabled ? ::printf("%s", s) : 0;
+}
+
+size_t HostSerial::print(long n) {
+    return host_serial_enabled ? ::printf("%ld", n) : 0;
+}
+
+size_t HostSerial::println(const char* s) {
+    return host_serial_enabled ? ::printf("%s\n", s) : 0;
+}
+
+size_t HostSerial::println(long n) {
+    return host_serial_enabled ? ::printf("%ld\n", n) : 0;
+}
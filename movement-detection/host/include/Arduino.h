@@ -0,0 +1,59 @@
+#pragma once
+
+// The part of the Arduino-ESP32 core API the sketch's modules use, on the host C library.
+// Serial output goes to stdout when host_serial_enabled is set.
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <algorithm>
+#include <type_traits>
+#include "WString.h"
+#include "Print.h"
+
+typedef uint8_t byte;
+
+using std::min;
+using std::max;
+
+// size_t is unsigned int on the ESP32, so min(size_t, unsigned) compiles there and must here
+template <typename T, typename U>
+typename std::common_type<T, U>::type min(T a, U b) {
+    return b < a ? b : a;
+}
+
+template <typename T, typename U>
+typename std::common_type<T, U>::type max(T a, U b) {
+    return a < b ? b : a;
+}
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+// Moves millis() and micros() forward, e.g. past a backoff
+void hostAdvanceTime(unsigned long ms);
+
+long random(long max);
+long random(long min, long max);
+
+// PSRAM is ordinary heap on the host
+void* ps_malloc(size_t size);
+
+extern bool host_serial_enabled;
+
+class HostSerial {
+public:
+    int printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+    size_t print(const char* s);
+    size_t print(long n);
+    size_t println(const char* s = "");
+    size_t println(long n);
+};
+
+extern HostSerial Serial;
@@ -0,0 +1,8 @@
+#pragma once
+
+// Arduino Client: the connection interface libraries such as UniversalTelegramBot take
+
+#include "Print.h"
+
+class Client : public Print {
+};
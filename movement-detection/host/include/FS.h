@@ -0,0 +1,57 @@
+#pragma once
+
+// The Arduino-ESP32 fs::File and fs::FS API, on a directory of the host file system.
+// See SD.h for the mount point and the power loss simulation.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+
+#define FILE_READ       "r"
+#define FILE_WRITE      "w"
+#define FILE_APPEND     "a"
+
+namespace fs {
+
+struct FileImpl;
+
+class File {
+public:
+    File() {}
+    explicit File(std::shared_ptr<FileImpl> impl) : impl_(impl) {}
+
+    operator bool() const;
+    size_t write(const uint8_t* buf, size_t size);
+    size_t write(uint8_t c) { return write(&c, 1); }
+    size_t print(const char* s);
+    int read();
+    size_t read(uint8_t* buf, size_t size);
+    int available();
+    bool seek(uint32_t pos);
+    size_t position() const;
+    size_t size() const;
+    void flush() {}
+    void close();
+    const char* name() const;   // File name without the directory, as in Arduino-ESP32 2.x
+    const char* path() const;
+    bool isDirectory() const;
+    File openNextFile(const char* mode = FILE_READ);
+    void rewindDirectory();
+
+private:
+    std::shared_ptr<FileImpl> impl_;
+};
+
+class FS {
+public:
+    File open(const char* path, const char* mode = FILE_READ, bool create = false);
+    bool exists(const char* path);
+    bool remove(const char* path);
+    bool mkdir(const char* path);
+    bool rmdir(const char* path);
+};
+
+}  // namespace fs
+
+using fs::File;
+using fs::FS;
@@ -0,0 +1,3 @@
+#pragma once
+
+// Arduino HTTPClient, the modules built on the host do not use it
@@ -0,0 +1,29 @@
+#pragma once
+
+// The Arduino-ESP32 Preferences library (key-value pairs in NVS) in memory. The values
+// survive a remount of the SD card stand-in, as NVS survives a reboot.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+class Preferences {
+public:
+    bool begin(const char* name, bool readOnly = false, const char* partitionLabel = NULL);
+    void end();
+    bool clear();
+    bool remove(const char* key);
+    bool isKey(const char* key);
+    size_t putULong(const char* key, uint32_t value);
+    uint32_t getULong(const char* key, uint32_t defaultValue = 0);
+
+private:
+    std::string key(const char* key) const { return name_ + "/" + key; }
+
+    std::string name_;
+    bool open_ = false;
+    bool readOnly_ = true;
+};
+
+// Forget every namespace, as a new board
+void hostPreferencesErase();
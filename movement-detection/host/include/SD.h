@@ -0,0 +1,32 @@
+#pragma once
+
+// The Arduino-ESP32 SD library on a directory of the host file system, with power loss:
+// after a given number of operations that change the card, the next one is cut short
+// (a write stores only half of its bytes, a file created for writing stays empty) and
+// every later operation fails until the power is restored, as after a reboot.
+
+#include "FS.h"
+
+typedef enum { CARD_NONE, CARD_MMC, CARD_SD, CARD_SDHC, CARD_UNKNOWN } sdcard_type_t;
+
+class SDFS : public fs::FS {
+public:
+    bool begin(uint8_t ssPin = 0);
+    void end() {}
+    sdcard_type_t cardType();
+    uint64_t cardSize();
+    uint64_t usedBytes();
+};
+
+extern SDFS SD;
+
+// Directory that stands in for the card, SD.begin() fails until it is set
+void hostSdMount(const char* dir);
+
+// Cut the power after ops more operations that change the card, -1 = never
+void hostSdCutPowerAfter(long ops);
+bool hostSdPowerLost();
+void hostSdRestorePower();
+
+// Operations that changed the card since the power was last restored
+unsigned long hostSdOps();
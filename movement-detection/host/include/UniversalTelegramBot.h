@@ -0,0 +1,20 @@
+#pragma once
+
+// The UniversalTelegramBot calls of telegram.cpp. Single messages and photos are not sent
+// on the host, the batch upload goes through WiFiClientSecure.h instead.
+
+#include <Arduino.h>
+#include "Client.h"
+
+class UniversalTelegramBot {
+public:
+    UniversalTelegramBot(const String& token, Client& client) {}
+
+    bool sendMessage(const String& chatId, const String& text, const String& parseMode = "") { return false; }
+
+    String sendPhotoByBinary(const String& chatId, const String& contentType, int fileSize,
+                             bool (*moreDataAvailable)(), byte (*getNextByte)(), uint8_t* (*getNextBuffer)(),
+                             int (*getNextBufferLen)()) {
+        return "";
+    }
+};
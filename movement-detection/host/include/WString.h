@@ -0,0 +1,69 @@
+#pragma once
+
+// The part of the Arduino String class the sketch's modules use, on std::string
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string>
+
+class String {
+public:
+    String(const char* s = "") : s_(s ? s : "") {}
+    String(const std::string& s) : s_(s) {}
+    String(char c) : s_(1, c) {}
+    String(int n) : s_(std::to_string(n)) {}
+    String(unsigned int n) : s_(std::to_string(n)) {}
+    String(long n) : s_(std::to_string(n)) {}
+    String(unsigned long n) : s_(std::to_string(n)) {}
+
+    const char* c_str() const { return s_.c_str(); }
+    unsigned int length() const { return s_.size(); }
+    bool isEmpty() const { return s_.empty(); }
+    char operator[](unsigned int i) const { return i < s_.size() ? s_[i] : 0; }
+    char charAt(unsigned int i) const { return (*this)[i]; }
+
+    String& operator+=(const String& s) { s_ += s.s_; return *this; }
+    String& operator+=(const char* s) { s_ += s ? s : ""; return *this; }
+    String& operator+=(char c) { s_ += c; return *this; }
+    bool concat(const String& s) { s_ += s.s_; return true; }
+    bool concat(const char* s, unsigned int len) { s_.append(s, len); return true; }
+
+    bool operator==(const String& s) const { return s_ == s.s_; }
+    bool operator==(const char* s) const { return s_ == (s ? s : ""); }
+    bool operator!=(const String& s) const { return s_ != s.s_; }
+    bool operator!=(const char* s) const { return !(*this == s); }
+    bool equals(const String& s) const { return s_ == s.s_; }
+
+    bool startsWith(const String& s) const { return s_.compare(0, s.s_.size(), s.s_) == 0; }
+    bool endsWith(const String& s) const {
+        return s_.size() >= s.s_.size() && s_.compare(s_.size() - s.s_.size(), s.s_.size(), s.s_) == 0;
+    }
+    int indexOf(char c, unsigned int from = 0) const { return find(s_.find(c, from)); }
+    int indexOf(const String& s, unsigned int from = 0) const { return find(s_.find(s.s_, from)); }
+    int lastIndexOf(char c) const { return find(s_.rfind(c)); }
+    String substring(unsigned int from) const { return from < s_.size() ? s_.substr(from) : ""; }
+    String substring(unsigned int from, unsigned int to) const {
+        return from < to && from < s_.size() ? s_.substr(from, to - from) : "";
+    }
+
+    long toInt() const { return strtol(s_.c_str(), NULL, 10); }
+    void trim() {
+        size_t first = s_.find_first_not_of(" \t\r\n");
+        size_t last = s_.find_last_not_of(" \t\r\n");
+        s_ = first == std::string::npos ? "" : s_.substr(first, last - first + 1);
+    }
+    void toLowerCase() {
+        for (char& c : s_) {
+            c = tolower((unsigned char)c);
+        }
+    }
+
+    friend String operator+(const String& a, const String& b) { return a.s_ + b.s_; }
+    friend String operator+(const String& a, const char* b) { return a.s_ + (b ? b : ""); }
+    friend String operator+(const char* a, const String& b) { return (a ? a : "") + b.s_; }
+
+private:
+    static int find(size_t pos) { return pos == std::string::npos ? -1 : (int)pos; }
+
+    std::string s_;
+};
@@ -0,0 +1,3 @@
+#pragma once
+
+// WiFi station, the modules built on the host do not use it
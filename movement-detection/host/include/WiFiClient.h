@@ -0,0 +1,5 @@
+#pragma once
+
+// Plain TCP client, the sketch only uses the TLS one (WiFiClientSecure.h)
+
+#include "Client.h"
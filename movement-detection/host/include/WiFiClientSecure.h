@@ -0,0 +1,46 @@
+#pragma once
+
+// The Arduino-ESP32 WiFiClientSecure on a scripted server: a test queues the bytes the
+// server sends on the current connection and closes its side; they reach the client in
+// pieces of at most the fragment size, like TLS records. A test can also answer every
+// request as it arrives, as a server would.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include "Client.h"
+
+class WiFiClientSecure : public Client {
+public:
+    using Print::write;
+
+    void setInsecure() {}
+    int connect(const char* host, uint16_t port);
+    uint8_t connected();
+    int available();
+    int read();
+    int read(uint8_t* buf, size_t size);
+    size_t write(const uint8_t* buf, size_t size) override;
+    void flush() {}
+    void stop();
+};
+
+// Bytes the server sends on the current connection
+void hostTlsServerSend(const char* data, size_t len);
+void hostTlsServerSend(const char* data);
+// The server closes its side once the client has read what was sent
+void hostTlsServerClose();
+// Most bytes available() reports at once, 0 = everything queued
+void hostTlsFragment(size_t size);
+// Connections opened, and the bytes the client wrote on the current one
+unsigned long hostTlsConnects();
+const std::string& hostTlsSent();
+
+// Called with every complete request the client writes (its headers and Content-Length
+// body), on the connection it came on. It answers with hostTlsServerSend() and
+// hostTlsServerClose(). NULL = the test scripts the server by hand.
+typedef void (*HostTlsServer)(const std::string& request, unsigned long connection);
+void hostTlsServe(HostTlsServer server);
+// millis() a connect takes, and the number of connects from now on that fail
+void hostTlsHandshakeMs(unsigned long ms);
+void hostTlsRefuseConnects(int count);
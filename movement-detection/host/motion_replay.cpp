@@ -0,0 +1,282 @@
+// Replays clips of JPEG frames through the sketch's motion path: decodeJpegLuma() as
+// captureGrayscale() calls it, then processMotionFrame() and isMotionScore().
+// A clip is a directory of JPEG frames played in name order, e.g. frames saved from the
+// camera stream. Without clips, synthetic ones are encoded: a still scene with sensor noise,
+// an exposure step, a small object and a person crossing, each with the result the detector
+// must give, and frames of another size, which must be rejected before they are decoded.
+
+#include <Arduino.h>
+#include <dirent.h>
+#include <strings.h>
+#include <getopt.h>
+#include <string>
+#include <vector>
+#include "img_converters.h"
+#include "jpeg_luma.h"
+#include "motion.h"
+
+#define REPLAY_FRAMES       30      // Frames of a synthetic clip
+#define REPLAY_EVENT_FRAME  12      // First frame of its event, after the warm-up
+
+enum Expect { EXPECT_ANY, EXPECT_STILL, EXPECT_MOTION };
+
+struct SyntheticClip {
+    const char* name;
+    Expect expect;
+    int brightnessStep;     // Added to the scene from the event frame on
+    int objectWidth;        // Dark object moving across the scene from the event frame on
+    int objectHeight;
+    int objectSpeed;        // Pixels per frame
+};
+
+static const SyntheticClip syntheticClips[] = {
+    { "still scene, sensor noise", EXPECT_STILL, 0, 0, 0, 0 },
+    { "exposure step +40", EXPECT_STILL, 40, 0, 0, 0 },
+    { "small object, 24x24 px", EXPECT_STILL, 0, 24, 24, 16 },
+    { "person crossing, 160x360 px", EXPECT_MOTION, 0, 160, 360, 40 },
+};
+
+struct Clip {
+    std::string name;
+    Expect expect;
+    std::vector<std::vector<uint8_t>> frames;
+};
+
+static size_t jpegWrite(void* arg, size_t index, const void* data, size_t len) {
+    std::vector<uint8_t>* out = (std::vector<uint8_t>*)arg;
+    out->resize(index + len);
+    memcpy(out->data() + index, data, len);
+    return len;
+}
+
+// A room: a gradient with a few flat surfaces, the same for every clip
+static void drawScene(uint8_t* rgb, int width, int height) {
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            uint8_t* p = rgb + (y * width + x) * 3;
+            p[0] = 90 + x * 60 / width;
+            p[1] = 100 + y * 50 / height;
+            p[2] = 110;
+            if (x > width / 8 && x < width / 3 && y > height / 2) {
+                p[0] = 150, p[1] = 120, p[2] = 80;      // Cupboard
+            } else if (x > width / 2 && x < width * 3 / 4 && y > height / 5 && y < height / 2) {
+                p[0] = 200, p[1] = 210, p[2] = 220;     // Window
+            }
+        }
+    }
+}
+
+static bool encodeFrame(const uint8_t* rgb, int width, int height, std::vector<uint8_t>* jpg) {
+    jpg->clear();
+    return fmt2jpg_cb((uint8_t*)rgb, (size_t)width * height * 3, width, height, PIXFORMAT_RGB888,
+                      CAMERA_JPEG_QUALITY, jpegWrite, jpg);
+}
+
+static bool synthesize(const SyntheticClip& def, int width, int height, Clip* clip) {
+    std::vector<uint8_t> scene((size_t)width * height * 3), frame(scene.size());
+    drawScene(scene.data(), width, height);
+    clip->name = def.name;
+    clip->expect = def.expect;
+    srand(1);
+
+    for (int n = 0; n < REPLAY_FRAMES; n++) {
+        bool event = n >= REPLAY_EVENT_FRAME;
+        int shift = event ? def.brightnessStep : 0;
+        for (size_t i = 0; i < frame.size(); i++) {
+            frame[i] = constrain(scene[i] + shift + rand() % 9 - 4, 0, 255);
+        }
+        if (event && def.objectWidth) {
+            int x0 = -def.objectWidth + (n - REPLAY_EVENT_FRAME) * def.objectSpeed;
+            int y0 = height - def.objectHeight - height / 10;
+            for (int y = max(y0, 0); y < min(y0 + def.objectHeight, height); y++) {
+                for (int x = max(x0, 0); x < min(x0 + def.objectWidth, width); x++) {
+                    uint8_t* p = &frame[(y * width + x) * 3];
+                    p[0] = 40, p[1] = 35, p[2] = 30;
+                }
+            }
+        }
+        clip->frames.emplace_back();
+        if (!encodeFrame(frame.data(), width, height, &clip->frames.back())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool loadClip(const char* dir, Expect expect, Clip* clip) {
+    DIR* d = opendir(dir);
+    if (!d) {
+        return false;
+    }
+    std::vector<std::string> names;
+    while (struct dirent* e = readdir(d)) {
+        size_t len = strlen(e->d_name);
+        if (len > 4 && (strcasecmp(e->d_name + len - 4, ".jpg") == 0 || strcasecmp(e->d_name + len - 5, ".jpeg") == 0)) {
+            names.push_back(e->d_name);
+        }
+    }
+    closedir(d);
+    std::sort(names.begin(), names.end());
+
+    clip->name = dir;
+    clip->expect = expect;
+    for (const std::string& name : names) {
+        FILE* f = fopen((std::string(dir) + "/" + name).c_str(), "rb");
+        if (!f) {
+            return false;
+        }
+        fseek(f, 0, SEEK_END);
+        clip->frames.emplace_back(ftell(f));
+        rewind(f);
+        bool ok = fread(clip->frames.back().data(), 1, clip->frames.back().size(), f) == clip->frames.back().size();
+        fclose(f);
+        if (!ok) {
+            return false;
+        }
+    }
+    return !clip->frames.empty();
+}
+
+// Plays the clip from a fresh background, true when the detector gave the expected result
+static bool replay(const Clip& clip, bool verbose) {
+    uint8_t* luma = getMotionLumaBuffer();
+    int width = getMotionLumaWidth(), height = getMotionLumaHeight();
+    int rejected = 0, firstMotion = -1, maxScore = 0;
+    unsigned long decodeUs = 0, detectUs = 0, decoded = 0;
+
+    resetMotionDetector();
+    for (size_t n = 0; n < clip.frames.size(); n++) {
+        unsigned long start = micros();
+        if (!decodeJpegLuma(clip.frames[n].data(), clip.frames[n].size(), luma, width, height)) {
+            rejected++;
+            continue;
+        }
+        decodeUs += micros() - start;
+        decoded++;
+
+        int score = processMotionFrame();
+        MotionStats stats;
+        getMotionStats(&stats);
+        detectUs += stats.lastProcessUs;
+        maxScore = max(maxScore, score);
+        if (isMotionScore(score) && firstMotion < 0) {
+            firstMotion = n;
+        }
+        if (verbose) {
+            printf("  frame %3zu  score %3d%%  %3d blocks  brightness %+d\n", n, score, stats.changedBlocks,
+                   stats.brightnessShift);
+        }
+    }
+
+    bool ok = clip.expect == EXPECT_ANY || (clip.expect == EXPECT_MOTION) == (firstMotion >= 0);
+    printf("%-30.30s %3zu frames, %2d rejected, ", clip.name.c_str(), clip.frames.size(), rejected);
+    if (firstMotion >= 0) {
+        printf("motion from frame %3d", firstMotion);
+    } else {
+        printf("no motion            ");
+    }
+    printf(", max score %3d%%, decode %5lu us, detect %4lu us per frame%s\n", maxScore,
+           decoded ? decodeUs / decoded : 0, decoded ? detectUs / decoded : 0,
+           ok ? "" : clip.expect == EXPECT_MOTION ? "  EXPECTED MOTION" : "  EXPECTED NO MOTION");
+    return ok;
+}
+
+// Frames of another size must leave the plane as it was, and a broken header must not pass
+static bool checkRejected(int width, int height) {
+    int otherWidth = width / 2, otherHeight = height / 2;
+    std::vector<uint8_t> rgb((size_t)otherWidth * otherHeight * 3, 128), jpg;
+    if (!encodeFrame(rgb.data(), otherWidth, otherHeight, &jpg)) {
+        return false;
+    }
+
+    uint8_t* luma = getMotionLumaBuffer();
+    size_t pixels = (size_t)getMotionLumaWidth() * getMotionLumaHeight();
+    memset(luma, 0xA5, pixels);
+    bool decoded = decodeJpegLuma(jpg.data(), jpg.size(), luma, getMotionLumaWidth(), getMotionLumaHeight());
+    bool untouched = true;
+    for (size_t i = 0; i < pixels; i++) {
+        untouched &= luma[i] == 0xA5;
+    }
+
+    int w, h;
+    bool sized = jpegImageSize(jpg.data(), jpg.size(), &w, &h) && w == otherWidth && h == otherHeight;
+    // Cut inside the headers, before the frame header
+    bool truncated = jpegImageSize(jpg.data(), 40, &w, &h);
+
+    printf("%-30.30s %dx%d frame %s, plane %s, header size %s, truncated header %s\n", "frame of another size",
+           otherWidth, otherHeight, decoded ? "DECODED" : "rejected", untouched ? "untouched" : "WRITTEN",
+           sized ? "read" : "WRONG", truncated ? "ACCEPTED" : "rejected");
+    return !decoded && untouched && sized && !truncated;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [options] [clip_dir...]\n"
+            "  -s WxH       camera frame size (800x600)\n"
+            "  -e result    still or motion, what every clip given must show\n"
+            "  -v           score of every frame, and the sketch's debug output\n",
+            prog);
+}
+
+int main(int argc, char** argv) {
+    int width = 800, height = 600;
+    Expect expect = EXPECT_ANY;
+    bool verbose = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:e:vh")) != -1) {
+        switch (opt) {
+            case 's':
+                if (sscanf(optarg, "%dx%d", &width, &height) != 2 || width < 64 || height < 64) {
+                    usage(argv[0]);
+                    return 2;
+                }
+                break;
+            case 'e':
+                if (strcmp(optarg, "still") == 0) {
+                    expect = EXPECT_STILL;
+                } else if (strcmp(optarg, "motion") == 0) {
+                    expect = EXPECT_MOTION;
+                } else {
+                    usage(argv[0]);
+                    return 2;
+                }
+                break;
+            case 'v':
+                verbose = true;
+                host_serial_enabled = true;
+                break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+
+    if (!initMotionDetector(width, height)) {
+        fprintf(stderr, "cannot allocate the motion detector\n");
+        return 1;
+    }
+
+    int failed = 0;
+    if (optind < argc) {
+        for (int i = optind; i < argc; i++) {
+            Clip clip;
+            if (!loadClip(argv[i], expect, &clip)) {
+                fprintf(stderr, "no JPEG frames in %s\n", argv[i]);
+                return 1;
+            }
+            failed += !replay(clip, verbose);
+        }
+    } else {
+        for (const SyntheticClip& def : syntheticClips) {
+            Clip clip;
+            if (!synthesize(def, width, height, &clip)) {
+                fprintf(stderr, "cannot encode %s\n", def.name);
+                return 1;
+            }
+            failed += !replay(clip, verbose);
+        }
+        failed += !checkRejected(width, height);
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,261 @@
+// Checks sendPhotosBatch() byte for byte against the String-based request it replaced:
+// the same boundary, headers, Content-Length, form fields and photo data for batches of
+// 1 to TELEGRAM_MAX_BATCH_SIZE photos whose sizes fall around the 512-byte reads of the old
+// code and the 4 KB chunks of the multipart encoder. The photos are on a local directory
+// standing in for the card (SD.h), the request goes to a stand-in TLS client.
+
+#include <Arduino.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <string>
+#include "SD.h"
+#include "WiFiClientSecure.h"
+#include "photo_index.h"
+#include "sd_storage.h"
+#include "telegram.h"
+#include "telegram_session.h"
+
+static const size_t photoSizes[] = { 1, 511, 512, 513, 4095, 4096, 4097, 9000, 23456, 65537 };
+#define PHOTO_COUNT     (sizeof(photoSizes) / sizeof(photoSizes[0]))
+
+// Collects what the old code printed
+class StringPrint : public Print {
+public:
+    using Print::write;
+    size_t write(const uint8_t* buf, size_t size) override {
+        data.append((const char*)buf, size);
+        return size;
+    }
+    std::string data;
+};
+
+// The request of sendPhotosBatch() before the multipart encoder, as it was written,
+// up to the end boundary. Only the client is replaced by out.
+String generateBoundary() {
+    return "----WebKitFormBoundary" + String(random(100000, 999999));
+}
+
+static bool legacyPhotosBatch(Print& out, String* filenames, int count) {
+    String boundary = generateBoundary();
+    String path = "/bot" + String(TELEGRAM_BOT_TOKEN) + "/sendMediaGroup";
+
+    // Build media array (NO escaping - it's a form field, not nested JSON)
+    String mediaArray = "[";
+    for (int i = 0; i < count; i++) {
+        if (i > 0) mediaArray += ",";
+        mediaArray += "{\"type\":\"photo\",\"media\":\"attach://photo" + String(i) + "\"";
+        if (i == 0) {
+            mediaArray += ",\"caption\":\"🚨 Motion detected! (" + String(count) + " photos)\"";
+        }
+        mediaArray += "}";
+    }
+    mediaArray += "]";
+
+    // Calculate content length
+    size_t contentLength = 0;
+
+    // chat_id part
+    String chatIdPart = "--" + boundary + "\r\n";
+    chatIdPart += "Content-Disposition: form-data; name=\"chat_id\"\r\n\r\n";
+    chatIdPart += String(TELEGRAM_CHAT_ID) + "\r\n";
+    contentLength += chatIdPart.length();
+
+    // disable_notification part (silent mode)
+    String notificationPart = "--" + boundary + "\r\n";
+    notificationPart += "Content-Disposition: form-data; name=\"disable_notification\"\r\n\r\n";
+    notificationPart += "true\r\n";
+    contentLength += notificationPart.length();
+
+    // media part
+    String mediaPart = "--" + boundary + "\r\n";
+    mediaPart += "Content-Disposition: form-data; name=\"media\"\r\n\r\n";
+    mediaPart += mediaArray + "\r\n";
+    contentLength += mediaPart.length();
+
+    // Photo parts
+    for (int i = 0; i < count; i++) {
+        File file = SD.open(filenames[i].c_str(), FILE_READ);
+        if (!file) {
+            return false;
+        }
+
+        size_t fileSize = file.size();
+        file.close();
+
+        String photoPart = "--" + boundary + "\r\n";
+        photoPart += "Content-Disposition: form-data; name=\"photo" + String(i) + "\"; filename=\"photo.jpg\"\r\n";
+        photoPart += "Content-Type: image/jpeg\r\n\r\n";
+
+        contentLength += photoPart.length();
+        contentLength += fileSize;
+        contentLength += 2; // \r\n
+    }
+
+    // End boundary
+    String endBoundary = "--" + boundary + "--\r\n";
+    contentLength += endBoundary.length();
+
+    // Send HTTP headers
+    out.print("POST " + path + " HTTP/1.1\r\n");
+    out.print("Host: " TELEGRAM_API_HOST "\r\n");
+    out.print("Content-Type: multipart/form-data; boundary=" + boundary + "\r\n");
+    out.print("Content-Length: " + String(contentLength) + "\r\n");
+    out.print("Connection: keep-alive\r\n\r\n");
+
+    // Send body parts
+    out.print(chatIdPart);
+    out.print(notificationPart);
+    out.print(mediaPart);
+
+    // Send photos
+    for (int i = 0; i < count; i++) {
+        String photoPart = "--" + boundary + "\r\n";
+        photoPart += "Content-Disposition: form-data; name=\"photo" + String(i) + "\"; filename=\"photo.jpg\"\r\n";
+        photoPart += "Content-Type: image/jpeg\r\n\r\n";
+        out.print(photoPart);
+
+        // Stream photo data
+        File file = SD.open(filenames[i].c_str(), FILE_READ);
+        if (file) {
+            uint8_t buf[512];
+            while (file.available()) {
+                size_t len = file.read(buf, sizeof(buf));
+                if (out.write(buf, len) != len) {
+                    file.close();
+                    return false;
+                }
+            }
+            file.close();
+            out.print("\r\n");
+        }
+    }
+
+    out.print(endBoundary);
+    return true;
+}
+
+static bool writePhoto(const char* cardDir, unsigned long seq, size_t size) {
+    char path[64];
+    photoPath(path, sizeof(path), seq);
+    FILE* f = fopen((std::string(cardDir) + path).c_str(), "wb");
+    if (!f) {
+        return false;
+    }
+    for (size_t i = 0; i < size; i++) {
+        fputc(rand() & 0xFF, f);
+    }
+    return fclose(f) == 0;
+}
+
+// Declared Content-Length against the bytes behind the headers
+static bool lengthMatches(const std::string& request) {
+    size_t body = request.find("\r\n\r\n");
+    size_t field = request.find("Content-Length: ");
+    return body != std::string::npos && field != std::string::npos &&
+           strtoul(request.c_str() + field + 16, NULL, 10) == request.size() - body - 4;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -d dir       directory standing in for the card (a new one in /tmp)\n"
+            "  -v           result of every batch, and the sketch's debug output\n",
+            prog);
+}
+
+int main(int argc, char** argv) {
+    const char* cardDir = NULL;
+    bool verbose = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:vh")) != -1) {
+        switch (opt) {
+            case 'd':
+                cardDir = optarg;
+                break;
+            case 'v':
+                verbose = true;
+                host_serial_enabled = true;
+                break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+
+    char tmpDir[] = "/tmp/multipart_compare.XXXXXX";
+    if (!cardDir && !(cardDir = mkdtemp(tmpDir))) {
+        perror("mkdtemp");
+        return 1;
+    }
+    hostSdMount(cardDir);
+    if (!initSDCard()) {
+        fprintf(stderr, "cannot mount %s\n", cardDir);
+        return 1;
+    }
+
+    // Photo numbers after the index, so their sizes come from the files as for old photos
+    unsigned long first = getNextPhotoNumber();
+    String filenames[PHOTO_COUNT];
+    for (size_t i = 0; i < PHOTO_COUNT; i++) {
+        char path[64];
+        photoPath(path, sizeof(path), first + i);
+        filenames[i] = path;
+        if (!writePhoto(cardDir, first + i, photoSizes[i])) {
+            fprintf(stderr, "cannot write %s in %s\n", path, cardDir);
+            return 1;
+        }
+    }
+
+    int failed = 0, batches = 0;
+    size_t bytes = 0;
+    for (int count = 1; count <= TELEGRAM_MAX_BATCH_SIZE; count++) {
+        for (size_t offset = 0; offset + count <= PHOTO_COUNT; offset += count) {
+            unsigned seed = count * 100 + offset;
+
+            StringPrint legacy;
+            srand(seed);
+            bool legacyOk = legacyPhotosBatch(legacy, filenames + offset, count);
+
+            // A fresh connection with the server's answer already queued
+            telegramSessionClose();
+            telegramSessionBegin();
+            hostTlsServerSend("HTTP/1.1 200 OK\r\nContent-Length: 11\r\n\r\n{\"ok\":true}");
+            srand(seed);
+            bool sent = sendPhotosBatch(filenames + offset, count);
+            const std::string& request = hostTlsSent();
+
+            size_t diff = 0;
+            while (diff < request.size() && diff < legacy.data.size() && request[diff] == legacy.data[diff]) {
+                diff++;
+            }
+            bool ok = legacyOk && sent && request == legacy.data && lengthMatches(request);
+            if (verbose || !ok) {
+                printf("  %2d photos from %zu: %7zu bytes, %s\n", count, offset, request.size(),
+                       ok ? "identical" : "DIFFERENT");
+            }
+            if (!ok && diff < max(request.size(), legacy.data.size())) {
+                printf("    first difference at byte %zu: \"%.40s\" against \"%.40s\"\n", diff,
+                       diff < request.size() ? request.c_str() + diff : "",
+                       diff < legacy.data.size() ? legacy.data.c_str() + diff : "");
+            }
+            failed += !ok;
+            bytes += request.size();
+            batches++;
+        }
+    }
+
+    if (cardDir == tmpDir) {
+        for (size_t i = 0; i < PHOTO_COUNT; i++) {
+            SD.remove(filenames[i].c_str());
+        }
+        char path[64];
+        snprintf(path, sizeof(path), "%s/%s", SD_PHOTO_DIR, PHOTO_INDEX_FILE);
+        SD.remove(path);
+        SD.rmdir(SD_PHOTO_DIR);
+        rmdir(cardDir);
+    }
+    printf("%d batches of 1-%d photos, %zu request bytes: %d differ from the String-based request\n", batches,
+           TELEGRAM_MAX_BATCH_SIZE, bytes, failed);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,239 @@
+// Hammers the photo pool from capture tasks and SD tasks at once, the way captureBurst() and
+// sdSaveTask() share it: producers store bursts of photos and hand them over a queue,
+// consumers check every byte and return the slots slower than photos come, so the pool runs out.
+// Every slot must be owned by one photo at a time, come back with its photo intact, and the
+// counters must add up to what the threads saw. Afterwards every slot must be free again.
+
+#include <Arduino.h>
+#include <getopt.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "photo_pool.h"
+
+#define STRESS_SLOT_SIZE    4096
+
+struct Photo {
+    uint8_t* slot;
+    size_t len;
+    uint32_t tag;           // Producer and sequence number, the fill pattern is made from it
+};
+
+static std::mutex queueLock;
+static std::condition_variable queueReady;
+static std::deque<Photo> queue;
+static bool producersDone = false;
+
+static uint8_t* slotAddress[PHOTO_POOL_SLOTS];
+static std::atomic<int> slotOwned[PHOTO_POOL_SLOTS];
+
+static std::atomic<unsigned long> stored(0), exhausted(0), consumed(0);
+static std::atomic<unsigned long> foreignSlots(0), doubleOwned(0), corrupted(0);
+
+static uint8_t pattern(uint32_t tag, size_t i) {
+    return (uint8_t)(tag * 31 + i * 7 + (i >> 8));
+}
+
+static int slotIndex(const uint8_t* slot) {
+    for (int i = 0; i < PHOTO_POOL_SLOTS; i++) {
+        if (slotAddress[i] == slot) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Marks the slot taken, false when it is not a pool slot or somebody else has it
+static bool takeSlot(const uint8_t* slot) {
+    int index = slotIndex(slot);
+    if (index < 0) {
+        foreignSlots++;
+        return false;
+    }
+    if (slotOwned[index].exchange(1) != 0) {
+        doubleOwned++;
+        return false;
+    }
+    return true;
+}
+
+static void giveSlot(const uint8_t* slot) {
+    int index = slotIndex(slot);
+    if (index >= 0) {
+        slotOwned[index] = 0;
+    }
+}
+
+static void producer(int id, unsigned long deadline) {
+    std::vector<uint8_t> jpeg(STRESS_SLOT_SIZE);
+    uint32_t seq = 0;
+    unsigned seed = id + 1;
+
+    while (millis() < deadline) {
+        int photos = 1 + rand_r(&seed) % MAX_PHOTOS_PER_BURST;
+        for (int n = 0; n < photos; n++) {
+            uint32_t tag = (id << 24) | (seq++ & 0xFFFFFF);
+            size_t len = 1 + rand_r(&seed) % STRESS_SLOT_SIZE;
+            for (size_t i = 0; i < len; i++) {
+                jpeg[i] = pattern(tag, i);
+            }
+
+            uint8_t* slot = storePhoto(jpeg.data(), len);
+            if (!slot) {
+                exhausted++;
+                continue;
+            }
+            stored++;
+            if (!takeSlot(slot)) {
+                continue;
+            }
+            std::lock_guard<std::mutex> lock(queueLock);
+            queue.push_back({ slot, len, tag });
+            queueReady.notify_one();
+        }
+        std::this_thread::yield();
+    }
+}
+
+// slowUs stands in for the card write, the pool fills up while it lasts
+static void consumer(unsigned slowUs) {
+    while (true) {
+        Photo photo;
+        {
+            std::unique_lock<std::mutex> lock(queueLock);
+            queueReady.wait(lock, [] { return !queue.empty() || producersDone; });
+            if (queue.empty()) {
+                return;
+            }
+            photo = queue.front();
+            queue.pop_front();
+        }
+
+        if (slowUs) {
+            std::this_thread::sleep_for(std::chrono::microseconds(slowUs));
+        }
+        for (size_t i = 0; i < photo.len; i++) {
+            if (photo.slot[i] != pattern(photo.tag, i)) {
+                corrupted++;
+                break;
+            }
+        }
+        // Clobber the slot so a photo handed out twice shows up as corrupted
+        memset(photo.slot, 0xEE, photo.len);
+        consumed++;
+        giveSlot(photo.slot);
+        releasePhotoSlot(photo.slot);
+    }
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -p count     capture tasks storing photos (2)\n"
+            "  -c count     SD tasks returning them (2)\n"
+            "  -s us        time an SD task spends on each photo (100)\n"
+            "  -t seconds   run time (2)\n",
+            prog);
+}
+
+int main(int argc, char** argv) {
+    int producers = 2, consumers = 2, seconds = 2;
+    unsigned slowUs = 100;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:c:s:t:h")) != -1) {
+        switch (opt) {
+            case 'p':
+                producers = atoi(optarg);
+                break;
+            case 'c':
+                consumers = atoi(optarg);
+                break;
+            case 's':
+                slowUs = atoi(optarg);
+                break;
+            case 't':
+                seconds = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+    if (producers < 1 || producers > 255 || consumers < 1 || seconds < 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (!initPhotoPool(STRESS_SLOT_SIZE)) {
+        fprintf(stderr, "cannot allocate the photo pool\n");
+        return 1;
+    }
+
+    // Learn the slot addresses: every acquire must succeed once, then the pool is empty
+    int failed = 0;
+    for (int i = 0; i < PHOTO_POOL_SLOTS; i++) {
+        slotAddress[i] = acquirePhotoSlot();
+        failed += !slotAddress[i] || slotIndex(slotAddress[i]) != i || ((uintptr_t)slotAddress[i] & 3);
+    }
+    failed += acquirePhotoSlot() != NULL;
+    for (int i = 0; i < PHOTO_POOL_SLOTS; i++) {
+        releasePhotoSlot(slotAddress[i]);
+    }
+    std::vector<uint8_t> big(STRESS_SLOT_SIZE + 1);
+    failed += storePhoto(big.data(), big.size()) != NULL;
+    if (failed) {
+        fprintf(stderr, "photo pool does not hand out %d distinct aligned slots\n", PHOTO_POOL_SLOTS);
+        return 1;
+    }
+
+    PhotoPoolStats before;
+    getPhotoPoolStats(&before);
+
+    unsigned long deadline = millis() + seconds * 1000UL;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < consumers; i++) {
+        threads.emplace_back(consumer, slowUs);
+    }
+    std::vector<std::thread> capture;
+    for (int i = 0; i < producers; i++) {
+        capture.emplace_back(producer, i, deadline);
+    }
+    for (std::thread& t : capture) {
+        t.join();
+    }
+    {
+        std::lock_guard<std::mutex> lock(queueLock);
+        producersDone = true;
+        queueReady.notify_all();
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+
+    PhotoPoolStats stats;
+    getPhotoPoolStats(&stats);
+    int reacquired = 0;
+    for (int i = 0; i < PHOTO_POOL_SLOTS; i++) {
+        reacquired += acquirePhotoSlot() != NULL;
+    }
+
+    bool counted = stats.acquired - before.acquired == stored &&
+                   stats.exhausted - before.exhausted == exhausted && stats.oversize == 1;
+    bool ok = counted && consumed == stored && !foreignSlots && !doubleOwned && !corrupted &&
+              stats.inUse == 0 && stats.highWater <= PHOTO_POOL_SLOTS && reacquired == PHOTO_POOL_SLOTS;
+
+    printf("%d capture, %d SD tasks at %u us per photo, %d s: %lu stored, %lu exhausted, %lu returned\n",
+           producers, consumers, slowUs, seconds, stored.load(), exhausted.load(), consumed.load());
+    printf("slots: %d x %u bytes, peak %d in use, %d in use after the run, %d/%d free again\n", stats.slots,
+           (unsigned)stats.slotSize, stats.highWater, stats.inUse, reacquired, PHOTO_POOL_SLOTS);
+    printf("errors: %lu foreign slots, %lu slots held twice, %lu photos corrupted, counters %s\n",
+           foreignSlots.load(), doubleOwned.load(), corrupted.load(), counted ? "match" : "DO NOT MATCH");
+    if (!exhausted) {
+        printf("warning: the pool never ran out, raise -s\n");
+    }
+    return ok ? 0 : 1;
+}
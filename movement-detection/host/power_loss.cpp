@@ -0,0 +1,366 @@
+// Cuts the power at every point of a run of the sketch's SD code: mounting the card, saving
+// bursts, marking photos sent and evicting the oldest. The card is a local directory (SD.h),
+// after each cut the card is mounted again as after a reboot and must hold every photo that
+// was saved before the cut, intact and with its sent flag, and no photo cut short.
+// New photos must then be saved under numbers that no file on the card has.
+// The first mount after an upgrade from the counters in Preferences is cut the same way:
+// photos after the last one they saw sent must come out unsent.
+
+#include <Arduino.h>
+#include <dirent.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "Preferences.h"
+#include "SD.h"
+#include "photo_index.h"
+#include "sd_storage.h"
+
+enum SentState { UNSENT, SENT, SENT_UNKNOWN };
+
+struct SavedPhoto {
+    std::vector<uint8_t> data;
+    SentState sent;
+};
+
+// What the sketch was told before the power went
+struct CardModel {
+    std::map<unsigned long, SavedPhoto> photos;     // Saved and not evicted
+    unsigned long nextId = 1;
+};
+
+struct CutResult {
+    bool ok = true;
+    int torn = 0;           // Photos cut short that were on the card after the cut
+    int missing = 0;        // Unsent photos in the index whose file is gone
+    bool rebuilt = false;
+};
+
+static bool verbose = false;
+
+// A JPEG-like photo: SOI, bytes that never form a marker, EOI
+static std::vector<uint8_t> makePhoto(unsigned long id, size_t size) {
+    std::vector<uint8_t> data(size);
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (id * 13 + i) % 251;
+    }
+    data[0] = 0xFF, data[1] = 0xD8;
+    data[size - 2] = 0xFF, data[size - 1] = 0xD9;
+    return data;
+}
+
+static bool readCardFile(unsigned long seq, std::vector<uint8_t>* data) {
+    char path[64];
+    photoPath(path, sizeof(path), seq);
+    size_t size;
+    uint8_t* buf = readPhotoFromSD(path, &size);
+    if (!buf) {
+        return false;
+    }
+    data->assign(buf, buf + size);
+    free(buf);
+    return true;
+}
+
+static bool isComplete(const std::vector<uint8_t>& data) {
+    size_t n = data.size();
+    return n >= 4 && data[0] == 0xFF && data[1] == 0xD8 && data[n - 2] == 0xFF && data[n - 1] == 0xD9;
+}
+
+static int removeEntry(const char* path, const struct stat* st, int flag, struct FTW* ftw) {
+    return remove(path);
+}
+
+static void eraseCard(const char* dir) {
+    nftw(dir, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+    mkdir(dir, 0755);
+}
+
+// Photo numbers of every photo file on the card, read around the sketch
+static std::set<unsigned long> photoFiles(const char* cardDir) {
+    std::set<unsigned long> seqs;
+    std::string dir = std::string(cardDir) + SD_PHOTO_DIR;
+    DIR* d = opendir(dir.c_str());
+    while (struct dirent* e = d ? readdir(d) : NULL) {
+        unsigned long seq;
+        if (sscanf(e->d_name, "photo_%lu.jpg", &seq) == 1) {
+            seqs.insert(seq);
+        }
+    }
+    if (d) {
+        closedir(d);
+    }
+    return seqs;
+}
+
+// The sketch's life on a new card until the power goes: rounds of bursts, sends and evictions.
+// The index is created with the power on, the cut comes after cut more card operations.
+// Returns the card operations of the rounds.
+static unsigned long runWorkload(const char* cardDir, int rounds, long cut, CardModel* model) {
+    eraseCard(cardDir);
+    hostSdRestorePower();
+    if (!initSDCard()) {
+        return 0;
+    }
+    unsigned long setupOps = hostSdOps();
+    hostSdCutPowerAfter(cut);
+    for (int r = 0; r < rounds && !hostSdPowerLost(); r++) {
+        int count = 1 + r % 3;
+        std::vector<std::vector<uint8_t>> burst;
+        uint8_t* photos[SD_BATCH_MAX_PHOTOS];
+        size_t sizes[SD_BATCH_MAX_PHOTOS];
+        for (int i = 0; i < count; i++) {
+            burst.push_back(makePhoto(model->nextId++, 600 + (r * 131 + i * 57) % 1500));
+            photos[i] = burst.back().data();
+            sizes[i] = burst.back().size();
+        }
+        unsigned long first = getNextPhotoNumber();
+        int saved = savePhotoBurst(photos, sizes, count);
+        for (int i = 0; i < saved; i++) {
+            model->photos[first + i] = { burst[i], UNSENT };
+        }
+
+        if (r % 2 == 1) {
+            String unsent[2];
+            int n = getUnsentPhotos(unsent, 2);
+            for (int i = 0; i < n; i++) {
+                unsigned long seq = strtoul(strrchr(unsent[i].c_str(), '_') + 1, NULL, 10);
+                auto photo = model->photos.find(seq);
+                if (photo == model->photos.end()) {
+                    continue;
+                }
+                if (markPhotoAsSent(unsent[i])) {
+                    photo->second.sent = SENT;
+                } else if (hostSdPowerLost()) {
+                    photo->second.sent = SENT_UNKNOWN;
+                }
+            }
+        }
+
+        if (r % 3 == 2) {
+            // Gone or not after a cut, the photo is no longer expected
+            model->photos.erase(getOldestPhotoNumber());
+            evictOldestPhoto();
+        }
+    }
+    return hostSdOps() - setupOps;
+}
+
+// Mount the card again after the cut and check it against what the sketch was told
+static CutResult checkAfterReboot(const char* cardDir, const CardModel& model) {
+    CutResult result;
+    std::vector<uint8_t> data;
+
+    std::set<unsigned long> before = photoFiles(cardDir);
+    hostSdRestorePower();
+    for (unsigned long seq : before) {
+        result.torn += readCardFile(seq, &data) && !isComplete(data);
+    }
+    if (!initSDCard()) {
+        printf("  card cannot be mounted again\n");
+        result.ok = false;
+        return result;
+    }
+
+    PhotoIndexStats stats;
+    getPhotoIndexStats(&stats);
+    result.rebuilt = stats.rebuilt;
+    String list[64];
+    std::set<unsigned long> unsent;
+    for (int i = 0, n = getUnsentPhotos(list, 64); i < n; i++) {
+        unsent.insert(strtoul(strrchr(list[i].c_str(), '_') + 1, NULL, 10));
+    }
+
+    for (const auto& entry : model.photos) {
+        unsigned long seq = entry.first;
+        const SavedPhoto& photo = entry.second;
+        if (!readCardFile(seq, &data) || data != photo.data) {
+            printf("  photo %lu saved before the cut is %s\n", seq, data.empty() ? "gone" : "changed");
+            result.ok = false;
+        } else if (seq < stats.oldest || seq > stats.newest) {
+            printf("  photo %lu saved before the cut is outside the index (%lu-%lu)\n", seq, stats.oldest,
+                   stats.newest);
+            result.ok = false;
+        } else if (photo.sent == SENT && unsent.count(seq)) {
+            printf("  photo %lu sent before the cut is unsent again\n", seq);
+            result.ok = false;
+        } else if (photo.sent == UNSENT && !unsent.count(seq)) {
+            printf("  photo %lu unsent before the cut will never be sent%s\n", seq,
+                   result.rebuilt ? " (index rebuilt)" : "");
+            result.ok = false;
+        }
+        data.clear();
+    }
+
+    // Nothing the index hands out may be cut short
+    for (unsigned long seq = stats.oldest; stats.oldest && seq <= stats.newest; seq++) {
+        if (readCardFile(seq, &data) && !isComplete(data)) {
+            printf("  photo %lu in the index is cut short (%zu bytes)\n", seq, data.size());
+            result.ok = false;
+        } else if (data.empty() && unsent.count(seq)) {
+            result.missing++;
+        }
+        data.clear();
+    }
+
+    // New photos go to numbers that no file has, and come back intact
+    std::set<unsigned long> files = photoFiles(cardDir);
+    unsigned long next = getNextPhotoNumber();
+    if (!files.empty() && next <= *files.rbegin()) {
+        printf("  next photo number %lu is not after photo_%06lu.jpg on the card\n", next, *files.rbegin());
+        result.ok = false;
+    }
+    std::vector<uint8_t> photo = makePhoto(0, 777);
+    uint8_t* photos[1] = { photo.data() };
+    size_t sizes[1] = { photo.size() };
+    if (savePhotoBurst(photos, sizes, 1) != 1 || !readCardFile(next, &data) || data != photo) {
+        printf("  photo saved after the reboot does not come back\n");
+        result.ok = false;
+    }
+    return result;
+}
+
+// A card written by the sketch before the index: photos 1 to count, the photo number and the
+// last sent photo in Preferences. The first mount is cut after cut card operations, ops
+// gets the operations it made.
+static bool checkUpgrade(const char* cardDir, unsigned long count, unsigned long lastSent, long cut,
+                         unsigned long* ops) {
+    eraseCard(cardDir);
+    mkdir((std::string(cardDir) + SD_PHOTO_DIR).c_str(), 0755);
+    for (unsigned long seq = 1; seq <= count; seq++) {
+        char path[64];
+        photoPath(path, sizeof(path), seq);
+        std::vector<uint8_t> photo = makePhoto(seq, 500 + seq * 37);
+        FILE* f = fopen((std::string(cardDir) + path).c_str(), "wb");
+        if (!f || fwrite(photo.data(), 1, photo.size(), f) != photo.size() || fclose(f) != 0) {
+            printf("  cannot write %s in %s\n", path, cardDir);
+            return false;
+        }
+    }
+    hostPreferencesErase();
+    Preferences prefs;
+    prefs.begin("motion-cam", false);
+    prefs.putULong("photoNum", count + 1);
+    prefs.putULong("lastSentNum", lastSent);
+    prefs.end();
+
+    hostSdRestorePower();
+    hostSdCutPowerAfter(cut);
+    initSDCard();
+    *ops = hostSdOps();
+    hostSdRestorePower();
+    if (!initSDCard()) {
+        printf("  card cannot be mounted again\n");
+        return false;
+    }
+
+    bool ok = true;
+    unsigned long seqs[64];
+    int n = getUnsentPhotoNumbers(seqs, 64);
+    if (n != (int)(count - lastSent) || (n && (seqs[0] != lastSent + 1 || seqs[n - 1] != count))) {
+        printf("  %d unsent photos from %lu, photos %lu-%lu were not sent\n", n, n ? seqs[0] : 0, lastSent + 1,
+               count);
+        ok = false;
+    }
+    if (getNextPhotoNumber() != count + 1) {
+        printf("  next photo number %lu, not %lu\n", getNextPhotoNumber(), count + 1);
+        ok = false;
+    }
+    prefs.begin("motion-cam", true);
+    if (prefs.isKey("photoNum") || prefs.isKey("lastSentNum")) {
+        printf("  the old counters are still in Preferences\n");
+        ok = false;
+    }
+    prefs.end();
+    return ok;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -r rounds    bursts saved per run (12)\n"
+            "  -d dir       directory standing in for the card (a new one in /tmp)\n"
+            "  -v           result of every cut, and the sketch's debug output\n",
+            prog);
+}
+
+int main(int argc, char** argv) {
+    int rounds = 12;
+    const char* cardDir = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:d:vh")) != -1) {
+        switch (opt) {
+            case 'r':
+                rounds = atoi(optarg);
+                break;
+            case 'd':
+                cardDir = optarg;
+                break;
+            case 'v':
+                verbose = true;
+                host_serial_enabled = true;
+                break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+    if (rounds < 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    char tmpDir[] = "/tmp/power_loss.XXXXXX";
+    if (!cardDir && !(cardDir = mkdtemp(tmpDir))) {
+        perror("mkdtemp");
+        return 1;
+    }
+    hostSdMount(cardDir);
+
+    // A run without a cut gives the number of places to cut
+    CardModel model;
+    unsigned long ops = runWorkload(cardDir, rounds, -1, &model);
+
+    int failed = 0, torn = 0, missing = 0, rebuilt = 0;
+    for (unsigned long cut = 0; cut < ops; cut++) {
+        CardModel model;
+        runWorkload(cardDir, rounds, cut, &model);
+
+        CutResult result = checkAfterReboot(cardDir, model);
+        failed += !result.ok;
+        torn += result.torn;
+        missing += result.missing;
+        rebuilt += result.rebuilt;
+        if (verbose || !result.ok) {
+            printf("cut after %3lu of %lu operations: %zu photos saved, %d cut short, %s%s\n", cut, ops,
+                   model.photos.size(), result.torn, result.rebuilt ? "index rebuilt, " : "",
+                   result.ok ? "ok" : "FAILED");
+        }
+    }
+
+    // Upgrade from the counters, with the power on and then cut at every point of the first mount
+    const unsigned long upgradePhotos = 9, upgradeSent = 5;
+    unsigned long upgradeOps = 0, cutOps;
+    int upgradeFailed = !checkUpgrade(cardDir, upgradePhotos, upgradeSent, -1, &upgradeOps);
+    for (unsigned long cut = 0; cut < upgradeOps; cut++) {
+        bool ok = checkUpgrade(cardDir, upgradePhotos, upgradeSent, cut, &cutOps);
+        upgradeFailed += !ok;
+        if (verbose || !ok) {
+            printf("upgrade, cut after %3lu of %lu operations: %s\n", cut, upgradeOps, ok ? "ok" : "FAILED");
+        }
+    }
+    failed += upgradeFailed;
+
+    if (cardDir == tmpDir) {
+        nftw(cardDir, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+    }
+    printf("%d bursts, power cut at %lu points: %d photos cut short on the card, %d index rebuilds, "
+           "%d unsent photos evicted; upgrade from the Preferences counters cut at %lu points; %d failed\n",
+           rounds, ops, torn, rebuilt, missing, upgradeOps, failed);
+    return failed ? 1 : 0;
+}
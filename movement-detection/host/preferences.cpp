@@ -0,0 +1,56 @@
+// NVS stand-in for the host tests: one map for every namespace, keys are "namespace/key"
+
+#include <map>
+#include "Preferences.h"
+
+static std::map<std::string, uint32_t> values;
+
+void hostPreferencesErase() {
+    values.clear();
+}
+
+bool Preferences::begin(const char* name, bool readOnly, const char* partitionLabel) {
+    if (open_ || !name) {
+        return false;
+    }
+    name_ = name;
+    readOnly_ = readOnly;
+    open_ = true;
+    return true;
+}
+
+void Preferences::end() {
+    open_ = false;
+}
+
+bool Preferences::clear() {
+    if (!open_ || readOnly_) {
+        return false;
+    }
+    std::string prefix = name_ + "/";
+    for (auto it = values.lower_bound(prefix); it != values.end() && it->first.compare(0, prefix.size(), prefix) == 0; ) {
+        it = values.erase(it);
+    }
+    return true;
+}
+
+bool Preferences::remove(const char* name) {
+    return open_ && !readOnly_ && values.erase(key(name)) == 1;
+}
+
+bool Preferences::isKey(const char* name) {
+    return open_ && values.count(key(name));
+}
+
+size_t Preferences::putULong(const char* name, uint32_t value) {
+    if (!open_ || readOnly_) {
+        return 0;
+    }
+    values[key(name)] = value;
+    return sizeof(value);
+}
+
+uint32_t Preferences::getULong(const char* name, uint32_t defaultValue) {
+    auto it = open_ ? values.find(key(name)) : values.end();
+    return it != values.end() ? it->second : defaultValue;
+}
@@ -0,0 +1,275 @@
+// SD card stand-in for the host tests: the card is a directory, operations that change it
+// are counted so a test can cut the power between any two of them
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include "SD.h"
+#include "SPI.h"
+
+SDFS SD;
+SPIClass SPI;
+
+static std::string mountDir;
+static long opsBeforeCut = -1;
+static bool powerLost = false;
+static unsigned long opsDone = 0;
+
+enum PowerResult { POWER_ON, POWER_CUT, POWER_OFF };
+
+// Accounts for one operation that changes the card. POWER_CUT: the power goes while it
+// runs, it is done halfway. POWER_OFF: it is not done at all.
+static PowerResult spendOp() {
+    if (powerLost) {
+        return POWER_OFF;
+    }
+    if (opsBeforeCut == 0) {
+        powerLost = true;
+        return POWER_CUT;
+    }
+    if (opsBeforeCut > 0) {
+        opsBeforeCut--;
+    }
+    opsDone++;
+    return POWER_ON;
+}
+
+void hostSdMount(const char* dir) {
+    mountDir = dir ? dir : "";
+}
+
+void hostSdCutPowerAfter(long ops) {
+    opsBeforeCut = ops;
+}
+
+bool hostSdPowerLost() {
+    return powerLost;
+}
+
+void hostSdRestorePower() {
+    powerLost = false;
+    opsBeforeCut = -1;
+    opsDone = 0;
+}
+
+unsigned long hostSdOps() {
+    return opsDone;
+}
+
+static std::string hostPath(const char* path) {
+    return mountDir + (path[0] == '/' ? "" : "/") + path;
+}
+
+namespace fs {
+
+struct FileImpl {
+    int fd = -1;
+    DIR* dir = NULL;
+    std::string path;       // Path on the card
+    std::string name;
+
+    ~FileImpl() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        if (dir) {
+            closedir(dir);
+        }
+    }
+};
+
+static std::shared_ptr<FileImpl> openImpl(const char* path, const char* mode) {
+    std::string host = hostPath(path);
+    struct stat st;
+    bool isDir = stat(host.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+
+    std::shared_ptr<FileImpl> impl = std::make_shared<FileImpl>();
+    impl->path = path;
+    const char* slash = strrchr(path, '/');
+    impl->name = slash ? slash + 1 : path;
+
+    if (isDir) {
+        impl->dir = opendir(host.c_str());
+        return impl->dir ? impl : nullptr;
+    }
+
+    int flags;
+    if (strcmp(mode, "r") == 0) {
+        flags = O_RDONLY;
+    } else if (strcmp(mode, "r+") == 0) {
+        flags = O_RDWR;
+    } else if (strcmp(mode, "w") == 0 || strcmp(mode, "w+") == 0) {
+        flags = O_RDWR | O_CREAT | O_TRUNC;
+    } else if (strcmp(mode, "a") == 0 || strcmp(mode, "a+") == 0) {
+        flags = O_RDWR | O_CREAT | O_APPEND;
+    } else {
+        return nullptr;
+    }
+
+    if (flags & O_CREAT) {
+        PowerResult power = spendOp();
+        if (power == POWER_OFF) {
+            return nullptr;
+        }
+        impl->fd = ::open(host.c_str(), flags, 0644);
+        // Cut while the directory entry was written: the file is there, empty
+        return power == POWER_ON && impl->fd >= 0 ? impl : nullptr;
+    }
+    if (powerLost) {
+        return nullptr;
+    }
+    impl->fd = ::open(host.c_str(), flags);
+    return impl->fd >= 0 ? impl : nullptr;
+}
+
+File::operator bool() const {
+    return impl_ && (impl_->fd >= 0 || impl_->dir);
+}
+
+size_t File::write(const uint8_t* buf, size_t size) {
+    if (!impl_ || impl_->fd < 0 || !size) {
+        return 0;
+    }
+    PowerResult power = spendOp();
+    if (power == POWER_OFF) {
+        return 0;
+    }
+    if (power == POWER_CUT) {
+        size /= 2;
+    }
+    ssize_t n = ::write(impl_->fd, buf, size);
+    return n > 0 && power == POWER_ON ? n : 0;
+}
+
+size_t File::print(const char* s) {
+    return write((const uint8_t*)s, strlen(s));
+}
+
+int File::read() {
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+}
+
+size_t File::read(uint8_t* buf, size_t size) {
+    if (!impl_ || impl_->fd < 0 || powerLost) {
+        return 0;
+    }
+    ssize_t n = ::read(impl_->fd, buf, size);
+    return n > 0 ? n : 0;
+}
+
+int File::available() {
+    return impl_ && impl_->fd >= 0 ? size() - position() : 0;
+}
+
+bool File::seek(uint32_t pos) {
+    return impl_ && impl_->fd >= 0 && !powerLost && lseek(impl_->fd, pos, SEEK_SET) == (off_t)pos;
+}
+
+size_t File::position() const {
+    return impl_ && impl_->fd >= 0 ? lseek(impl_->fd, 0, SEEK_CUR) : 0;
+}
+
+size_t File::size() const {
+    struct stat st;
+    return impl_ && impl_->fd >= 0 && fstat(impl_->fd, &st) == 0 ? st.st_size : 0;
+}
+
+void File::close() {
+    impl_.reset();
+}
+
+const char* File::name() const {
+    return impl_ ? impl_->name.c_str() : "";
+}
+
+const char* File::path() const {
+    return impl_ ? impl_->path.c_str() : "";
+}
+
+bool File::isDirectory() const {
+    return impl_ && impl_->dir;
+}
+
+File File::openNextFile(const char* mode) {
+    if (!impl_ || !impl_->dir || powerLost) {
+        return File();
+    }
+    while (struct dirent* e = readdir(impl_->dir)) {
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) {
+            continue;
+        }
+        std::string path = impl_->path + "/" + e->d_name;
+        return File(openImpl(path.c_str(), mode));
+    }
+    return File();
+}
+
+void File::rewindDirectory() {
+    if (impl_ && impl_->dir) {
+        rewinddir(impl_->dir);
+    }
+}
+
+File FS::open(const char* path, const char* mode, bool create) {
+    return File(openImpl(path, mode));
+}
+
+bool FS::exists(const char* path) {
+    struct stat st;
+    return !powerLost && stat(hostPath(path).c_str(), &st) == 0;
+}
+
+bool FS::remove(const char* path) {
+    return spendOp() == POWER_ON && unlink(hostPath(path).c_str()) == 0;
+}
+
+bool FS::mkdir(const char* path) {
+    return spendOp() == POWER_ON && ::mkdir(hostPath(path).c_str(), 0755) == 0;
+}
+
+bool FS::rmdir(const char* path) {
+    return spendOp() == POWER_ON && ::rmdir(hostPath(path).c_str()) == 0;
+}
+
+}  // namespace fs
+
+bool SDFS::begin(uint8_t ssPin) {
+    struct stat st;
+    return !mountDir.empty() && !powerLost && stat(mountDir.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+sdcard_type_t SDFS::cardType() {
+    return mountDir.empty() ? CARD_NONE : CARD_SDHC;
+}
+
+uint64_t SDFS::cardSize() {
+    return 4ULL << 30;
+}
+
+static uint64_t directoryBytes(const std::string& dir) {
+    uint64_t bytes = 0;
+    DIR* d = opendir(dir.c_str());
+    if (!d) {
+        return 0;
+    }
+    while (struct dirent* e = readdir(d)) {
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) {
+            continue;
+        }
+        std::string path = dir + "/" + e->d_name;
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0) {
+            bytes += S_ISDIR(st.st_mode) ? directoryBytes(path) : st.st_size;
+        }
+    }
+    closedir(d);
+    return bytes;
+}
+
+uint64_t SDFS::usedBytes() {
+    return directoryBytes(mountDir);
+}
@@ -0,0 +1,184 @@
+// Feeds scripted server responses to telegramSessionReadResponse(): bodies framed by
+// Content-Length, chunked and ended by the server closing the connection, bodies larger than
+// what is kept, and responses cut short or stalled. A response the connection is kept for must
+// be read to its last byte: a second one sent right behind it on the same connection must come
+// out as its own. Every case runs with the response arriving whole and in small pieces.
+
+#include <Arduino.h>
+#include <getopt.h>
+#include <string>
+#include "WiFiClientSecure.h"
+#include "telegram_session.h"
+
+#define RESPONSE_TIMEOUT_MS     50
+
+enum After { KEPT_OPEN, CLOSED, FAILED };
+
+struct ResponseCase {
+    const char* name;
+    std::string response;
+    bool serverCloses;      // The server closes its side after the response
+    int code;               // Status telegramSessionReadResponse() must return
+    std::string body;
+    After after;
+};
+
+// Sent behind every response the connection must be kept for
+static const char followUp[] = "HTTP/1.1 204 No Content\r\nContent-Length: 0\r\n\r\n";
+
+static const std::string json = "{\"ok\":true,\"result\":1}";
+static const std::string longBody(3000, 'x');
+
+static const ResponseCase cases[] = {
+    { "content-length",
+      "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: 22\r\n\r\n" + json,
+      false, 200, json, KEPT_OPEN },
+    { "content-length, lower case",
+      "HTTP/1.1 200 OK\r\ncontent-length: 22\r\nconnection: keep-alive\r\n\r\n" + json,
+      false, 200, json, KEPT_OPEN },
+    { "content-length, connection close",
+      "HTTP/1.1 200 OK\r\nConnection: close\r\nContent-Length: 22\r\n\r\n" + json,
+      true, 200, json, CLOSED },
+    { "content-length, HTTP/1.0",
+      "HTTP/1.0 200 OK\r\nContent-Length: 22\r\n\r\n" + json,
+      true, 200, json, CLOSED },
+    { "empty body",
+      "HTTP/1.1 204 No Content\r\nContent-Length: 0\r\n\r\n",
+      false, 204, "", KEPT_OPEN },
+    { "body longer than kept",
+      "HTTP/1.1 413 Request Entity Too Large\r\nContent-Length: 3000\r\n\r\n" + longBody,
+      false, 413, longBody.substr(0, TELEGRAM_MAX_RESPONSE_BODY), KEPT_OPEN },
+    { "header longer than a line",
+      "HTTP/1.1 200 OK\r\nSet-Cookie: " + std::string(400, 'c') + "\r\nContent-Length: 22\r\n\r\n" + json,
+      false, 200, json, KEPT_OPEN },
+    { "chunked",
+      "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+      "7\r\n{\"ok\":t\r\nA\r\nrue,\"resul\r\n5\r\nt\":1}\r\n0\r\n\r\n",
+      false, 200, json, KEPT_OPEN },
+    { "chunked, extensions and trailer",
+      "HTTP/1.1 429 Too Many Requests\r\ntransfer-encoding: Chunked\r\n\r\n"
+      "7;a=b\r\n{\"ok\":t\r\na\r\nrue,\"resul\r\n5\r\nt\":1}\r\n0\r\nX-Trailer: 1\r\n\r\n",
+      false, 429, json, KEPT_OPEN },
+    { "chunked, longer than kept",
+      "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+      "bb8\r\n" + longBody + "\r\n0\r\n\r\n",
+      false, 200, longBody.substr(0, TELEGRAM_MAX_RESPONSE_BODY), KEPT_OPEN },
+    { "until close",
+      "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n\r\n" + json,
+      true, 200, json, CLOSED },
+    { "until close, longer than kept",
+      "HTTP/1.0 502 Bad Gateway\r\n\r\n" + longBody,
+      true, 502, longBody.substr(0, TELEGRAM_MAX_RESPONSE_BODY), CLOSED },
+    { "content-length, cut short",
+      "HTTP/1.1 200 OK\r\nContent-Length: 50\r\n\r\n" + json,
+      true, 0, "", FAILED },
+    { "content-length, stalled",
+      "HTTP/1.1 200 OK\r\nContent-Length: 50\r\n\r\n" + json,
+      false, 0, "", FAILED },
+    { "chunked, cut short",
+      "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n10\r\n{\"ok\"",
+      true, 0, "", FAILED },
+    { "chunked, no last chunk",
+      "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n7\r\n{\"ok\":t\r\n",
+      true, 0, "", FAILED },
+    { "headers cut short",
+      "HTTP/1.1 200 OK\r\nContent-Len",
+      true, 0, "", FAILED },
+    { "not HTTP",
+      "SSH-2.0-OpenSSH_9.6\r\n\r\n",
+      true, 0, "", FAILED },
+};
+
+// Runs one case on a fresh connection, true when the parser did what it must
+static bool runCase(const ResponseCase& c, size_t fragment, bool verbose) {
+    TelegramSessionStats before, after;
+    getTelegramSessionStats(&before);
+
+    hostTlsFragment(fragment);
+    WiFiClientSecure* client = telegramSessionBegin();
+    if (!client) {
+        printf("  %s: no connection\n", c.name);
+        return false;
+    }
+    client->print("POST /bot/sendMessage HTTP/1.1\r\n\r\n");
+    hostTlsServerSend(c.response.data(), c.response.size());
+    if (c.after == KEPT_OPEN) {
+        hostTlsServerSend(followUp);
+    }
+    if (c.serverCloses) {
+        hostTlsServerClose();
+    }
+
+    String body;
+    unsigned long start = millis();
+    int code = telegramSessionReadResponse(&body, RESPONSE_TIMEOUT_MS);
+    unsigned long elapsed = millis() - start;
+    getTelegramSessionStats(&after);
+
+    bool ok = code == c.code && (c.after == FAILED || body == String(c.body));
+    if (c.after == FAILED) {
+        ok &= after.failures == before.failures + 1 && elapsed <= RESPONSE_TIMEOUT_MS + 100;
+    } else {
+        ok &= after.requests == before.requests + 1;
+    }
+
+    // Whatever is left on a kept connection must be exactly the next response
+    unsigned long connects = hostTlsConnects();
+    client = telegramSessionBegin();
+    bool reused = client && hostTlsConnects() == connects;
+    if (c.after == KEPT_OPEN) {
+        String next;
+        ok &= reused && telegramSessionReadResponse(&next, RESPONSE_TIMEOUT_MS) == 204 && next.isEmpty();
+    } else {
+        ok &= !reused;
+    }
+    telegramSessionClose();
+    // The next case starts without the reconnect backoff of a failure
+    hostAdvanceTime(TELEGRAM_BACKOFF_MAX_MS * 2);
+
+    if (verbose || !ok) {
+        printf("  %-34s fragment %4zu: status %3d, %4u body bytes, connection %s%s\n", c.name, fragment, code,
+               body.length(), reused ? "kept" : "closed", ok ? "" : "  FAILED");
+    }
+    return ok;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -v           result of every case, and the sketch's debug output\n",
+            prog);
+}
+
+int main(int argc, char** argv) {
+    bool verbose = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "vh")) != -1) {
+        switch (opt) {
+            case 'v':
+                verbose = true;
+                host_serial_enabled = true;
+                break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+
+    // Whole responses, TLS record sized pieces, and byte by byte
+    static const size_t fragments[] = { 0, 1371, 7, 1 };
+    int failed = 0;
+    for (size_t fragment : fragments) {
+        for (const ResponseCase& c : cases) {
+            failed += !runCase(c, fragment, verbose);
+        }
+    }
+
+    TelegramSessionStats stats;
+    getTelegramSessionStats(&stats);
+    printf("%zu responses in %zu deliveries: %d failed (%lu connects, %lu reuses, %lu requests, %lu failures)\n",
+           sizeof(cases) / sizeof(cases[0]), sizeof(fragments) / sizeof(fragments[0]), failed, stats.connects,
+           stats.reuses, stats.requests, stats.failures);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,411 @@
+// Sends media groups with sendPhotosBatch() to a stand-in Telegram server on the stand-in
+// TLS client: a handshake takes seconds, the server checks every request and answers it.
+// The server keeps the connection for several media groups, closes it after a response
+// with Connection: close, or closes a kept connection while it is idle, so the client only
+// finds out with the next request. Connects that fail must back off, doubling up to the
+// limit, and a kept connection found closed must get the request again at once on a new
+// one. Prints the time each media group took on a new and on a kept connection.
+
+#include <Arduino.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "SD.h"
+#include "WiFiClientSecure.h"
+#include "photo_index.h"
+#include "sd_storage.h"
+#include "telegram.h"
+#include "telegram_session.h"
+
+#define HANDSHAKE_MS    1500    // TLS handshake with the server
+#define RESPONSE_MS     200     // Server time for a media group
+#define PHOTO_COUNT     24
+
+// How the server treats the requests of a scenario
+struct ServerScript {
+    int closeEvery = 0;             // Connection: close on every n-th response of a connection
+    std::set<int> drop;             // Requests (from 1) it takes and closes the connection on, unanswered
+};
+
+struct ServedRequest {
+    unsigned long connection;
+    int onConnection;               // Requests on that connection so far, this one included
+    int photos;
+    size_t bytes;
+    bool valid;
+    bool answered;
+};
+
+struct BatchResult {
+    bool sent;
+    bool kept;                      // Sent on the connection of the previous one
+    int photos;
+    unsigned long ms;
+};
+
+static bool verbose = false;
+static ServerScript script;
+static std::vector<ServedRequest> served;
+static std::map<unsigned long, int> connectionRequests;
+// Time a media group took on a new and on a kept connection, over all scenarios
+static unsigned long newMs = 0, newCount = 0, keptMs = 0, keptCount = 0;
+
+static size_t countOf(const std::string& s, const std::string& what) {
+    size_t n = 0;
+    for (size_t pos = s.find(what); pos != std::string::npos; pos = s.find(what, pos + 1)) {
+        n++;
+    }
+    return n;
+}
+
+// The request is a sendMediaGroup with its declared length, a photo part for every media
+// entry and a complete JPEG in each
+static bool validRequest(const std::string& request, int* photos) {
+    static const std::string start = "POST /bot" + std::string(TELEGRAM_BOT_TOKEN) + "/sendMediaGroup HTTP/1.1\r\n";
+    size_t body = request.find("\r\n\r\n");
+    size_t length = request.find("Content-Length: ");
+    size_t type = request.find("boundary=");
+    if (request.compare(0, start.size(), start) != 0 || body == std::string::npos || length > body || type > body ||
+        strtoul(request.c_str() + length + 16, NULL, 10) != request.size() - body - 4) {
+        return false;
+    }
+    std::string boundary = "--" + request.substr(type + 9, request.find("\r\n", type) - type - 9);
+    if (request.compare(request.size() - boundary.size() - 4, boundary.size() + 4, boundary + "--\r\n") != 0) {
+        return false;
+    }
+
+    *photos = countOf(request, "filename=\"photo.jpg\"");
+    if (*photos != (int)countOf(request, "attach://photo")) {
+        return false;
+    }
+    static const std::string partHead = "Content-Type: image/jpeg\r\n\r\n";
+    for (size_t pos = request.find(partHead); pos != std::string::npos; pos = request.find(partHead, pos + 1)) {
+        size_t data = pos + partHead.size();
+        size_t end = request.find("\r\n" + boundary, data);
+        if (end == std::string::npos || end - data < 4 || (uint8_t)request[data] != 0xFF ||
+            (uint8_t)request[data + 1] != 0xD8 || (uint8_t)request[end - 2] != 0xFF ||
+            (uint8_t)request[end - 1] != 0xD9) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void serve(const std::string& request, unsigned long connection) {
+    ServedRequest r = { connection, ++connectionRequests[connection], 0, request.size(), false, false };
+    r.valid = validRequest(request, &r.photos);
+    if (script.drop.count(served.size() + 1)) {
+        served.push_back(r);
+        hostTlsServerClose();
+        return;
+    }
+
+    hostAdvanceTime(RESPONSE_MS);
+    bool close = script.closeEvery && r.onConnection % script.closeEvery == 0;
+    const char* body = r.valid ? "{\"ok\":true,\"result\":[]}" : "{\"ok\":false,\"error_code\":400}";
+    char head[160];
+    snprintf(head, sizeof(head), "HTTP/1.1 %s\r\nContent-Type: application/json\r\nContent-Length: %zu\r\n%s\r\n",
+             r.valid ? "200 OK" : "400 Bad Request", strlen(body), close ? "Connection: close\r\n" : "");
+    hostTlsServerSend(head);
+    hostTlsServerSend(body);
+    if (close) {
+        hostTlsServerClose();
+    }
+    r.answered = true;
+    served.push_back(r);
+}
+
+// A JPEG-like photo: SOI, bytes that never form a marker, EOI
+static std::vector<uint8_t> makePhoto(unsigned long id, size_t size) {
+    std::vector<uint8_t> data(size);
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (id * 7 + i) % 251;
+    }
+    data[0] = 0xFF, data[1] = 0xD8;
+    data[size - 2] = 0xFF, data[size - 1] = 0xD9;
+    return data;
+}
+
+// The oldest count unsent photos as one media group. They stay unsent, every scenario has photos.
+static BatchResult sendBatch(int count, bool quiet = false) {
+    String files[TELEGRAM_MAX_BATCH_SIZE];
+    int n = getUnsentPhotos(files, count);
+    unsigned long connects = hostTlsConnects();
+    unsigned long start = millis();
+
+    BatchResult result;
+    result.sent = sendPhotosBatch(files, n);
+    result.ms = millis() - start;
+    result.kept = hostTlsConnects() == connects;
+    result.photos = n;
+    if (result.sent) {
+        (result.kept ? keptMs : newMs) += result.ms;
+        (result.kept ? keptCount : newCount)++;
+    }
+    if (verbose && !quiet) {
+        printf("    %2d photos: %s, %5lu ms\n", n,
+               !result.sent ? "not sent" : result.kept ? "sent on the kept connection" : "sent on a new connection",
+               result.ms);
+    }
+    return result;
+}
+
+// A new scenario: no connection, no backoff, nothing served
+static void beginScenario(const char* name, const ServerScript& s) {
+    telegramSessionClose();
+    hostAdvanceTime(TELEGRAM_BACKOFF_MAX_MS * 2);
+    script = s;
+    served.clear();
+    connectionRequests.clear();
+    if (verbose) {
+        printf("  %s\n", name);
+    }
+}
+
+static bool check(bool ok, const char* scenario, const char* what) {
+    if (!ok) {
+        printf("  %s: %s\n", scenario, what);
+    }
+    return ok;
+}
+
+// Several media groups of every size on one connection
+static bool keepAlive() {
+    const char* name = "keep-alive";
+    beginScenario(name, ServerScript());
+    TelegramSessionStats before, after;
+    getTelegramSessionStats(&before);
+
+    bool ok = true;
+    for (int count = 1; count <= TELEGRAM_MAX_BATCH_SIZE; count++) {
+        BatchResult r = sendBatch(count);
+        ok &= check(r.sent, name, "a media group was not sent");
+        ok &= check(r.kept == (count > 1), name, "a media group did not go on the kept connection");
+        ok &= check(!r.kept || r.ms < HANDSHAKE_MS, name, "a media group on the kept connection took a handshake");
+    }
+    getTelegramSessionStats(&after);
+    ok &= check(after.connects == before.connects + 1, name, "more than one connection");
+    ok &= check(served.size() == TELEGRAM_MAX_BATCH_SIZE && served.back().onConnection == TELEGRAM_MAX_BATCH_SIZE,
+                name, "requests missing on the connection");
+    for (const ServedRequest& r : served) {
+        ok &= check(r.valid, name, "the server got a broken request");
+    }
+    return ok;
+}
+
+// The server ends every second response with Connection: close
+static bool connectionClose() {
+    const char* name = "connection close";
+    ServerScript s;
+    s.closeEvery = 2;
+    beginScenario(name, s);
+    TelegramSessionStats before, after;
+    getTelegramSessionStats(&before);
+
+    bool ok = true;
+    for (int i = 0; i < 6; i++) {
+        BatchResult r = sendBatch(3);
+        ok &= check(r.sent, name, "a media group was not sent");
+        ok &= check(r.kept == (i % 2 == 1), name, "a closed connection was used, or a kept one not");
+    }
+    getTelegramSessionStats(&after);
+    ok &= check(after.connects == before.connects + 3, name, "not one connection per two media groups");
+    ok &= check(after.failures == before.failures && after.staleRetries == before.staleRetries, name,
+                "a close the server announced counted as a failure");
+    return ok;
+}
+
+// A connection idle for longer than the client keeps it is not used again
+static bool idleTimeout() {
+    const char* name = "idle timeout";
+    beginScenario(name, ServerScript());
+
+    bool ok = check(sendBatch(2).sent, name, "a media group was not sent");
+    hostAdvanceTime(TELEGRAM_IDLE_TIMEOUT_MS + 1000);
+    BatchResult r = sendBatch(2);
+    ok &= check(r.sent && !r.kept, name, "the idle connection was used again");
+    return ok;
+}
+
+// The server closed the kept connection while it was idle: the media group goes again on a
+// new connection, without a failure or a backoff
+static bool staleConnection() {
+    const char* name = "stale kept connection";
+    ServerScript s;
+    s.drop = { 3 };
+    beginScenario(name, s);
+    TelegramSessionStats before, after;
+    getTelegramSessionStats(&before);
+
+    bool ok = true;
+    for (int i = 0; i < 4; i++) {
+        ok &= check(sendBatch(4).sent, name, "a media group was not sent");
+    }
+    getTelegramSessionStats(&after);
+    ok &= check(after.staleRetries == before.staleRetries + 1, name, "the stale connection was not retried once");
+    ok &= check(after.failures == before.failures && after.backoffMs == 0, name, "the stale connection backed off");
+    ok &= check(after.connects == before.connects + 2, name, "not one new connection for the retry");
+    ok &= check(served.size() == 5 && served[3].connection != served[2].connection &&
+                served[3].onConnection == 1 && served[3].photos == served[2].photos,
+                name, "the media group was not sent again on the new connection");
+    return ok;
+}
+
+// The new connection fails as well: no second retry, the client backs off
+static bool staleThenFailed() {
+    const char* name = "stale, then failed";
+    ServerScript s;
+    s.drop = { 2, 3 };
+    beginScenario(name, s);
+    TelegramSessionStats before, after;
+    getTelegramSessionStats(&before);
+
+    bool ok = check(sendBatch(2).sent, name, "a media group was not sent");
+    ok &= check(!sendBatch(2).sent, name, "a media group the server never answered counts as sent");
+    getTelegramSessionStats(&after);
+    ok &= check(served.size() == 3, name, "the media group was not sent exactly twice");
+    ok &= check(after.failures == before.failures + 1 && after.backoffMs == TELEGRAM_BACKOFF_MIN_MS, name,
+                "no backoff after the failed retry");
+
+    unsigned long connects = hostTlsConnects();
+    ok &= check(!sendBatch(2).sent && hostTlsConnects() == connects && served.size() == 3, name,
+                "connected while backing off");
+    hostAdvanceTime(TELEGRAM_BACKOFF_MIN_MS * 5 / 4 + 1);
+    ok &= check(sendBatch(2).sent, name, "no connection after the backoff");
+    getTelegramSessionStats(&after);
+    ok &= check(after.backoffMs == 0, name, "the backoff stayed after a success");
+    return ok;
+}
+
+// Connects fail: every retry waits twice as long as the one before, plus up to a quarter
+static bool backoff() {
+    const char* name = "backoff";
+    const int refused = 5;
+    const unsigned long step = 100;
+    beginScenario(name, ServerScript());
+    hostTlsRefuseConnects(refused);
+    TelegramSessionStats stats;
+    getTelegramSessionStats(&stats);
+
+    bool ok = true;
+    unsigned long failures = stats.failures, expected = TELEGRAM_BACKOFF_MIN_MS, failedAt = 0;
+    for (int attempts = 0; attempts <= refused; hostAdvanceTime(step)) {
+        unsigned long start = millis();
+        bool sent = sendBatch(1, true).sent;
+        getTelegramSessionStats(&stats);
+        if (!sent && stats.failures == failures) {
+            continue;   // Backing off, nothing was tried
+        }
+        if (attempts) {
+            unsigned long wait = start - failedAt;
+            if (verbose) {
+                printf("    connect %s %lu ms after the failure, backoff %lu ms\n", sent ? "taken" : "refused", wait,
+                       expected / 2);
+            }
+            ok &= check(wait >= expected / 2 && wait <= expected / 2 * 5 / 4 + step + 50, name,
+                        "a connect outside its backoff");
+        }
+        attempts++;
+        failedAt = millis();
+        failures = stats.failures;
+        if (attempts <= refused) {
+            ok &= check(!sent && stats.backoffMs == min(expected, (unsigned long)TELEGRAM_BACKOFF_MAX_MS), name,
+                        "the backoff did not double");
+            expected *= 2;
+        } else {
+            ok &= check(sent && stats.backoffMs == 0, name, "no connection once the server took it");
+        }
+    }
+    return ok;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -d dir       directory standing in for the card (a new one in /tmp)\n"
+            "  -v           every media group with its time, and the sketch's debug output\n",
+            prog);
+}
+
+int main(int argc, char** argv) {
+    const char* cardDir = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:vh")) != -1) {
+        switch (opt) {
+            case 'd':
+                cardDir = optarg;
+                break;
+            case 'v':
+                verbose = true;
+                host_serial_enabled = true;
+                break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+
+    char tmpDir[] = "/tmp/telegram_server.XXXXXX";
+    if (!cardDir && !(cardDir = mkdtemp(tmpDir))) {
+        perror("mkdtemp");
+        return 1;
+    }
+    hostSdMount(cardDir);
+    if (!initSDCard()) {
+        fprintf(stderr, "cannot mount %s\n", cardDir);
+        return 1;
+    }
+    unsigned long first = getNextPhotoNumber();
+    for (int saved = 0; saved < PHOTO_COUNT; saved += SD_BATCH_MAX_PHOTOS) {
+        std::vector<std::vector<uint8_t>> burst;
+        uint8_t* photos[SD_BATCH_MAX_PHOTOS];
+        size_t sizes[SD_BATCH_MAX_PHOTOS];
+        int count = min(SD_BATCH_MAX_PHOTOS, PHOTO_COUNT - saved);
+        for (int i = 0; i < count; i++) {
+            burst.push_back(makePhoto(saved + i, 1500 + (saved + i) * 397 % 9000));
+            photos[i] = burst.back().data();
+            sizes[i] = burst.back().size();
+        }
+        if (savePhotoBurst(photos, sizes, count) != count) {
+            fprintf(stderr, "cannot save photos in %s\n", cardDir);
+            return 1;
+        }
+    }
+
+    hostTlsHandshakeMs(HANDSHAKE_MS);
+    hostTlsServe(serve);
+    bool (*const scenarios[])() = { keepAlive, connectionClose, idleTimeout, staleConnection, staleThenFailed,
+                                    backoff };
+    int failed = 0;
+    for (auto scenario : scenarios) {
+        failed += !scenario();
+    }
+    hostTlsServe(NULL);
+    hostTlsHandshakeMs(0);
+    telegramSessionClose();
+
+    if (cardDir == tmpDir) {
+        for (int i = 0; i < PHOTO_COUNT; i++) {
+            char path[64];
+            photoPath(path, sizeof(path), first + i);
+            SD.remove(path);
+        }
+        char path[64];
+        snprintf(path, sizeof(path), "%s/%s", SD_PHOTO_DIR, PHOTO_INDEX_FILE);
+        SD.remove(path);
+        SD.rmdir(SD_PHOTO_DIR);
+        rmdir(cardDir);
+    }
+    TelegramSessionStats stats;
+    getTelegramSessionStats(&stats);
+    printf("%zu scenarios, %lu media groups on %lu connections: %lu ms on a new connection, %lu ms on a kept one; "
+           "%lu stale retries, %lu failures; %d failed\n",
+           sizeof(scenarios) / sizeof(scenarios[0]), newCount + keptCount, stats.connects,
+           newCount ? newMs / newCount : 0, keptCount ? keptMs / keptCount : 0, stats.staleRetries, stats.failures,
+           failed);
+    return failed ? 1 : 0;
+}
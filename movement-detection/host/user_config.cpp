@@ -0,0 +1,28 @@
+// The settings of user_config.ino.example, for the host tests. Debug output is on, Serial
+// only prints it when a test sets host_serial_enabled.
+#include <Arduino.h>
+#include "esp_camera.h"
+#include "config.h"
+
+const char* WIFI_SSID = "YOUR_WIFI_SSID";
+const char* WIFI_PASSWORD = "YOUR_WIFI_PASSWORD";
+const char* TELEGRAM_BOT_TOKEN = "YOUR_BOT_TOKEN";
+const char* TELEGRAM_CHAT_ID = "YOUR_CHAT_ID";
+const int CAMERA_FRAME_SIZE = FRAMESIZE_SVGA;
+const int CAMERA_JPEG_QUALITY = 12;
+const int CAMERA_FB_COUNT = 2;
+const int MOTION_COOLDOWN_MS = 10000;
+const int PIR_TRIGGER_DURATION_MS = 150;
+const int PHOTOS_PER_BURST = 3;
+const int PHOTO_BURST_DELAY_MS = 300;
+const bool CAMERA_MOTION_ENABLED = true;
+const int MOTION_THRESHOLD = 12;
+const int MOTION_MIN_AREA_PERCENT = 3;
+const bool SD_CARD_ENABLED = true;
+const char* SD_PHOTO_DIR = "/motion";
+const bool TELEGRAM_ENABLED = true;
+const bool TELEGRAM_SEND_PHOTO = true;
+const char* TELEGRAM_MOTION_MESSAGE = "Motion detected!";
+const bool LED_INDICATOR_ENABLED = true;
+const int LED_FLASH_DURATION_MS = 500;
+const bool DEBUG_SERIAL_ENABLED = true;     // printed with host_serial_enabled
@@ -0,0 +1,136 @@
+// Scripted TLS connection for the host tests
+
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "Arduino.h"
+#include "WiFiClientSecure.h"
+
+static std::string received;    // Server to client
+static size_t readPos = 0;
+static std::string sent;        // Client to server
+static bool clientOpen = false;
+static bool serverClosed = false;
+static size_t fragment = 0;
+static unsigned long connects = 0;
+static HostTlsServer server = NULL;
+static size_t served = 0;       // Bytes of sent the server has answered
+static unsigned long handshakeMs = 0;
+static int refuseConnects = 0;
+
+void hostTlsServerSend(const char* data, size_t len) {
+    received.append(data, len);
+}
+
+void hostTlsServerSend(const char* data) {
+    hostTlsServerSend(data, strlen(data));
+}
+
+void hostTlsServerClose() {
+    serverClosed = true;
+}
+
+void hostTlsFragment(size_t size) {
+    fragment = size;
+}
+
+unsigned long hostTlsConnects() {
+    return connects;
+}
+
+const std::string& hostTlsSent() {
+    return sent;
+}
+
+void hostTlsServe(HostTlsServer s) {
+    server = s;
+}
+
+void hostTlsHandshakeMs(unsigned long ms) {
+    handshakeMs = ms;
+}
+
+void hostTlsRefuseConnects(int count) {
+    refuseConnects = count;
+}
+
+// Hand every complete request the client wrote so far to the server
+static void serveRequests() {
+    while (server && !serverClosed) {
+        size_t end = sent.find("\r\n\r\n", served);
+        if (end == std::string::npos) {
+            return;
+        }
+        end += 4;
+        size_t length = 0;
+        size_t field = sent.find("Content-Length: ", served);
+        if (field != std::string::npos && field < end) {
+            length = strtoul(sent.c_str() + field + 16, NULL, 10);
+        }
+        if (sent.size() < end + length) {
+            return;
+        }
+        std::string request = sent.substr(served, end + length - served);
+        served = end + length;
+        server(request, connects);
+    }
+}
+
+int WiFiClientSecure::connect(const char* host, uint16_t port) {
+    received.clear();
+    readPos = 0;
+    sent.clear();
+    served = 0;
+    serverClosed = false;
+    clientOpen = false;
+    hostAdvanceTime(handshakeMs);
+    if (refuseConnects > 0) {
+        refuseConnects--;
+        return 0;
+    }
+    clientOpen = true;
+    connects++;
+    return 1;
+}
+
+// Like lwIP, the connection counts as open while unread data is left
+uint8_t WiFiClientSecure::connected() {
+    return clientOpen && (!serverClosed || readPos < received.size());
+}
+
+int WiFiClientSecure::available() {
+    if (!clientOpen) {
+        return 0;
+    }
+    size_t left = received.size() - readPos;
+    return fragment && left > fragment ? fragment : left;
+}
+
+int WiFiClientSecure::read() {
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+}
+
+int WiFiClientSecure::read(uint8_t* buf, size_t size) {
+    size_t n = available();
+    if (!n) {
+        return -1;
+    }
+    n = n < size ? n : size;
+    memcpy(buf, received.data() + readPos, n);
+    readPos += n;
+    return n;
+}
+
+size_t WiFiClientSecure::write(const uint8_t* buf, size_t size) {
+    if (!connected()) {
+        return 0;
+    }
+    sent.append((const char*)buf, size);
+    serveRequests();
+    return size;
+}
+
+void WiFiClientSecure::stop() {
+    clientOpen = false;
+}
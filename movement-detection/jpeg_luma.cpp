@@ -0,0 +1,86 @@
+#include <Arduino.h>
+#include "jpeg_luma.h"
+#include "motion.h"
+#include "esp_jpg_decode.h"
+
+// Destination of the 1/8 scale decode used for motion detection
+struct LumaDecoder {
+    const uint8_t* src;
+    uint8_t* luma;
+    int width;
+    int height;
+};
+
+bool jpegImageSize(const uint8_t* jpg, size_t len, int* width, int* height) {
+    if (len < 4 || jpg[0] != 0xFF || jpg[1] != 0xD8) {
+        return false;
+    }
+
+    size_t i = 2;
+    while (i + 4 <= len) {
+        if (jpg[i] != 0xFF) {
+            return false;
+        }
+        uint8_t marker = jpg[i + 1];
+        if (marker == 0xFF) {
+            i++;            // Fill byte
+            continue;
+        }
+        if (marker == 0xD9 || marker == 0xDA) {
+            return false;   // EOI or start of scan before any frame header
+        }
+        size_t segment = (jpg[i + 2] << 8) | jpg[i + 3];
+        // SOF0-SOF15, except DHT (C4), JPG (C8) and DAC (CC)
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            if (segment < 7 || i + 9 > len) {
+                return false;
+            }
+            *height = (jpg[i + 5] << 8) | jpg[i + 6];
+            *width = (jpg[i + 7] << 8) | jpg[i + 8];
+            return true;
+        }
+        i += 2 + segment;
+    }
+    return false;
+}
+
+static size_t lumaRead(void* arg, size_t index, uint8_t* buf, size_t len) {
+    LumaDecoder* decoder = (LumaDecoder*)arg;
+    if (buf) {
+        memcpy(buf, decoder->src + index, len);
+    }
+    return len;
+}
+
+// Receives RGB888 blocks from the decoder and keeps only their luma
+static bool lumaWrite(void* arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t* data) {
+    LumaDecoder* decoder = (LumaDecoder*)arg;
+    if (!data) {
+        // Start and end of image, esp_jpg_decode() ignores what is returned here
+        return true;
+    }
+
+    int rows = min((int)h, decoder->height - y);
+    int cols = min((int)w, decoder->width - x);
+    for (int iy = 0; iy < rows; iy++) {
+        const uint8_t* rgb = data + iy * w * 3;
+        uint8_t* out = decoder->luma + (y + iy) * decoder->width + x;
+        for (int ix = 0; ix < cols; ix++, rgb += 3) {
+            out[ix] = (rgb[0] * 77 + rgb[1] * 150 + rgb[2] * 29) >> 8;
+        }
+    }
+    return true;
+}
+
+bool decodeJpegLuma(const uint8_t* jpg, size_t len, uint8_t* luma, int width, int height) {
+    // The plane must match the size it was allocated for, a frame of another size
+    // (e.g. after the frame size was changed) would leave part of it stale
+    int frameWidth, frameHeight;
+    if (!jpegImageSize(jpg, len, &frameWidth, &frameHeight) ||
+        (frameWidth >> MOTION_SCALE_SHIFT) != width || (frameHeight >> MOTION_SCALE_SHIFT) != height) {
+        return false;
+    }
+
+    LumaDecoder decoder = { jpg, luma, width, height };
+    return esp_jpg_decode(len, JPG_SCALE_8X, lumaRead, lumaWrite, &decoder) == ESP_OK;
+}
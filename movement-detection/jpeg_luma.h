@@ -0,0 +1,14 @@
+#ifndef JPEG_LUMA_H
+#define JPEG_LUMA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Image size from the SOF segment of a JPEG, false when there is none before the scan
+bool jpegImageSize(const uint8_t* jpg, size_t len, int* width, int* height);
+
+// Decode a JPEG at 1/8 scale into a luma plane of width x height.
+// A frame of another size is rejected from its header, before anything is decoded.
+bool decodeJpegLuma(const uint8_t* jpg, size_t len, uint8_t* luma, int width, int height);
+
+#endif // JPEG_LUMA_H
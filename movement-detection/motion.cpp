@@ -0,0 +1,166 @@
+#include <Arduino.h>
+#include "motion.h"
+
+// Background is kept in 8.8 fixed point so slow learning rates do not stall on rounding
+#define BG_SHIFT_STILL      4   // Learning rate 1/16 for blocks without motion
+#define BG_SHIFT_MOVING     7   // Learning rate 1/128 for blocks with motion (absorbs parked objects)
+// Block noise is kept in 12.4 fixed point, learning rate 1/16
+#define NOISE_SHIFT         4
+#define NOISE_MARGIN        2   // Threshold = MOTION_THRESHOLD + NOISE_MARGIN * block noise
+
+static uint8_t* luma = NULL;          // Current frame, lumaWidth x lumaHeight
+static uint16_t* background = NULL;   // Background model, 8.8 fixed point
+static uint16_t* blockNoise = NULL;   // Mean absolute difference of still blocks, 12.4 fixed point
+static int lumaWidth = 0;
+static int lumaHeight = 0;
+static int blocksX = 0;
+static int blocksY = 0;
+static int warmupFrames = 0;
+static MotionStats stats;
+
+bool initMotionDetector(int frameWidth, int frameHeight) {
+    if (luma) {
+        return true;
+    }
+
+    lumaWidth = frameWidth >> MOTION_SCALE_SHIFT;
+    lumaHeight = frameHeight >> MOTION_SCALE_SHIFT;
+    blocksX = (lumaWidth + MOTION_BLOCK_SIZE - 1) / MOTION_BLOCK_SIZE;
+    blocksY = (lumaHeight + MOTION_BLOCK_SIZE - 1) / MOTION_BLOCK_SIZE;
+    int pixels = lumaWidth * lumaHeight;
+    int blocks = blocksX * blocksY;
+
+    // Small enough for internal RAM, which keeps the per-frame pass fast
+    luma = (uint8_t*)malloc(pixels);
+    background = (uint16_t*)malloc(pixels * sizeof(uint16_t));
+    blockNoise = (uint16_t*)malloc(blocks * sizeof(uint16_t));
+    if (!luma || !background || !blockNoise) {
+        free(luma);
+        free(background);
+        free(blockNoise);
+        luma = NULL;
+        return false;
+    }
+
+    memset(&stats, 0, sizeof(stats));
+    stats.totalBlocks = blocks;
+    resetMotionDetector();
+
+    if (DEBUG_SERIAL_ENABLED) {
+        Serial.printf("✓ Motion detector: %dx%d luma, %d blocks, %d bytes\n",
+                      lumaWidth, lumaHeight, blocks, pixels * 3 + blocks * 2);
+    }
+    return true;
+}
+
+uint8_t* getMotionLumaBuffer() {
+    return luma;
+}
+
+int getMotionLumaWidth() {
+    return lumaWidth;
+}
+
+int getMotionLumaHeight() {
+    return lumaHeight;
+}
+
+void resetMotionDetector() {
+    warmupFrames = 0;
+}
+
+static void learnFrame() {
+    int pixels = lumaWidth * lumaHeight;
+    int blocks = blocksX * blocksY;
+
+    if (warmupFrames == 0) {
+        for (int i = 0; i < pixels; i++) {
+            background[i] = luma[i] << 8;
+        }
+        for (int i = 0; i < blocks; i++) {
+            blockNoise[i] = 0;
+        }
+        return;
+    }
+
+    for (int i = 0; i < pixels; i++) {
+        background[i] += ((luma[i] << 8) - background[i]) >> 2;
+    }
+}
+
+int processMotionFrame() {
+    unsigned long start = micros();
+
+    stats.frames++;
+    if (warmupFrames < MOTION_WARMUP_FRAMES) {
+        learnFrame();
+        warmupFrames++;
+        stats.score = 0;
+        stats.changedBlocks = 0;
+        stats.brightnessShift = 0;
+        stats.lastProcessUs = micros() - start;
+        return 0;
+    }
+
+    // Global brightness shift (auto exposure, lights switched on) is not motion
+    int pixels = lumaWidth * lumaHeight;
+    int32_t shiftSum = 0;
+    for (int i = 0; i < pixels; i++) {
+        shiftSum += luma[i] - (background[i] >> 8);
+    }
+    int shift = shiftSum / pixels;
+
+    int changed = 0;
+    for (int by = 0; by < blocksY; by++) {
+        int y0 = by * MOTION_BLOCK_SIZE;
+        int y1 = min(y0 + MOTION_BLOCK_SIZE, lumaHeight);
+
+        for (int bx = 0; bx < blocksX; bx++) {
+            int x0 = bx * MOTION_BLOCK_SIZE;
+            int x1 = min(x0 + MOTION_BLOCK_SIZE, lumaWidth);
+            int b = by * blocksX + bx;
+
+            uint32_t sad = 0;
+            for (int y = y0; y < y1; y++) {
+                const uint8_t* cur = luma + y * lumaWidth;
+                const uint16_t* bg = background + y * lumaWidth;
+                for (int x = x0; x < x1; x++) {
+                    sad += abs(cur[x] - (bg[x] >> 8) - shift);
+                }
+            }
+            int count = (y1 - y0) * (x1 - x0);
+            int diff = (sad << NOISE_SHIFT) / count;   // 12.4 fixed point
+            int threshold = (MOTION_THRESHOLD << NOISE_SHIFT) + NOISE_MARGIN * blockNoise[b];
+            bool moving = diff > threshold;
+
+            if (moving) {
+                changed++;
+            } else {
+                blockNoise[b] += (diff - blockNoise[b]) >> NOISE_SHIFT;
+            }
+
+            int rate = moving ? BG_SHIFT_MOVING : BG_SHIFT_STILL;
+            for (int y = y0; y < y1; y++) {
+                const uint8_t* cur = luma + y * lumaWidth;
+                uint16_t* bg = background + y * lumaWidth;
+                for (int x = x0; x < x1; x++) {
+                    bg[x] += ((cur[x] << 8) - bg[x]) >> rate;
+                }
+            }
+        }
+    }
+
+    stats.changedBlocks = changed;
+    stats.score = changed * 100 / stats.totalBlocks;
+    stats.brightnessShift = shift;
+    stats.lastProcessUs = micros() - start;
+    return stats.score;
+}
+
+bool isMotionScore(int score) {
+    return stats.changedBlocks > 0 && score >= MOTION_MIN_AREA_PERCENT;
+}
+
+void getMotionStats(MotionStats* out) {
+    *out = stats;
+}
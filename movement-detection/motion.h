@@ -0,0 +1,44 @@
+#ifndef MOTION_H
+#define MOTION_H
+
+#include <stdint.h>
+#include "config.h"
+
+// Luma plane size: the camera frame decoded at 1/8 scale (one pixel per JPEG 8x8 block)
+#define MOTION_SCALE_SHIFT      3
+// Luma pixels per motion block side (8x8 luma = 64x64 image pixels)
+#define MOTION_BLOCK_SIZE       8
+// Frames used to learn the background after init or reset before motion is reported
+#define MOTION_WARMUP_FRAMES    5
+
+struct MotionStats {
+    int score;              // Percent of blocks that changed in the last frame (0-100)
+    int changedBlocks;      // Blocks over their threshold in the last frame
+    int totalBlocks;
+    int brightnessShift;    // Global luma offset removed from the last frame
+    unsigned long frames;   // Frames processed since init
+    unsigned long lastProcessUs;  // Time spent in the last processMotionFrame()
+};
+
+// Allocate all detector buffers for the given camera frame size (pixels).
+// Nothing is allocated after this call.
+bool initMotionDetector(int frameWidth, int frameHeight);
+
+// Luma plane to fill before calling processMotionFrame()
+uint8_t* getMotionLumaBuffer();
+int getMotionLumaWidth();
+int getMotionLumaHeight();
+
+// Compare the luma plane with the background model and update it.
+// Returns the motion score (percent of changed blocks), 0 while warming up.
+int processMotionFrame();
+
+// True when the score reaches MOTION_MIN_AREA_PERCENT
+bool isMotionScore(int score);
+
+// Forget the background model, e.g. after the scene changed during a burst
+void resetMotionDetector();
+
+void getMotionStats(MotionStats* stats);
+
+#endif // MOTION_H
@@ -2,7 +2,7 @@
  * ESP32-S3 Motion Detection Camera
  *
  * Features:
- * - Motion detection using frame comparison
+ * - Motion detection using PIR sensor and camera frame comparison
  * - Save photos to SD card on motion detection
  * - Send alerts to Telegram bot with photos
  * - Configurable sensitivity and cooldown
@@ -20,10 +20,13 @@
 #include "WiFi.h"
 #include "config.h"
 #include "camera.h"
+#include "motion.h"
+#include "photo_pool.h"
+#include "photo_index.h"
 #include "sd_storage.h"
 #include "telegram.h"
+#include "telegram_session.h"
 #include <Adafruit_NeoPixel.h>
-#include <Preferences.h>
 #include "SD.h"
 #include "FS.h"
 
@@ -36,7 +39,7 @@ unsigned long lastCheckTime = 0;
 // Queue for photo burst (series of 3 photos)
 QueueHandle_t photoBurstQueue = NULL;
 
-// Structure for motion event (burst of photos)
+// Structure for motion event (burst of photos), photoData are photo pool slots
 struct PhotoBurst {
     uint8_t* photoData[MAX_PHOTOS_PER_BURST];
     size_t photoSize[MAX_PHOTOS_PER_BURST];
@@ -48,7 +51,112 @@ TaskHandle_t detectionTaskHandle = NULL;
 TaskHandle_t telegramTaskHandle = NULL;
 volatile bool systemReady = false;
 
-// Task for PIR motion detection on Core 1
+// Capture a burst of photos and queue it for saving.
+// firstFrame is the frame that triggered camera motion detection (NULL for PIR),
+// it becomes the first photo of the burst and is released here.
+void captureBurst(camera_fb_t* firstFrame) {
+    // Turn on LED during photo capture
+    setLED(0, 51, 0);  // Green 20%
+
+    // Capture burst of 3 photos
+    PhotoBurst burst;
+    burst.photoCount = 0;
+
+    for (int i = 0; i < PHOTOS_PER_BURST; i++) {
+        camera_fb_t* fbJpeg = (i == 0 && firstFrame) ? firstFrame : capturePhoto();
+        if (fbJpeg) {
+            // Copy photo data into a preallocated slot so the frame buffer goes straight back to the camera
+            burst.photoData[burst.photoCount] = storePhoto(fbJpeg->buf, fbJpeg->len);
+            if (burst.photoData[burst.photoCount]) {
+                burst.photoSize[burst.photoCount] = fbJpeg->len;
+                burst.photoCount++;
+            } else if (DEBUG_SERIAL_ENABLED) {
+                Serial.printf("✗ No photo pool slot - photo %d dropped (%u bytes)\n", i + 1, fbJpeg->len);
+            }
+            releasePhoto(fbJpeg);
+        }
+        delay(PHOTO_BURST_DELAY_MS);  // Configurable delay between photos
+    }
+
+    ledOff();
+
+    // Send burst to queue
+    if (burst.photoCount > 0) {
+        if (xQueueSend(photoBurstQueue, &burst, 0) != pdTRUE) {
+            // Queue full - return the slots
+            for (int i = 0; i < burst.photoCount; i++) {
+                releasePhotoSlot(burst.photoData[i]);
+            }
+        }
+    }
+}
+
+// Wait for cooldown AND for PIR to go LOW (prevent immediate re-trigger)
+void waitMotionCooldown() {
+    if (DEBUG_SERIAL_ENABLED) {
+        Serial.println("⏳ Cooldown period + waiting for PIR to stabilize...");
+    }
+
+    unsigned long cooldownStart = millis();
+    bool pirWentLow = false;
+
+    // Wait for cooldown period
+    while (millis() - cooldownStart < MOTION_COOLDOWN_MS) {
+        if (digitalRead(PIR_PIN) == LOW) {
+            pirWentLow = true;
+        }
+        delay(100);
+    }
+
+    // After cooldown, ensure PIR is LOW before allowing next trigger
+    if (!pirWentLow || digitalRead(PIR_PIN) == HIGH) {
+        if (DEBUG_SERIAL_ENABLED) {
+            Serial.println("⚠️ PIR still HIGH after cooldown - waiting for it to stabilize...");
+        }
+
+        // Wait up to 30 seconds for PIR to go LOW
+        unsigned long waitStart = millis();
+        while (digitalRead(PIR_PIN) == HIGH && (millis() - waitStart < 30000)) {
+            delay(500);
+        }
+
+        // Additional 2 second delay after PIR goes LOW
+        delay(2000);
+    }
+
+    // The scene may have changed since the background was learned
+    resetMotionDetector();
+
+    if (DEBUG_SERIAL_ENABLED) {
+        Serial.println("✓ Ready for next motion detection");
+    }
+}
+
+// Check the camera for motion. Returns the frame that showed motion (caller
+// releases it), NULL when nothing changed.
+camera_fb_t* checkCameraMotion() {
+    camera_fb_t* fb = captureGrayscale(getMotionLumaBuffer(), getMotionLumaWidth(), getMotionLumaHeight());
+    if (!fb) {
+        return NULL;
+    }
+
+    int score = processMotionFrame();
+    if (!isMotionScore(score)) {
+        // Nothing changed - don't keep the frame
+        releasePhoto(fb);
+        return NULL;
+    }
+
+    if (DEBUG_SERIAL_ENABLED) {
+        MotionStats stats;
+        getMotionStats(&stats);
+        Serial.printf("📷 Camera motion detected! Score %d%% (%d/%d blocks, %lu us)\n",
+                      score, stats.changedBlocks, stats.totalBlocks, stats.lastProcessUs);
+    }
+    return fb;
+}
+
+// Task for PIR and camera motion detection on Core 1
 void motionDetectionTask(void* parameter) {
     // Setup PIR sensor
     pinMode(PIR_PIN, INPUT);
@@ -75,6 +183,7 @@ void motionDetectionTask(void* parameter) {
 
         unsigned long currentTime = millis();
         bool pirReady = (currentTime - pirStartTime >= PIR_WARMUP_MS);
+        bool pirTriggered = false;
 
         // Check PIR sensor state
         if (digitalRead(PIR_PIN) == HIGH) {
@@ -85,120 +194,72 @@ void motionDetectionTask(void* parameter) {
                     Serial.println("⏳ PIR triggered but still warming up (ignoring for 30 sec)");
                     warmupMessageShown = true;
                 }
-                delay(100);
-                continue;
-            }
-
-            // PIR is HIGH - verify it stays HIGH for minimum duration (filter false triggers)
-            unsigned long triggerStartTime = millis();
-            bool validTrigger = true;
-
-            while (millis() - triggerStartTime < PIR_TRIGGER_DURATION_MS) {
-                if (digitalRead(PIR_PIN) == LOW) {
-                    // PIR went LOW too quickly - false trigger
-                    validTrigger = false;
-                    if (DEBUG_SERIAL_ENABLED) {
-                        Serial.println("⚠️ PIR false trigger detected (too short)");
-                    }
-                    break;
-                }
-                delay(10);  // Check every 10ms
-            }
-
-            if (!validTrigger) {
-                delay(100);
-                continue;
-            }
-
-            // Valid trigger - process motion
-            if (DEBUG_SERIAL_ENABLED) {
-                Serial.println("🔍 PIR sensor triggered!");
-            }
-
-            // Turn on LED during photo capture
-            setLED(0, 51, 0);  // Green 20%
-
-            // Capture burst of 3 photos
-            PhotoBurst burst;
-            burst.photoCount = 0;
-
-            for (int i = 0; i < PHOTOS_PER_BURST; i++) {
-                camera_fb_t* fbJpeg = capturePhoto();
-                if (fbJpeg) {
-                    // Copy photo data
-                    burst.photoData[i] = (uint8_t*)malloc(fbJpeg->len);
-                    if (burst.photoData[i]) {
-                        memcpy(burst.photoData[i], fbJpeg->buf, fbJpeg->len);
-                        burst.photoSize[i] = fbJpeg->len;
-                        burst.photoCount++;
-                    }
-                    releasePhoto(fbJpeg);
-                }
-                delay(PHOTO_BURST_DELAY_MS);  // Configurable delay between photos
-            }
-
-            ledOff();
-
-            // Send burst to queue
-            if (burst.photoCount > 0) {
-                if (xQueueSend(photoBurstQueue, &burst, 0) != pdTRUE) {
-                    // Queue full - free memory
-                    for (int i = 0; i < burst.photoCount; i++) {
-                        free(burst.photoData[i]);
+            } else {
+                // PIR is HIGH - verify it stays HIGH for minimum duration (filter false triggers)
+                unsigned long triggerStartTime = millis();
+                pirTriggered = true;
+
+                while (millis() - triggerStartTime < PIR_TRIGGER_DURATION_MS) {
+                    if (digitalRead(PIR_PIN) == LOW) {
+                        // PIR went LOW too quickly - false trigger
+                        pirTriggered = false;
+                        if (DEBUG_SERIAL_ENABLED) {
+                            Serial.println("⚠️ PIR false trigger detected (too short)");
+                        }
+                        break;
                     }
+                    delay(10);  // Check every 10ms
                 }
-            }
-
-            // Wait for cooldown AND for PIR to go LOW (prevent immediate re-trigger)
-            if (DEBUG_SERIAL_ENABLED) {
-                Serial.println("⏳ Cooldown period + waiting for PIR to stabilize...");
-            }
 
-            unsigned long cooldownStart = millis();
-            bool pirWentLow = false;
-
-            // Wait for cooldown period
-            while (millis() - cooldownStart < MOTION_COOLDOWN_MS) {
-                if (digitalRead(PIR_PIN) == LOW) {
-                    pirWentLow = true;
+                if (pirTriggered && DEBUG_SERIAL_ENABLED) {
+                    Serial.println("🔍 PIR sensor triggered!");
                 }
-                delay(100);
             }
+        }
 
-            // After cooldown, ensure PIR is LOW before allowing next trigger
-            if (!pirWentLow || digitalRead(PIR_PIN) == HIGH) {
-                if (DEBUG_SERIAL_ENABLED) {
-                    Serial.println("⚠️ PIR still HIGH after cooldown - waiting for it to stabilize...");
-                }
-
-                // Wait up to 30 seconds for PIR to go LOW
-                unsigned long waitStart = millis();
-                while (digitalRead(PIR_PIN) == HIGH && (millis() - waitStart < 30000)) {
-                    delay(500);
-                }
-
-                // Additional 2 second delay after PIR goes LOW
-                delay(2000);
-            }
+        // Frame differencing runs at sensor rate between PIR checks
+        camera_fb_t* motionFrame = NULL;
+        if (!pirTriggered && CAMERA_MOTION_ENABLED && getMotionLumaBuffer()) {
+            motionFrame = checkCameraMotion();
+        }
 
-            if (DEBUG_SERIAL_ENABLED) {
-                Serial.println("✓ Ready for next motion detection");
-            }
+        if (pirTriggered || motionFrame) {
+            captureBurst(motionFrame);
+            waitMotionCooldown();
+            continue;
         }
 
-        // Check PIR every 100ms
-        delay(100);
+        // Check PIR every 100ms (camera frames pace the loop when enabled)
+        delay(CAMERA_MOTION_ENABLED ? 10 : 100);
     }
 }
 
 // Task for saving photos to SD card on Core 0
 void sdSaveTask(void* parameter) {
-    PhotoBurst burst;
+    static_assert(PHOTO_POOL_SLOTS <= SD_BATCH_MAX_PHOTOS, "Every pooled photo must fit in one SD batch");
+    PhotoBurst bursts[PHOTO_POOL_BURSTS];
+    uint8_t* photos[SD_BATCH_MAX_PHOTOS];
+    size_t sizes[SD_BATCH_MAX_PHOTOS];
 
     while (true) {
-        if (xQueueReceive(photoBurstQueue, &burst, portMAX_DELAY)) {
+        if (xQueueReceive(photoBurstQueue, &bursts[0], portMAX_DELAY)) {
+            // Bursts queued while the card was busy are written together
+            int burstCount = 1;
+            while (burstCount < PHOTO_POOL_BURSTS && xQueueReceive(photoBurstQueue, &bursts[burstCount], 0)) {
+                burstCount++;
+            }
+
+            int photoCount = 0;
+            for (int b = 0; b < burstCount; b++) {
+                for (int i = 0; i < bursts[b].photoCount; i++) {
+                    photos[photoCount] = bursts[b].photoData[i];
+                    sizes[photoCount] = bursts[b].photoSize[i];
+                    photoCount++;
+                }
+            }
+
             if (DEBUG_SERIAL_ENABLED) {
-                Serial.printf("\n🚨 === MOTION DETECTED: %d photos ===\n", burst.photoCount);
+                Serial.printf("\n🚨 === MOTION DETECTED: %d photos ===\n", photoCount);
             }
 
             // Flash LED indicator
@@ -208,19 +269,10 @@ void sdSaveTask(void* parameter) {
             if (SD_CARD_ENABLED && isSDCardMounted()) {
                 checkAndManageSpace();
 
-                for (int i = 0; i < burst.photoCount; i++) {
-                    // Create temporary frame buffer structure
-                    camera_fb_t tempFb;
-                    tempFb.buf = burst.photoData[i];
-                    tempFb.len = burst.photoSize[i];
-                    tempFb.width = 0;
-                    tempFb.height = 0;
-                    tempFb.format = PIXFORMAT_JPEG;
-
-                    bool saved = savePhotoToSD(&tempFb);
-                    if (DEBUG_SERIAL_ENABLED) {
-                        Serial.printf("Photo %d SD save: %s\n", i+1, saved ? "✓ Success" : "✗ Failed");
-                    }
+                int saved = savePhotoBurst(photos, sizes, photoCount);
+                if (DEBUG_SERIAL_ENABLED) {
+                    Serial.printf("SD save: %d/%d photos %s\n", saved, photoCount,
+                                  saved == photoCount ? "✓ Success" : "✗ Failed");
                 }
             }
 
@@ -228,9 +280,9 @@ void sdSaveTask(void* parameter) {
                 Serial.println("=========================\n");
             }
 
-            // Free allocated memory
-            for (int i = 0; i < burst.photoCount; i++) {
-                free(burst.photoData[i]);
+            // Return the slots to the photo pool
+            for (int i = 0; i < photoCount; i++) {
+                releasePhotoSlot(photos[i]);
             }
         }
     }
@@ -357,6 +409,24 @@ void setup() {
         Serial.println("✓ Camera initialized");
     }
 
+    // Burst photos are copied into a fixed PSRAM pool instead of malloc'd one by one.
+    // Slots match the camera JPEG buffer (width * height / 5), so every frame fits.
+    framesize_t frameSize = (framesize_t)CAMERA_FRAME_SIZE;
+    if (!initPhotoPool(resolution[frameSize].width * resolution[frameSize].height / 5)) {
+        if (DEBUG_SERIAL_ENABLED) {
+            Serial.println("✗ Photo pool allocation failed - bursts will not be saved");
+        }
+    }
+
+    // Allocate motion detector buffers once, sized for the configured frame
+    if (CAMERA_MOTION_ENABLED) {
+        if (!initMotionDetector(resolution[frameSize].width, resolution[frameSize].height)) {
+            if (DEBUG_SERIAL_ENABLED) {
+                Serial.println("✗ Motion detector allocation failed - PIR only");
+            }
+        }
+    }
+
     // Connect to WiFi
     WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
     if (DEBUG_SERIAL_ENABLED) {
@@ -411,8 +481,8 @@ void setup() {
         }
     }
 
-    // Create photo burst queue
-    photoBurstQueue = xQueueCreate(5, sizeof(PhotoBurst));
+    // Create photo burst queue (a burst that does not fit in the photo pool is dropped anyway)
+    photoBurstQueue = xQueueCreate(PHOTO_POOL_BURSTS, sizeof(PhotoBurst));
     if (!photoBurstQueue) {
         if (DEBUG_SERIAL_ENABLED) {
             Serial.println("✗ Failed to create photo burst queue");
@@ -481,13 +551,6 @@ void loop() {
             if (SD_CARD_ENABLED && isSDCardMounted()) {
                 int deletedCount = eraseAllPhotos();
                 Serial.printf("✓ Deleted %d photos from SD card\n", deletedCount);
-
-                // Reset lastSent in Preferences
-                Preferences prefs;
-                prefs.begin("motion-cam", false);
-                prefs.putULong("lastSent", 0);
-                prefs.end();
-
                 Serial.println("✓ Reset sent photo tracking\n");
             } else {
                 Serial.println("✗ SD card not available\n");
@@ -499,40 +562,42 @@ void loop() {
             if (SD_CARD_ENABLED && isSDCardMounted()) {
                 printSDCardInfo();
 
-                // Count photos
-                String fileList[100];
-                int totalPhotos = 0;
-                File dir = SD.open(SD_PHOTO_DIR);
-                if (dir && dir.isDirectory()) {
-                    File file = dir.openNextFile();
-                    while (file) {
-                        String filename = String(file.name());
-                        if (filename.endsWith(".jpg")) {
-                            totalPhotos++;
-                        }
-                        file = dir.openNextFile();
-                    }
-                    dir.close();
-                }
-
-                int unsentCount = getUnsentPhotos(fileList, 100);
+                // Counts come from the photo index, no directory scan
+                PhotoIndexStats indexStats;
+                getPhotoIndexStats(&indexStats);
 
-                Serial.printf("Total photos: %d\n", totalPhotos);
-                Serial.printf("Unsent photos: %d\n", unsentCount);
-
-                Preferences prefs;
-                prefs.begin("motion-cam", true);
-                unsigned long lastSent = prefs.getULong("lastSent", 0);
-                prefs.end();
-
-                Serial.printf("Last sent timestamp: %lu\n", lastSent);
+                Serial.printf("Total photos: %lu\n", indexStats.count);
+                Serial.printf("Unsent photos: %lu\n", indexStats.unsent);
+                if (indexStats.count) {
+                    Serial.printf("Photo range: %06lu - %06lu\n", indexStats.oldest, indexStats.newest);
+                }
             } else {
                 Serial.println("SD card: Not available");
             }
 
             Serial.printf("WiFi: %s\n", WiFi.status() == WL_CONNECTED ? "Connected" : "Disconnected");
             Serial.printf("Telegram: %s\n", TELEGRAM_ENABLED ? "Enabled" : "Disabled");
+            if (TELEGRAM_ENABLED) {
+                TelegramSessionStats sessionStats;
+                getTelegramSessionStats(&sessionStats);
+                Serial.printf("Telegram connection: %lu handshakes (last %lu ms), %lu reused, %lu stale, %lu failures\n",
+                              sessionStats.connects, sessionStats.lastConnectMs,
+                              sessionStats.reuses, sessionStats.staleRetries, sessionStats.failures);
+            }
             Serial.printf("PIR sensor: Enabled (GPIO%d)\n", PIR_PIN);
+            if (CAMERA_MOTION_ENABLED) {
+                MotionStats stats;
+                getMotionStats(&stats);
+                Serial.printf("Camera motion: %lu frames, last score %d%%, %lu us/frame\n",
+                              stats.frames, stats.score, stats.lastProcessUs);
+            } else {
+                Serial.println("Camera motion: Disabled");
+            }
+            PhotoPoolStats poolStats;
+            getPhotoPoolStats(&poolStats);
+            Serial.printf("Photo pool: %d/%d slots in use (peak %d), %lu stored, %lu exhausted, %lu oversize\n",
+                          poolStats.inUse, poolStats.slots, poolStats.highWater,
+                          poolStats.acquired, poolStats.exhausted, poolStats.oversize);
             Serial.printf("Free heap: %d bytes\n", ESP.getFreeHeap());
             Serial.println("====================\n");
         }
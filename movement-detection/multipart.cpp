@@ -0,0 +1,120 @@
+#include "multipart.h"
+#include "SD.h"
+#include "FS.h"
+
+// The whole request goes out through this buffer. Only the Telegram task uploads,
+// so it is static instead of taking 4 KB of that task's stack.
+static uint8_t chunk[MULTIPART_CHUNK_SIZE];
+
+struct ChunkWriter {
+    Print* out;
+    size_t used;        // Bytes waiting in chunk
+    bool ok;            // False after the first failed write
+};
+
+static bool flushChunk(ChunkWriter* w) {
+    if (w->ok && w->used && w->out->write(chunk, w->used) != w->used) {
+        w->ok = false;
+    }
+    w->used = 0;
+    return w->ok;
+}
+
+static void put(ChunkWriter* w, const void* data, size_t len) {
+    const uint8_t* p = (const uint8_t*)data;
+    while (len && w->ok) {
+        size_t n = min(len, sizeof(chunk) - w->used);
+        memcpy(chunk + w->used, p, n);
+        w->used += n;
+        p += n;
+        len -= n;
+        if (w->used == sizeof(chunk)) {
+            flushChunk(w);
+        }
+    }
+}
+
+// Read the file straight into the free end of the chunk, no second copy
+static bool putFile(ChunkWriter* w, const MultipartPart* part) {
+    File file = SD.open(part->path, FILE_READ);
+    if (!file) {
+        return false;
+    }
+    // Content-Length was sent with the indexed size, any other size breaks the request
+    if (file.size() != part->size) {
+        file.close();
+        return false;
+    }
+
+    size_t left = part->size;
+    while (left && w->ok) {
+        size_t want = min(left, sizeof(chunk) - w->used);
+        size_t n = file.read(chunk + w->used, want);
+        if (n == 0 || n > want) {
+            break;
+        }
+        w->used += n;
+        left -= n;
+        if (w->used == sizeof(chunk)) {
+            flushChunk(w);
+        }
+    }
+    file.close();
+    return w->ok && left == 0;
+}
+
+// Header of a part. With buf NULL it is only measured. Returns its length.
+static int partHeader(char* buf, size_t len, const char* boundary, const MultipartPart* part) {
+    if (part->value) {
+        return snprintf(buf, len, "--%s\r\nContent-Disposition: form-data; name=\"%s\"\r\n\r\n",
+                        boundary, part->name);
+    }
+    return snprintf(buf, len, "--%s\r\nContent-Disposition: form-data; name=\"%s\"; filename=\"%s\"\r\n"
+                    "Content-Type: %s\r\n\r\n", boundary, part->name, part->filename, part->contentType);
+}
+
+void multipartBoundary(char* boundary) {
+    snprintf(boundary, MULTIPART_BOUNDARY_SIZE, "----WebKitFormBoundary%ld", (long)random(100000, 999999));
+}
+
+size_t multipartContentLength(const char* boundary, const MultipartPart* parts, int count) {
+    size_t length = 0;
+    for (int i = 0; i < count; i++) {
+        length += partHeader(NULL, 0, boundary, &parts[i]);
+        length += parts[i].value ? strlen(parts[i].value) : parts[i].size;
+        length += 2;    // \r\n
+    }
+    length += strlen(boundary) + 6;     // --boundary--\r\n
+    return length;
+}
+
+bool multipartSend(Print& out, const char* head, const char* boundary, const MultipartPart* parts, int count) {
+    ChunkWriter w = { &out, 0, true };
+    char header[256];
+
+    if (head) {
+        put(&w, head, strlen(head));
+    }
+
+    for (int i = 0; i < count; i++) {
+        int n = partHeader(header, sizeof(header), boundary, &parts[i]);
+        if (n < 0 || n >= (int)sizeof(header)) {
+            return false;
+        }
+        put(&w, header, n);
+
+        if (parts[i].value) {
+            put(&w, parts[i].value, strlen(parts[i].value));
+        } else if (!putFile(&w, &parts[i])) {
+            if (DEBUG_SERIAL_ENABLED && w.ok) {
+                Serial.printf("✗ Could not read %s\n", parts[i].path);
+            }
+            return false;
+        }
+        put(&w, "\r\n", 2);
+    }
+
+    int n = snprintf(header, sizeof(header), "--%s--\r\n", boundary);
+    put(&w, header, n);
+    return flushChunk(&w);
+}
@@ -0,0 +1,33 @@
+#ifndef MULTIPART_H
+#define MULTIPART_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// Bytes handed to the connection per write. File data is read straight into this
+// buffer behind the part headers, so every TLS record is full.
+#define MULTIPART_CHUNK_SIZE    4096
+#define MULTIPART_BOUNDARY_SIZE 40
+
+// One form-data field: either a text value or a file streamed from the SD card
+struct MultipartPart {
+    const char* name;
+    const char* value;          // Text field value, NULL for a file field
+    const char* filename;       // File field: file name sent to the server
+    const char* contentType;    // File field: MIME type
+    const char* path;           // File field: SD card file with the data
+    size_t size;                // File field: data size, the file must have exactly this size
+};
+
+// Fill boundary (MULTIPART_BOUNDARY_SIZE bytes) with a random boundary string
+void multipartBoundary(char* boundary);
+
+// Exact body size for the parts, computed without touching the SD card
+size_t multipartContentLength(const char* boundary, const MultipartPart* parts, int count);
+
+// Write head (e.g. the HTTP request headers, may be NULL) followed by the multipart body.
+// Nothing is allocated, everything goes through one MULTIPART_CHUNK_SIZE buffer.
+// False when a write failed or a file did not match its size (the body is then incomplete).
+bool multipartSend(Print& out, const char* head, const char* boundary, const MultipartPart* parts, int count);
+
+#endif // MULTIPART_H
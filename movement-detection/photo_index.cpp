@@ -0,0 +1,525 @@
+#include <Arduino.h>
+#include <Preferences.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "photo_index.h"
+#include "SD.h"
+#include "FS.h"
+
+#define INDEX_MAGIC         0x58444950  // "PIDX"
+#define INDEX_VERSION       1
+#define RECORD_SIZE         sizeof(PhotoRecord)
+#define READ_CHUNK          32          // Records read at once while loading
+#define ROLL_FORWARD_MAX    (MAX_PHOTOS_PER_BURST * 4)  // Photos saved without a record that are picked up at startup
+#define LEGACY_PREFS        "motion-cam"                // Preferences namespace of the counters the index replaced
+
+static_assert(sizeof(PhotoRecord) == 16, "Index records must stay 16 bytes");
+static_assert(PHOTO_INDEX_CAPACITY % 8 == 0, "Sent flags are kept in a bitmap");
+
+static File indexFile;
+static bool indexOpen = false;
+static bool indexRebuilt = false;
+static unsigned long oldestSeq = 1;     // First photo still on the card
+static unsigned long newestSeq = 0;     // oldestSeq - 1 when the card is empty
+static unsigned long firstUnsent = 1;   // Every photo before this one is sent
+// Bit set = nothing to send for the photo in this ring slot (sent, or its record was lost)
+static uint8_t sentBits[PHOTO_INDEX_CAPACITY / 8];
+
+// Held by every exported function: the SD task saves and evicts, the Telegram task marks
+// photos sent and loop() clears the index and reads its stats, all on the same file and state
+class IndexLock {
+public:
+    IndexLock() { xSemaphoreTake(mutex(), portMAX_DELAY); }
+    ~IndexLock() { xSemaphoreGive(mutex()); }
+
+private:
+    static SemaphoreHandle_t mutex() {
+        static SemaphoreHandle_t handle = xSemaphoreCreateMutex();
+        return handle;
+    }
+};
+
+// Before the index the photo number and the last sent photo were kept in Preferences
+struct LegacyCounters {
+    bool found;
+    unsigned long photoNum;     // Next photo number
+    unsigned long lastSent;     // Every photo up to this one was sent
+};
+
+static uint16_t recordCheck(const PhotoRecord* record) {
+    uint32_t x = record->seq * 0x9E3779B1 ^ record->size ^ record->timestamp * 0x85EBCA77 ^
+                 ((uint32_t)record->flags << 16) ^ 0x5A5A;
+    return (uint16_t)(x ^ (x >> 16));
+}
+
+void photoPath(char* buf, size_t len, unsigned long seq) {
+    snprintf(buf, len, "%s/photo_%06lu.jpg", SD_PHOTO_DIR, seq);
+}
+
+static void indexPath(char* buf, size_t len) {
+    snprintf(buf, len, "%s/%s", SD_PHOTO_DIR, PHOTO_INDEX_FILE);
+}
+
+// Slot -1 is the header
+static bool readSlot(int slot, PhotoRecord* records, int count) {
+    if (!indexFile.seek((slot + 1) * RECORD_SIZE)) {
+        return false;
+    }
+    return indexFile.read((uint8_t*)records, count * RECORD_SIZE) == count * RECORD_SIZE;
+}
+
+// Write count records to consecutive slots with one write
+static bool writeSlots(int slot, PhotoRecord* records, int count) {
+    for (int i = 0; i < count; i++) {
+        records[i].check = recordCheck(&records[i]);
+    }
+    if (!indexFile.seek((slot + 1) * RECORD_SIZE)) {
+        return false;
+    }
+    bool written = indexFile.write((const uint8_t*)records, count * RECORD_SIZE) == count * RECORD_SIZE;
+    indexFile.flush();
+    return written;
+}
+
+static bool writeSlot(int slot, PhotoRecord* record) {
+    return writeSlots(slot, record, 1);
+}
+
+static bool writeHeader() {
+    PhotoRecord header = { INDEX_MAGIC, PHOTO_INDEX_CAPACITY, (uint32_t)oldestSeq, INDEX_VERSION, 0 };
+    return writeSlot(-1, &header);
+}
+
+static bool isRecord(const PhotoRecord* record, int slot) {
+    return record->seq && record->seq % PHOTO_INDEX_CAPACITY == (uint32_t)slot &&
+           record->check == recordCheck(record);
+}
+
+// First photo number that still has its record in the ring
+static unsigned long windowStart() {
+    return newestSeq >= PHOTO_INDEX_CAPACITY ? newestSeq - PHOTO_INDEX_CAPACITY + 1 : 1;
+}
+
+static bool isSent(unsigned long seq) {
+    if (seq < windowStart()) {
+        return true;
+    }
+    int slot = seq % PHOTO_INDEX_CAPACITY;
+    return sentBits[slot >> 3] & (1 << (slot & 7));
+}
+
+static void setSent(unsigned long seq, bool sent) {
+    int slot = seq % PHOTO_INDEX_CAPACITY;
+    if (sent) {
+        sentBits[slot >> 3] |= 1 << (slot & 7);
+    } else {
+        sentBits[slot >> 3] &= ~(1 << (slot & 7));
+    }
+}
+
+static void advanceFirstUnsent() {
+    unsigned long start = max(oldestSeq, windowStart());
+    if (firstUnsent < start) {
+        firstUnsent = start;
+    }
+    while (firstUnsent <= newestSeq && isSent(firstUnsent)) {
+        firstUnsent++;
+    }
+}
+
+// Create an empty index file: PHOTO_INDEX_CAPACITY empty slots behind a blank header.
+// It only loads once writeHeader() is done, a rebuild cut short is started over.
+static bool createIndexFile() {
+    char path[64];
+    indexPath(path, sizeof(path));
+
+    if (indexFile) {
+        indexFile.close();
+    }
+    File file = SD.open(path, FILE_WRITE);
+    if (!file) {
+        return false;
+    }
+    uint8_t zeros[READ_CHUNK * RECORD_SIZE];
+    memset(zeros, 0, sizeof(zeros));
+    bool written = file.write(zeros, RECORD_SIZE) == RECORD_SIZE;
+    for (int slot = 0; written && slot < PHOTO_INDEX_CAPACITY; slot += READ_CHUNK) {
+        written = file.write(zeros, sizeof(zeros)) == sizeof(zeros);
+    }
+    file.close();
+
+    indexFile = SD.open(path, "r+");
+    return written && indexFile;
+}
+
+static void readLegacyCounters(LegacyCounters* legacy) {
+    Preferences prefs;
+    legacy->found = prefs.begin(LEGACY_PREFS, true) && prefs.isKey("photoNum");
+    legacy->photoNum = legacy->found ? prefs.getULong("photoNum", 1) : 1;
+    legacy->lastSent = legacy->found ? prefs.getULong("lastSentNum", 0) : 0;
+    prefs.end();
+}
+
+static void removeLegacyCounters() {
+    Preferences prefs;
+    if (prefs.begin(LEGACY_PREFS, false)) {
+        prefs.remove("photoNum");
+        prefs.remove("lastSentNum");
+        prefs.remove("lastSent");
+        prefs.end();
+    }
+}
+
+// Rebuild the index from the photo files. Photos after the last one the old counters
+// saw sent are unsent, without the counters all photos found are marked as sent.
+static bool rebuildIndex(const LegacyCounters* legacy) {
+    if (DEBUG_SERIAL_ENABLED) {
+        Serial.println("Rebuilding photo index from SD card...");
+    }
+
+    File dir = SD.open(SD_PHOTO_DIR);
+    if (!dir || !dir.isDirectory()) {
+        return false;
+    }
+
+    // Find the photo number range first, only the newest photos get records
+    unsigned long minSeq = 0;
+    unsigned long maxSeq = 0;
+    unsigned long count = 0;
+    File file = dir.openNextFile();
+    while (file) {
+        unsigned long seq;
+        if (sscanf(file.name(), "photo_%lu.jpg", &seq) == 1 && seq) {
+            if (!minSeq || seq < minSeq) {
+                minSeq = seq;
+            }
+            if (seq > maxSeq) {
+                maxSeq = seq;
+            }
+            count++;
+        }
+        file = dir.openNextFile();
+    }
+
+    // Numbering continues after the photos on the card, or after what the old index or counters knew
+    unsigned long nextSeq = maxSeq ? maxSeq + 1 : max(newestSeq + 1, legacy->found ? legacy->photoNum : 1);
+    oldestSeq = minSeq ? minSeq : nextSeq;
+    newestSeq = oldestSeq - 1;
+    memset(sentBits, 0xFF, sizeof(sentBits));
+    if (!createIndexFile()) {
+        dir.close();
+        return false;
+    }
+
+    dir.rewindDirectory();
+    file = dir.openNextFile();
+    while (file) {
+        unsigned long seq;
+        if (sscanf(file.name(), "photo_%lu.jpg", &seq) == 1 && seq && seq + PHOTO_INDEX_CAPACITY > maxSeq) {
+            bool sent = !legacy->found || seq <= legacy->lastSent;
+            PhotoRecord record = { (uint32_t)seq, (uint32_t)file.size(), (uint32_t)time(NULL),
+                                   (uint16_t)(sent ? PHOTO_FLAG_SENT : 0), 0 };
+            if (!writeSlot(seq % PHOTO_INDEX_CAPACITY, &record)) {
+                dir.close();
+                return false;
+            }
+            if (!sent) {
+                setSent(seq, false);
+            }
+        }
+        file = dir.openNextFile();
+    }
+    dir.close();
+    if (!writeHeader()) {
+        return false;
+    }
+
+    newestSeq = nextSeq - 1;
+    firstUnsent = 0;
+    advanceFirstUnsent();
+    indexRebuilt = true;
+
+    if (DEBUG_SERIAL_ENABLED) {
+        if (legacy->found) {
+            Serial.printf("✓ Photo index rebuilt: %lu photos, sent up to %lu by the old counters\n", count,
+                          legacy->lastSent);
+        } else {
+            Serial.printf("✓ Photo index rebuilt: %lu photos (all marked as sent)\n", count);
+        }
+    }
+    return true;
+}
+
+static bool appendRecords(unsigned long firstSeq, const size_t* sizes, int count) {
+    if (!indexOpen || firstSeq <= newestSeq || count <= 0) {
+        return false;
+    }
+
+    // Consecutive photos have consecutive slots: one write per READ_CHUNK records,
+    // split where the ring wraps
+    PhotoRecord records[READ_CHUNK];
+    uint32_t now = time(NULL);
+    for (int done = 0; done < count; ) {
+        unsigned long seq = firstSeq + done;
+        int slot = seq % PHOTO_INDEX_CAPACITY;
+        int n = min(min(count - done, READ_CHUNK), PHOTO_INDEX_CAPACITY - slot);
+        for (int i = 0; i < n; i++) {
+            records[i] = { (uint32_t)(seq + i), (uint32_t)sizes[done + i], now, 0, 0 };
+        }
+        if (!writeSlots(slot, records, n)) {
+            return false;
+        }
+        done += n;
+    }
+
+    // Photo numbers that were skipped have nothing to send
+    unsigned long lastSeq = firstSeq + count - 1;
+    unsigned long from = max(newestSeq + 1, lastSeq >= PHOTO_INDEX_CAPACITY ? lastSeq - PHOTO_INDEX_CAPACITY + 1 : 1UL);
+    for (unsigned long seq = from; seq <= lastSeq; seq++) {
+        setSent(seq, seq < firstSeq);
+    }
+    newestSeq = lastSeq;
+    advanceFirstUnsent();
+    return true;
+}
+
+// A photo is complete when it starts with SOI and ends with EOI. Power lost while it was
+// written leaves it empty or without the EOI.
+static bool isCompleteJpeg(File& file) {
+    size_t size = file.size();
+    uint8_t soi[2], eoi[2];
+    return size >= 4 && file.read(soi, 2) == 2 && soi[0] == 0xFF && soi[1] == 0xD8 &&
+           file.seek(size - 2) && file.read(eoi, 2) == 2 && eoi[0] == 0xFF && eoi[1] == 0xD9;
+}
+
+// Load an existing index file. False when it has to be rebuilt.
+static bool loadIndex() {
+    PhotoRecord records[READ_CHUNK];
+
+    if (!readSlot(-1, records, 1) || records[0].seq != INDEX_MAGIC || records[0].size != PHOTO_INDEX_CAPACITY ||
+        records[0].flags != INDEX_VERSION || records[0].check != recordCheck(&records[0])) {
+        return false;
+    }
+    oldestSeq = records[0].timestamp;
+
+    // Pass 1: the newest record ends the ring
+    unsigned long newest = 0;
+    for (int slot = 0; slot < PHOTO_INDEX_CAPACITY; slot += READ_CHUNK) {
+        if (!readSlot(slot, records, READ_CHUNK)) {
+            return false;
+        }
+        for (int i = 0; i < READ_CHUNK; i++) {
+            if (isRecord(&records[i], slot + i) && records[i].seq > newest) {
+                newest = records[i].seq;
+            }
+        }
+    }
+    newestSeq = max(newest, oldestSeq - 1);
+
+    // Pass 2: sent flags of the records in the ring window, slots without one have nothing to send
+    memset(sentBits, 0xFF, sizeof(sentBits));
+    unsigned long start = windowStart();
+    for (int slot = 0; slot < PHOTO_INDEX_CAPACITY; slot += READ_CHUNK) {
+        if (!readSlot(slot, records, READ_CHUNK)) {
+            return false;
+        }
+        for (int i = 0; i < READ_CHUNK; i++) {
+            if (isRecord(&records[i], slot + i) && records[i].seq >= start) {
+                setSent(records[i].seq, records[i].flags & PHOTO_FLAG_SENT);
+            }
+        }
+    }
+    firstUnsent = 0;
+    advanceFirstUnsent();
+
+    // A photo can be on the card without its record if power was lost in between.
+    // One cut short while it was written is deleted, the next photo takes its number.
+    char path[64];
+    indexOpen = true;
+    for (int i = 0; i < ROLL_FORWARD_MAX; i++) {
+        photoPath(path, sizeof(path), newestSeq + 1);
+        File file = SD.open(path, FILE_READ);
+        if (!file) {
+            break;
+        }
+        size_t size = file.size();
+        bool complete = isCompleteJpeg(file);
+        file.close();
+        if (!complete) {
+            SD.remove(path);
+            if (DEBUG_SERIAL_ENABLED) {
+                Serial.printf("Photo index: deleted incomplete %s (%u bytes)\n", path, (unsigned)size);
+            }
+            break;
+        }
+        if (!appendRecords(newestSeq + 1, &size, 1)) {
+            return false;
+        }
+        if (DEBUG_SERIAL_ENABLED) {
+            Serial.printf("Photo index: recovered %s\n", path);
+        }
+    }
+
+    // The card was changed behind our back (erased or copied from elsewhere)
+    if (newestSeq >= oldestSeq) {
+        photoPath(path, sizeof(path), newestSeq);
+        if (!SD.exists(path)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void readStats(PhotoIndexStats* stats) {
+    stats->oldest = oldestSeq <= newestSeq ? oldestSeq : 0;
+    stats->newest = stats->oldest ? newestSeq : 0;
+    stats->count = newestSeq + 1 - oldestSeq;
+    stats->unsent = 0;
+    for (unsigned long seq = firstUnsent; seq <= newestSeq; seq++) {
+        if (!isSent(seq)) {
+            stats->unsent++;
+        }
+    }
+    stats->rebuilt = indexRebuilt;
+}
+
+bool openPhotoIndex() {
+    IndexLock lock;
+    char path[64];
+    indexPath(path, sizeof(path));
+
+    LegacyCounters legacy;
+    readLegacyCounters(&legacy);
+
+    indexOpen = false;
+    indexRebuilt = false;
+    if (SD.exists(path)) {
+        indexFile = SD.open(path, "r+");
+        indexOpen = indexFile && loadIndex();
+    }
+    if (!indexOpen) {
+        indexOpen = rebuildIndex(&legacy);
+    }
+    // Once an index is on the card the counters are stale, a later rebuild must not use them
+    if (indexOpen && legacy.found) {
+        removeLegacyCounters();
+    }
+
+    if (indexOpen && DEBUG_SERIAL_ENABLED) {
+        PhotoIndexStats stats;
+        readStats(&stats);
+        Serial.printf("✓ Photo index: %lu photos (%lu-%lu), %lu unsent\n",
+                      stats.count, stats.oldest, stats.newest, stats.unsent);
+    }
+    return indexOpen;
+}
+
+unsigned long getNextPhotoNumber() {
+    IndexLock lock;
+    return newestSeq + 1;
+}
+
+bool addPhotosToIndex(unsigned long firstSeq, const size_t* sizes, int count) {
+    IndexLock lock;
+    return appendRecords(firstSeq, sizes, count);
+}
+
+int getUnsentPhotoNumbers(unsigned long* seqs, int maxCount) {
+    IndexLock lock;
+    int count = 0;
+    for (unsigned long seq = firstUnsent; seq <= newestSeq && count < maxCount; seq++) {
+        if (!isSent(seq)) {
+            seqs[count++] = seq;
+        }
+    }
+    return count;
+}
+
+bool markPhotoNumberSent(unsigned long seq) {
+    IndexLock lock;
+    if (!indexOpen || seq < windowStart() || seq > newestSeq) {
+        return false;
+    }
+    if (isSent(seq)) {
+        return true;
+    }
+
+    int slot = seq % PHOTO_INDEX_CAPACITY;
+    PhotoRecord record;
+    if (!readSlot(slot, &record, 1) || !isRecord(&record, slot) || record.seq != seq) {
+        return false;
+    }
+    record.flags |= PHOTO_FLAG_SENT;
+    if (!writeSlot(slot, &record)) {
+        return false;
+    }
+    setSent(seq, true);
+    advanceFirstUnsent();
+    return true;
+}
+
+size_t getPhotoSize(unsigned long seq) {
+    IndexLock lock;
+    if (!indexOpen || seq < windowStart() || seq < oldestSeq || seq > newestSeq) {
+        return 0;
+    }
+
+    int slot = seq % PHOTO_INDEX_CAPACITY;
+    PhotoRecord record;
+    if (!readSlot(slot, &record, 1) || !isRecord(&record, slot) || record.seq != seq) {
+        return 0;
+    }
+    return record.size;
+}
+
+unsigned long getOldestPhotoNumber() {
+    IndexLock lock;
+    return oldestSeq <= newestSeq ? oldestSeq : 0;
+}
+
+size_t evictOldestPhoto() {
+    IndexLock lock;
+    if (!indexOpen || oldestSeq > newestSeq) {
+        return 0;
+    }
+
+    char path[64];
+    photoPath(path, sizeof(path), oldestSeq);
+
+    size_t size = 0;
+    int slot = oldestSeq % PHOTO_INDEX_CAPACITY;
+    PhotoRecord record;
+    if (oldestSeq >= windowStart() && readSlot(slot, &record, 1) && isRecord(&record, slot) && record.seq == oldestSeq) {
+        size = record.size;
+    } else {
+        File file = SD.open(path, FILE_READ);
+        if (file) {
+            size = file.size();
+            file.close();
+        }
+    }
+
+    // A photo that is already gone (deleted by hand) is skipped
+    if (!SD.remove(path)) {
+        size = 0;
+    }
+    oldestSeq++;
+    writeHeader();
+    advanceFirstUnsent();
+    return size;
+}
+
+void clearPhotoIndex() {
+    IndexLock lock;
+    if (!indexOpen) {
+        return;
+    }
+    oldestSeq = newestSeq + 1;
+    firstUnsent = oldestSeq;
+    writeHeader();
+}
+
+void getPhotoIndexStats(PhotoIndexStats* stats) {
+    IndexLock lock;
+    readStats(stats);
+}
@@ -0,0 +1,72 @@
+#ifndef PHOTO_INDEX_H
+#define PHOTO_INDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "config.h"
+
+// Index file inside SD_PHOTO_DIR
+#define PHOTO_INDEX_FILE        "index.dat"
+// Records kept in the index ring. Older photos stay on the card and are still
+// evicted by number, they just have no size or sent flag any more (treated as sent).
+#define PHOTO_INDEX_CAPACITY    4096
+
+// Record flags
+#define PHOTO_FLAG_SENT         0x0001
+
+// One record per photo, written at slot (seq % PHOTO_INDEX_CAPACITY).
+// The first 16 bytes of the file hold the header instead.
+struct PhotoRecord {
+    uint32_t seq;           // Photo number (photo_<seq>.jpg), 0 = empty slot
+    uint32_t size;          // JPEG size in bytes
+    uint32_t timestamp;     // time() when saved
+    uint16_t flags;         // PHOTO_FLAG_*
+    uint16_t check;         // Detects torn or foreign records
+};
+
+struct PhotoIndexStats {
+    unsigned long oldest;   // Oldest photo on the card, 0 when empty
+    unsigned long newest;   // Newest photo on the card, 0 when empty
+    unsigned long count;    // Photos on the card
+    unsigned long unsent;   // Photos not sent to Telegram yet
+    bool rebuilt;           // The index was rebuilt from a directory scan at startup
+};
+
+// Load the index from the SD card, repairing it after a crash. The photo directory
+// is only scanned when the index is missing, invalid or no longer matches the card.
+// The index is also the journal of the photo number: photos written after the last
+// index update are found again by number. The first time, the photo number and last
+// sent photo that older versions kept in Preferences are taken over and removed.
+// Every function takes the index lock and can be called from any task.
+bool openPhotoIndex();
+
+// Photo number the next saved photo must use
+unsigned long getNextPhotoNumber();
+
+// Record count photos numbered from firstSeq that are completely written to the card.
+// The records go to the card with one write, so a whole burst costs one index update.
+bool addPhotosToIndex(unsigned long firstSeq, const size_t* sizes, int count);
+
+// Fill seqs with the oldest unsent photo numbers, returns how many
+int getUnsentPhotoNumbers(unsigned long* seqs, int maxCount);
+
+bool markPhotoNumberSent(unsigned long seq);
+
+// Size of a photo from its record, without touching the file. 0 when it has no record.
+size_t getPhotoSize(unsigned long seq);
+
+// Oldest photo number on the card, 0 when there are none
+unsigned long getOldestPhotoNumber();
+
+// Delete the oldest photo. Returns the bytes it took (0 when nothing was deleted).
+size_t evictOldestPhoto();
+
+// Forget every photo after they were erased, numbering continues
+void clearPhotoIndex();
+
+void getPhotoIndexStats(PhotoIndexStats* stats);
+
+// Build the path of a photo file into buf
+void photoPath(char* buf, size_t len, unsigned long seq);
+
+#endif // PHOTO_INDEX_H
@@ -0,0 +1,93 @@
+#include <Arduino.h>
+#include <atomic>
+#include "photo_pool.h"
+
+static_assert(PHOTO_POOL_SLOTS <= 32, "Photo pool slots are tracked in a 32-bit mask");
+
+static uint8_t* slab = NULL;          // PHOTO_POOL_SLOTS slots of slotBytes, allocated once
+static size_t slotBytes = 0;
+// Bit n set = slot n is free. Acquire and release are a single compare-and-swap or
+// fetch_or on this word, so the capture task never waits for the SD task.
+static std::atomic<uint32_t> freeMask(0);
+static std::atomic<int> inUse(0);
+static std::atomic<int> highWater(0);
+static std::atomic<uint32_t> acquiredCount(0);
+static std::atomic<uint32_t> exhaustedCount(0);
+static std::atomic<uint32_t> oversizeCount(0);
+
+bool initPhotoPool(size_t slotSize) {
+    if (slab) {
+        return true;
+    }
+
+    // Keep every slot 4-byte aligned for fast copies
+    slotBytes = (slotSize + 3) & ~(size_t)3;
+    slab = (uint8_t*)ps_malloc(slotBytes * PHOTO_POOL_SLOTS);
+    if (!slab) {
+        slotBytes = 0;
+        return false;
+    }
+
+    freeMask = (PHOTO_POOL_SLOTS == 32) ? 0xFFFFFFFF : ((1UL << PHOTO_POOL_SLOTS) - 1);
+
+    if (DEBUG_SERIAL_ENABLED) {
+        Serial.printf("✓ Photo pool: %d slots x %u bytes in PSRAM\n",
+                      PHOTO_POOL_SLOTS, (unsigned)slotBytes);
+    }
+    return true;
+}
+
+uint8_t* acquirePhotoSlot() {
+    uint32_t mask = freeMask.load();
+    int slot;
+
+    do {
+        if (!mask) {
+            exhaustedCount++;
+            return NULL;
+        }
+        slot = __builtin_ctz(mask);
+        // On failure mask is reloaded and another free slot is tried
+    } while (!freeMask.compare_exchange_weak(mask, mask & ~(1UL << slot)));
+
+    acquiredCount++;
+    int used = ++inUse;
+    int peak = highWater.load();
+    while (used > peak && !highWater.compare_exchange_weak(peak, used)) {
+    }
+
+    return slab + slot * slotBytes;
+}
+
+void releasePhotoSlot(uint8_t* slot) {
+    if (!slot) {
+        return;
+    }
+
+    int index = (slot - slab) / slotBytes;
+    inUse--;
+    freeMask.fetch_or(1UL << index);
+}
+
+uint8_t* storePhoto(const uint8_t* data, size_t len) {
+    if (slab && len > slotBytes) {
+        oversizeCount++;
+        return NULL;
+    }
+
+    uint8_t* slot = acquirePhotoSlot();
+    if (slot) {
+        memcpy(slot, data, len);
+    }
+    return slot;
+}
+
+void getPhotoPoolStats(PhotoPoolStats* stats) {
+    stats->slots = slab ? PHOTO_POOL_SLOTS : 0;
+    stats->slotSize = slotBytes;
+    stats->inUse = inUse;
+    stats->highWater = highWater;
+    stats->acquired = acquiredCount;
+    stats->exhausted = exhaustedCount;
+    stats->oversize = oversizeCount;
+}
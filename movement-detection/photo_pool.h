@@ -0,0 +1,38 @@
+#ifndef PHOTO_POOL_H
+#define PHOTO_POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "config.h"
+
+// Bursts that can be held at once: one being captured while the previous ones are saved
+#define PHOTO_POOL_BURSTS       2
+// Photo slots in the pool (at most 32, slots are tracked in one bitmask)
+#define PHOTO_POOL_SLOTS        (PHOTO_POOL_BURSTS * MAX_PHOTOS_PER_BURST)
+
+struct PhotoPoolStats {
+    int slots;                  // Slots in the pool
+    size_t slotSize;            // Bytes per slot
+    int inUse;                  // Slots acquired right now
+    int highWater;              // Most slots ever in use at once
+    unsigned long acquired;     // Successful acquires since init
+    unsigned long exhausted;    // Acquires that failed because every slot was in use
+    unsigned long oversize;     // Photos dropped because they did not fit in a slot
+};
+
+// Allocate the pool in PSRAM, PHOTO_POOL_SLOTS slots of slotSize bytes.
+// Nothing is allocated or freed after this call.
+bool initPhotoPool(size_t slotSize);
+
+// Take a free slot, NULL when the pool is exhausted. Safe from any task, never blocks.
+uint8_t* acquirePhotoSlot();
+
+// Return a slot taken with acquirePhotoSlot(). Safe from any task, never blocks.
+void releasePhotoSlot(uint8_t* slot);
+
+// Copy a JPEG into a free slot, NULL when the pool is exhausted or the photo is too large
+uint8_t* storePhoto(const uint8_t* data, size_t len);
+
+void getPhotoPoolStats(PhotoPoolStats* stats);
+
+#endif // PHOTO_POOL_H
@@ -3,10 +3,9 @@
 #include "SD.h"
 #include "SPI.h"
 #include "FS.h"
-#include <Preferences.h>
+#include "photo_index.h"
 
 static bool sdCardMounted = false;
-static Preferences preferences;
 
 bool initSDCard() {
     if (!SD_CARD_ENABLED) {
@@ -44,62 +43,6 @@ bool initSDCard() {
 
     sdCardMounted = true;
 
-    // Initialize Preferences for tracking sent photos
-    preferences.begin("motion-cam", false);  // false = read/write mode
-
-    // Scan SD card to find maximum photo number
-    unsigned long maxPhotoNum = 0;
-    File dir = SD.open(SD_PHOTO_DIR);
-    if (!dir) {
-        // Directory doesn't exist yet - will be created below
-        if (DEBUG_SERIAL_ENABLED) {
-            Serial.println("Photo directory doesn't exist yet");
-        }
-    } else if (dir.isDirectory()) {
-        File file = dir.openNextFile();
-        while (file) {
-            String filename = String(file.name());
-
-            // Check for photo_XXXXXX.jpg pattern
-            if (filename.endsWith(".jpg") && filename.startsWith("photo_")) {
-                int startPos = filename.indexOf('_');
-                int endPos = filename.indexOf('.');
-
-                if (startPos > 0 && endPos > startPos) {
-                    String numStr = filename.substring(startPos + 1, endPos);
-                    unsigned long photoNum = numStr.toInt();
-
-                    if (photoNum > maxPhotoNum) {
-                        maxPhotoNum = photoNum;
-                    }
-                }
-            }
-
-            file = dir.openNextFile();
-        }
-        dir.close();
-    }
-
-    // Set photoNum to continue from max found number
-    if (maxPhotoNum > 0) {
-        preferences.putULong("photoNum", maxPhotoNum + 1);
-        preferences.putULong("lastSentNum", maxPhotoNum);
-
-        if (DEBUG_SERIAL_ENABLED) {
-            Serial.printf("Found %lu photos on SD card\n", maxPhotoNum);
-            Serial.printf("Next photo will be: photo_%06lu.jpg\n", maxPhotoNum + 1);
-            Serial.printf("Set lastSentNum to: %lu (all existing photos marked as sent)\n", maxPhotoNum);
-        }
-    } else {
-        // No photos on SD card - start from 1
-        preferences.putULong("photoNum", 1);
-        preferences.putULong("lastSentNum", 0);
-
-        if (DEBUG_SERIAL_ENABLED) {
-            Serial.println("No existing photos found - starting from photo_000001.jpg");
-        }
-    }
-
     // Create photo directory if it doesn't exist
     if (!SD.exists(SD_PHOTO_DIR)) {
         if (SD.mkdir(SD_PHOTO_DIR)) {
@@ -113,6 +56,20 @@ bool initSDCard() {
         }
     }
 
+    // Load the photo index, the directory is only scanned when it has to be rebuilt
+    if (!openPhotoIndex()) {
+        if (DEBUG_SERIAL_ENABLED) {
+            Serial.println("Failed to open photo index");
+        }
+        sdCardMounted = false;
+        return false;
+    }
+
+    // Numbering continues after the newest photo in the index
+    if (DEBUG_SERIAL_ENABLED) {
+        Serial.printf("Next photo will be: photo_%06lu.jpg\n", getNextPhotoNumber());
+    }
+
     if (DEBUG_SERIAL_ENABLED) {
         Serial.println("SD Card initialized successfully");
         printSDCardInfo();
@@ -122,46 +79,70 @@ bool initSDCard() {
 }
 
 bool savePhotoToSD(camera_fb_t* fb) {
-    if (!sdCardMounted || !fb) {
+    if (!fb) {
         return false;
     }
+    return savePhotoBurst(&fb->buf, &fb->len, 1) == 1;
+}
+
+int savePhotoBurst(uint8_t* const* photos, const size_t* sizes, int count) {
+    if (!sdCardMounted || count <= 0) {
+        return 0;
+    }
+    count = min(count, SD_BATCH_MAX_PHOTOS);
 
-    // Get next photo number from Preferences
-    unsigned long photoNumber = preferences.getULong("photoNum", 1);
+    // Photos are numbered consecutively after the newest one in the index
+    unsigned long firstNumber = getNextPhotoNumber();
+    size_t savedSizes[SD_BATCH_MAX_PHOTOS];
+    size_t savedBytes = 0;
+    int saved = 0;
+    unsigned long startTime = millis();
 
-    // Generate filename with sequential number
-    char filename[64];
-    snprintf(filename, sizeof(filename), "%s/photo_%06lu.jpg",
-             SD_PHOTO_DIR, photoNumber);
+    for (int i = 0; i < count; i++) {
+        // Generate filename with sequential number
+        char filename[64];
+        photoPath(filename, sizeof(filename), firstNumber + saved);
 
-    // Open file for writing
-    File file = SD.open(filename, FILE_WRITE);
-    if (!file) {
-        if (DEBUG_SERIAL_ENABLED) {
-            Serial.println("Failed to open file for writing");
+        // Open file for writing
+        File file = SD.open(filename, FILE_WRITE);
+        if (!file) {
+            if (DEBUG_SERIAL_ENABLED) {
+                Serial.printf("Failed to open %s for writing\n", filename);
+            }
+            continue;
         }
-        return false;
-    }
 
-    // Write JPEG data
-    size_t bytesWritten = file.write(fb->buf, fb->len);
-    file.close();
+        // Write JPEG data with a single call, so FatFs extends the cluster chain in one pass
+        // and writes whole sectors as multi-block transfers
+        size_t bytesWritten = file.write(photos[i], sizes[i]);
+        file.close();
 
-    if (bytesWritten != fb->len) {
-        if (DEBUG_SERIAL_ENABLED) {
-            Serial.println("Failed to write complete image");
+        if (bytesWritten != sizes[i]) {
+            if (DEBUG_SERIAL_ENABLED) {
+                Serial.printf("Failed to write complete image %s\n", filename);
+            }
+            // The number is used by the next photo
+            SD.remove(filename);
+            continue;
         }
-        return false;
+
+        savedSizes[saved++] = sizes[i];
+        savedBytes += sizes[i];
     }
 
-    // Increment photo number for next time
-    preferences.putULong("photoNum", photoNumber + 1);
+    // One index update for the whole burst, it also persists the photo number.
+    // If power is lost before this, the photos are found again at startup.
+    if (saved) {
+        addPhotosToIndex(firstNumber, savedSizes, saved);
+    }
 
-    if (DEBUG_SERIAL_ENABLED) {
-        Serial.printf("Photo saved to SD: %s (%d bytes)\n", filename, fb->len);
+    if (DEBUG_SERIAL_ENABLED && saved) {
+        unsigned long elapsed = millis() - startTime;
+        Serial.printf("Photos saved to SD: photo_%06lu-%06lu (%u KB in %lu ms)\n",
+                      firstNumber, firstNumber + saved - 1, (unsigned)(savedBytes / 1024), elapsed);
     }
 
-    return true;
+    return saved;
 }
 
 void printSDCardInfo() {
@@ -195,82 +176,67 @@ bool isSDCardMounted() {
     return sdCardMounted;
 }
 
-// Get list of unsent photos (photoNumber > lastSentNum)
+// Get list of unsent photos, oldest first
 int getUnsentPhotos(String* fileList, int maxFiles) {
     if (!sdCardMounted) {
         return 0;
     }
 
-    // Get last sent photo number from Preferences
-    unsigned long lastSentNum = preferences.getULong("lastSentNum", 0);
-
-    if (DEBUG_SERIAL_ENABLED) {
-        Serial.printf("🔍 getUnsentPhotos: lastSentNum = %lu\n", lastSentNum);
-    }
+    unsigned long seqs[maxFiles];
+    int count = getUnsentPhotoNumbers(seqs, maxFiles);
 
-    File dir = SD.open(SD_PHOTO_DIR);
-    if (!dir || !dir.isDirectory()) {
-        return 0;
+    for (int i = 0; i < count; i++) {
+        char filename[64];
+        photoPath(filename, sizeof(filename), seqs[i]);
+        fileList[i] = filename;
     }
 
-    int count = 0;
-    File file = dir.openNextFile();
-
-    while (file && count < maxFiles) {
-        String filename = String(file.name());
-
-        // Only include .jpg files (photo_XXXXXX.jpg)
-        if (filename.endsWith(".jpg") && filename.startsWith("photo_")) {
-            // Extract number from filename (photo_000001.jpg)
-            int startPos = filename.indexOf('_');
-            int endPos = filename.indexOf('.');
-
-            if (startPos > 0 && endPos > startPos) {
-                String numStr = filename.substring(startPos + 1, endPos);
-                unsigned long photoNum = numStr.toInt();
-
-                // Only include photos newer than last sent
-                if (photoNum > lastSentNum) {
-                    fileList[count] = String(SD_PHOTO_DIR) + "/" + filename;
-                    count++;
-                }
-            }
-        }
-
-        file = dir.openNextFile();
-    }
-
-    dir.close();
     return count;
 }
 
-// Mark photo as sent by updating lastSentNum in Preferences
+// Photo number from a photo_<number>.jpg path, 0 when it has none
+static unsigned long photoNumber(const String& filename) {
+    const char* number = strrchr(filename.c_str(), '_');
+    return number ? strtoul(number + 1, NULL, 10) : 0;
+}
+
+// Mark photo as sent in the photo index
 bool markPhotoAsSent(const String& filename) {
     if (!sdCardMounted) {
         return false;
     }
 
-    // Extract number from filename
-    int startPos = filename.lastIndexOf('_');
-    int endPos = filename.lastIndexOf('.');
-
-    if (startPos > 0 && endPos > startPos) {
-        String numStr = filename.substring(startPos + 1, endPos);
-        unsigned long photoNum = numStr.toInt();
-
-        // Update lastSentNum in Preferences
-        preferences.putULong("lastSentNum", photoNum);
-
+    unsigned long photoNum = photoNumber(filename);
+    if (photoNum && markPhotoNumberSent(photoNum)) {
         if (DEBUG_SERIAL_ENABLED) {
-            Serial.printf("Updated lastSentNum: %lu\n", photoNum);
+            Serial.printf("Marked as sent: %lu\n", photoNum);
         }
-
         return true;
     }
 
     return false;
 }
 
+size_t getPhotoFileSize(const String& filename) {
+    if (!sdCardMounted) {
+        return 0;
+    }
+
+    size_t size = getPhotoSize(photoNumber(filename));
+    if (size) {
+        return size;
+    }
+
+    // Photos older than the index ring have no record any more
+    File file = SD.open(filename.c_str(), FILE_READ);
+    if (!file) {
+        return 0;
+    }
+    size = file.size();
+    file.close();
+    return size;
+}
+
 // Read photo from SD card
 uint8_t* readPhotoFromSD(const String& filename, size_t* size) {
     if (!sdCardMounted) {
@@ -332,6 +298,9 @@ int eraseAllPhotos() {
     }
 
     dir.close();
+
+    // Numbering continues, the index just forgets the erased photos
+    clearPhotoIndex();
     return deletedCount;
 }
 
@@ -350,41 +319,14 @@ String getOldestPhoto() {
         return "";
     }
 
-    File dir = SD.open(SD_PHOTO_DIR);
-    if (!dir || !dir.isDirectory()) {
+    unsigned long oldestNum = getOldestPhotoNumber();
+    if (!oldestNum) {
         return "";
     }
 
-    String oldestFile = "";
-    unsigned long oldestNum = 0xFFFFFFFF;
-
-    File file = dir.openNextFile();
-
-    while (file) {
-        String filename = String(file.name());
-
-        // Only consider .jpg files (photo_XXXXXX.jpg)
-        if (filename.endsWith(".jpg") && filename.startsWith("photo_")) {
-            // Extract number from filename (photo_000001.jpg)
-            int startPos = filename.indexOf('_');
-            int endPos = filename.indexOf('.');
-
-            if (startPos > 0 && endPos > startPos) {
-                String numStr = filename.substring(startPos + 1, endPos);
-                unsigned long photoNum = numStr.toInt();
-
-                if (photoNum < oldestNum) {
-                    oldestNum = photoNum;
-                    oldestFile = String(SD_PHOTO_DIR) + "/" + filename;
-                }
-            }
-        }
-
-        file = dir.openNextFile();
-    }
-
-    dir.close();
-    return oldestFile;
+    char filename[64];
+    photoPath(filename, sizeof(filename), oldestNum);
+    return String(filename);
 }
 
 // Check free space and delete oldest photos if needed (< 2MB free)
@@ -393,7 +335,9 @@ void checkAndManageSpace() {
         return;
     }
 
-    uint64_t freeSpace = (SD.cardSize() - SD.usedBytes()) / (1024 * 1024);  // MB
+    // usedBytes() walks the whole FAT, so it is only read before and after the cleanup
+    uint64_t freeBytes = SD.cardSize() - SD.usedBytes();
+    uint64_t freeSpace = freeBytes / (1024 * 1024);  // MB
 
     if (freeSpace < 2) {
         if (DEBUG_SERIAL_ENABLED) {
@@ -402,26 +346,17 @@ void checkAndManageSpace() {
 
         // Delete oldest photos until we have at least 5MB free
         int deletedCount = 0;
-        while (freeSpace < 5 && deletedCount < 50) {  // Max 50 deletions per cycle
-            String oldestFile = getOldestPhoto();
-
-            if (oldestFile.length() == 0) {
+        while (freeBytes < 5 * 1024 * 1024 && deletedCount < 50) {  // Max 50 deletions per cycle
+            if (!getOldestPhotoNumber()) {
                 break;  // No more photos to delete
             }
 
-            if (deletePhoto(oldestFile)) {
-                deletedCount++;
-                if (DEBUG_SERIAL_ENABLED) {
-                    Serial.printf("Deleted oldest: %s\n", oldestFile.c_str());
-                }
-            } else {
-                break;  // Failed to delete
-            }
-
-            // Recalculate free space
-            freeSpace = (SD.cardSize() - SD.usedBytes()) / (1024 * 1024);
+            // Sizes come from the index, no directory scan per photo
+            freeBytes += evictOldestPhoto();
+            deletedCount++;
         }
 
+        freeSpace = (SD.cardSize() - SD.usedBytes()) / (1024 * 1024);
         if (DEBUG_SERIAL_ENABLED) {
             Serial.printf("✓ Space management: deleted %d photos, %llu MB free\n", deletedCount, freeSpace);
         }
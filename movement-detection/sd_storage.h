@@ -7,21 +7,31 @@
 // Initialize SD card
 bool initSDCard();
 
+// Most photos savePhotoBurst() takes at once (two bursts coalesced by the SD task)
+#define SD_BATCH_MAX_PHOTOS     (MAX_PHOTOS_PER_BURST * 2)
+
 // Save photo to SD card
 bool savePhotoToSD(camera_fb_t* fb);
 
+// Save up to SD_BATCH_MAX_PHOTOS photos with consecutive numbers and a single photo
+// index update. Returns the number of photos saved.
+int savePhotoBurst(uint8_t* const* photos, const size_t* sizes, int count);
+
 // Get SD card info
 void printSDCardInfo();
 
 // Check if SD card is mounted
 bool isSDCardMounted();
 
-// Get list of unsent photos from SD card
+// Get list of unsent photos from the photo index, oldest first
 int getUnsentPhotos(String* fileList, int maxFiles);
 
-// Mark photo as sent (rename with .sent suffix)
+// Mark photo as sent in the photo index
 bool markPhotoAsSent(const String& filename);
 
+// Size of a saved photo, taken from the photo index when it has a record
+size_t getPhotoFileSize(const String& filename);
+
 // Read photo from SD card
 uint8_t* readPhotoFromSD(const String& filename, size_t* size);
 
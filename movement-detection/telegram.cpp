@@ -1,5 +1,8 @@
 #include <Arduino.h>
 #include "telegram.h"
+#include "telegram_session.h"
+#include "multipart.h"
+#include "sd_storage.h"
 #include <WiFi.h>
 #include <WiFiClient.h>
 #include <WiFiClientSecure.h>
@@ -10,7 +13,6 @@
 
 static WiFiClientSecure client;
 static UniversalTelegramBot* bot = NULL;
-static WiFiClientSecure secureClient;
 
 // Buffer for photo data
 static const uint8_t* photoBuffer = NULL;
@@ -148,14 +150,19 @@ bool sendMotionAlert(camera_fb_t* fb) {
     return success;
 }
 
-// Helper function to create multipart form data boundary
-String generateBoundary() {
-    return "----WebKitFormBoundary" + String(random(100000, 999999));
+// snprintf at len in buf. The returned length stops at the last byte of buf, so the
+// space left (size - len) never underflows when the output was cut short.
+static size_t appendf(char* buf, size_t size, size_t len, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf + len, size - len, format, args);
+    va_end(args);
+    return n < 0 ? len : min(len + n, size - 1);
 }
 
 // Send multiple photos as a batch using sendMediaGroup with direct WiFiClientSecure
 bool sendPhotosBatch(String* filenames, int count) {
-    if (!TELEGRAM_ENABLED || count == 0 || count > 10) {
+    if (!TELEGRAM_ENABLED || count == 0 || count > TELEGRAM_MAX_BATCH_SIZE) {
         return false;
     }
 
@@ -163,147 +170,79 @@ bool sendPhotosBatch(String* filenames, int count) {
         Serial.printf("📸 Sending media group of %d photos...\n", count);
     }
 
-    // Connect to Telegram API
-    secureClient.setInsecure();
-    if (!secureClient.connect("api.telegram.org", 443)) {
-        if (DEBUG_SERIAL_ENABLED) {
-            Serial.println("✗ Connection failed");
-        }
-        return false;
-    }
-
-    String boundary = generateBoundary();
-    String path = "/bot" + String(TELEGRAM_BOT_TOKEN) + "/sendMediaGroup";
+    char boundary[MULTIPART_BOUNDARY_SIZE];
+    multipartBoundary(boundary);
 
     // Build media array (NO escaping - it's a form field, not nested JSON)
-    String mediaArray = "[";
+    char media[768];
+    size_t len = appendf(media, sizeof(media), 0, "[");
     for (int i = 0; i < count; i++) {
-        if (i > 0) mediaArray += ",";
-        mediaArray += "{\"type\":\"photo\",\"media\":\"attach://photo" + String(i) + "\"";
+        len = appendf(media, sizeof(media), len, "%s{\"type\":\"photo\",\"media\":\"attach://photo%d\"",
+                      i > 0 ? "," : "", i);
         if (i == 0) {
-            mediaArray += ",\"caption\":\"🚨 Motion detected! (" + String(count) + " photos)\"";
+            len = appendf(media, sizeof(media), len, ",\"caption\":\"🚨 Motion detected! (%d photos)\"", count);
         }
-        mediaArray += "}";
+        len = appendf(media, sizeof(media), len, "}");
     }
-    mediaArray += "]";
-
-    // Calculate content length
-    size_t contentLength = 0;
-
-    // chat_id part
-    String chatIdPart = "--" + boundary + "\r\n";
-    chatIdPart += "Content-Disposition: form-data; name=\"chat_id\"\r\n\r\n";
-    chatIdPart += String(TELEGRAM_CHAT_ID) + "\r\n";
-    contentLength += chatIdPart.length();
-
-    // disable_notification part (silent mode)
-    String notificationPart = "--" + boundary + "\r\n";
-    notificationPart += "Content-Disposition: form-data; name=\"disable_notification\"\r\n\r\n";
-    notificationPart += "true\r\n";
-    contentLength += notificationPart.length();
-
-    // media part
-    String mediaPart = "--" + boundary + "\r\n";
-    mediaPart += "Content-Disposition: form-data; name=\"media\"\r\n\r\n";
-    mediaPart += mediaArray + "\r\n";
-    contentLength += mediaPart.length();
-
-    // Photo parts
-    for (int i = 0; i < count; i++) {
-        File file = SD.open(filenames[i].c_str(), FILE_READ);
-        if (!file) {
-            secureClient.stop();
-            return false;
+    len = appendf(media, sizeof(media), len, "]");
+    if (len == sizeof(media) - 1) {
+        // Cut short: Telegram would reject the JSON, and the photos stay unsent
+        if (DEBUG_SERIAL_ENABLED) {
+            Serial.println("✗ Media group description too long");
         }
-
-        size_t fileSize = file.size();
-        file.close();
-
-        String photoPart = "--" + boundary + "\r\n";
-        photoPart += "Content-Disposition: form-data; name=\"photo" + String(i) + "\"; filename=\"photo.jpg\"\r\n";
-        photoPart += "Content-Type: image/jpeg\r\n\r\n";
-
-        contentLength += photoPart.length();
-        contentLength += fileSize;
-        contentLength += 2; // \r\n
+        return false;
     }
 
-    // End boundary
-    String endBoundary = "--" + boundary + "--\r\n";
-    contentLength += endBoundary.length();
-
-    // Send HTTP headers
-    secureClient.print("POST " + path + " HTTP/1.1\r\n");
-    secureClient.print("Host: api.telegram.org\r\n");
-    secureClient.print("Content-Type: multipart/form-data; boundary=" + boundary + "\r\n");
-    secureClient.print("Content-Length: " + String(contentLength) + "\r\n");
-    secureClient.print("Connection: close\r\n\r\n");
-
-    // Send body parts
-    secureClient.print(chatIdPart);
-    secureClient.print(notificationPart);
-    secureClient.print(mediaPart);
-
-    // Send photos
+    // chat_id, disable_notification (silent mode), media, then the photos
+    char photoNames[TELEGRAM_MAX_BATCH_SIZE][8];
+    MultipartPart parts[3 + TELEGRAM_MAX_BATCH_SIZE] = {
+        { "chat_id", TELEGRAM_CHAT_ID },
+        { "disable_notification", "true" },
+        { "media", media },
+    };
     for (int i = 0; i < count; i++) {
-        String photoPart = "--" + boundary + "\r\n";
-        photoPart += "Content-Disposition: form-data; name=\"photo" + String(i) + "\"; filename=\"photo.jpg\"\r\n";
-        photoPart += "Content-Type: image/jpeg\r\n\r\n";
-        secureClient.print(photoPart);
-
-        // Stream photo data
-        File file = SD.open(filenames[i].c_str(), FILE_READ);
-        if (file) {
-            uint8_t buf[512];
-            while (file.available()) {
-                size_t len = file.read(buf, sizeof(buf));
-                secureClient.write(buf, len);
-            }
-            file.close();
-            secureClient.print("\r\n");
-
-            if (DEBUG_SERIAL_ENABLED) {
-                Serial.printf("✓ Sent photo %d\n", i + 1);
-            }
+        // Sizes come from the photo index, the files are only opened to stream them
+        size_t size = getPhotoFileSize(filenames[i]);
+        if (!size) {
+            return false;
         }
+        snprintf(photoNames[i], sizeof(photoNames[i]), "photo%d", i);
+        parts[3 + i] = { photoNames[i], NULL, "photo.jpg", "image/jpeg", filenames[i].c_str(), size };
     }
-
-    secureClient.print(endBoundary);
-
-    // Wait for response
-    unsigned long timeout = millis();
-    while (secureClient.connected() && !secureClient.available()) {
-        if (millis() - timeout > 30000) {
-            secureClient.stop();
-            if (DEBUG_SERIAL_ENABLED) {
-                Serial.println("✗ Timeout");
-            }
+    size_t contentLength = multipartContentLength(boundary, parts, 3 + count);
+
+    char head[256];
+    snprintf(head, sizeof(head),
+             "POST /bot%s/sendMediaGroup HTTP/1.1\r\n"
+             "Host: " TELEGRAM_API_HOST "\r\n"
+             "Content-Type: multipart/form-data; boundary=%s\r\n"
+             "Content-Length: %u\r\n"
+             "Connection: keep-alive\r\n\r\n",
+             TELEGRAM_BOT_TOKEN, boundary, (unsigned)contentLength);
+
+    // Reuse the keep-alive connection of the previous batch, a TLS handshake takes seconds.
+    // When the server had closed it while idle, the batch goes once more on a new connection.
+    String response;
+    int httpCode;
+    do {
+        WiFiClientSecure* client = telegramSessionBegin();
+        if (!client) {
             return false;
         }
-        delay(10);
-    }
-
-    // Read response
-    String response = "";
-    bool headersEnded = false;
-    int httpCode = 0;
 
-    while (secureClient.available()) {
-        String line = secureClient.readStringUntil('\n');
-
-        if (!headersEnded) {
-            if (line.startsWith("HTTP/1.1")) {
-                httpCode = line.substring(9, 12).toInt();
-            }
-            if (line == "\r") {
-                headersEnded = true;
+        if (!multipartSend(*client, head, boundary, parts, 3 + count)) {
+            // The request is incomplete, the photos stay unsent for the next batch
+            if (DEBUG_SERIAL_ENABLED) {
+                Serial.println("✗ Connection lost while sending");
             }
-        } else {
-            response += line;
+            telegramSessionFail();
+            httpCode = 0;
+            continue;
         }
-    }
 
-    secureClient.stop();
+        // Wait for response, the connection stays open for the next batch
+        httpCode = telegramSessionReadResponse(&response, 30000);
+    } while (!httpCode && telegramSessionRetry());
 
     if (DEBUG_SERIAL_ENABLED) {
         Serial.printf("HTTP Code: %d\n", httpCode);
@@ -0,0 +1,232 @@
+#include "telegram_session.h"
+
+static WiFiClientSecure secureClient;
+static bool connectionOpen = false;
+static unsigned long lastUsed = 0;         // millis() when the last response was read
+static unsigned long backoffMs = 0;        // 0 = no failure since the last success
+static unsigned long retryAt = 0;          // millis() before which no connect is tried
+static bool connectionReused = false;      // The current request went to a kept connection
+static bool responseStarted = false;       // A byte of its response was read
+static bool retryStale = false;            // Set by telegramSessionFail(), see telegramSessionRetry()
+static TelegramSessionStats stats;
+
+static void closeConnection() {
+    if (connectionOpen) {
+        secureClient.stop();
+        connectionOpen = false;
+    }
+}
+
+WiFiClientSecure* telegramSessionBegin() {
+    // A connection idle for too long may already be closed on the server side
+    if (connectionOpen && (!secureClient.connected() || millis() - lastUsed > TELEGRAM_IDLE_TIMEOUT_MS)) {
+        closeConnection();
+    }
+
+    retryStale = false;
+    responseStarted = false;
+    connectionReused = connectionOpen;
+    if (connectionOpen) {
+        stats.reuses++;
+        return &secureClient;
+    }
+
+    if (backoffMs && (long)(millis() - retryAt) < 0) {
+        if (DEBUG_SERIAL_ENABLED) {
+            Serial.printf("⏳ Telegram reconnect in %lu ms\n", retryAt - millis());
+        }
+        return NULL;
+    }
+
+    unsigned long start = millis();
+    secureClient.setInsecure();
+    if (!secureClient.connect(TELEGRAM_API_HOST, TELEGRAM_API_PORT)) {
+        if (DEBUG_SERIAL_ENABLED) {
+            Serial.println("✗ Connection failed");
+        }
+        telegramSessionFail();
+        return NULL;
+    }
+
+    connectionOpen = true;
+    stats.connects++;
+    stats.lastConnectMs = millis() - start;
+    if (DEBUG_SERIAL_ENABLED) {
+        Serial.printf("✓ Telegram connected (TLS handshake %lu ms)\n", stats.lastConnectMs);
+    }
+    return &secureClient;
+}
+
+static int readByte(unsigned long deadline) {
+    while (!secureClient.available()) {
+        if (!secureClient.connected() || (long)(millis() - deadline) > 0) {
+            return -1;
+        }
+        delay(1);
+    }
+    responseStarted = true;
+    return secureClient.read();
+}
+
+// Read one line without its CRLF. Returns its length, -1 on timeout or disconnect.
+static int readLine(char* buf, size_t len, unsigned long deadline) {
+    size_t n = 0;
+    while (true) {
+        int c = readByte(deadline);
+        if (c < 0) {
+            return -1;
+        }
+        if (c == '\n') {
+            break;
+        }
+        if (c != '\r' && n < len - 1) {
+            buf[n++] = c;
+        }
+    }
+    buf[n] = 0;
+    return n;
+}
+
+// Read len body bytes, keeping the start of them in body
+static bool readBody(size_t len, String* body, unsigned long deadline) {
+    uint8_t buf[256];
+    while (len) {
+        if (!secureClient.available()) {
+            if (!secureClient.connected() || (long)(millis() - deadline) > 0) {
+                return false;
+            }
+            delay(1);
+            continue;
+        }
+        int n = secureClient.read(buf, min(len, sizeof(buf)));
+        if (n <= 0) {
+            continue;
+        }
+        if (body && body->length() < TELEGRAM_MAX_RESPONSE_BODY) {
+            body->concat((const char*)buf, min((size_t)n, TELEGRAM_MAX_RESPONSE_BODY - body->length()));
+        }
+        len -= n;
+    }
+    return true;
+}
+
+int telegramSessionReadResponse(String* body, unsigned long timeoutMs) {
+    unsigned long deadline = millis() + timeoutMs;
+    char line[256];
+
+    if (body) {
+        *body = "";
+    }
+
+    // Status line
+    if (readLine(line, sizeof(line), deadline) < 0 || strncmp(line, "HTTP/1.", 7) != 0) {
+        if (DEBUG_SERIAL_ENABLED) {
+            Serial.println("✗ Timeout");
+        }
+        telegramSessionFail();
+        return 0;
+    }
+    int httpCode = atoi(line + 9);
+    bool keepAlive = line[7] == '1';    // HTTP/1.1 keeps the connection by default
+
+    // Headers
+    long contentLength = -1;
+    bool chunked = false;
+    while (true) {
+        int n = readLine(line, sizeof(line), deadline);
+        if (n < 0) {
+            telegramSessionFail();
+            return 0;
+        }
+        if (n == 0) {
+            break;
+        }
+        if (!strncasecmp(line, "Content-Length:", 15)) {
+            contentLength = atol(line + 15);
+        } else if (!strncasecmp(line, "Transfer-Encoding:", 18) && strcasestr(line + 18, "chunked")) {
+            chunked = true;
+        } else if (!strncasecmp(line, "Connection:", 11)) {
+            keepAlive = !strcasestr(line + 11, "close");
+        }
+    }
+
+    // Body: the whole of it has to be read or the next response on this connection is garbage
+    bool complete;
+    if (chunked) {
+        complete = true;
+        while (complete) {
+            complete = readLine(line, sizeof(line), deadline) >= 0;
+            size_t chunkSize = strtoul(line, NULL, 16);
+            if (!complete || !chunkSize) {
+                break;
+            }
+            complete = readBody(chunkSize, body, deadline) && readLine(line, sizeof(line), deadline) >= 0;
+        }
+        // Trailers end with an empty line
+        while (complete) {
+            int n = readLine(line, sizeof(line), deadline);
+            complete = n >= 0;
+            if (n == 0) {
+                break;
+            }
+        }
+    } else if (contentLength >= 0) {
+        complete = readBody(contentLength, body, deadline);
+    } else {
+        // No length: the body ends when the server closes the connection
+        readBody(SIZE_MAX, body, deadline);
+        complete = true;
+        keepAlive = false;
+    }
+
+    if (!complete) {
+        telegramSessionFail();
+        return 0;
+    }
+
+    stats.requests++;
+    backoffMs = 0;
+    stats.backoffMs = 0;
+    lastUsed = millis();
+    if (!keepAlive) {
+        closeConnection();
+    }
+    return httpCode;
+}
+
+void telegramSessionFail() {
+    // The server closes an idle connection on its own, the client only sees it once it sent
+    // the next request. That is no failure of the server, a new connection gets the request.
+    if (connectionOpen && connectionReused && !responseStarted && !secureClient.connected()) {
+        closeConnection();
+        connectionReused = false;
+        retryStale = true;
+        stats.staleRetries++;
+        if (DEBUG_SERIAL_ENABLED) {
+            Serial.println("↻ Kept connection was closed by the server, reconnecting");
+        }
+        return;
+    }
+
+    closeConnection();
+    stats.failures++;
+
+    backoffMs = backoffMs ? min(backoffMs * 2, (unsigned long)TELEGRAM_BACKOFF_MAX_MS) : TELEGRAM_BACKOFF_MIN_MS;
+    // Jitter keeps retries from lining up with the batch interval
+    retryAt = millis() + backoffMs + random(backoffMs / 4);
+    stats.backoffMs = backoffMs;
+}
+
+bool telegramSessionRetry() {
+    bool retry = retryStale;
+    retryStale = false;
+    return retry;
+}
+
+void telegramSessionClose() {
+    closeConnection();
+}
+
+void getTelegramSessionStats(TelegramSessionStats* out) {
+    *out = stats;
+}
@@ -0,0 +1,52 @@
+#ifndef TELEGRAM_SESSION_H
+#define TELEGRAM_SESSION_H
+
+#include <Arduino.h>
+#include <WiFiClientSecure.h>
+#include "config.h"
+
+#define TELEGRAM_API_HOST           "api.telegram.org"
+#define TELEGRAM_API_PORT           443
+// Close an unused connection before the server drops it on its side
+#define TELEGRAM_IDLE_TIMEOUT_MS    30000
+// Reconnect delay after a failure, doubled on every failure in a row
+#define TELEGRAM_BACKOFF_MIN_MS     2000
+#define TELEGRAM_BACKOFF_MAX_MS     120000
+// Longest response body kept for logging, the rest is read and dropped
+#define TELEGRAM_MAX_RESPONSE_BODY  1024
+
+struct TelegramSessionStats {
+    unsigned long connects;         // TLS handshakes
+    unsigned long reuses;           // Requests sent over an already open connection
+    unsigned long requests;         // Requests that got a complete response
+    unsigned long failures;         // Connects or requests that failed
+    unsigned long staleRetries;     // Requests sent again after a kept connection turned out closed
+    unsigned long lastConnectMs;    // Duration of the last handshake
+    unsigned long backoffMs;        // Current reconnect delay, 0 when healthy
+};
+
+// Connected client for the next request: the open keep-alive connection when it is
+// still usable, otherwise a new one. NULL on failure or while backing off after one.
+WiFiClientSecure* telegramSessionBegin();
+
+// Read one complete response for the request sent on the client from telegramSessionBegin().
+// Returns the HTTP status code, 0 on failure. The connection stays open unless the server
+// asked to close it. body (optional) gets up to TELEGRAM_MAX_RESPONSE_BODY bytes.
+int telegramSessionReadResponse(String* body, unsigned long timeoutMs);
+
+// The request failed: drop the connection and back off before the next connect. A kept
+// connection the server had already closed is only dropped, see telegramSessionRetry().
+void telegramSessionFail();
+
+// True once after telegramSessionFail() found the request went to a kept connection the
+// server closed while it was idle, before any response: send it again right away, the next
+// telegramSessionBegin() opens a new connection without backing off. A request that fails
+// on that new connection backs off, so it is sent at most twice.
+bool telegramSessionRetry();
+
+// Close the connection, e.g. when WiFi went down
+void telegramSessionClose();
+
+void getTelegramSessionStats(TelegramSessionStats* stats);
+
+#endif // TELEGRAM_SESSION_H
@@ -10,6 +10,7 @@
 #include "FS.h"
 #include "SD.h"
 #include "SPI.h"
+#include <Preferences.h>
 
 // SPI pins for ESP32-S3 SPK (from schematic)
 #define SD_CS    2   // CD/DAT3 (CS)
@@ -21,6 +22,12 @@
 #define TEST_FILE_PATH "/test.txt"
 #define TEST_DIR_PATH "/testdir"
 
+// Write benchmark: a motion burst of photo-sized files (SVGA JPEG at quality 12)
+#define BENCH_DIR_PATH      "/benchdir"
+#define BENCH_PHOTO_SIZE    (60 * 1024)
+#define BENCH_PHOTO_COUNT   10
+#define BENCH_INDEX_PATH    BENCH_DIR_PATH "/photos.idx"
+
 void setup() {
     Serial.begin(115200);
     delay(1000);
@@ -62,6 +69,7 @@ void setup() {
 
     runDiagnostics();
     runTests();
+    runWriteBenchmark();
 }
 
 void runDiagnostics() {
@@ -221,6 +229,117 @@ void runTests() {
     Serial.println("========================================");
 }
 
+// Write one burst of photo files. chunkSize = 0 writes every file with a single call.
+// syncCounter stores a counter in NVS after every file, like a per-photo sequence number.
+// indexBurst writes a 16-byte record per photo to an index file after the last one, in one
+// write and flush, as movement-detection's addPhotosToIndex() does after a burst. The index
+// file is created before the burst, the sketch keeps it open.
+void benchBurst(const char* label, const uint8_t* photo, size_t chunkSize, bool syncCounter, bool indexBurst = false) {
+    File index;
+    if (indexBurst) {
+        index = SD.open(BENCH_INDEX_PATH, FILE_WRITE);
+        uint32_t header[4] = { 0 };
+        if (!index || index.write((const uint8_t*)header, sizeof(header)) != sizeof(header)) {
+            Serial.printf("✗ Failed to create %s\n", BENCH_INDEX_PATH);
+            return;
+        }
+        index.flush();
+    }
+    Preferences prefs;
+    if (syncCounter) {
+        prefs.begin("sd-bench", false);
+    }
+
+    unsigned long maxLatency = 0;
+    unsigned long start = micros();
+
+    for (int i = 0; i < BENCH_PHOTO_COUNT; i++) {
+        unsigned long fileStart = micros();
+        char path[48];
+        snprintf(path, sizeof(path), "%s/photo_%06d.jpg", BENCH_DIR_PATH, i);
+
+        File file = SD.open(path, FILE_WRITE);
+        if (!file) {
+            Serial.printf("✗ Failed to open %s\n", path);
+            break;
+        }
+        size_t step = chunkSize ? chunkSize : BENCH_PHOTO_SIZE;
+        for (size_t offset = 0; offset < BENCH_PHOTO_SIZE; offset += step) {
+            file.write(photo + offset, min(step, (size_t)BENCH_PHOTO_SIZE - offset));
+        }
+        file.close();
+
+        if (syncCounter) {
+            prefs.putULong("photoNum", i + 1);
+        }
+        if (indexBurst && i == BENCH_PHOTO_COUNT - 1) {
+            uint32_t records[BENCH_PHOTO_COUNT][4];
+            for (int r = 0; r < BENCH_PHOTO_COUNT; r++) {
+                records[r][0] = r + 1;
+                records[r][1] = BENCH_PHOTO_SIZE;
+                records[r][2] = millis();
+                records[r][3] = 0;
+            }
+            index.seek(sizeof(records[0]));
+            index.write((const uint8_t*)records, sizeof(records));
+            index.flush();
+        }
+
+        unsigned long latency = micros() - fileStart;
+        if (latency > maxLatency) {
+            maxLatency = latency;
+        }
+    }
+
+    unsigned long elapsed = micros() - start;
+    if (syncCounter) {
+        prefs.end();
+    }
+    if (indexBurst) {
+        index.close();
+        SD.remove(BENCH_INDEX_PATH);
+    }
+
+    Serial.printf("  %-30s %6lu KB/s  %5lu ms/photo  max %5lu ms\n", label,
+                  (unsigned long)((uint64_t)BENCH_PHOTO_SIZE * BENCH_PHOTO_COUNT * 1000000 / 1024 / elapsed),
+                  elapsed / 1000 / BENCH_PHOTO_COUNT, maxLatency / 1000);
+
+    for (int i = 0; i < BENCH_PHOTO_COUNT; i++) {
+        char path[48];
+        snprintf(path, sizeof(path), "%s/photo_%06d.jpg", BENCH_DIR_PATH, i);
+        SD.remove(path);
+    }
+}
+
+void runWriteBenchmark() {
+    Serial.println("\n--- PHOTO WRITE BENCHMARK ---");
+    Serial.printf("%d files x %d KB per run\n\n", BENCH_PHOTO_COUNT, BENCH_PHOTO_SIZE / 1024);
+
+    // Photo buffers live in PSRAM on the camera sketches
+    uint8_t* photo = (uint8_t*)ps_malloc(BENCH_PHOTO_SIZE);
+    if (!photo) {
+        photo = (uint8_t*)malloc(BENCH_PHOTO_SIZE);
+    }
+    if (!photo) {
+        Serial.println("✗ Not enough memory for the benchmark");
+        return;
+    }
+    for (int i = 0; i < BENCH_PHOTO_SIZE; i++) {
+        photo[i] = (uint8_t)(i * 7 + (i >> 9));
+    }
+
+    SD.mkdir(BENCH_DIR_PATH);
+    benchBurst("single write + NVS counter", photo, 0, true);
+    benchBurst("512 B writes", photo, 512, false);
+    benchBurst("4 KB writes", photo, 4096, false);
+    benchBurst("32 KB writes", photo, 32768, false);
+    benchBurst("single write per file + index", photo, 0, false, true);
+    SD.rmdir(BENCH_DIR_PATH);
+
+    free(photo);
+    Serial.println("-----------------------------\n");
+}
+
 void loop() {
     // Nothing to do in loop
     delay(1000);
@@ -0,0 +1,239 @@
+#include <Arduino.h>
+#include "framehub.h"
+#include "img_converters.h"
+
+#define FRAME_HUB_TASK_STACK    8192
+#define FRAME_HUB_TASK_PRIO     5
+
+struct HubSubscriber {
+    bool used;
+    uint32_t lastSeq;               // Sequence number of the last frame handed out
+    uint32_t delivered;
+    uint32_t dropped;
+    SemaphoreHandle_t ready;        // Given by the capture task for every new frame
+};
+
+static SemaphoreHandle_t hubLock = NULL;
+static SemaphoreHandle_t frameFree = NULL;   // Given whenever a frame slot becomes free
+static TaskHandle_t hubTaskHandle = NULL;
+static HubFrame frames[FRAME_HUB_MAX_FRAMES];
+static HubSubscriber subs[FRAME_HUB_MAX_SUBS];
+static HubFrame *latest = NULL;              // Newest frame, the hub holds one reference to it
+static volatile uint32_t numSubs = 0;
+static uint32_t frameSeq = 0;
+static uint32_t inFlight = 0;
+static uint32_t inFlightMax = 0;
+static uint32_t delivered = 0;
+static uint32_t dropped = 0;
+
+static HubFrame *allocFrame() {
+    HubFrame *frame = NULL;
+
+    xSemaphoreTake(hubLock, portMAX_DELAY);
+    for (int i = 0; i < FRAME_HUB_MAX_FRAMES; i++) {
+        if (!frames[i].refs) {
+            frame = &frames[i];
+            memset(frame, 0, sizeof(*frame));
+            frame->refs = 1;
+            if (++inFlight > inFlightMax) {
+                inFlightMax = inFlight;
+            }
+            break;
+        }
+    }
+    xSemaphoreGive(hubLock);
+    return frame;
+}
+
+void frameHubRelease(HubFrame *frame) {
+    if (!frame) {
+        return;
+    }
+
+    // Once only one reference is left the frame is no longer the latest one,
+    // so nobody can take a new reference while its buffer is being returned.
+    xSemaphoreTake(hubLock, portMAX_DELAY);
+    bool last = frame->refs == 1;
+    if (!last) {
+        frame->refs--;
+    }
+    xSemaphoreGive(hubLock);
+    if (!last) {
+        return;
+    }
+
+    if (frame->fb) {
+        esp_camera_fb_return(frame->fb);
+    } else {
+        free((void *)frame->buf);
+    }
+
+    xSemaphoreTake(hubLock, portMAX_DELAY);
+    frame->refs = 0;
+    inFlight--;
+    xSemaphoreGive(hubLock);
+    xSemaphoreGive(frameFree);
+}
+
+// Capture task: grabs every frame once and publishes it to all subscribers
+static void frameHubTask(void *parameter) {
+    while (true) {
+        if (!numSubs) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        HubFrame *frame = allocFrame();
+        if (!frame) {
+            // Every slot is still being sent by a slow client
+            xSemaphoreTake(frameFree, pdMS_TO_TICKS(100));
+            continue;
+        }
+
+        camera_fb_t *fb = esp_camera_fb_get();
+        if (!fb) {
+            Serial.println("Camera capture failed");
+            frameHubRelease(frame);
+            continue;
+        }
+        frame->timestamp = fb->timestamp;
+        if (fb->format != PIXFORMAT_JPEG) {
+            uint8_t *jpgBuf = NULL;
+            size_t jpgBufLen = 0;
+            bool jpegConverted = frame2jpg(fb, 80, &jpgBuf, &jpgBufLen);
+            esp_camera_fb_return(fb);
+            if (!jpegConverted) {
+                Serial.println("JPEG compression failed");
+                frameHubRelease(frame);
+                continue;
+            }
+            frame->buf = jpgBuf;
+            frame->len = jpgBufLen;
+        } else {
+            frame->fb = fb;
+            frame->buf = fb->buf;
+            frame->len = fb->len;
+        }
+
+        HubFrame *old = frame;
+        xSemaphoreTake(hubLock, portMAX_DELAY);
+        if (numSubs) {
+            frame->seq = ++frameSeq;
+            old = latest;
+            latest = frame;
+            for (int i = 0; i < FRAME_HUB_MAX_SUBS; i++) {
+                if (subs[i].used) {
+                    xSemaphoreGive(subs[i].ready);
+                }
+            }
+        }
+        xSemaphoreGive(hubLock);
+        frameHubRelease(old);
+    }
+}
+
+bool startFrameHub() {
+    if (hubTaskHandle) {
+        return true;
+    }
+
+    hubLock = xSemaphoreCreateMutex();
+    frameFree = xSemaphoreCreateBinary();
+    if (!hubLock || !frameFree) {
+        return false;
+    }
+    for (int i = 0; i < FRAME_HUB_MAX_SUBS; i++) {
+        subs[i].ready = xSemaphoreCreateBinary();
+        if (!subs[i].ready) {
+            return false;
+        }
+    }
+    if (xTaskCreate(frameHubTask, "FrameHub", FRAME_HUB_TASK_STACK, NULL, FRAME_HUB_TASK_PRIO, &hubTaskHandle) != pdPASS) {
+        Serial.println("Failed to create frame hub task!");
+        return false;
+    }
+    return true;
+}
+
+HubSubscriber *frameHubSubscribe() {
+    HubSubscriber *sub = NULL;
+
+    xSemaphoreTake(hubLock, portMAX_DELAY);
+    for (int i = 0; i < FRAME_HUB_MAX_SUBS; i++) {
+        if (!subs[i].used) {
+            sub = &subs[i];
+            sub->used = true;
+            sub->lastSeq = 0;
+            sub->delivered = 0;
+            sub->dropped = 0;
+            xSemaphoreTake(sub->ready, 0);
+            numSubs++;
+            break;
+        }
+    }
+    xSemaphoreGive(hubLock);
+
+    if (sub) {
+        xTaskNotifyGive(hubTaskHandle);
+    }
+    return sub;
+}
+
+void frameHubUnsubscribe(HubSubscriber *sub) {
+    HubFrame *old = NULL;
+
+    if (!sub) {
+        return;
+    }
+
+    xSemaphoreTake(hubLock, portMAX_DELAY);
+    Serial.printf("Stream client done: %u frames sent, %u dropped\n", (unsigned)sub->delivered, (unsigned)sub->dropped);
+    sub->used = false;
+    // Hand the buffer back to the camera when nobody is watching
+    if (!--numSubs) {
+        old = latest;
+        latest = NULL;
+    }
+    xSemaphoreGive(hubLock);
+    frameHubRelease(old);
+}
+
+HubFrame *frameHubGet(HubSubscriber *sub, TickType_t timeout) {
+    TimeOut_t timeOut;
+
+    vTaskSetTimeOutState(&timeOut);
+    while (true) {
+        xSemaphoreTake(hubLock, portMAX_DELAY);
+        HubFrame *frame = latest;
+        if (frame && frame->seq != sub->lastSeq) {
+            frame->refs++;
+            if (sub->lastSeq) {
+                uint32_t skipped = frame->seq - sub->lastSeq - 1;
+                sub->dropped += skipped;
+                dropped += skipped;
+            }
+            sub->lastSeq = frame->seq;
+            sub->delivered++;
+            delivered++;
+            xSemaphoreGive(hubLock);
+            return frame;
+        }
+        xSemaphoreGive(hubLock);
+
+        if (xTaskCheckForTimeOut(&timeOut, &timeout) == pdTRUE) {
+            return NULL;
+        }
+        xSemaphoreTake(sub->ready, timeout);
+    }
+}
+
+void getFrameHubStats(FrameHubStats *stats) {
+    xSemaphoreTake(hubLock, portMAX_DELAY);
+    stats->frames = frameSeq;
+    stats->subs = numSubs;
+    stats->inFlight = inFlight;
+    stats->inFlightMax = inFlightMax;
+    stats->delivered = delivered;
+    stats->dropped = dropped;
+    xSemaphoreGive(hubLock);
+}
@@ -0,0 +1,47 @@
+#ifndef FRAMEHUB_H
+#define FRAMEHUB_H
+
+#include "esp_camera.h"
+
+#define FRAME_HUB_MAX_SUBS      4   // Concurrent stream clients
+#define FRAME_HUB_MAX_FRAMES    3   // Frames referenced at once: the latest one plus those still being sent
+
+// A captured JPEG frame shared by every subscriber, the buffer is read only.
+// It goes back to the camera (or is freed) when the last reference is released.
+struct HubFrame {
+    const uint8_t *buf;
+    size_t len;
+    struct timeval timestamp;
+    uint32_t seq;                   // Capture sequence number, starts at 1
+
+    camera_fb_t *fb;                // Backing camera frame buffer, NULL when buf was converted to JPEG
+    uint32_t refs;
+};
+
+struct HubSubscriber;
+
+struct FrameHubStats {
+    uint32_t frames;                // Frames captured
+    uint32_t subs;                  // Current subscribers
+    uint32_t inFlight;              // Frames referenced right now
+    uint32_t inFlightMax;           // High water mark of inFlight
+    uint32_t delivered;             // Frames handed to subscribers
+    uint32_t dropped;               // Frames subscribers skipped because they were behind
+};
+
+// Start the capture task, the camera must already be initialized
+bool startFrameHub();
+
+// Register a subscriber, capture only runs while there is at least one.
+// Returns NULL when all FRAME_HUB_MAX_SUBS slots are taken.
+HubSubscriber *frameHubSubscribe();
+void frameHubUnsubscribe(HubSubscriber *sub);
+
+// Take a reference to the newest frame the subscriber has not seen yet, NULL on timeout.
+// A subscriber slower than the camera skips the frames it missed instead of queueing them.
+HubFrame *frameHubGet(HubSubscriber *sub, TickType_t timeout);
+void frameHubRelease(HubFrame *frame);
+
+void getFrameHubStats(FrameHubStats *stats);
+
+#endif // FRAMEHUB_H
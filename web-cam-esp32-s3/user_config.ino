@@ -12,7 +12,8 @@ const char* WIFI_PASSWORD = "YOUR_WIFI_PASSWORD";
 const int CAMERA_FRAME_SIZE = FRAMESIZE_QVGA;    // Options: FRAMESIZE_QVGA (320x240), FRAMESIZE_VGA (640x480),
                                                   //          FRAMESIZE_SVGA (800x600), FRAMESIZE_HD (1280x720)
 const int CAMERA_JPEG_QUALITY = 15;               // 0-63, lower means higher quality (but slower)
-const int CAMERA_FB_COUNT = 2;                    // Number of frame buffers (1-2)
+const int CAMERA_FB_COUNT = 4;                    // Number of frame buffers (2-4), with 3 one slow viewer costs the others
+                                                  // a third of the frames (the hub's latest, its frame and the capture)
 
 // Audio Settings
 const int AUDIO_SAMPLE_RATE = 16000;              // Sample rate in Hz (8000, 16000, 44100)
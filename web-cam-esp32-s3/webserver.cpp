@@ -1,8 +1,10 @@
 #include <Arduino.h>
+#include "lwip/sockets.h"
 #include "webserver.h"
 #include "webpage.h"
 #include "img_converters.h"
 #include "config.h"
+#include "framehub.h"
 
 httpd_handle_t camera_httpd = NULL;
 
@@ -12,62 +14,157 @@ esp_err_t index_handler(httpd_req_t *req) {
     return httpd_resp_send(req, (const char *)INDEX_HTML, strlen(INDEX_HTML));
 }
 
-// HTTP handler for JPEG stream
-esp_err_t stream_handler(httpd_req_t *req) {
-    camera_fb_t * fb = NULL;
-    esp_err_t res = ESP_OK;
-    size_t _jpg_buf_len = 0;
-    uint8_t * _jpg_buf = NULL;
-    char * part_buf[64];
+#define STREAM_CLIENT_STACK     4096
+#define STREAM_CLIENT_PRIO      5
+#define STREAM_FRAME_TIMEOUT_MS 3000
+
+static const char *STREAM_HEADER = "HTTP/1.1 200 OK\r\n"
+                                   "Content-Type: multipart/x-mixed-replace; boundary=frame\r\n"
+                                   "Access-Control-Allow-Origin: *\r\n\r\n";
+
+// One streaming viewer. The sender task and the HTTP session each hold an owner reference.
+struct StreamClient {
+    int fd;
+    HubSubscriber *sub;
+    SemaphoreHandle_t lock;         // Held around every send, the server closes the socket under it
+    volatile bool closed;           // Set under lock once the server closed the socket
+    uint8_t owners;
+};
+
+static portMUX_TYPE streamLock = portMUX_INITIALIZER_UNLOCKED;
 
-    res = httpd_resp_set_type(req, "multipart/x-mixed-replace; boundary=frame");
-    if(res != ESP_OK){
-        return res;
+static void releaseStreamClient(StreamClient *client) {
+    portENTER_CRITICAL(&streamLock);
+    bool last = --client->owners == 0;
+    portEXIT_CRITICAL(&streamLock);
+    if (last) {
+        vSemaphoreDelete(client->lock);
+        free(client);
     }
+}
 
-    while(true){
-        fb = esp_camera_fb_get();
-        if (!fb) {
-            Serial.println("Camera capture failed");
+// Called by the server after closeSocket() closed the stream socket
+static void streamClientClosed(void *ctx) {
+    releaseStreamClient((StreamClient *)ctx);
+}
+
+// Socket close function of the server. Only stream sessions have a context: their sender
+// may be blocked in send(), the shutdown wakes it, then the socket is closed under the lock
+// so no send can reach the fd once it may belong to another connection.
+static int closeSocket(httpd_handle_t hd, int sockfd) {
+    StreamClient *client = (StreamClient *)httpd_sess_get_ctx(hd, sockfd);
+    if (!client) {
+        return close(sockfd);
+    }
+
+    shutdown(sockfd, SHUT_RDWR);
+    xSemaphoreTake(client->lock, portMAX_DELAY);
+    client->closed = true;
+    int ret = close(sockfd);
+    xSemaphoreGive(client->lock);
+    return ret;
+}
+
+// The fd is only written while the lock shows the server has not closed it
+static esp_err_t streamSend(StreamClient *client, const char *buf, size_t len) {
+    esp_err_t res = ESP_OK;
+
+    xSemaphoreTake(client->lock, portMAX_DELAY);
+    while (len) {
+        int sent = client->closed ? -1 : send(client->fd, buf, len, 0);
+        if (sent <= 0) {
             res = ESP_FAIL;
-        } else {
-            if(fb->format != PIXFORMAT_JPEG){
-                bool jpeg_converted = frame2jpg(fb, 80, &_jpg_buf, &_jpg_buf_len);
-                esp_camera_fb_return(fb);
-                fb = NULL;
-                if(!jpeg_converted){
-                    Serial.println("JPEG compression failed");
-                    res = ESP_FAIL;
-                }
-            } else {
-                _jpg_buf_len = fb->len;
-                _jpg_buf = fb->buf;
-            }
+            break;
         }
+        buf += sent;
+        len -= sent;
+    }
+    xSemaphoreGive(client->lock);
+    return res;
+}
 
-        if(res == ESP_OK){
-            size_t hlen = snprintf((char *)part_buf, 64, "Content-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n", _jpg_buf_len);
-            res = httpd_resp_send_chunk(req, (const char *)part_buf, hlen);
-        }
-        if(res == ESP_OK){
-            res = httpd_resp_send_chunk(req, (const char *)_jpg_buf, _jpg_buf_len);
-        }
-        if(res == ESP_OK){
-            res = httpd_resp_send_chunk(req, "\r\n--frame\r\n", 12);
+// Sender task for one viewer. Every viewer sends the same frame buffer,
+// a viewer slower than the camera skips frames instead of slowing the others down.
+static void streamClientTask(void *parameter) {
+    StreamClient *client = (StreamClient *)parameter;
+    esp_err_t res = ESP_OK;
+    char part_buf[64];
+
+    while (res == ESP_OK) {
+        HubFrame *frame = frameHubGet(client->sub, pdMS_TO_TICKS(STREAM_FRAME_TIMEOUT_MS));
+        if (!frame) {
+            if (client->closed) {
+                break;
+            }
+            Serial.println("Camera capture failed");
+            continue;
         }
-        if(fb){
-            esp_camera_fb_return(fb);
-            fb = NULL;
-            _jpg_buf = NULL;
-        } else if(_jpg_buf){
-            free(_jpg_buf);
-            _jpg_buf = NULL;
+
+        size_t hlen = snprintf(part_buf, sizeof(part_buf), "Content-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n", frame->len);
+        res = streamSend(client, part_buf, hlen);
+        if (res == ESP_OK) {
+            res = streamSend(client, (const char *)frame->buf, frame->len);
         }
-        if(res != ESP_OK){
-            break;
+        if (res == ESP_OK) {
+            res = streamSend(client, "\r\n--frame\r\n", 11);
         }
+        frameHubRelease(frame);
     }
-    return res;
+
+    frameHubUnsubscribe(client->sub);
+    // The server sees the shut down socket fail and closes the session itself. Closing it by fd
+    // from here could close another session that got the same fd in the meantime.
+    xSemaphoreTake(client->lock, portMAX_DELAY);
+    if (!client->closed) {
+        shutdown(client->fd, SHUT_RDWR);
+    }
+    xSemaphoreGive(client->lock);
+    releaseStreamClient(client);
+    vTaskDelete(NULL);
+}
+
+// HTTP handler for JPEG stream
+// The socket is handed over to a sender task so the server stays free for the
+// index page and other viewers, all of them share frames captured once by the frame hub.
+esp_err_t stream_handler(httpd_req_t *req) {
+    StreamClient *client = (StreamClient *)calloc(1, sizeof(StreamClient));
+    if (!client) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    client->lock = xSemaphoreCreateMutex();
+    if (!client->lock) {
+        free(client);
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    client->sub = frameHubSubscribe();
+    if (!client->sub) {
+        Serial.println("Too many stream clients");
+        vSemaphoreDelete(client->lock);
+        free(client);
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_send(req, NULL, 0);
+    }
+    client->fd = httpd_req_to_sockfd(req);
+    client->owners = 2;
+
+    // The response is written raw, chunked encoding would add framing to every send
+    if (httpd_send(req, STREAM_HEADER, strlen(STREAM_HEADER)) < 0 ||
+        xTaskCreate(streamClientTask, "StreamClient", STREAM_CLIENT_STACK, client, STREAM_CLIENT_PRIO, NULL) != pdPASS) {
+        Serial.println("Failed to start the stream!");
+        frameHubUnsubscribe(client->sub);
+        vSemaphoreDelete(client->lock);
+        free(client);
+        return ESP_FAIL;
+    }
+
+    // The server only closes the session after this handler returned, so closeSocket() finds the context
+    req->sess_ctx = client;
+    req->free_ctx = streamClientClosed;
+    return ESP_OK;
 }
 
 // Start HTTP server
@@ -90,6 +187,12 @@ void startCameraServer() {
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.server_port = HTTP_SERVER_PORT;
     config.stack_size = 8192;
+    config.close_fn = closeSocket;
+
+    if (!startFrameHub()) {
+        Serial.println("Failed to start frame hub!");
+        return;
+    }
 
     Serial.printf("Starting HTTP server on port: '%d'\n", config.server_port);
     if (httpd_start(&camera_httpd, &config) == ESP_OK) {